@@ -5,6 +5,17 @@
 #include <Datatype/Tensor.h>
 // #include <HE/NetIO.h>
 #include <Utils/net_io_channel.h>
+#include <Utils/session.h>
+#include <Utils/seed.h>
+#include <HE/KeyCache.h>
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <HE/unified/UnifiedEvk.h>
 #include "HE/unified/UnifiedEncoder.h"
 #include <HE/unified/UnifiedEvaluator.h>
@@ -31,6 +42,10 @@ class HEEvaluator {
     uint64_t polyModulusDegree = 8192;
     uint64_t plainWidth = 20;
     uint64_t plain_mod = 1048576;
+    // Reconnecting clients: a client with an identity (UseIdentity) reuses its keys across sessions
+    // and announces client_id; a server with a KeyCache (UseKeyCache) then skips the key upload.
+    uint64_t client_id = 0;
+    bool keys_from_cache = false;
 
     HEEvaluator(
         Utils::NetIO *IO,
@@ -57,64 +72,116 @@ class HEEvaluator {
         this->plain_mod = this->param->plain_modulus().value();
     }
 
+    // Session view for the multi-client server: shares context, encoder and evaluator with `shared`
+    // (read-only after construction) and owns only the client's keys and channel.
+    HEEvaluator(HEEvaluator *shared, Utils::NetIO *IO){
+        this->IO = IO;
+        this->shared = shared;
+        this->server = shared->server;
+        this->backend = shared->backend;
+        this->plainWidth = shared->plainWidth;
+        this->polyModulusDegree = shared->polyModulusDegree;
+        this->param = shared->param;
+        this->context = shared->context;
+        this->encoder = shared->encoder;
+        this->evaluator = shared->evaluator;
+        this->plain_mod = shared->plain_mod;
+        this->key_cache = shared->key_cache;
+    }
+
     ~HEEvaluator() = default;
 
+    // The evaluator holding keys/IO for the calling thread: the bound session view if any, else this.
+    HEEvaluator *Session() {
+        return Utils::SessionBinding<HEEvaluator>::Resolve(this);
+    }
+
+    bool IsSessionView() const { return shared != nullptr; }
+
+    // Client: keep the key set in `path`, created on first use and reloaded afterwards.
+    void UseIdentity(const std::string &path) { identity_path = path; }
+
+    // Server: serve the evaluation keys of returning clients from `cache`. Session views inherit it.
+    void UseKeyCache(KeyCache *cache) { key_cache = cache; }
+
+    // Identifies the HE parameters a key set belongs to.
+    uint64_t ParamHash() const {
+        const parms_id_type &id = context->hcontext().key_parms_id();
+        return id[0] ^ id[1] ^ id[2] ^ id[3];
+    }
+
     void GenerateNewKey() {
+        CreateKeys();
+        ExchangeKeys();
+    }
+
+    // Local half of GenerateNewKey: the client generates its keys, no communication. May run
+    // concurrently with other setup on the channels (see CryptoPrimitive).
+    void CreateKeys() {
         publicKeys = new PublicKey();
         secretKeys = new SecretKey();
         relinKeys  = new RelinKeys();
         galoisKeys = new unified::UnifiedGaloisKeys(HOST);
-        if (server) {
-            uint64_t pk_sze{0};
-            uint64_t gk_sze{0};
-            this->IO->recv_data(&pk_sze, sizeof(uint64_t));
-            this->IO->recv_data(&gk_sze, sizeof(uint64_t));
-            // cout << "pk_sze = " << pk_sze << endl;
-            // cout << "gk_sze = " << gk_sze << endl;
-            char *key_buf = new char[pk_sze + gk_sze];
-            this->IO->recv_data(key_buf, pk_sze + gk_sze);
-            // cout << "key_buf received" << endl;
-            std::stringstream is;
-            is.write(key_buf, pk_sze);
-            publicKeys->load(context->hcontext(), is);
-            is.write(key_buf + pk_sze, gk_sze);
-            galoisKeys->hgalois().load(context->hcontext(), is);
-
-            if (IsGPUenable()) {
-                // Load Galois Keys to GPU
-                galoisKeys->to_device(*context);
-                std::cout << "Load Galois Keys to GPU: " << galoisKeys->location() << std::endl;
+        if (!server) {
+            if (identity_path.empty() || !LoadIdentity()) {
+                KeyGenerator keygen(*context);
+                *secretKeys = keygen.secret_key();
+                keygen.create_relin_keys(*relinKeys);
+                keygen.create_galois_keys(*galoisKeys);
+                keygen.create_public_key(*publicKeys);
+                if (!identity_path.empty()) {
+                    SaveIdentity();
+                }
             }
-
-            // std::cout << "Server received: " << key_buf << "\n";
-            // std::cout << "Server received: " << pk_sze << "\n";
             encryptor = new Encryptor(*context, *publicKeys);
-            delete[] key_buf;
+            decryptor = new Decryptor(*context, *secretKeys);
+        }
+    }
+
+    // Transfer of the public and Galois keys from the client to the server over IO. The client
+    // first sends {client_id, ParamHash()}; the server answers whether it holds these keys already.
+    void ExchangeKeys() {
+        uint64_t hello[2] = {client_id, ParamHash()};
+        uint8_t cached = 0;
+        if (server) {
+            this->IO->recv_data(hello, sizeof(hello));
+            std::string keys;
+            cached = key_cache != nullptr && hello[0] != 0 && hello[1] == ParamHash() &&
+                     key_cache->Get(hello[0], hello[1], keys);
+            this->IO->send_data(&cached, sizeof(uint8_t));
+            this->IO->flush();
+            if (!cached) {
+                uint64_t sizes[2] = {0, 0};
+                this->IO->recv_data(sizes, sizeof(sizes));
+                keys.resize(sizeof(sizes) + sizes[0] + sizes[1]);
+                memcpy(&keys[0], sizes, sizeof(sizes));
+                this->IO->recv_data(&keys[sizeof(sizes)], sizes[0] + sizes[1]);
+                if (key_cache != nullptr && hello[0] != 0) {
+                    key_cache->Put(hello[0], hello[1], keys);
+                }
+            }
+            LoadClientKeys(keys);
+            this->client_id = hello[0];
         } else {
+            this->IO->send_data(hello, sizeof(hello));
+            this->IO->flush();
+            this->IO->recv_data(&cached, sizeof(uint8_t));
+            if (cached) {
+                keys_from_cache = true;
+                return;
+            }
             //send the key
-            KeyGenerator keygen(*context);
-            *secretKeys = keygen.secret_key();
-            keygen.create_relin_keys(*relinKeys);
-            keygen.create_galois_keys(*galoisKeys);
-            keygen.create_public_key(*publicKeys);
-            encryptor = new Encryptor(*context, *publicKeys);
-            decryptor = new Decryptor(*context, *secretKeys);
-            uint64_t plain_mod = this->param->plain_modulus().value(); 
             std::stringstream os;
             publicKeys->save(os);
             uint64_t pk_sze = static_cast<uint64_t>(os.tellp());
             galoisKeys->save(os);
             uint64_t gk_size = (uint64_t)os.tellp() - pk_sze;
             const std::string &keys_str = os.str();
-            // cout << "pk_sze = " << pk_sze << endl;
-            // cout << "gk_size = " << gk_size << endl;
             this->IO->send_data(&pk_sze, sizeof(uint64_t));
             this->IO->send_data(&gk_size,sizeof(uint64_t));
             this->IO->send_data(keys_str.c_str(),pk_sze + gk_size);
-            // cout << "size =" << keys_str.size() << endl;
-            // std::cout << "Client send: " << keys_str.c_str() << "\n";
-            // std::cout << "Client send: " << pk_sze << "\n";
         }
+        keys_from_cache = cached;
     }
 
     void print_parameters()
@@ -180,12 +247,16 @@ class HEEvaluator {
 
         safe_delete(encryptor);
         safe_delete(decryptor);
-        safe_delete(encoder);
-        safe_delete(evaluator);
         safe_delete(relinKeys);
         safe_delete(galoisKeys);
         safe_delete(publicKeys);
         safe_delete(secretKeys);
+        if (shared != nullptr) {
+            // context, encoder and evaluator belong to the shared evaluator
+            return;
+        }
+        safe_delete(encoder);
+        safe_delete(evaluator);
         safe_delete(context);
     }
 
@@ -194,13 +265,14 @@ class HEEvaluator {
         ct.save(os);
         uint64_t ct_sze = static_cast<uint64_t>(os.tellp());
         const std::string &ct_str = os.str();
-        this->IO->send_data(&ct_sze, sizeof(uint64_t));
-        this->IO->send_data(ct_str.c_str(), ct_sze);
+        Utils::NetIO *io = Session()->IO;
+        io->send_data(&ct_sze, sizeof(uint64_t));
+        io->send_data(ct_str.c_str(), ct_sze);
     }
 
     void SendEncVec(const Tensor<unified::UnifiedCiphertext> &ct_vec){
         uint64_t vec_size = static_cast<uint64_t>(ct_vec.size());
-        this->IO->send_data(&vec_size, sizeof(uint64_t));
+        Session()->IO->send_data(&vec_size, sizeof(uint64_t));
 
         // Send each Ciphertext in the vector using SendCipherText
         for (size_t i = 0; i < vec_size; i++) {
@@ -210,9 +282,10 @@ class HEEvaluator {
 
     void ReceiveCipherText(Ciphertext &ct){
         uint64_t ct_sze{0};
-        this->IO->recv_data(&ct_sze,sizeof(uint64_t));
+        Utils::NetIO *io = Session()->IO;
+        io->recv_data(&ct_sze,sizeof(uint64_t));
         char *char_buf = new char[ct_sze];
-        this->IO->recv_data(char_buf,ct_sze);
+        io->recv_data(char_buf,ct_sze);
         std::stringstream is;
         is.write(char_buf, ct_sze);
         ct.load(*context, is);
@@ -222,7 +295,7 @@ class HEEvaluator {
     void ReceiveEncVec(Tensor<unified::UnifiedCiphertext> &ct_vec){
         // Get # of ciphertext
         uint64_t vec_size{0};
-        this->IO->recv_data(&vec_size,sizeof(uint64_t));
+        Session()->IO->recv_data(&vec_size,sizeof(uint64_t));
         assert(vec_size == ct_vec.size() && "Number of ciphertexts does not match.");
 
         // Receive ciphertexts
@@ -237,7 +310,7 @@ class HEEvaluator {
 
         std::vector<uint64_t> zeros(this->polyModulusDegree, 0);
         this->encoder->encode(zeros, zeros_pt);
-        this->encryptor->encrypt(zeros_pt, zeros_ct);
+        Session()->encryptor->encrypt(zeros_pt, zeros_ct);
 
         if (loc == DEVICE) {
             zeros_ct.to_device(*context);
@@ -246,6 +319,19 @@ class HEEvaluator {
         return zeros_ct;
     }
 
+    // An encoded plaintext to NTT form at the level of fresh ciphertexts, for multiply_plain_ntt(_accumulate).
+    void PlainToNTT(unified::UnifiedPlaintext &pt) {
+        if (pt.on_host()) {
+            evaluator->transform_to_ntt_inplace(pt, context->hcontext().first_parms_id());
+        }
+#ifdef USE_HE_GPU
+        else {
+            // phantom counts the chain from the special prime, the first data level is 1
+            evaluator->transform_to_ntt_inplace(pt, size_t(1));
+        }
+#endif
+    }
+
     inline bool IsGPUenable() {
         return backend == LOCATION::DEVICE;
     }
@@ -254,6 +340,74 @@ class HEEvaluator {
 
     private:
         LOCATION backend = LOCATION::UNDEF;
+        HEEvaluator *shared = nullptr;
+        KeyCache *key_cache = nullptr;
+        std::string identity_path;
+
+        // {pk size, gk size, pk, gk} as sent by the client
+        void LoadClientKeys(const std::string &keys) {
+            uint64_t sizes[2];
+            memcpy(sizes, keys.data(), sizeof(sizes));
+            std::stringstream is;
+            is.write(keys.data() + sizeof(sizes), sizes[0]);
+            publicKeys->load(context->hcontext(), is);
+            is.write(keys.data() + sizeof(sizes) + sizes[0], sizes[1]);
+            galoisKeys->hgalois().load(context->hcontext(), is);
+
+            if (IsGPUenable()) {
+                // Load Galois Keys to GPU
+                galoisKeys->to_device(*context);
+                std::cout << "Load Galois Keys to GPU: " << galoisKeys->location() << std::endl;
+            }
+            encryptor = new Encryptor(*context, *publicKeys);
+        }
+
+        // identity file: param hash, client id, secret, public, relin and Galois keys
+        bool LoadIdentity() {
+            std::ifstream is(identity_path, std::ios::binary);
+            uint64_t header[2];
+            if (!is.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != ParamHash()) {
+                return false;
+            }
+            client_id = header[1];
+            secretKeys->load(context->hcontext(), is);
+            publicKeys->load(context->hcontext(), is);
+            relinKeys->load(context->hcontext(), is);
+            galoisKeys->hgalois().load(context->hcontext(), is);
+            return true;
+        }
+
+        // the file holds the secret key: created owner-only, a short write is an error
+        void SaveIdentity() {
+            client_id = Utils::RandomSeed() | 1;
+            std::ostringstream os(std::ios::binary);
+            uint64_t header[2] = {ParamHash(), client_id};
+            os.write(reinterpret_cast<const char *>(header), sizeof(header));
+            secretKeys->save(os);
+            publicKeys->save(os);
+            relinKeys->save(os);
+            galoisKeys->save(os);
+            const std::string data = os.str();
+            int fd = ::open(identity_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+            if (fd < 0) {
+                throw std::runtime_error("cannot create identity file " + identity_path + ": " + std::strerror(errno));
+            }
+            // an existing file keeps its mode through O_TRUNC
+            bool ok = ::fchmod(fd, 0600) == 0;
+            for (size_t done = 0; ok && done < data.size();) {
+                ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                ok = n > 0;
+                done += ok ? n : 0;
+            }
+            ok = ::close(fd) == 0 && ok;
+            if (!ok) {
+                ::unlink(identity_path.c_str());
+                throw std::runtime_error("cannot write identity file " + identity_path);
+            }
+        }
 };
 
 }
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace HE {
+// Server-side cache of the evaluation keys (public + Galois, serialized as the client sent them)
+// of returning clients, keyed by client id and HE parameter hash. A client that reconnects with the
+// same identity and parameters skips the key upload. Entries expire `ttl` after their last use; at
+// most `max_entries` are kept, the least recently used is dropped first. Thread-safe, shared by all
+// sessions of a server.
+class KeyCache {
+    public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit KeyCache(std::chrono::seconds ttl = std::chrono::hours(24), size_t max_entries = 1024)
+        : ttl(ttl), max_entries(max_entries) {}
+
+    bool Get(uint64_t client_id, uint64_t param_hash, std::string &keys) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find({client_id, param_hash});
+        if (it == entries.end()) {
+            return false;
+        }
+        if (Clock::now() - it->second.last_used > ttl) {
+            entries.erase(it);
+            return false;
+        }
+        it->second.last_used = Clock::now();
+        keys = it->second.keys;
+        hits++;
+        return true;
+    }
+
+    void Put(uint64_t client_id, uint64_t param_hash, std::string keys) {
+        std::lock_guard<std::mutex> lock(mtx);
+        EvictLocked();
+        entries[{client_id, param_hash}] = Entry{std::move(keys), Clock::now()};
+    }
+
+    void Erase(uint64_t client_id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto it = entries.begin(); it != entries.end();) {
+            it = it->first.first == client_id ? entries.erase(it) : std::next(it);
+        }
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return entries.size();
+    }
+
+    // number of successful Get()s
+    uint64_t hit_count() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return hits;
+    }
+
+    private:
+    struct Entry {
+        std::string keys;
+        Clock::time_point last_used;
+    };
+
+    std::chrono::seconds ttl;
+    size_t max_entries;
+    std::mutex mtx;
+    std::map<std::pair<uint64_t, uint64_t>, Entry> entries;
+    uint64_t hits = 0;
+
+    // drop expired entries, then the least recently used ones until there is room for one more
+    void EvictLocked() {
+        auto now = Clock::now();
+        for (auto it = entries.begin(); it != entries.end();) {
+            it = now - it->second.last_used > ttl ? entries.erase(it) : std::next(it);
+        }
+        while (!entries.empty() && entries.size() >= max_entries) {
+            auto oldest = entries.begin();
+            for (auto it = entries.begin(); it != entries.end(); it++) {
+                if (it->second.last_used < oldest->second.last_used) {
+                    oldest = it;
+                }
+            }
+            entries.erase(oldest);
+        }
+    }
+};
+} // namespace HE
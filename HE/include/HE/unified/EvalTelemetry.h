@@ -0,0 +1,190 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <Utils/profiler.h>
+
+namespace HE
+{
+    namespace unified
+    {
+        // Operations counted by the UnifiedEvaluator telemetry. Rotations are key switches, so
+        // RotateRows also stands for the key-switching cost of a layer.
+        enum class EvalOp : int
+        {
+            RotateRows = 0,
+            MultiplyPlain,
+            Multiply,
+            Relinearize,
+            AddPlain,
+            Add,
+            ToNTT,
+            FromNTT,
+            MultiplyPlainAccumulate,  // one multiply_plain_ntt_accumulate, whatever its number of terms
+            NumOps
+        };
+
+        constexpr int kNumEvalOps = static_cast<int>(EvalOp::NumOps);
+
+        inline const char *EvalOpName(EvalOp op)
+        {
+            static const char *names[kNumEvalOps] = {
+                "he.rotate_rows", "he.multiply_plain", "he.multiply", "he.relinearize",
+                "he.add_plain", "he.add", "he.to_ntt", "he.from_ntt", "he.multiply_plain_acc"};
+            return names[static_cast<int>(op)];
+        }
+
+        struct EvalCounts
+        {
+            std::array<uint64_t, kNumEvalOps> count{};
+            std::array<double, kNumEvalOps> ms{};
+
+            EvalCounts operator-(const EvalCounts &other) const
+            {
+                EvalCounts d;
+                for (int i = 0; i < kNumEvalOps; i++)
+                {
+                    d.count[i] = count[i] - other.count[i];
+                    d.ms[i] = ms[i] - other.ms[i];
+                }
+                return d;
+            }
+
+            std::string ToJson() const
+            {
+                std::ostringstream os;
+                os << "{";
+                for (int i = 0; i < kNumEvalOps; i++)
+                {
+                    os << (i ? "," : "") << "\"" << EvalOpName(static_cast<EvalOp>(i)) << "\":{\"count\":" << count[i]
+                       << ",\"ms\":" << ms[i] << "}";
+                }
+                os << "}";
+                return os.str();
+            }
+        };
+
+        // Process-wide, thread-safe operation counters. Per-scope attribution goes through
+        // Utils::Profiler: while it is enabled every operation is also counted on the open spans.
+        class EvalTelemetry
+        {
+        public:
+            static EvalTelemetry &Get()
+            {
+                static EvalTelemetry telemetry;
+                return telemetry;
+            }
+
+            void Record(EvalOp op, uint64_t ns)
+            {
+                int i = static_cast<int>(op);
+                count_[i].fetch_add(1, std::memory_order_relaxed);
+                ns_[i].fetch_add(ns, std::memory_order_relaxed);
+                Utils::Profiler::Get().Count(EvalOpName(op));
+            }
+
+            EvalCounts Snapshot() const
+            {
+                EvalCounts c;
+                for (int i = 0; i < kNumEvalOps; i++)
+                {
+                    c.count[i] = count_[i].load(std::memory_order_relaxed);
+                    c.ms[i] = ns_[i].load(std::memory_order_relaxed) * 1e-6;
+                }
+                return c;
+            }
+
+            void Reset()
+            {
+                for (int i = 0; i < kNumEvalOps; i++)
+                {
+                    count_[i] = 0;
+                    ns_[i] = 0;
+                }
+            }
+
+        private:
+            std::array<std::atomic<uint64_t>, kNumEvalOps> count_{};
+            std::array<std::atomic<uint64_t>, kNumEvalOps> ns_{};
+        };
+
+        class EvalTimer
+        {
+        public:
+            explicit EvalTimer(EvalOp op) : op_(op), start_(std::chrono::steady_clock::now()) {}
+
+            ~EvalTimer()
+            {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+                EvalTelemetry::Get().Record(op_, ns.count());
+            }
+
+        private:
+            EvalOp op_;
+            std::chrono::steady_clock::time_point start_;
+        };
+
+        // Predicts the evaluator time of a layer from its operation counts. Default() is analytic:
+        // costs in modular multiplications for polynomial degree N and L ciphertext primes, e.g. a
+        // rotation is an automorphism plus a hybrid key switch of (L + 1) L NTTs and inner products.
+        // Calibrate() replaces the constants with the per-op averages of a measured run.
+        struct EvalCostModel
+        {
+            std::array<double, kNumEvalOps> ms_per_op{};
+
+            static EvalCostModel Default(size_t N, size_t L, double ns_per_mulmod = 1.0)
+            {
+                double n = static_cast<double>(N), l = static_cast<double>(L);
+                double ntt = n * std::log2(n) / 2;
+                EvalCostModel m;
+                auto set = [&](EvalOp op, double mulmods) { m.ms_per_op[static_cast<int>(op)] = mulmods * ns_per_mulmod * 1e-6; };
+                set(EvalOp::RotateRows, (l + 1) * l * ntt + 2 * (l + 1) * l * n);
+                set(EvalOp::MultiplyPlain, 2 * l * n);
+                set(EvalOp::Multiply, 4 * l * ntt + 4 * l * n);
+                set(EvalOp::Relinearize, (l + 1) * l * ntt + 2 * (l + 1) * l * n);
+                set(EvalOp::AddPlain, l * n);
+                // two polynomial additions, an addition is about a quarter of a mulmod
+                set(EvalOp::Add, 0.5 * l * n);
+                set(EvalOp::ToNTT, 2 * l * ntt);
+                set(EvalOp::FromNTT, 2 * l * ntt);
+                return m;
+            }
+
+            void Calibrate(const EvalCounts &measured)
+            {
+                for (int i = 0; i < kNumEvalOps; i++)
+                {
+                    if (measured.count[i] > 0)
+                    {
+                        ms_per_op[i] = measured.ms[i] / measured.count[i];
+                    }
+                }
+            }
+
+            double Predict(const EvalCounts &counts) const
+            {
+                double ms = 0;
+                for (int i = 0; i < kNumEvalOps; i++)
+                {
+                    ms += counts.count[i] * ms_per_op[i];
+                }
+                return ms;
+            }
+        };
+
+    } // namespace unified
+} // namespace HE
+
+// Compiled out unless the HE target is configured with -DHE_TELEMETRY=ON.
+#ifdef HE_TELEMETRY
+#define HE_COUNT_OP(op) HE::unified::EvalTimer he_eval_timer_(HE::unified::EvalOp::op)
+#else
+#define HE_COUNT_OP(op) \
+    do                  \
+    {                   \
+    } while (0)
+#endif
@@ -3,6 +3,8 @@
 #include <Datatype/UnifiedType.h>
 #include <cstdint>
 #include <seal/context.h>
+#include <seal/randomgen.h>
+#include <Utils/seed.h>
 
 #ifdef USE_HE_GPU
 #include <phantom/context.cuh>
@@ -42,6 +44,16 @@ namespace HE
                 }
                 parms.set_plain_modulus(
                     batch ? seal::PlainModulus::Batching(poly_modulus_degree, bit_size) : 1 << bit_size);
+                if (Utils::SeedPin::Pinned())
+                {
+                    // replay: every SEAL generator starts from the same pinned seed
+                    seal::prng_seed_type seed;
+                    for (auto &word : seed)
+                    {
+                        word = Utils::SeedPin::Next();
+                    }
+                    parms.set_random_generator(std::make_shared<seal::Blake2xbPRNGFactory>(seed));
+                }
                 seal_context_ = std::make_unique<seal::SEALContext>(parms);
                 max_data_modulus_bit_ = get_max_data_modulus_bit(parms);
 #ifdef USE_HE_GPU
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <seal/evaluator.h>
+#include <vector>
 #include "HE/unified/UnifiedCiphertext.h"
 #include "HE/unified/UnifiedEvk.h"
 #include "HE/unified/UnifiedPlaintext.h"
+#include "HE/unified/EvalTelemetry.h"
 
 #ifdef USE_HE_GPU
 #include "HE/unified/PhantomWrapper.h"
@@ -21,8 +23,39 @@ namespace HE
         class UnifiedEvaluator : public seal::Evaluator
         {
         public:
-            // Explicitly inherit all constructors from the Base class
-            using seal::Evaluator::Evaluator;
+            explicit UnifiedEvaluator(const seal::SEALContext &context) : seal::Evaluator(context), hcontext_(context)
+            {}
+
+#ifdef HE_TELEMETRY
+// Hide the counted seal::Evaluator members behind timed forwarders; without HE_TELEMETRY the
+// base members are called directly.
+#define HE_COUNTED_MEMBER(name, op)                                  \
+    template <typename... Args>                                      \
+    inline void name(Args &&...args) const                           \
+    {                                                                \
+        EvalTimer timer(EvalOp::op);                                 \
+        seal::Evaluator::name(std::forward<Args>(args)...);          \
+    }
+            HE_COUNTED_MEMBER(rotate_rows_inplace, RotateRows)
+            HE_COUNTED_MEMBER(rotate_rows, RotateRows)
+            HE_COUNTED_MEMBER(multiply_plain_inplace, MultiplyPlain)
+            HE_COUNTED_MEMBER(multiply_plain, MultiplyPlain)
+            HE_COUNTED_MEMBER(multiply_inplace, Multiply)
+            HE_COUNTED_MEMBER(multiply, Multiply)
+            HE_COUNTED_MEMBER(square_inplace, Multiply)
+            HE_COUNTED_MEMBER(square, Multiply)
+            HE_COUNTED_MEMBER(relinearize_inplace, Relinearize)
+            HE_COUNTED_MEMBER(relinearize, Relinearize)
+            HE_COUNTED_MEMBER(add_plain_inplace, AddPlain)
+            HE_COUNTED_MEMBER(add_plain, AddPlain)
+            HE_COUNTED_MEMBER(add_inplace, Add)
+            HE_COUNTED_MEMBER(add, Add)
+            HE_COUNTED_MEMBER(transform_to_ntt_inplace, ToNTT)
+            HE_COUNTED_MEMBER(transform_to_ntt, ToNTT)
+            HE_COUNTED_MEMBER(transform_from_ntt_inplace, FromNTT)
+            HE_COUNTED_MEMBER(transform_from_ntt, FromNTT)
+#undef HE_COUNTED_MEMBER
+#endif
 
             inline Datatype::LOCATION backend() const
             {
@@ -38,6 +71,16 @@ namespace HE
                 multiply_plain_ntt_inplace(destination, plain);
             }
 
+            /*
+            destination = sum_t encrypted[t] * plain[t], for NTT-form ciphertexts and plaintexts at one level.
+            The products are accumulated lazily in 128 bits (52-bit halves with AVX512-IFMA for moduli below
+            2^50) and reduced once per coefficient at the end, with no ciphertext per term. The result is
+            in NTT form.
+            */
+            void multiply_plain_ntt_accumulate(
+                const std::vector<const UnifiedCiphertext *> &encrypted, const std::vector<const UnifiedPlaintext *> &plain,
+                UnifiedCiphertext &destination) const;
+
             inline void sync() {};
 
             inline auto &device_evaluator() const
@@ -50,6 +93,9 @@ namespace HE
             {
                 return *this;
             }
+
+        private:
+            seal::SEALContext hcontext_;
         };
 
 #else
@@ -74,6 +120,7 @@ namespace HE
                 if constexpr (std::is_same_v<context_t, seal::SEALContext>)
                 {
                     seal_eval_ = std::make_unique<seal::Evaluator>(context);
+                    hcontext_ = std::make_unique<seal::SEALContext>(context);
                 }
                 else if constexpr (std::is_same_v<context_t, PhantomContext>)
                 {
@@ -216,6 +263,12 @@ namespace HE
                 multiply_plain_ntt_inplace(destination, plain);
             }
 
+            // sum_t encrypted[t] * plain[t] in NTT form, lazily reduced on host (see the CPU-only evaluator);
+            // on device it is multiply_plain_ntt and add per term.
+            void multiply_plain_ntt_accumulate(
+                const std::vector<const UnifiedCiphertext *> &encrypted, const std::vector<const UnifiedPlaintext *> &plain,
+                UnifiedCiphertext &destination) const;
+
             void rotate_vector_inplace(
                 UnifiedCiphertext &encrypted, int step, const UnifiedGaloisKeys &galois_key) const;
 
@@ -316,6 +369,7 @@ namespace HE
 
         private:
             std::unique_ptr<seal::Evaluator> seal_eval_ = nullptr;
+            std::unique_ptr<seal::SEALContext> hcontext_ = nullptr;
             std::unique_ptr<PhantomEvaluator> phantom_eval_ = nullptr;
         };
 #endif
@@ -1,7 +1,161 @@
 #include "HE/unified/UnifiedEvaluator.h"
+#include <seal/util/uintarithsmallmod.h>
+#include <algorithm>
+#include <stdexcept>
+#if defined(__AVX512IFMA__)
+#include <immintrin.h>
+#endif
 
 using namespace HE::unified;
 
+namespace
+{
+    // coefficients accumulated at a time, so that the accumulators stay in L1
+    constexpr std::size_t kAccBlock = 256;
+
+    inline std::uint64_t reduce_128(unsigned __int128 x, const seal::Modulus &q)
+    {
+        const std::uint64_t words[2] = { static_cast<std::uint64_t>(x), static_cast<std::uint64_t>(x >> 64) };
+        return seal::util::barrett_reduce_128(words, q);
+    }
+
+#if defined(__AVX512IFMA__)
+    /*
+    Operands below 2^50 fit the 52-bit IFMA multiplier: the low and high 52 bits of each product are
+    summed in separate 64-bit lanes. A reduction leaves a residual below 2^50 in the low lane and each
+    product adds at most 2^52 - 1, so 2^12 - 1 products fit in 64 bits; 2^12 could overflow.
+    */
+    void accumulate_ifma(
+        const std::vector<const std::uint64_t *> &a, const std::vector<const std::uint64_t *> &b, std::size_t begin,
+        std::size_t len, const seal::Modulus &q, std::uint64_t *out)
+    {
+        constexpr std::size_t lazy = (std::size_t(1) << 12) - 1;
+        alignas(64) std::uint64_t lo[kAccBlock], hi[kAccBlock];
+        std::fill_n(lo, len, 0);
+        std::fill_n(hi, len, 0);
+        for (std::size_t t = 0; t < a.size(); t++)
+        {
+            const std::uint64_t *x = a[t] + begin, *y = b[t] + begin;
+            std::size_t k = 0;
+            for (; k + 8 <= len; k += 8)
+            {
+                __m512i vx = _mm512_loadu_si512(x + k), vy = _mm512_loadu_si512(y + k);
+                _mm512_store_si512(lo + k, _mm512_madd52lo_epu64(_mm512_load_si512(lo + k), vx, vy));
+                _mm512_store_si512(hi + k, _mm512_madd52hi_epu64(_mm512_load_si512(hi + k), vx, vy));
+            }
+            for (; k < len; k++)
+            {
+                unsigned __int128 prod = static_cast<unsigned __int128>(x[k]) * y[k];
+                lo[k] += static_cast<std::uint64_t>(prod) & ((std::uint64_t(1) << 52) - 1);
+                hi[k] += static_cast<std::uint64_t>(prod >> 52);
+            }
+            if ((t + 1) % lazy == 0)
+            {
+                for (k = 0; k < len; k++)
+                {
+                    lo[k] = reduce_128((static_cast<unsigned __int128>(hi[k]) << 52) + lo[k], q);
+                    hi[k] = 0;
+                }
+            }
+        }
+        for (std::size_t k = 0; k < len; k++)
+        {
+            out[k] = reduce_128((static_cast<unsigned __int128>(hi[k]) << 52) + lo[k], q);
+        }
+    }
+#endif
+
+    // out[k] = sum_t a[t][begin + k] * b[t][begin + k] mod q, k < len
+    void accumulate(
+        const std::vector<const std::uint64_t *> &a, const std::vector<const std::uint64_t *> &b, std::size_t begin,
+        std::size_t len, const seal::Modulus &q, std::uint64_t *out)
+    {
+#if defined(__AVX512IFMA__)
+        if (q.bit_count() <= 50)
+        {
+            accumulate_ifma(a, b, begin, len, q, out);
+            return;
+        }
+#endif
+        // products are below 2^(2 * bits), so 2^(128 - 2 * bits) of them fit before a reduction
+        const std::size_t lazy = std::size_t(1) << std::min(32, 128 - 2 * q.bit_count());
+        unsigned __int128 acc[kAccBlock] = {};
+        for (std::size_t t = 0; t < a.size(); t++)
+        {
+            const std::uint64_t *x = a[t] + begin, *y = b[t] + begin;
+            for (std::size_t k = 0; k < len; k++)
+            {
+                acc[k] += static_cast<unsigned __int128>(x[k]) * y[k];
+            }
+            if ((t + 1) % lazy == 0)
+            {
+                for (std::size_t k = 0; k < len; k++)
+                {
+                    acc[k] = reduce_128(acc[k], q);
+                }
+            }
+        }
+        for (std::size_t k = 0; k < len; k++)
+        {
+            out[k] = reduce_128(acc[k], q);
+        }
+    }
+
+    void multiply_plain_ntt_accumulate_host(
+        const seal::SEALContext &context, const std::vector<const UnifiedCiphertext *> &encrypted,
+        const std::vector<const UnifiedPlaintext *> &plain, UnifiedCiphertext &destination)
+    {
+        if (encrypted.empty() || encrypted.size() != plain.size())
+        {
+            throw std::invalid_argument("multiply_plain_ntt_accumulate: need as many plaintexts as ciphertexts");
+        }
+        const seal::Ciphertext &first = encrypted[0]->hcipher();
+        const auto context_data = context.get_context_data(first.parms_id());
+        if (!context_data)
+        {
+            throw std::invalid_argument("multiply_plain_ntt_accumulate: encrypted is not valid for encryption parameters");
+        }
+        const auto &coeff_modulus = context_data->parms().coeff_modulus();
+        const std::size_t coeff_count = context_data->parms().poly_modulus_degree();
+        const std::size_t size = first.size();
+        for (std::size_t t = 0; t < encrypted.size(); t++)
+        {
+            const seal::Ciphertext &ct = encrypted[t]->hcipher();
+            const seal::Plaintext &pt = plain[t]->hplain();
+            if (!ct.is_ntt_form() || !pt.is_ntt_form())
+            {
+                throw std::invalid_argument("multiply_plain_ntt_accumulate: plaintext and ciphertext must be in NTT form");
+            }
+            if (ct.parms_id() != first.parms_id() || pt.parms_id() != first.parms_id() || ct.size() != size)
+            {
+                throw std::invalid_argument("multiply_plain_ntt_accumulate: operands are at different levels");
+            }
+        }
+
+        seal::Ciphertext result;
+        result.resize(context, first.parms_id(), size);
+        result.is_ntt_form() = true;
+        std::vector<const std::uint64_t *> a(encrypted.size()), b(plain.size());
+        for (std::size_t p = 0; p < size; p++)
+        {
+            for (std::size_t j = 0; j < coeff_modulus.size(); j++)
+            {
+                for (std::size_t t = 0; t < encrypted.size(); t++)
+                {
+                    a[t] = encrypted[t]->hcipher().data(p) + j * coeff_count;
+                    b[t] = plain[t]->hplain().data() + j * coeff_count;
+                }
+                std::uint64_t *out = result.data(p) + j * coeff_count;
+                for (std::size_t k = 0; k < coeff_count; k += kAccBlock)
+                {
+                    accumulate(a, b, k, std::min(kAccBlock, coeff_count - k), coeff_modulus[j], out + k);
+                }
+            }
+        }
+        destination = UnifiedCiphertext(std::move(result));
+    }
+} // namespace
+
 #ifdef USE_HE_GPU
 
 void UnifiedEvaluator::negate_inplace(UnifiedCiphertext &encrypted) const
@@ -19,6 +173,7 @@ void UnifiedEvaluator::negate_inplace(UnifiedCiphertext &encrypted) const
 
 void UnifiedEvaluator::add_inplace(UnifiedCiphertext &encrypted1, const UnifiedCiphertext &encrypted2) const
 {
+    HE_COUNT_OP(Add);
     backend_check(encrypted1, encrypted2);
     if (encrypted1.on_host() && encrypted2.on_host())
     {
@@ -45,6 +200,7 @@ void UnifiedEvaluator::sub_inplace(UnifiedCiphertext &encrypted1, const UnifiedC
 
 void UnifiedEvaluator::multiply_inplace(UnifiedCiphertext &encrypted1, const UnifiedCiphertext &encrypted2) const
 {
+    HE_COUNT_OP(Multiply);
     backend_check(encrypted1, encrypted2);
     if (encrypted1.on_host() && encrypted2.on_host())
     {
@@ -58,6 +214,7 @@ void UnifiedEvaluator::multiply_inplace(UnifiedCiphertext &encrypted1, const Uni
 
 void UnifiedEvaluator::relinearize_inplace(UnifiedCiphertext &encrypted, const UnifiedRelinKeys &relin_keys) const
 {
+    HE_COUNT_OP(Relinearize);
     backend_check(encrypted);
     if (encrypted.on_host())
     {
@@ -97,6 +254,7 @@ void UnifiedEvaluator::rescale_to_next(const UnifiedCiphertext &encrypted, Unifi
 
 void UnifiedEvaluator::add_plain_inplace(UnifiedCiphertext &encrypted, const UnifiedPlaintext &plain) const
 {
+    HE_COUNT_OP(AddPlain);
     backend_check(encrypted, plain);
     if (encrypted.on_host() && plain.on_host())
     {
@@ -124,6 +282,7 @@ void UnifiedEvaluator::sub_plain_inplace(UnifiedCiphertext &encrypted, const Uni
 
 void UnifiedEvaluator::multiply_plain_inplace(UnifiedCiphertext &encrypted, const UnifiedPlaintext &plain) const
 {
+    HE_COUNT_OP(MultiplyPlain);
     backend_check(encrypted, plain);
     if (encrypted.on_host() && plain.on_host())
     {
@@ -137,6 +296,7 @@ void UnifiedEvaluator::multiply_plain_inplace(UnifiedCiphertext &encrypted, cons
 
 void UnifiedEvaluator::multiply_plain_ntt_inplace(UnifiedCiphertext &encrypted, const UnifiedPlaintext &plain) const
 {
+    HE_COUNT_OP(MultiplyPlain);
     backend_check(encrypted, plain);
     if (encrypted.on_host() && plain.on_host())
     {
@@ -156,6 +316,32 @@ void UnifiedEvaluator::multiply_plain_ntt_inplace(UnifiedCiphertext &encrypted,
     }
 }
 
+void UnifiedEvaluator::multiply_plain_ntt_accumulate(
+    const std::vector<const UnifiedCiphertext *> &encrypted, const std::vector<const UnifiedPlaintext *> &plain,
+    UnifiedCiphertext &destination) const
+{
+    HE_COUNT_OP(MultiplyPlainAccumulate);
+    if (encrypted.empty() || encrypted.size() != plain.size())
+    {
+        throw std::invalid_argument("multiply_plain_ntt_accumulate: need as many plaintexts as ciphertexts");
+    }
+    if (encrypted[0]->on_host())
+    {
+        multiply_plain_ntt_accumulate_host(*hcontext_, encrypted, plain, destination);
+        return;
+    }
+    backend_check(*encrypted[0]);
+    PhantomCiphertext acc = encrypted[0]->dcipher();
+    phantom_eval_->multiply_plain_ntt_inplace(acc, *plain[0]);
+    for (std::size_t t = 1; t < encrypted.size(); t++)
+    {
+        PhantomCiphertext tmp = encrypted[t]->dcipher();
+        phantom_eval_->multiply_plain_ntt_inplace(tmp, *plain[t]);
+        phantom_eval_->add_inplace(acc, tmp);
+    }
+    destination = UnifiedCiphertext(std::move(acc));
+}
+
 void UnifiedEvaluator::rotate_vector_inplace(
     UnifiedCiphertext &encrypted, int step, const UnifiedGaloisKeys &galois_key) const
 {
@@ -187,6 +373,7 @@ void UnifiedEvaluator::complex_conjugate_inplace(
 void UnifiedEvaluator::rotate_rows_inplace(
     UnifiedCiphertext &encrypted, int step, const UnifiedGaloisKeys &galois_key) const
 {
+    HE_COUNT_OP(RotateRows);
     backend_check(encrypted, galois_key);
     if (encrypted.on_host() && galois_key.on_host())
     {
@@ -213,6 +400,7 @@ void UnifiedEvaluator::rotate_columns_inplace(UnifiedCiphertext &encrypted, cons
 
 void UnifiedEvaluator::transform_to_ntt_inplace(UnifiedPlaintext &plain, const seal::parms_id_type &parms_id) const
 {
+    HE_COUNT_OP(ToNTT);
     backend_check(plain);
     if (plain.on_host())
     {
@@ -226,6 +414,7 @@ void UnifiedEvaluator::transform_to_ntt_inplace(UnifiedPlaintext &plain, const s
 
 void UnifiedEvaluator::transform_to_ntt_inplace(UnifiedPlaintext &plain, size_t chain_index) const
 {
+    HE_COUNT_OP(ToNTT);
     backend_check(plain);
     if (plain.on_host())
     {
@@ -239,6 +428,7 @@ void UnifiedEvaluator::transform_to_ntt_inplace(UnifiedPlaintext &plain, size_t
 
 void UnifiedEvaluator::transform_to_ntt_inplace(UnifiedCiphertext &encrypted) const
 {
+    HE_COUNT_OP(ToNTT);
     backend_check(encrypted);
     if (encrypted.on_host())
     {
@@ -260,6 +450,7 @@ void UnifiedEvaluator::transform_to_ntt_inplace(UnifiedCiphertext &encrypted) co
 
 void UnifiedEvaluator::transform_from_ntt_inplace(UnifiedCiphertext &encrypted) const
 {
+    HE_COUNT_OP(FromNTT);
     backend_check(encrypted);
     if (encrypted.on_host())
     {
@@ -283,13 +474,14 @@ void UnifiedEvaluator::transform_from_ntt_inplace(UnifiedCiphertext &encrypted)
 
 void UnifiedEvaluator::multiply_plain_ntt_inplace(UnifiedCiphertext &encrypted, const UnifiedPlaintext &plain) const
 {
+    HE_COUNT_OP(MultiplyPlain);
     if (encrypted.on_host() && plain.on_host())
     {
         if (!plain.hplain().is_ntt_form() || !encrypted.hcipher().is_ntt_form())
         {
             throw std::invalid_argument("multiply_plain_ntt_inplace: plaintext and ciphertext must be in NTT form");
         }
-        seal_eval_->multiply_plain_inplace(encrypted, plain);
+        seal::Evaluator::multiply_plain_inplace(encrypted, plain);
     }
     else
     {
@@ -297,4 +489,12 @@ void UnifiedEvaluator::multiply_plain_ntt_inplace(UnifiedCiphertext &encrypted,
     }
 }
 
+void UnifiedEvaluator::multiply_plain_ntt_accumulate(
+    const std::vector<const UnifiedCiphertext *> &encrypted, const std::vector<const UnifiedPlaintext *> &plain,
+    UnifiedCiphertext &destination) const
+{
+    HE_COUNT_OP(MultiplyPlainAccumulate);
+    multiply_plain_ntt_accumulate_host(hcontext_, encrypted, plain, destination);
+}
+
 #endif
\ No newline at end of file
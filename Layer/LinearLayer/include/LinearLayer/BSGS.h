@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Datatype/Tensor.h>
+#include <HE/HE.h>
+#include <vector>
+
+using namespace Datatype;
+using namespace HE;
+using namespace HE::unified;
+
+namespace LinearLayer {
+
+/*
+Baby-step giant-step product of diagonal-packed plaintexts with rotated input ciphertexts, shared by
+Conv2DNest, LinearBolt, LinearNest, CirConv2D and CirLinearNest. Diagonal (i, j, k) multiplies input ciphertext i, rotated by
+input_rot - 1 - k % input_rot baby steps, and is summed into giant group k / input_rot of output
+ciphertext j; group g is then rotated by (groups - 1 - g) giant steps of input_rot baby steps.
+
+zero[(i * tiled_out + j) * tile_size + k] marks the all-zero diagonals (pruned weights, padding
+channels, pairs of different images of a batch). Their multiplies are skipped, and so are the baby
+rotations and giant groups no other diagonal uses. A rotation over several (skipped) steps is done as
+one rotation per set bit of the step count, with the power-of-two Galois keys when step is one.
+*/
+class SparseBSGS {
+    public:
+        uint64_t tiled_in;
+        uint64_t tiled_out;
+        uint64_t tile_size;
+        std::vector<bool> zero;
+
+        SparseBSGS(uint64_t tiled_in, uint64_t tiled_out, uint64_t tile_size, const std::vector<bool> &zero);
+
+        // the largest power of two <= sqrt(tile_size), the dense split
+        static uint64_t DefaultInputRot(uint64_t tile_size);
+        // key switches of all rotations with input_rot baby steps
+        uint64_t Cost(uint64_t input_rot) const;
+        // the power of two input_rot dividing tile_size with the fewest key switches, default on ties
+        uint64_t BestInputRot(uint64_t default_rot) const;
+
+        /*
+        step: slots of one baby step; only the server calls this. weight_pt must be in NTT form
+        (HEEvaluator::PlainToNTT): the baby steps are moved to NTT form once and each giant group is a
+        single multiply_plain_ntt_accumulate, instead of a multiply_plain and add per diagonal.
+        */
+        Tensor<UnifiedCiphertext> operator()(HEEvaluator *HE, const Tensor<UnifiedPlaintext> &weight_pt, const Tensor<UnifiedCiphertext> &ac_ct,
+                                             uint64_t input_rot, uint64_t step) const;
+
+        // of the last operator() call
+        struct Stats {
+            uint64_t rotations = 0;
+            uint64_t products = 0;
+            double rotation_ms = 0;
+            double multiply_ms = 0;
+        };
+        mutable Stats stats;
+
+    private:
+        bool is_zero(uint64_t i, uint64_t j, uint64_t k) const { return zero[(i * tiled_out + j) * tile_size + k]; }
+        // in_used[i * tile_size + k] / out_used[j * tile_size + k]: some diagonal k of input i / output j is nonzero
+        std::vector<bool> in_used;
+        std::vector<bool> out_used;
+};
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <LinearLayer/Conv.h>
+#include <vector>
+
+namespace LinearLayer {
+
+/*
+Inference-time BatchNorm2D, y = gamma * (x - running_mean) / sqrt(running_var + eps) + beta per
+channel. It never runs as a layer of its own: FoldInto() turns it into a per-channel scale and shift
+in fixed point at model-load time and folds them into the preceding conv (Conv2D::fuse_bn). The
+scale ends up in the packed weights, the shift in the conv bias, which the server adds while masking
+the HEToSS of the conv. Inference then has no BatchNorm step and no extra communication.
+*/
+class BatchNorm2D : public Module {
+    public:
+        uint64_t num_features;
+        std::vector<double> gamma;
+        std::vector<double> beta;
+        std::vector<double> running_mean;
+        std::vector<double> running_var;
+        double eps = 1e-5;
+
+        // identity normalization until the parameters are loaded
+        explicit BatchNorm2D(uint64_t num_features, double eps = 1e-5);
+
+        /*
+        Folds into `conv`, whose outputs carry a fixed-point scale of 2^out_scale. The per-channel scale
+        is rounded to scale_bits fractional bits, so the conv output afterwards carries 2^(out_scale +
+        scale_bits), like Conv2D::fold_scale; the shift is encoded at that scale. channel_offset selects
+        the output channels of one branch of a Conv2DFused, the other channels are only rescaled.
+        */
+        void FoldInto(Conv2D *conv, int out_scale, int scale_bits, uint64_t channel_offset = 0) const;
+};
+
+} // namespace LinearLayer
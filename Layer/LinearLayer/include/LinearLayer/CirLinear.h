@@ -3,6 +3,7 @@
 #include <Datatype/Tensor.h>
 #include <HE/HE.h>
 #include <LinearOperator/Conversion.h>
+#include <LinearLayer/BSGS.h>
 #include "../../../Layer/Module.h"
 
 using namespace seal;
@@ -116,6 +117,9 @@ private:
      * Apply iNTT and extract according to coefficient encoding rule.
      */
     Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out_msg);
+
+    // weight_pt entries that are all zero, by {i, j, k}; they are neither encoded nor multiplied
+    std::vector<bool> zero_weight_pt;
 };
 
 } // namespace LinearLayer
@@ -5,7 +5,10 @@
 #include <Datatype/Tensor.h>
 #include <HE/HE.h>
 #include <LinearOperator/Conversion.h>
+#include <LinearLayer/BSGS.h>
 #include "../../../Layer/Module.h"
+#include <algorithm>
+#include <thread>
 
 using namespace seal;
 using namespace Datatype;
@@ -26,22 +29,55 @@ class Conv2D : public Module {
         Tensor<uint64_t> weight;
         Tensor<HE::unified::UnifiedPlaintext> weight_pt;  // We denote all plaintext(ciphertext) variables with suffix '_pt'('_ct')
         Tensor<uint64_t> bias;
+        /*
+        The bias packed like the output ciphertexts (server). HEToSS masks them with bias_msg - mask
+        instead of -mask, so the bias (and a folded BatchNorm shift) is added without any extra
+        operation or communication. Empty for layers that do not pack their bias.
+        */
+        Tensor<uint64_t> bias_msg;
         HE::HEEvaluator* HE;
-        bool fused_bn;
+        bool fused_bn = false;
+        /*
+        Number of images per forward pass. With batch_size > 1 the input is {B, Ci, H, W} and the
+        output {B, Co, H', W'}: the images are packed side by side into the slots/coefficients a single
+        image leaves unused, as one layer with B * Ci inputs, B * Co outputs and a block-diagonal kernel,
+        so the whole batch shares one SSToHE, HECompute and HEToSS.
+        */
+        uint64_t batch_size = 1;
 
-        Conv2D(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE);
-        Conv2D(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE);
+        Conv2D(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE, uint64_t batch_size = 1);
+        Conv2D(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE, uint64_t batch_size = 1);
     
         virtual ~Conv2D() = default;
     
         virtual Tensor<uint64_t> operator()(Tensor<uint64_t> &x) = 0;
 
+        // Fold a per-output-channel scale and shift (a BatchNorm, see BatchNorm2D) into weight and bias
+        // at load time and repack: weight[o] *= gamma[o], bias[o] = bias[o] * gamma[o] + beta[o] in Z_t.
         void fuse_bn(Tensor<uint64_t> *gamma, Tensor<uint64_t> *beta);
+
+        // Multiply the weights by round(factor * 2^shift) and the bias by 2^shift and repack, e.g. to absorb
+        // the 1/k^2 of a preceding average pool. The output then carries an extra 2^shift scale.
+        void fold_scale(double factor, int shift);
+    protected:
+        uint64_t batch_in_channels() const { return batch_size * in_channels; }
+        uint64_t batch_out_channels() const { return batch_size * out_channels; }
+        // Kernel entry between channels of the packed batch, zero across images.
+        uint64_t batched_weight(uint64_t out_idx, uint64_t in_idx, uint64_t m, uint64_t n) const;
+        // {B, C, H, W} <-> {B * C, H, W}, the layout the packing routines work on.
+        void fold_batch(Tensor<uint64_t> &x, uint64_t channels) const;
+        void unfold_batch(Tensor<uint64_t> &x, uint64_t channels) const;
+        // the HEToSS offset of this layer, nullptr without a packed bias
+        const Tensor<uint64_t> *mask_offset() const { return bias_msg.size() ? &bias_msg : nullptr; }
     private:
         virtual Tensor<HE::unified::UnifiedPlaintext> PackWeight() = 0;
+        // bias -> bias_msg
+        virtual Tensor<uint64_t> PackBias() { return Tensor<uint64_t>(); }
         virtual Tensor<uint64_t> PackActivation(Tensor<uint64_t> &x) = 0;
         virtual Tensor<HE::unified::UnifiedCiphertext> HECompute(const Tensor<HE::unified::UnifiedPlaintext> &weight_pt, Tensor<HE::unified::UnifiedCiphertext> &ac_ct) = 0;
         virtual Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out) = 0;
+        friend class Conv2DPolyphase;
+        friend class Conv2DFused;
 };
 
 
@@ -50,20 +86,55 @@ class Conv2DNest : public Conv2D {
         uint64_t tiled_in_channels;
         uint64_t tiled_out_channels;
         uint64_t tile_size;
-        uint64_t padded_feature_size = 0;
+        uint64_t padded_feature_size = 0;  // row stride of a channel in its slot block
+        uint64_t block_len = 0;            // slots of one channel, a power of two for the NTT
         uint64_t input_rot;
         vector<uint64_t> tmp_w;
+        /*
+        Row layout of a channel. With compact_rows each row of the padded map is stored with its own
+        width and only block_len = pow2(rows * rows) is rounded up (34x34 -> 2048 slots), otherwise
+        rows are padded to a power of two as well (34x34 -> 64x64 = 4096 slots).
+        */
+        bool compact_rows = true;
+        /*
+        Maps whose block does not fit in N/2 slots are cut into spatial_tiles x spatial_tiles output
+        tiles. Each tile is computed from its own input window, overlapping its neighbours by a
+        halo of kernel_size - stride rows/columns, and the windows are packed like extra images of
+        a batch. tile_feature_size/tile_padding/tile_out_size describe one packed window; without
+        tiling they are the layer's own sizes.
+        */
+        uint64_t spatial_tiles = 1;
+        uint64_t tile_feature_size;
+        uint64_t tile_padding;
+        uint64_t tile_out_size;
 
-        Conv2DNest(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE);
-        Conv2DNest(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE);
+        Conv2DNest(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE, uint64_t batch_size = 1, bool compact_rows = true);
+        Conv2DNest(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE, uint64_t batch_size = 1, bool compact_rows = true);
         Tensor<uint64_t> operator()(Tensor<uint64_t> &x) ;
 
+        // slots of one channel for a padded map of `rows` x `rows`
+        static uint64_t BlockLen(uint64_t rows, bool compact_rows);
+
     private:
         Tensor<HE::unified::UnifiedPlaintext> PackWeight() ;
         Tensor<uint64_t> PackActivation(Tensor<uint64_t> &x) ;
         Tensor<HE::unified::UnifiedCiphertext> HECompute(const Tensor<HE::unified::UnifiedPlaintext> &weight_pt, Tensor<HE::unified::UnifiedCiphertext> &ac_ct) ;
         Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out);
+        Tensor<uint64_t> PackBias() override;
+        // slot of output (i, j, k) of the packed channels, in output ciphertext `ct`
+        uint64_t out_slot(uint64_t i, uint64_t j, uint64_t k, uint64_t &ct) const;
         void compute_he_params(uint64_t in_feature_size);
+        // images in one pass: the batch times its spatial tiles
+        uint64_t packed_images() const { return batch_size * spatial_tiles * spatial_tiles; }
+        uint64_t packed_in_channels() const { return packed_images() * in_channels; }
+        uint64_t packed_out_channels() const { return packed_images() * out_channels; }
+        // {B * Ci, H, W} -> {B * T * T * Ci, h, h}, zero outside of the padded map
+        Tensor<uint64_t> ExtractTiles(const Tensor<uint64_t> &x) const;
+        // {B * T * T * Co, h', h'} -> {B * Co, H', W'}
+        Tensor<uint64_t> StitchTiles(const Tensor<uint64_t> &y) const;
+        // weight_pt entries that are all zero, by {i, j, k}; they are neither encoded nor multiplied
+        std::vector<bool> zero_weight_pt;
+        std::vector<bool> ZeroDiagonals() const;
 };
 
 
@@ -72,13 +143,15 @@ class Conv2DCheetah : public Conv2D {
         unsigned long N, HW, WW, CW, MW, dM, dC, dH, dW, OW, HOut, WOut, HWprime, WWprime;
         size_t polyModulusDegree = 8192;
         uint64_t plain;
+        // threads of the per-tile loops in PackActivation and HECompute (one on DEVICE)
+        size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
 
-        Conv2DCheetah(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE);
+        Conv2DCheetah(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE, uint64_t batch_size = 1);
 
         Conv2DCheetah(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE
-                            , Tensor<uint64_t> *gamma, Tensor<uint64_t> *beta);
+                            , Tensor<uint64_t> *gamma, Tensor<uint64_t> *beta, uint64_t batch_size = 1);
 
-        Conv2DCheetah(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE);
+        Conv2DCheetah(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE, uint64_t batch_size = 1);
 
         
         Tensor<uint64_t> operator()(Tensor<uint64_t> &x) override;
@@ -87,15 +160,16 @@ class Conv2DCheetah : public Conv2D {
         int DivUpper(int a, int b);
         int CalculateCost(int H, int W, int h, int Hw, int Ww, int C, int N);
         void FindOptimalPartition(int H, int W, int h, int C, int N, int* optimal_Hw, int* optimal_Ww);
-        Tensor<UnifiedCiphertext> EncryptTensor(Tensor<UnifiedPlaintext> plainTensor);
+        Tensor<UnifiedCiphertext> EncryptTensor(const Tensor<UnifiedPlaintext> &plainTensor);
         Tensor<uint64_t> PackActivation(Tensor<uint64_t> &x) override;
         Tensor<UnifiedPlaintext> PackWeight() override;
-        Tensor<UnifiedCiphertext> TensorTOHE(Tensor<uint64_t> PackActivationTensor);
+        Tensor<UnifiedCiphertext> TensorTOHE(const Tensor<uint64_t> &PackActivationTensor);
         Tensor<UnifiedCiphertext> HECompute(const Tensor<UnifiedPlaintext> &weight_pt, Tensor<UnifiedCiphertext> &ac_ct) override;
-        Tensor<UnifiedCiphertext> sumCP(Tensor<UnifiedCiphertext> cipherTensor, Tensor<UnifiedPlaintext> plainTensor);
+        Tensor<UnifiedCiphertext> sumCP(const Tensor<UnifiedCiphertext> &cipherTensor, const Tensor<UnifiedPlaintext> &plainTensor);
         Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out) override;
-        Tensor<uint64_t> HETOTensor (Tensor<UnifiedCiphertext> inputCipher);
-        void fuse_bn(Tensor<uint64_t> *gamma, Tensor<uint64_t> *beta);
+        Tensor<uint64_t> HETOTensor (const Tensor<UnifiedCiphertext> &inputCipher);
+        Tensor<uint64_t> PackBias() override;
+        size_t out_index(size_t cprime, size_t iprime, size_t jprime) const;
         void compute_he_params(uint64_t in_feature_size);
     };
 
@@ -111,8 +185,8 @@ class CirConv2D : public Conv2D {
         uint64_t num_blocks_in;
         uint64_t num_blocks_out;
 
-        CirConv2D(uint64_t in_feature_size, uint64_t stride, uint64_t padding, uint64_t block_size, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE);
-        CirConv2D(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, uint64_t block_size, HE::HEEvaluator* HE);
+        CirConv2D(uint64_t in_feature_size, uint64_t stride, uint64_t padding, uint64_t block_size, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE, uint64_t batch_size = 1);
+        CirConv2D(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, uint64_t block_size, HE::HEEvaluator* HE, uint64_t batch_size = 1);
         Tensor<uint64_t> operator()(Tensor<uint64_t> &x) ;
 
     private:
@@ -121,6 +195,89 @@ class CirConv2D : public Conv2D {
         Tensor<HE::unified::UnifiedCiphertext> HECompute(const Tensor<HE::unified::UnifiedPlaintext> &weight_pt, Tensor<HE::unified::UnifiedCiphertext> &ac_ct) ;
         Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out);
         void compute_he_params(uint64_t in_feature_size);
+        // weight_pt entries that are all zero, by {i, j, k}; they are neither encoded nor multiplied
+        std::vector<bool> zero_weight_pt;
+};
+
+/*
+Strided convolution as a stride-1 convolution over polyphase components. With
+xpad[s * i + u, s * j + v] =: X_uv[i, j] and w[s * a + u, s * b + v] =: W_uv[a, b],
+    y = sum_{u, v} X_uv (*) W_uv,
+so a stride-s layer becomes a stride-1 layer over the phase sub-images (1/s^2 of the padded map
+each, stacked as extra input channels) with ceil(k / s) sub-kernels. The inner Nest/Cheetah layer
+then only computes the outputs that are kept, instead of the full stride-1 result that DepackResult
+subsamples. Phases whose sub-kernel is empty (u or v >= k, e.g. all but one for a 1x1 kernel) are
+dropped. Weight, bias and the public shape fields keep the strided layer's meaning.
+*/
+class Conv2DPolyphase : public Conv2D {
+    public:
+        std::vector<std::pair<uint64_t, uint64_t>> phases;  // (u, v) offsets of the kept phases
+        uint64_t phase_feature_size;                         // ceil((H + 2p) / s)
+        uint64_t phase_kernel_size;                          // ceil(k / s)
+        Conv2D *inner = nullptr;
+
+        Conv2DPolyphase(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE, CONV_TYPE conv_type = CONV_TYPE::Nest, uint64_t batch_size = 1);
+        Conv2DPolyphase(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE, CONV_TYPE conv_type = CONV_TYPE::Nest, uint64_t batch_size = 1);
+        ~Conv2DPolyphase() { delete inner; }
+        Tensor<uint64_t> operator()(Tensor<uint64_t> &x) override;
+
+    private:
+        CONV_TYPE conv_type;
+        void compute_phases(CONV_TYPE conv_type);
+        // {Co, Ci, k, k} -> {Co, Ci * P, k', k'}, zero on the client
+        Tensor<uint64_t> PhaseWeight() const;
+        // repacks the inner layer from the current weight
+        Tensor<HE::unified::UnifiedPlaintext> PackWeight() override;
+        // {B * Ci, H, W} -> {B * Ci * P, H', H'}
+        Tensor<uint64_t> PackActivation(Tensor<uint64_t> &x) override;
+        Tensor<HE::unified::UnifiedCiphertext> HECompute(const Tensor<HE::unified::UnifiedPlaintext> &weight_pt, Tensor<HE::unified::UnifiedCiphertext> &ac_ct) override;
+        // crops the inner output to out_feature_size
+        Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out) override;
+};
+
+
+/*
+Sibling convs reading the same input, e.g. conv1 and the projection shortcut of a ResNet block. Run
+separately each one uploads the input (SSToHE), computes and converts its output back (HEToSS).
+Here the branch kernels are centered in the largest one and their output channels concatenated
+into one conv at the smallest branch stride: the input is uploaded once and every branch output
+comes back from the same HEToSS. With Conv2DNest the extra branches only add output ciphertexts,
+a 1x1 kernel centered in a 3x3 costs no more multiplies than the 3x3 itself.
+
+Branches must be aligned on the input: padding - (kernel_size - 1) / 2 is the same for all of them
+(true for the (k - 1) / 2 padding of the shape constructor), kernel sizes have the same parity and
+every stride is a multiple of the smallest one; a branch with a larger stride reads its outputs
+subsampled from the fused ones. weight and bias are the concatenated {sum Co, Ci, K, K} and
+{sum Co}, zero outside of each branch kernel.
+*/
+class Conv2DFused : public Conv2D {
+    public:
+        struct Branch {
+            uint64_t out_channels;
+            uint64_t kernel_size;
+            uint64_t stride = 1;
+            uint64_t padding = 0;
+        };
+        std::vector<Branch> branches;
+        Conv2D *inner = nullptr;
+
+        Conv2DFused(uint64_t in_feature_size, const std::vector<Branch> &branches, const std::vector<Tensor<uint64_t>> &weights, const std::vector<Tensor<uint64_t>> &biases, HE::HEEvaluator* HE, CONV_TYPE conv_type = CONV_TYPE::Nest, bool polyphase = false, uint64_t batch_size = 1);
+        // random weights on the server, padding (kernel_size - 1) / 2 for every branch
+        Conv2DFused(uint64_t in_feature_size, uint64_t in_channels, const std::vector<Branch> &branches, HE::HEEvaluator* HE, CONV_TYPE conv_type = CONV_TYPE::Nest, bool polyphase = false, uint64_t batch_size = 1);
+        ~Conv2DFused() { delete inner; }
+        // concatenated output channels at the fused stride
+        Tensor<uint64_t> operator()(Tensor<uint64_t> &x) override;
+        // one output per branch, shaped like the output of the branch conv
+        std::vector<Tensor<uint64_t>> Forward(Tensor<uint64_t> &x);
+        std::vector<Tensor<uint64_t>> Split(Tensor<uint64_t> &y) const;
+
+    private:
+        void build_inner(CONV_TYPE conv_type, bool polyphase);
+        // repacks the inner layer from the current weight
+        Tensor<HE::unified::UnifiedPlaintext> PackWeight() override;
+        Tensor<uint64_t> PackActivation(Tensor<uint64_t> &x) override { return x; }
+        Tensor<HE::unified::UnifiedCiphertext> HECompute(const Tensor<HE::unified::UnifiedPlaintext> &weight_pt, Tensor<HE::unified::UnifiedCiphertext> &ac_ct) override;
+        Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out) override { return out; }
 };
 
 }
@@ -3,6 +3,7 @@
 #include <Datatype/Tensor.h>
 #include <HE/HE.h>
 #include <LinearOperator/Conversion.h>
+#include <LinearLayer/BSGS.h>
 #include "../../../Layer/Module.h"
 
 using namespace seal;
@@ -19,7 +20,9 @@ class Linear : public Module {
         uint64_t dim_2;  // The number of columns of the second matrix
         Tensor<uint64_t> weight;
         Tensor<HE::unified::UnifiedPlaintext> weight_pt;  // We denote all plaintext(ciphertext) variables with suffix '_pt'('_ct')
-        Tensor<uint64_t> bias;
+        Tensor<uint64_t> bias;  // {dim_0, dim_2}, or {dim_2} shared by all rows
+        // the bias packed like the output ciphertexts (server), added by HEToSS (see Conv2D::bias_msg)
+        Tensor<uint64_t> bias_msg;
         HE::HEEvaluator* HE;
         // TODO: remove the parameter `in_feature_size`
         Linear(uint64_t dim_0, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HE::HEEvaluator* HE);
@@ -28,8 +31,13 @@ class Linear : public Module {
         virtual ~Linear() = default;
     
         virtual Tensor<uint64_t> operator()(Tensor<uint64_t> &x) = 0;
+    protected:
+        uint64_t bias_at(uint64_t row, uint64_t col) const { return bias.shape().size() == 1 ? bias(col) : bias({row, col}); }
+        const Tensor<uint64_t> *mask_offset() const { return bias_msg.size() ? &bias_msg : nullptr; }
     private:
         virtual Tensor<HE::unified::UnifiedPlaintext> PackWeight() = 0;
+        // bias -> bias_msg
+        virtual Tensor<uint64_t> PackBias() { return Tensor<uint64_t>(); }
         virtual Tensor<uint64_t> PackActivation(Tensor<uint64_t> &x) = 0;
         virtual Tensor<HE::unified::UnifiedCiphertext> HECompute(const Tensor<HE::unified::UnifiedPlaintext> &weight_pt, Tensor<HE::unified::UnifiedCiphertext> &ac_ct) = 0;
         virtual Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out) = 0;
@@ -56,7 +64,10 @@ class LinearBolt : public Linear {
         Tensor<uint64_t> PackActivation(Tensor<uint64_t> &x) override;
         Tensor<HE::unified::UnifiedCiphertext> HECompute(const Tensor<HE::unified::UnifiedPlaintext> &weight_pt, Tensor<HE::unified::UnifiedCiphertext> &ac_ct) override;
         Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out) override;
+        Tensor<uint64_t> PackBias() override;
         void compute_he_params(uint64_t in_feature_size);
+        // weight_pt entries that are all zero, by {i, j, k}; they are neither encoded nor multiplied
+        std::vector<bool> zero_weight_pt;
 };
 
 
@@ -80,7 +91,10 @@ class LinearNest : public Linear {
         Tensor<uint64_t> PackActivation(Tensor<uint64_t> &x) override;
         Tensor<HE::unified::UnifiedCiphertext> HECompute(const Tensor<HE::unified::UnifiedPlaintext> &weight_pt, Tensor<HE::unified::UnifiedCiphertext> &ac_ct) override;
         Tensor<uint64_t> DepackResult(Tensor<uint64_t> &out) override;
+        Tensor<uint64_t> PackBias() override;
         void compute_he_params();
+        // weight_pt entries that are all zero, by {i, j, k}; they are neither encoded nor multiplied
+        std::vector<bool> zero_weight_pt;
 };
 
 class MatmulCtctBumble : public Module {
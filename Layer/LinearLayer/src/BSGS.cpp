@@ -0,0 +1,203 @@
+#include <LinearLayer/BSGS.h>
+#include <algorithm>
+#include <chrono>
+
+namespace LinearLayer {
+
+namespace {
+
+uint64_t Popcount(uint64_t x) {
+    uint64_t n = 0;
+    for (; x; x &= x - 1) {
+        n++;
+    }
+    return n;
+}
+
+// in rotated by count * step slots, one rotation per set bit of count; returns the rotations
+uint64_t RotateSteps(HEEvaluator *HE, const UnifiedCiphertext &in, uint64_t count, uint64_t step, UnifiedCiphertext &out) {
+    UnifiedGaloisKeys* keys = HE->Session()->galoisKeys;
+    bool first = true;
+    for (uint64_t bit = 0; (count >> bit) != 0; bit++) {
+        if ((count >> bit) & 1) {
+            HE->evaluator->rotate_rows(first ? in : out, step << bit, *keys, out);
+            first = false;
+        }
+    }
+    if (first) {
+        out = in;
+    }
+    return Popcount(count);
+}
+
+} // namespace
+
+SparseBSGS::SparseBSGS(uint64_t tiled_in, uint64_t tiled_out, uint64_t tile_size, const std::vector<bool> &zero)
+    : tiled_in(tiled_in),
+      tiled_out(tiled_out),
+      tile_size(tile_size),
+      zero(zero),
+      in_used(tiled_in * tile_size, false),
+      out_used(tiled_out * tile_size, false)
+{
+    for (uint64_t i = 0; i < tiled_in; i++) {
+        for (uint64_t j = 0; j < tiled_out; j++) {
+            for (uint64_t k = 0; k < tile_size; k++) {
+                if (!is_zero(i, j, k)) {
+                    in_used[i * tile_size + k] = true;
+                    out_used[j * tile_size + k] = true;
+                }
+            }
+        }
+    }
+}
+
+uint64_t SparseBSGS::DefaultInputRot(uint64_t tile_size) {
+    uint64_t input_rot = 1;
+    while (4 * input_rot * input_rot <= tile_size) {
+        input_rot *= 2;
+    }
+    return input_rot;
+}
+
+uint64_t SparseBSGS::Cost(uint64_t input_rot) const {
+    const uint64_t groups = (tile_size + input_rot - 1) / input_rot;
+    uint64_t cost = 0;
+    // baby steps: each input ciphertext is rotated up to the largest step one of its diagonals needs
+    for (uint64_t i = 0; i < tiled_in; i++) {
+        std::vector<bool> need(input_rot, false);
+        for (uint64_t k = 0; k < tile_size; k++) {
+            if (in_used[i * tile_size + k]) {
+                need[input_rot - 1 - k % input_rot] = true;
+            }
+        }
+        uint64_t prev = 0;
+        for (uint64_t b = 1; b < input_rot; b++) {
+            if (need[b]) {
+                cost += Popcount(b - prev);
+                prev = b;
+            }
+        }
+    }
+    // giant steps: the chain starts at the first nonempty group and jumps over the empty ones
+    for (uint64_t j = 0; j < tiled_out; j++) {
+        bool started = false;
+        uint64_t prev = 0;
+        for (uint64_t g = 0; g < groups; g++) {
+            bool used = false;
+            for (uint64_t k = g * input_rot; k < std::min(tile_size, (g + 1) * input_rot); k++) {
+                used = used || out_used[j * tile_size + k];
+            }
+            if (used) {
+                cost += started ? Popcount(g - prev) : 0;
+                started = true;
+                prev = g;
+            }
+        }
+        cost += started ? Popcount(groups - 1 - prev) : 0;
+    }
+    return cost;
+}
+
+uint64_t SparseBSGS::BestInputRot(uint64_t default_rot) const {
+    uint64_t best = default_rot, best_cost = Cost(default_rot);
+    for (uint64_t input_rot = 1; input_rot <= tile_size; input_rot *= 2) {
+        if (tile_size % input_rot) {
+            break;
+        }
+        uint64_t cost = Cost(input_rot);
+        if (cost < best_cost) {
+            best = input_rot;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+Tensor<UnifiedCiphertext> SparseBSGS::operator()(HEEvaluator *HE, const Tensor<UnifiedPlaintext> &weight_pt, const Tensor<UnifiedCiphertext> &ac_ct,
+                                                 uint64_t input_rot, uint64_t step) const {
+    using Clock = std::chrono::high_resolution_clock;
+    auto ms_since = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+    const auto target = HE->Backend();
+    const uint64_t groups = (tile_size + input_rot - 1) / input_rot;
+    // Outputs that only meet zero diagonals keep their encryption of zero.
+    Tensor<UnifiedCiphertext> out_ct({tiled_out}, HE->GenerateZeroCiphertext(target));
+    stats = Stats();
+
+    // First, the baby steps some nonzero diagonal uses, by [i * input_rot + b], in NTT form for the products.
+    std::vector<UnifiedCiphertext> ac_rot_ct(tiled_in * input_rot, UnifiedCiphertext(target));
+    for (uint64_t i = 0; i < tiled_in; i++) {
+        std::vector<bool> need(input_rot, false);
+        for (uint64_t k = 0; k < tile_size; k++) {
+            if (in_used[i * tile_size + k]) {
+                need[input_rot - 1 - k % input_rot] = true;
+            }
+        }
+        UnifiedCiphertext *rot = &ac_rot_ct[i * input_rot];
+        rot[0] = ac_ct(i);
+        uint64_t prev = 0;
+        auto start = Clock::now();
+        for (uint64_t b = 1; b < input_rot; b++) {
+            if (need[b]) {
+                stats.rotations += RotateSteps(HE, rot[prev], b - prev, step, rot[b]);
+                prev = b;
+            }
+        }
+        stats.rotation_ms += ms_since(start);
+        for (uint64_t b = 0; b < input_rot; b++) {
+            if (need[b]) {
+                HE->evaluator->transform_to_ntt_inplace(rot[b]);
+            }
+        }
+    }
+
+    std::vector<const UnifiedCiphertext *> cts;
+    std::vector<const UnifiedPlaintext *> pts;
+    for (uint64_t j = 0; j < tiled_out; j++) {
+        bool any = false;
+        uint64_t prev = 0;
+        for (uint64_t g = 0; g < groups; g++) {
+            // Then, one lazily reduced dot product per giant group, over input channels and baby steps.
+            cts.clear();
+            pts.clear();
+            for (uint64_t i = 0; i < tiled_in; i++) {
+                for (uint64_t k = g * input_rot; k < std::min(tile_size, (g + 1) * input_rot); k++) {
+                    if (!is_zero(i, j, k)) {
+                        cts.push_back(&ac_rot_ct[i * input_rot + input_rot - 1 - k % input_rot]);
+                        pts.push_back(&weight_pt({i, j, k}));
+                    }
+                }
+            }
+            if (cts.empty()) {
+                continue;
+            }
+            auto start = Clock::now();
+            UnifiedCiphertext group_ct(target);
+            HE->evaluator->multiply_plain_ntt_accumulate(cts, pts, group_ct);
+            HE->evaluator->transform_from_ntt_inplace(group_ct);
+            stats.products += cts.size();
+            stats.multiply_ms += ms_since(start);
+
+            // Complete the output rotation to reduce along the giant-step dimension.
+            start = Clock::now();
+            if (any) {
+                stats.rotations += RotateSteps(HE, out_ct(j), g - prev, step * input_rot, out_ct(j));
+                HE->evaluator->add_inplace(out_ct(j), group_ct);
+            }
+            else {
+                out_ct(j) = std::move(group_ct);
+                any = true;
+            }
+            prev = g;
+            stats.rotation_ms += ms_since(start);
+        }
+        if (any) {
+            auto start = Clock::now();
+            stats.rotations += RotateSteps(HE, out_ct(j), groups - 1 - prev, step * input_rot, out_ct(j));
+            stats.rotation_ms += ms_since(start);
+        }
+    }
+    return out_ct;
+}
+
+}
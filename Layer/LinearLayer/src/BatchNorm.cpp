@@ -0,0 +1,38 @@
+#include <LinearLayer/BatchNorm.h>
+#include <cassert>
+#include <cmath>
+
+namespace LinearLayer {
+
+BatchNorm2D::BatchNorm2D(uint64_t num_features, double eps)
+    : num_features(num_features),
+      gamma(num_features, 1.0),
+      beta(num_features, 0.0),
+      running_mean(num_features, 0.0),
+      running_var(num_features, 1.0),
+      eps(eps)
+{
+}
+
+void BatchNorm2D::FoldInto(Conv2D *conv, int out_scale, int scale_bits, uint64_t channel_offset) const {
+    assert(channel_offset + num_features <= conv->out_channels && "BatchNorm does not match the conv output channels.");
+    const uint64_t t = conv->HE->plain_mod;
+    // centered fixed-point value in Z_t
+    auto encode = [t](double v, int bits) {
+        int64_t q = llround(std::ldexp(v, bits)) % static_cast<int64_t>(t);
+        return static_cast<uint64_t>(q < 0 ? q + static_cast<int64_t>(t) : q);
+    };
+    Tensor<uint64_t> scale({conv->out_channels});
+    Tensor<uint64_t> shift({conv->out_channels});
+    for (uint64_t c = 0; c < conv->out_channels; c++) {
+        scale(c) = encode(1.0, scale_bits);
+    }
+    for (uint64_t c = 0; c < num_features; c++) {
+        double a = gamma[c] / std::sqrt(running_var[c] + eps);
+        scale(channel_offset + c) = encode(a, scale_bits);
+        shift(channel_offset + c) = encode(beta[c] - a * running_mean[c], out_scale + scale_bits);
+    }
+    conv->fuse_bn(&scale, &shift);
+}
+
+} // namespace LinearLayer
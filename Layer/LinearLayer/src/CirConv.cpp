@@ -19,6 +19,7 @@
 
 #include <LinearLayer/Conv.h>
 #include <Utils/CyclicNTT.h>
+#include <algorithm>
 #include <cassert>
 
 using namespace seal;
@@ -31,8 +32,8 @@ namespace LinearLayer {
 
 CirConv2D::CirConv2D(uint64_t in_feature_size, uint64_t stride, uint64_t padding,
                      uint64_t block_size, const Tensor<uint64_t>& weight,
-                     const Tensor<uint64_t>& bias, HEEvaluator* HE)
-    : Conv2D(in_feature_size, stride, padding, weight, bias, HE),
+                     const Tensor<uint64_t>& bias, HEEvaluator* HE, uint64_t batch_size)
+    : Conv2D(in_feature_size, stride, padding, weight, bias, HE, batch_size),
       block_size(block_size)
 {
     compute_he_params(in_feature_size);
@@ -43,8 +44,8 @@ CirConv2D::CirConv2D(uint64_t in_feature_size, uint64_t stride, uint64_t padding
 
 CirConv2D::CirConv2D(uint64_t in_feature_size, uint64_t in_channels,
                      uint64_t out_channels, uint64_t kernel_size,
-                     uint64_t stride, uint64_t block_size, HEEvaluator* HE)
-    : Conv2D(in_feature_size, in_channels, out_channels, kernel_size, stride, HE),
+                     uint64_t stride, uint64_t block_size, HEEvaluator* HE, uint64_t batch_size)
+    : Conv2D(in_feature_size, in_channels, out_channels, kernel_size, stride, HE, batch_size),
       block_size(block_size)
 {
     compute_he_params(in_feature_size);
@@ -66,8 +67,9 @@ void CirConv2D::compute_he_params(uint64_t in_feature_size) {
     uint64_t padded_HW = padded_feature_size * padded_feature_size;
     ntt_size = block_size * padded_HW;
 
-    num_blocks_in = in_channels / block_size;
-    num_blocks_out = out_channels / block_size;
+    // blocks never straddle two images of a batch, since block_size divides the channel counts
+    num_blocks_in = batch_in_channels() / block_size;
+    num_blocks_out = batch_out_channels() / block_size;
 
     tile_size = HE->polyModulusDegree / (2 * ntt_size);
     if (tile_size < 1) tile_size = 1;
@@ -89,6 +91,7 @@ void CirConv2D::compute_he_params(uint64_t in_feature_size) {
     std::cout << "CirConv2D params: in_channels=" << in_channels
               << ", out_channels=" << out_channels
               << ", block_size=" << block_size
+              << ", batch_size=" << batch_size
               << ", padded_feature_size=" << padded_feature_size
               << ", ntt_size=" << ntt_size
               << ", num_blocks=(" << num_blocks_in << "," << num_blocks_out << ")"
@@ -104,6 +107,7 @@ Tensor<UnifiedPlaintext> CirConv2D::PackWeight() {
     uint64_t offset = (kernel_size - 1) * (padded_feature_size + 1);
 
     Tensor<UnifiedPlaintext> wpt({tiled_in_channels, tiled_out_channels, tile_size}, HE->Backend());
+    zero_weight_pt.assign(tiled_in_channels * tiled_out_channels * tile_size, false);
 
     for (uint64_t ti = 0; ti < tiled_in_channels; ti++) {
         for (uint64_t tj = 0; tj < tiled_out_channels; tj++) {
@@ -127,11 +131,11 @@ Tensor<UnifiedPlaintext> CirConv2D::PackWeight() {
                     for (uint64_t i = 0; i < block_size; i++) {
                         uint64_t out_ch = out_blk * block_size + i;
                         uint64_t in_ch = in_blk * block_size;
-                        if (out_ch < out_channels && in_ch < in_channels) {
+                        if (out_ch < batch_out_channels() && in_ch < batch_in_channels()) {
                             for (uint64_t m = 0; m < kernel_size; m++) {
                                 for (uint64_t n = 0; n < kernel_size; n++) {
                                     w_coef[i * padded_HW + offset - m * padded_feature_size - n] =
-                                        weight({out_ch, in_ch, m, n});
+                                        batched_weight(out_ch, in_ch, m, n);
                                 }
                             }
                         }
@@ -151,15 +155,13 @@ Tensor<UnifiedPlaintext> CirConv2D::PackWeight() {
                     }
                 }
 
-                bool all_zero = true;
-                for (uint64_t m = 0; m < HE->polyModulusDegree && all_zero; m++) {
-                    all_zero = (poly[m] == 0);
+                // all-zero diagonals are skipped in HECompute, their product would be a transparent ciphertext
+                bool all_zero = std::all_of(poly.begin(), poly.end(), [](uint64_t v) { return v == 0; });
+                zero_weight_pt[(ti * tiled_out_channels + tj) * tile_size + k] = all_zero;
+                if (!all_zero) {
+                    HE->encoder->encode(poly, wpt({ti, tj, k}));
+                    HE->PlainToNTT(wpt({ti, tj, k}));
                 }
-                if (all_zero) {
-                    poly[HE->polyModulusDegree - 1] = 1;
-                }
-
-                HE->encoder->encode(poly, wpt({ti, tj, k}));
             }
         }
     }
@@ -180,7 +182,7 @@ Tensor<uint64_t> CirConv2D::PackActivation(Tensor<uint64_t> &x) {
             std::vector<uint64_t> x_coef(ntt_size, 0);
             for (uint64_t i = 0; i < block_size; i++) {
                 uint64_t ch = blk * block_size + i;
-                if (ch >= in_channels) continue;
+                if (ch >= batch_in_channels()) continue;
                 for (uint64_t j = 0; j < padded_feature_size; j++) {
                     for (uint64_t kk = 0; kk < padded_feature_size; kk++) {
                         if (j >= padding && j < padding + in_feature_size &&
@@ -219,69 +221,8 @@ Tensor<UnifiedCiphertext> CirConv2D::HECompute(
 
     if (!HE->server) return out_ct;
 
-    UnifiedGaloisKeys* keys = HE->galoisKeys;
-
-    if (tile_size == 1) {
-        for (uint64_t tj = 0; tj < tiled_out_channels; tj++) {
-            bool first = true;
-            for (uint64_t ti = 0; ti < tiled_in_channels; ti++) {
-                UnifiedCiphertext tmp(target);
-                HE->evaluator->multiply_plain(ac_ct(ti), wpt({ti, tj, 0}), tmp);
-
-                if (first) {
-                    out_ct(tj) = tmp;
-                    first = false;
-                } else {
-                    HE->evaluator->add_inplace(out_ct(tj), tmp);
-                }
-            }
-        }
-    } else {
-        Tensor<UnifiedCiphertext> ac_rot({input_rot, tiled_in_channels},
-                                          HE->GenerateZeroCiphertext(target));
-        Tensor<UnifiedCiphertext> int_ct({tiled_out_channels, tile_size},
-                                          HE->GenerateZeroCiphertext(target));
-
-        for (uint64_t ti = 0; ti < tiled_in_channels; ti++) {
-            ac_rot({0, ti}) = ac_ct(ti);
-            for (uint64_t r = 1; r < input_rot; r++) {
-                HE->evaluator->rotate_rows(ac_rot({r-1, ti}), ntt_size, *keys, ac_rot({r, ti}));
-            }
-        }
-
-        for (uint64_t ti = 0; ti < tiled_in_channels; ti++) {
-            for (uint64_t tj = 0; tj < tiled_out_channels; tj++) {
-                for (uint64_t k = 0; k < tile_size; k++) {
-                    uint64_t rot_idx = input_rot - 1 - k % input_rot;
-                    UnifiedCiphertext tmp(target);
-                    HE->evaluator->multiply_plain(ac_rot({rot_idx, ti}), wpt({ti, tj, k}), tmp);
-
-                    if (ti == 0) {
-                        int_ct({tj, k}) = tmp;
-                    } else {
-                        HE->evaluator->add_inplace(int_ct({tj, k}), tmp);
-                    }
-                }
-            }
-        }
-
-        for (uint64_t tj = 0; tj < tiled_out_channels; tj++) {
-            for (uint64_t k = 1; k < tile_size; k++) {
-                if (k % input_rot != 0) {
-                    HE->evaluator->add_inplace(int_ct({tj, k - k % input_rot}), int_ct({tj, k}));
-                }
-            }
-
-            out_ct(tj) = int_ct({tj, 0});
-            for (uint64_t g = 1; g < (tile_size + input_rot - 1) / input_rot; g++) {
-                uint64_t k = g * input_rot;
-                if (k < tile_size) {
-                    HE->evaluator->rotate_rows(out_ct(tj), ntt_size * input_rot, *keys, out_ct(tj));
-                    HE->evaluator->add_inplace(out_ct(tj), int_ct({tj, k}));
-                }
-            }
-        }
-    }
+    // BSGS over blocks of ntt_size slots; with tile_size == 1 only the dot product over input ciphertexts
+    out_ct = SparseBSGS(tiled_in_channels, tiled_out_channels, tile_size, zero_weight_pt)(HE, wpt, ac_ct, tile_size == 1 ? 1 : input_rot, ntt_size);
 
     return out_ct;
 }
@@ -290,7 +231,7 @@ Tensor<uint64_t> CirConv2D::DepackResult(Tensor<uint64_t> &out_msg) {
     Utils::CyclicNTT cyclic_ntt(ntt_size, HE->plain_mod);
     uint64_t padded_HW = padded_feature_size * padded_feature_size;
     uint64_t offset = (kernel_size - 1) * (padded_feature_size + 1);
-    Tensor<uint64_t> y({out_channels, out_feature_size, out_feature_size});
+    Tensor<uint64_t> y({batch_out_channels(), out_feature_size, out_feature_size});
 
     for (uint64_t tj = 0; tj < tiled_out_channels; tj++) {
         for (uint64_t l = 0; l < tile_size; l++) {
@@ -314,7 +255,7 @@ Tensor<uint64_t> CirConv2D::DepackResult(Tensor<uint64_t> &out_msg) {
 
             for (uint64_t i = 0; i < block_size; i++) {
                 uint64_t out_ch = out_blk * block_size + i;
-                if (out_ch >= out_channels) continue;
+                if (out_ch >= batch_out_channels()) continue;
 
                 for (uint64_t j = 0; j < out_feature_size; j++) {
                     for (uint64_t kk = 0; kk < out_feature_size; kk++) {
@@ -330,11 +271,14 @@ Tensor<uint64_t> CirConv2D::DepackResult(Tensor<uint64_t> &out_msg) {
 }
 
 Tensor<uint64_t> CirConv2D::operator()(Tensor<uint64_t> &x) {
+    fold_batch(x, in_channels);
     Tensor<uint64_t> ac_msg = PackActivation(x);
+    unfold_batch(x, in_channels);
     Tensor<UnifiedCiphertext> ac_ct = Operator::SSToHE(ac_msg, HE);
     Tensor<UnifiedCiphertext> out_ct = HECompute(weight_pt, ac_ct);
     Tensor<uint64_t> out_msg = Operator::HEToSS(out_ct, HE);
     Tensor<uint64_t> y = DepackResult(out_msg);
+    unfold_batch(y, out_channels);
     return y;
 }
 
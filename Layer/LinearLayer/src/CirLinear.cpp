@@ -26,7 +26,7 @@
 #include <Utils/CyclicNTT.h>
 #include <cassert>
 #include <hexl/hexl.hpp>
-#include <chrono>
+#include <algorithm>
 
 using namespace seal;
 using namespace HE;
@@ -169,6 +169,7 @@ Tensor<UnifiedPlaintext> CirLinearNest::PackWeight() {
      */
     Utils::CyclicNTT cyclic_ntt(ntt_size, HE->plain_mod);
     Tensor<UnifiedPlaintext> wpt({tiled_blocks_1, tiled_blocks_2, tile_size}, HE->Backend());
+    zero_weight_pt.assign(tiled_blocks_1 * tiled_blocks_2 * tile_size, false);
     
     for (uint64_t ti = 0; ti < tiled_blocks_1; ti++) {
         for (uint64_t tj = 0; tj < tiled_blocks_2; tj++) {
@@ -217,7 +218,13 @@ Tensor<UnifiedPlaintext> CirLinearNest::PackWeight() {
                     }
                 }
                 
-                HE->encoder->encode(poly, wpt({ti, tj, k}));
+                // all-zero diagonals are skipped in HECompute, their product would be a transparent ciphertext
+                bool all_zero = std::all_of(poly.begin(), poly.end(), [](uint64_t v) { return v == 0; });
+                zero_weight_pt[(ti * tiled_blocks_2 + tj) * tile_size + k] = all_zero;
+                if (!all_zero) {
+                    HE->encoder->encode(poly, wpt({ti, tj, k}));
+                    HE->PlainToNTT(wpt({ti, tj, k}));
+                }
             }
         }
     }
@@ -292,101 +299,13 @@ Tensor<UnifiedCiphertext> CirLinearNest::HECompute(
     
     if (!HE->server) return out_ct;
     
-    UnifiedGaloisKeys* keys = HE->galoisKeys;
-    
-    auto time_rotation = [&](auto&& func) {
-        auto start = std::chrono::high_resolution_clock::now();
-        func();
-        auto end = std::chrono::high_resolution_clock::now();
-        rotation_time_ms += std::chrono::duration<double, std::milli>(end - start).count();
-        rotation_count++;
-    };
-    
-    auto time_multiply = [&](auto&& func) {
-        auto start = std::chrono::high_resolution_clock::now();
-        func();
-        auto end = std::chrono::high_resolution_clock::now();
-        multiply_time_ms += std::chrono::duration<double, std::milli>(end - start).count();
-        multiply_count++;
-    };
-    
-    if (tile_size == 1) {
-        // Simple case: no BSGS, just multiply and accumulate
-        for (uint64_t tj = 0; tj < tiled_blocks_2; tj++) {
-            bool first = true;
-            for (uint64_t ti = 0; ti < tiled_blocks_1; ti++) {
-                UnifiedCiphertext tmp(target);
-                time_multiply([&]() {
-                    HE->evaluator->multiply_plain(ac_ct(ti), wpt({ti, tj, 0}), tmp);
-                });
-                
-                if (first) {
-                    out_ct(tj) = tmp;
-                    first = false;
-                } else {
-                    HE->evaluator->add_inplace(out_ct(tj), tmp);
-                }
-            }
-        }
-    } else {
-        // Full BSGS
-        Tensor<UnifiedCiphertext> ac_rot({input_rot, tiled_blocks_1}, 
-                                          HE->GenerateZeroCiphertext(target));
-        Tensor<UnifiedCiphertext> int_ct({tiled_blocks_2, tile_size}, 
-                                          HE->GenerateZeroCiphertext(target));
-        
-        // Step 1: Precompute input rotations
-        for (uint64_t ti = 0; ti < tiled_blocks_1; ti++) {
-            ac_rot({0, ti}) = ac_ct(ti);
-            for (uint64_t r = 1; r < input_rot; r++) {
-                // Rotate by ntt_size (one block)
-                time_rotation([&]() {
-                    HE->evaluator->rotate_rows(ac_rot({r-1, ti}), ntt_size, *keys, ac_rot({r, ti}));
-                });
-            }
-        }
-        
-        // Step 2: Multiply and accumulate
-        for (uint64_t ti = 0; ti < tiled_blocks_1; ti++) {
-            for (uint64_t tj = 0; tj < tiled_blocks_2; tj++) {
-                for (uint64_t k = 0; k < tile_size; k++) {
-                    uint64_t rot_idx = input_rot - 1 - k % input_rot;
-                    UnifiedCiphertext tmp(target);
-                    time_multiply([&]() {
-                        HE->evaluator->multiply_plain(ac_rot({rot_idx, ti}), wpt({ti, tj, k}), tmp);
-                    });
-                    
-                    if (ti == 0) {
-                        int_ct({tj, k}) = tmp;
-                    } else {
-                        HE->evaluator->add_inplace(int_ct({tj, k}), tmp);
-                    }
-                }
-            }
-        }
-        
-        // Step 3: Reduce along BSGS dimension
-        for (uint64_t tj = 0; tj < tiled_blocks_2; tj++) {
-            // First reduce within each input_rot group
-            for (uint64_t k = 1; k < tile_size; k++) {
-                if (k % input_rot != 0) {
-                    HE->evaluator->add_inplace(int_ct({tj, k - k % input_rot}), int_ct({tj, k}));
-                }
-            }
-            
-            // Then reduce across groups with output rotations
-            out_ct(tj) = int_ct({tj, 0});
-            for (uint64_t g = 1; g < (tile_size + input_rot - 1) / input_rot; g++) {
-                uint64_t k = g * input_rot;
-                if (k < tile_size) {
-                    time_rotation([&]() {
-                        HE->evaluator->rotate_rows(out_ct(tj), ntt_size * input_rot, *keys, out_ct(tj));
-                    });
-                    HE->evaluator->add_inplace(out_ct(tj), int_ct({tj, k}));
-                }
-            }
-        }
-    }
+    // Degenerate tile_size == 1: no rotations, only the dot product over input ciphertexts
+    SparseBSGS bsgs(tiled_blocks_1, tiled_blocks_2, tile_size, zero_weight_pt);
+    out_ct = bsgs(HE, wpt, ac_ct, tile_size == 1 ? 1 : input_rot, ntt_size);
+    rotation_count = bsgs.stats.rotations;
+    multiply_count = bsgs.stats.products;
+    rotation_time_ms = bsgs.stats.rotation_ms;
+    multiply_time_ms = bsgs.stats.multiply_ms;
     
     return out_ct;
 }
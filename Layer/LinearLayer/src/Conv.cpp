@@ -7,13 +7,14 @@ using namespace HE::unified;
 
 namespace LinearLayer {
 // Extract shared parameters. Let dim(w) = {Co, Ci, k, k}
-Conv2D::Conv2D(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HEEvaluator* HE)
+Conv2D::Conv2D(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HEEvaluator* HE, uint64_t batch_size)
     : in_feature_size(in_feature_size), 
       stride(stride),
       padding(padding),
       weight(weight), 
       bias(bias), 
-      HE(HE)
+      HE(HE),
+      batch_size(batch_size)
 {
     std::vector<size_t> weight_shape = weight.shape();
 
@@ -27,13 +28,14 @@ Conv2D::Conv2D(uint64_t in_feature_size, uint64_t stride, uint64_t padding, cons
     out_feature_size = (in_feature_size + 2 * padding - kernel_size) / stride + 1;
 };
 
-Conv2D::Conv2D(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HEEvaluator* HE)
+Conv2D::Conv2D(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HEEvaluator* HE, uint64_t batch_size)
     : in_feature_size(in_feature_size),
       in_channels(in_channels),
       out_channels(out_channels),
       kernel_size(kernel_size),
       stride(stride),
-      HE(HE)
+      HE(HE),
+      batch_size(batch_size)
       {
         cout << "---------in Conv2D constructor-----------" << endl;
         cout << "in_feature_size, in_channels, out_channels, kernel_size, stride: " << in_feature_size << ", " << in_channels << ", " << out_channels << ", " << kernel_size << ", " << stride << endl;
@@ -47,4 +49,72 @@ Conv2D::Conv2D(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_chan
             // cout << "server Conv2D constructor done" << endl;
         }
       }
+
+void Conv2D::fold_scale(double factor, int shift) {
+    if (!HE->server) {
+        return;
+    }
+    // weights live in Z_t, interpret them as centered values before scaling
+    const uint64_t t = HE->plain_mod;
+    const int64_t c = llround(factor * static_cast<double>(1ULL << shift));
+    auto scale_entry = [t](uint64_t w, int64_t c) {
+        int64_t centered = (w > t / 2) ? static_cast<int64_t>(w) - static_cast<int64_t>(t) : static_cast<int64_t>(w);
+        __int128 prod = static_cast<__int128>(centered) * c % static_cast<__int128>(t);
+        if (prod < 0) {
+            prod += t;
+        }
+        return static_cast<uint64_t>(prod);
+    };
+    for (size_t i = 0; i < weight.size(); i++) {
+        weight(i) = scale_entry(weight(i), c);
+    }
+    // the bias is added after the product, it only takes the 2^shift of the output, not the factor
+    for (size_t i = 0; i < bias.size(); i++) {
+        bias(i) = scale_entry(bias(i), int64_t(1) << shift);
+    }
+    weight_pt = PackWeight();
+    bias_msg = PackBias();
+}
+
+void Conv2D::fuse_bn(Tensor<uint64_t> *gamma, Tensor<uint64_t> *beta) {
+    fused_bn = true;
+    if (!HE->server) {
+        return;
+    }
+    assert(gamma->size() == out_channels && beta->size() == out_channels && "BatchNorm does not match the output channels.");
+    const uint64_t t = HE->plain_mod;
+    auto mul = [t](uint64_t a, uint64_t b) { return static_cast<uint64_t>(static_cast<unsigned __int128>(a) * b % t); };
+    const uint64_t per_channel = in_channels * kernel_size * kernel_size;
+    for (uint64_t o = 0; o < out_channels; o++) {
+        const uint64_t g = (*gamma)(o) % t;
+        for (uint64_t i = 0; i < per_channel; i++) {
+            weight(o * per_channel + i) = mul(weight(o * per_channel + i), g);
+        }
+        bias(o) = (mul(bias(o), g) + (*beta)(o) % t) % t;
+    }
+    weight_pt = PackWeight();
+    bias_msg = PackBias();
+}
+
+uint64_t Conv2D::batched_weight(uint64_t out_idx, uint64_t in_idx, uint64_t m, uint64_t n) const {
+    if (out_idx / out_channels != in_idx / in_channels) {
+        return 0;
+    }
+    return weight({out_idx % out_channels, in_idx % in_channels, m, n});
+}
+
+void Conv2D::fold_batch(Tensor<uint64_t> &x, uint64_t channels) const {
+    if (batch_size > 1) {
+        std::vector<size_t> shape = x.shape();
+        assert(shape.size() == 4 && shape[0] == batch_size && shape[1] == channels && "Expected a {B, C, H, W} batch.");
+        x.reshape({batch_size * channels, shape[2], shape[3]});
+    }
+}
+
+void Conv2D::unfold_batch(Tensor<uint64_t> &x, uint64_t channels) const {
+    if (batch_size > 1) {
+        std::vector<size_t> shape = x.shape();
+        x.reshape({batch_size, channels, shape[1], shape[2]});
+    }
+}
 } // namespace LinearLayer
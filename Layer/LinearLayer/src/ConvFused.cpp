@@ -0,0 +1,190 @@
+#include <LinearLayer/Conv.h>
+#include <algorithm>
+#include <cassert>
+
+using namespace seal;
+using namespace HE;
+using namespace HE::unified;
+
+namespace LinearLayer {
+
+namespace {
+
+using Branch = Conv2DFused::Branch;
+
+uint64_t FusedKernel(const std::vector<Branch> &branches) {
+    uint64_t k = 0;
+    for (const auto &b : branches) {
+        k = std::max(k, b.kernel_size);
+    }
+    return k;
+}
+
+uint64_t FusedStride(const std::vector<Branch> &branches) {
+    uint64_t s = branches[0].stride;
+    for (const auto &b : branches) {
+        s = std::min(s, b.stride);
+    }
+    return s;
+}
+
+uint64_t FusedOutChannels(const std::vector<Branch> &branches) {
+    uint64_t co = 0;
+    for (const auto &b : branches) {
+        co += b.out_channels;
+    }
+    return co;
+}
+
+std::vector<Branch> CenteredPadding(std::vector<Branch> branches) {
+    for (auto &b : branches) {
+        b.padding = (b.kernel_size - 1) / 2;
+    }
+    return branches;
+}
+
+// padding of the fused kernel, the same input window for every branch
+uint64_t FusedPadding(const std::vector<Branch> &branches) {
+    const uint64_t K = FusedKernel(branches), s = FusedStride(branches);
+    const uint64_t P = branches[0].padding + (K - branches[0].kernel_size) / 2;
+    for (const auto &b : branches) {
+        assert((K - b.kernel_size) % 2 == 0 && "Branch kernels cannot be centered.");
+        assert(b.padding + (K - b.kernel_size) / 2 == P && "Branches are not aligned on the input.");
+        assert(b.stride % s == 0 && "Branch stride is not a multiple of the fused stride.");
+    }
+    return P;
+}
+
+Tensor<uint64_t> ConcatWeight(const std::vector<Branch> &branches, const std::vector<Tensor<uint64_t>> &weights) {
+    const uint64_t K = FusedKernel(branches), Ci = weights[0].shape()[1];
+    Tensor<uint64_t> weight({FusedOutChannels(branches), Ci, K, K});
+    uint64_t base = 0;
+    for (size_t b = 0; b < branches.size(); b++) {
+        const uint64_t k = branches[b].kernel_size, shift = (K - k) / 2;
+        assert(weights[b].shape()[1] == Ci && "Branches differ in input channels.");
+        for (uint64_t o = 0; o < branches[b].out_channels; o++) {
+            for (uint64_t c = 0; c < Ci; c++) {
+                for (uint64_t m = 0; m < k; m++) {
+                    for (uint64_t n = 0; n < k; n++) {
+                        weight({base + o, c, shift + m, shift + n}) = weights[b]({o, c, m, n});
+                    }
+                }
+            }
+        }
+        base += branches[b].out_channels;
+    }
+    return weight;
+}
+
+Tensor<uint64_t> ConcatBias(const std::vector<Branch> &branches, const std::vector<Tensor<uint64_t>> &biases) {
+    Tensor<uint64_t> bias({FusedOutChannels(branches)});
+    uint64_t base = 0;
+    for (size_t b = 0; b < branches.size(); b++) {
+        for (uint64_t o = 0; o < branches[b].out_channels; o++) {
+            bias(base + o) = biases[b](o);
+        }
+        base += branches[b].out_channels;
+    }
+    return bias;
+}
+
+} // namespace
+
+Conv2DFused::Conv2DFused(uint64_t in_feature_size, const std::vector<Branch> &branches, const std::vector<Tensor<uint64_t>> &weights, const std::vector<Tensor<uint64_t>> &biases, HEEvaluator* HE, CONV_TYPE conv_type, bool polyphase, uint64_t batch_size)
+    : Conv2D(in_feature_size, FusedStride(branches), FusedPadding(branches), ConcatWeight(branches, weights), ConcatBias(branches, biases), HE, batch_size),
+      branches(branches)
+{
+    build_inner(conv_type, polyphase);
+}
+
+Conv2DFused::Conv2DFused(uint64_t in_feature_size, uint64_t in_channels, const std::vector<Branch> &branches, HEEvaluator* HE, CONV_TYPE conv_type, bool polyphase, uint64_t batch_size)
+    : Conv2D(in_feature_size, in_channels, FusedOutChannels(branches), FusedKernel(branches), FusedStride(branches), HE, batch_size),
+      branches(CenteredPadding(branches))
+{
+    this->padding = FusedPadding(this->branches);
+    this->out_feature_size = (in_feature_size + 2 * padding - kernel_size) / stride + 1;
+    if (HE->server) {
+        // keep the random weights inside each branch kernel only
+        uint64_t base = 0;
+        for (const auto &b : this->branches) {
+            const uint64_t shift = (kernel_size - b.kernel_size) / 2;
+            for (uint64_t o = base; o < base + b.out_channels; o++) {
+                for (uint64_t c = 0; c < in_channels; c++) {
+                    for (uint64_t m = 0; m < kernel_size; m++) {
+                        for (uint64_t n = 0; n < kernel_size; n++) {
+                            bool inside = m >= shift && m < shift + b.kernel_size && n >= shift && n < shift + b.kernel_size;
+                            if (!inside) {
+                                weight({o, c, m, n}) = 0;
+                            }
+                        }
+                    }
+                }
+            }
+            base += b.out_channels;
+        }
+    } else {
+        weight = Tensor<uint64_t>({out_channels, in_channels, kernel_size, kernel_size});
+        bias = Tensor<uint64_t>({out_channels});
+    }
+    build_inner(conv_type, polyphase);
+}
+
+void Conv2DFused::build_inner(CONV_TYPE conv_type, bool polyphase) {
+    cout << "fused conv: " << branches.size() << " branches, " << out_channels << " output channels, kernel "
+         << kernel_size << ", stride " << stride << endl;
+    if (polyphase && stride > 1) {
+        inner = new Conv2DPolyphase(in_feature_size, stride, padding, weight, bias, HE, conv_type, batch_size);
+    } else if (conv_type == CONV_TYPE::Cheetah) {
+        inner = new Conv2DCheetah(in_feature_size, stride, padding, weight, bias, HE, batch_size);
+    } else {
+        inner = new Conv2DNest(in_feature_size, stride, padding, weight, bias, HE, batch_size);
+    }
+}
+
+Tensor<UnifiedPlaintext> Conv2DFused::PackWeight() {
+    inner->weight = weight;
+    inner->bias = bias;
+    inner->weight_pt = inner->PackWeight();
+    inner->bias_msg = inner->PackBias();
+    return Tensor<UnifiedPlaintext>();
+}
+
+Tensor<UnifiedCiphertext> Conv2DFused::HECompute(const Tensor<UnifiedPlaintext> &weight_pt, Tensor<UnifiedCiphertext> &ac_ct) {
+    return inner->HECompute(inner->weight_pt, ac_ct);
+}
+
+Tensor<uint64_t> Conv2DFused::operator()(Tensor<uint64_t> &x) {  // x.shape = {Ci, H, W}, or {B, Ci, H, W} when batched
+    return (*inner)(x);
+}
+
+std::vector<Tensor<uint64_t>> Conv2DFused::Split(Tensor<uint64_t> &y) const {
+    fold_batch(y, out_channels);
+    std::vector<Tensor<uint64_t>> outs;
+    uint64_t base = 0;
+    for (const auto &b : branches) {
+        const uint64_t r = b.stride / stride;
+        const uint64_t size = (in_feature_size + 2 * b.padding - b.kernel_size) / b.stride + 1;
+        Tensor<uint64_t> out({batch_size * b.out_channels, size, size});
+        for (uint64_t img = 0; img < batch_size; img++) {
+            for (uint64_t o = 0; o < b.out_channels; o++) {
+                for (uint64_t i = 0; i < size; i++) {
+                    for (uint64_t j = 0; j < size; j++) {
+                        out({img * b.out_channels + o, i, j}) = y({img * out_channels + base + o, r * i, r * j});
+                    }
+                }
+            }
+        }
+        unfold_batch(out, b.out_channels);
+        outs.push_back(std::move(out));
+        base += b.out_channels;
+    }
+    unfold_batch(y, out_channels);
+    return outs;
+}
+
+std::vector<Tensor<uint64_t>> Conv2DFused::Forward(Tensor<uint64_t> &x) {
+    Tensor<uint64_t> y = (*this)(x);
+    return Split(y);
+}
+
+} // namespace LinearLayer
@@ -1,4 +1,6 @@
 #include <LinearLayer/Conv.h>
+#include <Utils/profiler.h>
+#include <algorithm>
 
 using namespace seal;
 using namespace HE;
@@ -6,53 +8,84 @@ using namespace HE::unified;
 
 namespace LinearLayer {
     
-Conv2DNest::Conv2DNest(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HEEvaluator* HE)
-    : Conv2D(in_feature_size, stride, padding, weight, bias, HE)
+Conv2DNest::Conv2DNest(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HEEvaluator* HE, uint64_t batch_size, bool compact_rows)
+    : Conv2D(in_feature_size, stride, padding, weight, bias, HE, batch_size),
+      compact_rows(compact_rows)
 {
-    // assert(padded_feature_size * padded_feature_size > HE->polyModulusDegree / 2 && "Input feature map is too big, please use Cheetah instead.");
-
-    // Pad the feature size to PO2.
-    int tmp_size = in_feature_size + 2 * padding - 1;
-    for (int i = 0; i < 5; i++) {
-        tmp_size |= tmp_size >> (1 << i);
-    }
-    padded_feature_size = tmp_size + 1;
-
-    /* 
-    The number of slots are divided into two identical parts in BFV, 
-    so we process out_channels in parallel, or more concretely, we turn Ci*Co/N into Ci*(Co/2)/(N/2).
-    */
-    tile_size = HE->polyModulusDegree / (2 * padded_feature_size * padded_feature_size);
-    out_channels /= 2;
-    
-    tiled_in_channels = in_channels / tile_size + (in_channels % tile_size != 0); // ceiling
-    tiled_out_channels = out_channels / tile_size + (out_channels % tile_size != 0);
-    input_rot = std::sqrt(tile_size);
+    compute_he_params(in_feature_size);
     if (HE->server) {
         weight_pt = PackWeight();
+        bias_msg = PackBias();
     }
 }
 
+uint64_t Conv2DNest::BlockLen(uint64_t rows, bool compact_rows) {
+    auto pow2 = [](uint64_t x) {
+        uint64_t p = 1;
+        while (p < x) {
+            p <<= 1;
+        }
+        return p;
+    };
+    return compact_rows ? pow2(rows * rows) : pow2(rows) * pow2(rows);
+}
+
 void Conv2DNest::compute_he_params(uint64_t in_feature_size) {
-    // cout << "compute_he_params called" << endl;
     cout << "in_feature_size: " << in_feature_size << ", padding: " << this->padding << ", kernel_size: " << this->kernel_size << ", stride: " << this->stride << endl;
-    int tmp_size = in_feature_size + 2 * this->padding - 1;
-    for (int i = 0; i < 5; i++) {
-        tmp_size |= tmp_size >> (1 << i);
-    }
-    cout << "tmp_size: " << tmp_size << endl;
-    this->padded_feature_size = tmp_size + 1;
-    this->tile_size = HE->polyModulusDegree / (2 * this->padded_feature_size * this->padded_feature_size);
-    if (this->tile_size <=0) {
-        cout << "tile_size is too small for: in_feature_size: " << in_feature_size << ", padding: " << this->padding << ", kernel_size: " << this->kernel_size << ", stride: " << this->stride << endl;
-        exit(1);
-    }
-    this->out_channels /= 2;
-    this->tiled_in_channels = in_channels / this->tile_size + (in_channels % this->tile_size != 0);
-    this->tiled_out_channels = out_channels / this->tile_size + (out_channels % this->tile_size != 0);
-    this->input_rot = std::sqrt(this->tile_size);  // to be checked
+    const uint64_t half_slots = HE->polyModulusDegree / 2;
     this->out_feature_size = (in_feature_size + 2 * this->padding - kernel_size) / stride + 1;
-    cout << "padded_feature_size: " << this->padded_feature_size << endl;
+    this->spatial_tiles = 1;
+    this->tile_feature_size = in_feature_size;
+    this->tile_padding = this->padding;
+    this->tile_out_size = this->out_feature_size;
+    if (BlockLen(in_feature_size + 2 * this->padding, compact_rows) > half_slots) {
+        /*
+        The map does not fit in half a ciphertext: pick the output tile size that needs the fewest
+        input + output ciphertexts, preferring larger tiles (less halo) on ties.
+        */
+        uint64_t best_cost = UINT64_MAX;
+        for (uint64_t out_size = 1; out_size <= this->out_feature_size; out_size++) {
+            uint64_t window = (out_size - 1) * stride + kernel_size;
+            uint64_t len = BlockLen(window, compact_rows);
+            if (len > half_slots) {
+                break;
+            }
+            uint64_t tiles = (this->out_feature_size + out_size - 1) / out_size;
+            uint64_t images = batch_size * tiles * tiles;
+            uint64_t channels_per_ct = half_slots / len;
+            uint64_t cost = (images * in_channels + channels_per_ct - 1) / channels_per_ct
+                          + (images * out_channels / 2 + channels_per_ct - 1) / channels_per_ct;
+            if (cost <= best_cost) {
+                best_cost = cost;
+                this->spatial_tiles = tiles;
+                this->tile_feature_size = window;
+                this->tile_out_size = out_size;
+            }
+        }
+        if (best_cost == UINT64_MAX) {
+            cout << "tile_size is too small for: kernel_size: " << this->kernel_size << ", stride: " << this->stride << endl;
+            exit(1);
+        }
+        this->tile_padding = 0;
+    }
+    uint64_t rows = this->tile_feature_size + 2 * this->tile_padding;
+    this->block_len = BlockLen(rows, compact_rows);
+    // without compact_rows the block is pow2(rows)^2
+    this->padded_feature_size = compact_rows ? rows : static_cast<uint64_t>(std::sqrt(this->block_len));
+    /* 
+    The number of slots are divided into two identical parts in BFV, 
+    so we process out_channels in parallel, or more concretely, we turn Ci*Co/N into Ci*(Co/2)/(N/2).
+    A batch of images (and the spatial tiles of each) is handled as one layer over the channels of all images.
+    */
+    this->tile_size = half_slots / this->block_len;
+    uint64_t half_out_channels = packed_out_channels() / 2;
+    this->tiled_in_channels = packed_in_channels() / this->tile_size + (packed_in_channels() % this->tile_size != 0);
+    this->tiled_out_channels = half_out_channels / this->tile_size + (half_out_channels % this->tile_size != 0);
+    // baby steps: the largest power of two <= sqrt(tile_size), so that it divides tile_size even when
+    // tile_size is an odd power of two (compact rows, or N = 16384). PackWeight may move it for sparse weights.
+    this->input_rot = SparseBSGS::DefaultInputRot(this->tile_size);
+    cout << "spatial_tiles: " << this->spatial_tiles << ", tile_feature_size: " << this->tile_feature_size << endl;
+    cout << "padded_feature_size: " << this->padded_feature_size << ", block_len: " << this->block_len << endl;
     cout << "tile_size: " << this->tile_size << endl;
     cout << "tiled_in_channels: " << this->tiled_in_channels << endl;
     cout << "tiled_out_channels: " << this->tiled_out_channels << endl;
@@ -60,24 +93,40 @@ void Conv2DNest::compute_he_params(uint64_t in_feature_size) {
     cout << "out_feature_size: " << this->out_feature_size << endl;
 }
 
-Conv2DNest::Conv2DNest(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE)
-    : Conv2D(in_feature_size, in_channels, out_channels, kernel_size, stride, HE)
+Conv2DNest::Conv2DNest(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE, uint64_t batch_size, bool compact_rows)
+    : Conv2D(in_feature_size, in_channels, out_channels, kernel_size, stride, HE, batch_size),
+      compact_rows(compact_rows)
 {
     compute_he_params(in_feature_size);
     // this->weight.print_shape();
     if(HE->server) {
         weight_pt = PackWeight();
+        bias_msg = PackBias();
     }
 }
 
 Tensor<UnifiedPlaintext> Conv2DNest::PackWeight() {
-    intel::hexl::NTT ntt(padded_feature_size * padded_feature_size, HE->plain_mod);
+    intel::hexl::NTT ntt(block_len, HE->plain_mod);
     uint64_t offset = (kernel_size - 1) * (padded_feature_size + 1);
+    uint64_t half_out_channels = packed_out_channels() / 2;
     Tensor<UnifiedPlaintext> weight_pt({tiled_in_channels, tiled_out_channels, tile_size}, HE->Backend());
+    /*
+    All-zero plaintexts (pruned weights, padding channels, and every pair of different images of a
+    batch) are not encoded and skipped in HECompute: their product would be a transparent ciphertext.
+    Which diagonals are empty does not depend on the BSGS split, so the split is chosen for them first.
+    */
+    zero_weight_pt = ZeroDiagonals();
+    SparseBSGS bsgs(tiled_in_channels, tiled_out_channels, tile_size, zero_weight_pt);
+    input_rot = bsgs.BestInputRot(SparseBSGS::DefaultInputRot(tile_size));
+    Utils::Profiler::Get().Count("conv.empty_diagonals", std::count(zero_weight_pt.begin(), zero_weight_pt.end(), true));
+    Utils::Profiler::Get().Count("conv.planned_rotations", bsgs.Cost(input_rot));
 
     for (uint64_t i = 0; i < tiled_in_channels; i++) {
         for (uint64_t j = 0; j < tiled_out_channels; j++) {
             for (uint64_t k = 0; k < tile_size; k++) {
+                if (zero_weight_pt[(i * tiled_out_channels + j) * tile_size + k]) {
+                    continue;
+                }
                 /*
                 Each ciphertext/plaintext executes tile_size convolutions in a SIMD manner.
                 The remaining dimensions are tiled_in_channels, tiled_out_channels and tile_size.
@@ -92,7 +141,7 @@ Tensor<UnifiedPlaintext> Conv2DNest::PackWeight() {
                     */
                     uint64_t in_channel_idx = i * tile_size + (l + (input_rot - k % input_rot - 1)) % tile_size;
                     uint64_t out_channel_idx = j * tile_size + (3 * tile_size - l - k - (input_rot - k % input_rot)) % tile_size;
-                    if (in_channel_idx < in_channels && out_channel_idx < out_channels) {
+                    if (in_channel_idx < packed_in_channels() && out_channel_idx < half_out_channels) {
                         for (uint64_t m = 0; m < kernel_size; m++) {
                             for (uint64_t n = 0; n < kernel_size; n++) {
                                 /*
@@ -100,9 +149,9 @@ Tensor<UnifiedPlaintext> Conv2DNest::PackWeight() {
                                 This is almost equivalent to the case of SISO convolution, where the offset guarantees that
                                 the weights start from the 0th index.
                                 */
-                                uint64_t poly_idx = l * padded_feature_size * padded_feature_size + offset - m * padded_feature_size - n;
-                                tmp_vec[poly_idx] = weight({out_channel_idx, in_channel_idx, m, n});
-                                tmp_vec[poly_idx + HE->polyModulusDegree / 2] = weight({out_channel_idx + out_channels, in_channel_idx, m, n});
+                                uint64_t poly_idx = l * block_len + offset - m * padded_feature_size - n;
+                                tmp_vec[poly_idx] = batched_weight(out_channel_idx, in_channel_idx, m, n);
+                                tmp_vec[poly_idx + HE->polyModulusDegree / 2] = batched_weight(out_channel_idx + half_out_channels, in_channel_idx, m, n);
                             }
                         }
                     }
@@ -110,25 +159,11 @@ Tensor<UnifiedPlaintext> Conv2DNest::PackWeight() {
 
                 // We perform NTT independently for each block in the ciphertext. 
                 for (uint64_t l = 0; l < 2 * tile_size; l++) {
-                    std::vector<uint64_t> tmp_ntt(padded_feature_size * padded_feature_size, 0);
-                    for (uint64_t m = 0; m < padded_feature_size * padded_feature_size; m++) {
-                        tmp_ntt[m] = tmp_vec[l * padded_feature_size * padded_feature_size + m];
-                    }
-                    ntt.ComputeForward(tmp_ntt.data(), tmp_ntt.data(), 1, 1);
-                    for (uint64_t m = 0; m < padded_feature_size * padded_feature_size; m++) {
-                        tmp_vec[l * padded_feature_size * padded_feature_size + m] = tmp_ntt[m];
-                    }
+                    ntt.ComputeForward(tmp_vec.data() + l * block_len, tmp_vec.data() + l * block_len, 1, 1);
                 }
 
-                // We set unused slots to non-zero values to avoid transparent ciphertext error.
-                bool zero_flag = 1;
-                for (uint64_t l = 0; l < HE->polyModulusDegree; l++) {
-                    zero_flag = zero_flag && (tmp_vec[l] == 0);
-                }
-                if (zero_flag) {
-                    tmp_vec[HE->polyModulusDegree - 1] = 1; 
-                }
                 HE->encoder->encode(tmp_vec, weight_pt({i, j, k}));
+                HE->PlainToNTT(weight_pt({i, j, k}));
             }
         }
     }
@@ -136,8 +171,39 @@ Tensor<UnifiedPlaintext> Conv2DNest::PackWeight() {
     return weight_pt;
 }
 
+/*
+Diagonal k pairs in_channel l with out_channel (3 * tile_size - 1 - k - l) % tile_size of the blocks
+(i, j) for every input_rot (see PackWeight), it is empty if all their kernels are zero.
+*/
+std::vector<bool> Conv2DNest::ZeroDiagonals() const {
+    const uint64_t half_out_channels = packed_out_channels() / 2;
+    std::vector<bool> zero(tiled_in_channels * tiled_out_channels * tile_size, true);
+    for (uint64_t i = 0; i < tiled_in_channels; i++) {
+        for (uint64_t j = 0; j < tiled_out_channels; j++) {
+            for (uint64_t k = 0; k < tile_size; k++) {
+                bool empty = true;
+                for (uint64_t l = 0; l < tile_size && empty; l++) {
+                    uint64_t in_channel_idx = i * tile_size + l;
+                    uint64_t out_channel_idx = j * tile_size + (3 * tile_size - 1 - k - l) % tile_size;
+                    if (in_channel_idx >= packed_in_channels() || out_channel_idx >= half_out_channels) {
+                        continue;
+                    }
+                    for (uint64_t m = 0; m < kernel_size && empty; m++) {
+                        for (uint64_t n = 0; n < kernel_size && empty; n++) {
+                            empty = batched_weight(out_channel_idx, in_channel_idx, m, n) % HE->plain_mod == 0
+                                 && batched_weight(out_channel_idx + half_out_channels, in_channel_idx, m, n) % HE->plain_mod == 0;
+                        }
+                    }
+                }
+                zero[(i * tiled_out_channels + j) * tile_size + k] = empty;
+            }
+        }
+    }
+    return zero;
+}
+
 Tensor<uint64_t> Conv2DNest::PackActivation(Tensor<uint64_t> &x) {
-    intel::hexl::NTT ntt(padded_feature_size * padded_feature_size, HE->plain_mod);
+    intel::hexl::NTT ntt(block_len, HE->plain_mod);
     Tensor<uint64_t> ac_msg({tiled_in_channels, HE->polyModulusDegree});
 
     for (uint64_t i = 0; i < tiled_in_channels; i++) {
@@ -146,28 +212,19 @@ Tensor<uint64_t> Conv2DNest::PackActivation(Tensor<uint64_t> &x) {
         The encoding for the activation is straightforward. We just flatten the original tensor.
         */
         for (uint64_t j = 0; j < tile_size; j++) {
-            if (i * tile_size + j < in_channels) {
-                for (uint64_t k = 0; k < padded_feature_size; k++) {
-                    for (uint64_t l = 0; l < padded_feature_size; l++) {
-                        if (k >= padding && k < padding + in_feature_size && l >= padding && l < padding + in_feature_size) {
-                            uint64_t idx = j * padded_feature_size * padded_feature_size + k * padded_feature_size + l;
-                            ac_msg({i, idx}) = x({i * tile_size + j, k - padding, l - padding}); // dim(x) = {Ci, Hi, Wi}
-                            ac_msg({i, idx + HE->polyModulusDegree / 2}) = x({i * tile_size + j, k - padding, l - padding});
-                        }
+            if (i * tile_size + j < packed_in_channels()) {
+                for (uint64_t k = tile_padding; k < tile_padding + tile_feature_size; k++) {
+                    for (uint64_t l = tile_padding; l < tile_padding + tile_feature_size; l++) {
+                        uint64_t idx = j * block_len + k * padded_feature_size + l;
+                        ac_msg({i, idx}) = x({i * tile_size + j, k - tile_padding, l - tile_padding}); // dim(x) = {B * T * T * Ci, h, h}
+                        ac_msg({i, idx + HE->polyModulusDegree / 2}) = x({i * tile_size + j, k - tile_padding, l - tile_padding});
                     }
                 }
             }
         }
 
         for (uint64_t j = 0; j < 2 * tile_size; j++) {
-            std::vector<uint64_t> tmp_ntt(padded_feature_size * padded_feature_size, 0);
-            for (uint64_t k = 0; k < padded_feature_size * padded_feature_size; k++) {
-                tmp_ntt[k] = ac_msg({i, j * padded_feature_size * padded_feature_size + k});
-            }
-            ntt.ComputeForward(tmp_ntt.data(), tmp_ntt.data(), 1, 1);
-            for (uint64_t k = 0; k < padded_feature_size * padded_feature_size; k++) {
-                ac_msg({i, j * padded_feature_size * padded_feature_size + k}) = tmp_ntt[k];
-            }
+            ntt.ComputeForward(&ac_msg({i, j * block_len}), &ac_msg({i, j * block_len}), 1, 1);
         }
     }
 
@@ -180,137 +237,154 @@ Tensor<UnifiedCiphertext> Conv2DNest::HECompute(const Tensor<UnifiedPlaintext> &
      *  Server computes on HE->Backend()
      *  Client does nothing
      */
-    const auto target = HE->server ? HE->Backend() : HOST;
-    Tensor<UnifiedCiphertext> out_ct({tiled_out_channels}, HE->GenerateZeroCiphertext(target));
-
     if (HE->server) {
-        Tensor<UnifiedCiphertext> ac_rot_ct({input_rot, tiled_in_channels}, HE->GenerateZeroCiphertext(target));
-        Tensor<UnifiedCiphertext> int_ct({tiled_out_channels, tile_size}, HE->GenerateZeroCiphertext(target));
-        UnifiedGaloisKeys* keys = HE->galoisKeys;
+        return SparseBSGS(tiled_in_channels, tiled_out_channels, tile_size, zero_weight_pt)(HE, weight_pt, ac_ct, input_rot, block_len);
+    }
+    return Tensor<UnifiedCiphertext>({tiled_out_channels}, HE->GenerateZeroCiphertext(HOST));
+}
 
-        // First, complete the input rotation.
-        for (uint64_t i = 0; i < input_rot; i++) {
-            for (uint64_t j = 0; j < tiled_in_channels; j++) {
-                if (i) {
-                    // cout << "rot1:" << padded_feature_size * padded_feature_size << endl;
-                    HE->evaluator->rotate_rows(ac_rot_ct({i - 1, j}), padded_feature_size * padded_feature_size, *keys, ac_rot_ct({i, j}));
-                    
-                }
-                else {
-                    ac_rot_ct({i, j}) = ac_ct(j);
-                }
-            }
-        }
-        // Then, complete all the multiplication, and reduce along the input channel dimension.
-        for (uint64_t i = 0; i < tiled_in_channels; i++) {
-            for (uint64_t j = 0; j < tiled_out_channels; j++) {
-                for (uint64_t k = 0; k < tile_size; k++) {
-                    UnifiedCiphertext tmp_ct(target);
-                    HE->evaluator->multiply_plain(ac_rot_ct({input_rot - 1 - k % input_rot, i}), weight_pt({i, j, k}), tmp_ct);
-                    if (i) {
-                        HE->evaluator->add_inplace(int_ct({j, k}), tmp_ct);
-                    }
-                    else {
-                        int_ct({j, k}) = tmp_ct;
-                    }
-                }
-            }
+Tensor<uint64_t> Conv2DNest::DepackResult(Tensor<uint64_t> &out_msg) {
+    Tensor<uint64_t> y({packed_out_channels(), tile_out_size, tile_out_size});
+    intel::hexl::NTT ntt(block_len, HE->plain_mod);
+
+    // iNTT needs to be executed before depacking.
+    for (uint64_t i = 0; i < tiled_out_channels; i++) {
+        for (uint64_t j = 0; j < 2 * tile_size; j++) {
+            ntt.ComputeInverse(&out_msg({i, j * block_len}), &out_msg({i, j * block_len}), 1, 1);
         }
-        for (uint64_t i = 0; i < tiled_out_channels; i++) {
-            // Reduce along the input rotation dimension, since it has been completed.
-            for (uint64_t j = 0; j < tile_size; j++) {
-                if (j % input_rot) {
-                    HE->evaluator->add_inplace(int_ct({i, j - j % input_rot}), int_ct({i, j}));
-                }
-            }
-            out_ct(i) = int_ct({i, 0});
-            // Complete output rotation to reduce along this dimension.
-            for (uint64_t j = input_rot; j < tile_size; j += input_rot) {
-                // cout << "rot2:" << padded_feature_size * padded_feature_size * input_rot << endl;
-                HE->evaluator->rotate_rows(out_ct(i), padded_feature_size * padded_feature_size * input_rot, *keys, out_ct(i));
-                
-                HE->evaluator->add_inplace(out_ct(i), int_ct({i, j}));
+    }
+
+    for (uint64_t i = 0; i < packed_out_channels(); i++) {
+        for (uint64_t j = 0; j < tile_out_size; j++) {
+            for (uint64_t k = 0; k < tile_out_size; k++) {
+                uint64_t ct;
+                uint64_t slot = out_slot(i, j, k, ct);
+                y({i, j, k}) = out_msg({ct, slot});
             }
         }
     }
 
-    return out_ct;
+    return y;
 }
 
-Tensor<uint64_t> Conv2DNest::DepackResult(Tensor<uint64_t> &out_msg) {
-    out_channels *= 2;
-    Tensor<uint64_t> y({out_channels, out_feature_size, out_feature_size});
-    intel::hexl::NTT ntt(padded_feature_size * padded_feature_size, HE->plain_mod);
+/*
+Depacking the results is almost the inverse of flattening, except considering the stride and
+the weight offset. Also, since we use anti-diagonal, the blocks here are in the inversed order.
+Note: The second half of output channels are stored in the second half of slots (offset by tile_size).
+*/
+uint64_t Conv2DNest::out_slot(uint64_t i, uint64_t j, uint64_t k, uint64_t &ct) const {
+    uint64_t offset = stride * padded_feature_size * j + stride * k + (kernel_size - 1) * (padded_feature_size + 1);
+    uint64_t half_out_channels = packed_out_channels() / 2;
+    uint64_t local_i = i < half_out_channels ? i : i - half_out_channels;
+    uint64_t slot_idx = (tile_size - local_i % tile_size) % tile_size + (i < half_out_channels ? 0 : tile_size);
+    ct = local_i / tile_size;
+    return slot_idx * block_len + offset;
+}
 
-    // iNTT needs to be executed before depacking.
+// The bias at every output position DepackResult reads, then NTT per block like HECompute's result.
+Tensor<uint64_t> Conv2DNest::PackBias() {
+    Tensor<uint64_t> bias_msg({tiled_out_channels, HE->polyModulusDegree});
+    bool any = false;
+    for (uint64_t i = 0; i < packed_out_channels(); i++) {
+        uint64_t b = bias(i % out_channels) % HE->plain_mod;
+        if (b == 0) {
+            continue;
+        }
+        any = true;
+        for (uint64_t j = 0; j < tile_out_size; j++) {
+            for (uint64_t k = 0; k < tile_out_size; k++) {
+                uint64_t ct;
+                uint64_t slot = out_slot(i, j, k, ct);
+                bias_msg({ct, slot}) = b;
+            }
+        }
+    }
+    if (!any) {
+        return Tensor<uint64_t>();
+    }
+    intel::hexl::NTT ntt(block_len, HE->plain_mod);
     for (uint64_t i = 0; i < tiled_out_channels; i++) {
-        std::vector<uint64_t> tmp_ntt(padded_feature_size * padded_feature_size, 0);
         for (uint64_t j = 0; j < 2 * tile_size; j++) {
-            for (uint64_t k = 0; k < padded_feature_size * padded_feature_size; k++) {
-                tmp_ntt[k] = out_msg({i, j * padded_feature_size * padded_feature_size + k});
-            }
-            ntt.ComputeInverse(tmp_ntt.data(), tmp_ntt.data(), 1, 1);
-            for (uint64_t k = 0; k < padded_feature_size * padded_feature_size; k++) {
-                out_msg({i, j * padded_feature_size * padded_feature_size + k}) = tmp_ntt[k];
-            }
+            ntt.ComputeForward(&bias_msg({i, j * block_len}), &bias_msg({i, j * block_len}), 1, 1);
         }
     }
+    return bias_msg;
+}
 
-    /*
-    Depacking the results is almost the inverse of flattening, except considering the stride and 
-    the weight offset. Also, since we use anti-diagonal, the blocks here are in the inversed order. 
-    Note: The second half of output channels are stored in the second half of slots (offset by tile_size).
-    */
-    uint64_t half_out_channels = out_channels / 2;
-    for (uint64_t i = 0; i < out_channels; i++) {
-        for (uint64_t j = 0; j < out_feature_size; j++) {
-            for (uint64_t k = 0; k < out_feature_size; k++) {
-                uint64_t offset = stride * padded_feature_size * j + stride * k + (kernel_size - 1) * (padded_feature_size + 1);
-                if (i < half_out_channels) {
-                    // First half: use slot index directly (0 to tile_size-1)
-                    uint64_t slot_idx = (tile_size - i % tile_size) % tile_size;
-                    y({i, j, k}) = out_msg({i / tile_size, slot_idx * padded_feature_size * padded_feature_size + offset});
-                }
-                else {
-                    // Second half: use slot index + tile_size to access second half of slots
-                    uint64_t local_i = i - half_out_channels;
-                    uint64_t slot_idx = (tile_size - local_i % tile_size) % tile_size + tile_size;
-                    y({i, j, k}) = out_msg({local_i / tile_size, slot_idx * padded_feature_size * padded_feature_size + offset});
+Tensor<uint64_t> Conv2DNest::ExtractTiles(const Tensor<uint64_t> &x) const {
+    const uint64_t T = spatial_tiles, h = tile_feature_size;
+    Tensor<uint64_t> tiles({packed_in_channels(), h, h});
+    for (uint64_t b = 0; b < batch_size; b++) {
+        for (uint64_t ty = 0; ty < T; ty++) {
+            for (uint64_t tx = 0; tx < T; tx++) {
+                uint64_t image = (b * T + ty) * T + tx;
+                // top-left of the window in the padded map; it overlaps the previous one by the halo
+                int64_t row0 = static_cast<int64_t>(ty * tile_out_size * stride) - static_cast<int64_t>(padding);
+                int64_t col0 = static_cast<int64_t>(tx * tile_out_size * stride) - static_cast<int64_t>(padding);
+                for (uint64_t c = 0; c < in_channels; c++) {
+                    for (uint64_t r = 0; r < h; r++) {
+                        int64_t row = row0 + static_cast<int64_t>(r);
+                        if (row < 0 || row >= static_cast<int64_t>(in_feature_size)) {
+                            continue;
+                        }
+                        for (uint64_t q = 0; q < h; q++) {
+                            int64_t col = col0 + static_cast<int64_t>(q);
+                            if (col >= 0 && col < static_cast<int64_t>(in_feature_size)) {
+                                tiles({image * in_channels + c, r, q}) = x({b * in_channels + c, static_cast<size_t>(row), static_cast<size_t>(col)});
+                            }
+                        }
+                    }
                 }
             }
         }
     }
+    return tiles;
+}
 
-    return y;
+Tensor<uint64_t> Conv2DNest::StitchTiles(const Tensor<uint64_t> &y) const {
+    const uint64_t T = spatial_tiles, h = tile_out_size;
+    Tensor<uint64_t> out({batch_out_channels(), out_feature_size, out_feature_size});
+    for (uint64_t b = 0; b < batch_size; b++) {
+        for (uint64_t ty = 0; ty < T; ty++) {
+            for (uint64_t tx = 0; tx < T; tx++) {
+                uint64_t image = (b * T + ty) * T + tx;
+                // the last row/column of tiles may run past the map
+                uint64_t rows = std::min(h, out_feature_size - ty * h);
+                uint64_t cols = std::min(h, out_feature_size - tx * h);
+                for (uint64_t o = 0; o < out_channels; o++) {
+                    for (uint64_t r = 0; r < rows; r++) {
+                        for (uint64_t q = 0; q < cols; q++) {
+                            out({b * out_channels + o, ty * h + r, tx * h + q}) = y({image * out_channels + o, r, q});
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return out;
 }
 
-Tensor<uint64_t> Conv2DNest::operator()(Tensor<uint64_t> &x) {  // x.shape = {Ci, H, W}
-    // cout << "in Conv2D, x.shape:" << endl;
-    // x.print_shape();
-    // cout << "in Conv2DNest operator" << endl;
-    // cout << "x.shape" << endl;
-    // x.print_shape();
-    // cout << "weight.shape" << endl;
-    // this->weight.print_shape();
+Tensor<uint64_t> Conv2DNest::operator()(Tensor<uint64_t> &x) {  // x.shape = {Ci, H, W}, or {B, Ci, H, W} when batched
+    fold_batch(x, in_channels);
     if (this->in_feature_size != x.shape()[1]) {
         cout << "in_feature_size:" << this->in_feature_size << endl;
         cout << "wrong input feature size" << endl;
         exit(1);
     }
-    // std::cout << "Conv2DNest operator called" << std::endl;
-    Tensor<uint64_t> ac_msg = PackActivation(x);  // ac_msg.shape = {ci, N}
-    // std::cout << "ac_msg generated" << std::endl;
+    Tensor<uint64_t> tiles;
+    if (spatial_tiles > 1) {
+        tiles = ExtractTiles(x);
+    }
+    Tensor<uint64_t> ac_msg = PackActivation(spatial_tiles > 1 ? tiles : x);  // ac_msg.shape = {ci, N}
     Tensor<UnifiedCiphertext> ac_ct = Operator::SSToHE(ac_msg, HE);  // ac_ct.shape = {ci}
-    // std::cout << "ac_ct generated" << std::endl;
     Tensor<UnifiedCiphertext> out_ct = HECompute(weight_pt, ac_ct);  // out_ct.shape = {co}
-    // std::cout << "out_ct generated: " << out_ct(0).location() << std::endl;
-
-    
-    Tensor<uint64_t> out_msg = Operator::HEToSS(out_ct, HE);  // out_msg.shape = {co, N}
-    // std::cout << "out_msg generated" << std::endl;
-    // out_msg.print_shape();
-    Tensor<uint64_t> y = DepackResult(out_msg);  // y.shape = {Co, H, W}
-    // std::cout << "y generated" << std::endl;
+    Tensor<uint64_t> out_msg = Operator::HEToSS(out_ct, HE, mask_offset());  // out_msg.shape = {co, N}, plus the bias
+    Tensor<uint64_t> y = DepackResult(out_msg);  // y.shape = {B * T * T * Co, h', h'}
+    if (spatial_tiles > 1) {
+        y = StitchTiles(y);  // {B * Co, H', W'}
+    }
+    unfold_batch(x, in_channels);
+    unfold_batch(y, out_channels);
     return y;
 };
 
@@ -0,0 +1,135 @@
+#include <LinearLayer/Conv.h>
+#include <algorithm>
+
+using namespace seal;
+using namespace HE;
+using namespace HE::unified;
+
+namespace LinearLayer {
+
+Conv2DPolyphase::Conv2DPolyphase(uint64_t in_feature_size, uint64_t stride, uint64_t padding, const Tensor<uint64_t>& weight, const Tensor<uint64_t>& bias, HEEvaluator* HE, CONV_TYPE conv_type, uint64_t batch_size)
+    : Conv2D(in_feature_size, stride, padding, weight, bias, HE, batch_size)
+{
+    compute_phases(conv_type);
+}
+
+Conv2DPolyphase::Conv2DPolyphase(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, HE::HEEvaluator* HE, CONV_TYPE conv_type, uint64_t batch_size)
+    : Conv2D(in_feature_size, in_channels, out_channels, kernel_size, stride, HE, batch_size)
+{
+    this->out_feature_size = (in_feature_size + 2 * padding - kernel_size) / stride + 1;
+    compute_phases(conv_type);
+}
+
+void Conv2DPolyphase::compute_phases(CONV_TYPE conv_type) {
+    this->conv_type = conv_type;
+    uint64_t offsets = std::min(stride, kernel_size);
+    phases.clear();
+    for (uint64_t u = 0; u < offsets; u++) {
+        for (uint64_t v = 0; v < offsets; v++) {
+            phases.emplace_back(u, v);
+        }
+    }
+    phase_feature_size = (in_feature_size + 2 * padding + stride - 1) / stride;
+    phase_kernel_size = (kernel_size + stride - 1) / stride;
+
+    Tensor<uint64_t> phase_weight = PhaseWeight();
+    Tensor<uint64_t> phase_bias = HE->server ? bias : Tensor<uint64_t>({out_channels});
+    if (conv_type == CONV_TYPE::Cheetah) {
+        inner = new Conv2DCheetah(phase_feature_size, 1, 0, phase_weight, phase_bias, HE, batch_size);
+    } else {
+        inner = new Conv2DNest(phase_feature_size, 1, 0, phase_weight, phase_bias, HE, batch_size);
+    }
+}
+
+Tensor<uint64_t> Conv2DPolyphase::PhaseWeight() const {
+    const uint64_t P = phases.size(), k = phase_kernel_size;
+    Tensor<uint64_t> phase_weight({out_channels, in_channels * P, k, k});
+    if (!HE->server) {
+        return phase_weight;
+    }
+    for (uint64_t o = 0; o < out_channels; o++) {
+        for (uint64_t c = 0; c < in_channels; c++) {
+            for (uint64_t p = 0; p < P; p++) {
+                const uint64_t u = phases[p].first, v = phases[p].second;
+                for (uint64_t a = 0; a < k && stride * a + u < kernel_size; a++) {
+                    for (uint64_t b = 0; b < k && stride * b + v < kernel_size; b++) {
+                        phase_weight({o, c * P + p, a, b}) = weight({o, c, stride * a + u, stride * b + v});
+                    }
+                }
+            }
+        }
+    }
+    return phase_weight;
+}
+
+Tensor<UnifiedPlaintext> Conv2DPolyphase::PackWeight() {
+    inner->weight = PhaseWeight();
+    inner->bias = bias;
+    inner->weight_pt = inner->PackWeight();
+    inner->bias_msg = inner->PackBias();
+    return Tensor<UnifiedPlaintext>();
+}
+
+Tensor<uint64_t> Conv2DPolyphase::PackActivation(Tensor<uint64_t> &x) {
+    const uint64_t P = phases.size(), h = phase_feature_size;
+    Tensor<uint64_t> phase_x({batch_in_channels() * P, h, h});
+    for (uint64_t c = 0; c < batch_in_channels(); c++) {
+        for (uint64_t p = 0; p < P; p++) {
+            const uint64_t u = phases[p].first, v = phases[p].second;
+            for (uint64_t i = 0; i < h; i++) {
+                // row of the padded map, zero in the padding and past its end
+                int64_t row = static_cast<int64_t>(stride * i + u) - static_cast<int64_t>(padding);
+                if (row < 0 || row >= static_cast<int64_t>(in_feature_size)) {
+                    continue;
+                }
+                for (uint64_t j = 0; j < h; j++) {
+                    int64_t col = static_cast<int64_t>(stride * j + v) - static_cast<int64_t>(padding);
+                    if (col >= 0 && col < static_cast<int64_t>(in_feature_size)) {
+                        phase_x({c * P + p, i, j}) = x({c, static_cast<size_t>(row), static_cast<size_t>(col)});
+                    }
+                }
+            }
+        }
+    }
+    return phase_x;
+}
+
+Tensor<UnifiedCiphertext> Conv2DPolyphase::HECompute(const Tensor<UnifiedPlaintext> &weight_pt, Tensor<UnifiedCiphertext> &ac_ct) {
+    return inner->HECompute(inner->weight_pt, ac_ct);
+}
+
+Tensor<uint64_t> Conv2DPolyphase::DepackResult(Tensor<uint64_t> &out) {
+    // the inner layer computes ceil((H + 2p) / s) - ceil(k / s) + 1 >= out_feature_size rows
+    const uint64_t h = out.shape()[1];
+    if (h == out_feature_size) {
+        return out;
+    }
+    Tensor<uint64_t> y({batch_out_channels(), out_feature_size, out_feature_size});
+    for (uint64_t o = 0; o < batch_out_channels(); o++) {
+        for (uint64_t i = 0; i < out_feature_size; i++) {
+            for (uint64_t j = 0; j < out_feature_size; j++) {
+                y({o, i, j}) = out({o, i, j});
+            }
+        }
+    }
+    return y;
+}
+
+Tensor<uint64_t> Conv2DPolyphase::operator()(Tensor<uint64_t> &x) {  // x.shape = {Ci, H, W}, or {B, Ci, H, W} when batched
+    fold_batch(x, in_channels);
+    if (this->in_feature_size != x.shape()[1]) {
+        cout << "in_feature_size:" << this->in_feature_size << endl;
+        cout << "wrong input feature size" << endl;
+        exit(1);
+    }
+    Tensor<uint64_t> phase_x = PackActivation(x);  // {B * Ci * P, H', H'}
+    unfold_batch(phase_x, in_channels * phases.size());
+    Tensor<uint64_t> out = (*inner)(phase_x);
+    fold_batch(out, out_channels);
+    Tensor<uint64_t> y = DepackResult(out);  // y.shape = {B * Co, Ho, Wo}
+    unfold_batch(x, in_channels);
+    unfold_batch(y, out_channels);
+    return y;
+}
+
+} // namespace LinearLayer
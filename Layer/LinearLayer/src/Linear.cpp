@@ -1,4 +1,5 @@
 #include <LinearLayer/Linear.h>
+#include <algorithm>
 #include <cassert>
 #include <hexl/hexl.hpp>
 
@@ -61,6 +62,7 @@ LinearBolt::LinearBolt(uint64_t dim_0, const Tensor<uint64_t>& weight, const Ten
 
     if (HE->server) {
         weight_pt = PackWeight();
+        bias_msg = PackBias();
     }
 }
 
@@ -88,11 +90,13 @@ LinearBolt::LinearBolt(uint64_t dim_0, uint64_t dim_1, uint64_t dim_2, HE::HEEva
 
     if (HE->server) {
         weight_pt = PackWeight();
+        bias_msg = PackBias();
     }
 }
 
 Tensor<UnifiedPlaintext> LinearBolt::PackWeight() {
     Tensor<UnifiedPlaintext> weight_pt({tiled_dim_1, tiled_dim_2, tile_size}, HE->Backend());
+    zero_weight_pt.assign(tiled_dim_1 * tiled_dim_2 * tile_size, false);
 
     for (uint64_t i = 0; i < tiled_dim_1; i++) {
         for (uint64_t j = 0; j < tiled_dim_2; j++) {
@@ -105,14 +109,13 @@ Tensor<UnifiedPlaintext> LinearBolt::PackWeight() {
                     tmp_vec[l + HE->polyModulusDegree / 2] = padded_weight({idx_0, j * tile_size + idx_1});
                 }
                 
-                bool zero_flag = 1;
-                for (uint64_t l = 0; l < HE->polyModulusDegree; l++) {
-                    zero_flag = zero_flag && (tmp_vec[l] == 0);
+                // all-zero diagonals are skipped in HECompute, their product would be a transparent ciphertext
+                bool zero_flag = std::all_of(tmp_vec.begin(), tmp_vec.end(), [](uint64_t v) { return v == 0; });
+                zero_weight_pt[(i * tiled_dim_2 + j) * tile_size + k] = zero_flag;
+                if (!zero_flag) {
+                    HE->encoder->encode(tmp_vec, weight_pt({i, j, k}));
+                    HE->PlainToNTT(weight_pt({i, j, k}));
                 }
-                if (zero_flag) {
-                    tmp_vec[HE->polyModulusDegree - 1] = 1; // set unused slots to non-zero values to avoid transparent ciphertext error
-                }
-                HE->encoder->encode(tmp_vec, weight_pt({i, j, k}));
             }
         }
     }
@@ -144,59 +147,11 @@ Tensor<UnifiedCiphertext> LinearBolt::HECompute(const Tensor<UnifiedPlaintext> &
      *  Server computes on HE->Backend()
      *  Client does nothing
      */
-    const auto target = HE->server ? HE->Backend() : HOST;
-    Tensor<UnifiedCiphertext> out_ct({tiled_dim_2}, HE->GenerateZeroCiphertext(target));
-
     if (HE->server) {
-        Tensor<UnifiedCiphertext> ac_rot_ct({input_rot, tiled_dim_1}, HE->GenerateZeroCiphertext(target));
-        Tensor<UnifiedCiphertext> int_ct({tiled_dim_2, tile_size}, HE->GenerateZeroCiphertext(target));
-        UnifiedGaloisKeys* keys = HE->galoisKeys;
-
-        // First complete the input rotation
-        for (uint64_t i = 0; i < input_rot; i++) {
-            for (uint64_t j = 0; j < tiled_dim_1; j++) {
-                if (i) {
-                    HE->evaluator->rotate_rows(ac_rot_ct({i - 1, j}), padded_dim_0 / 2, *keys, ac_rot_ct({i, j}));
-                    
-                }
-                else {
-                    ac_rot_ct({i, j}) = ac_ct(j);
-                }
-            }
-        }
-        // Complete all the multiplication, and reduce along the input channel dimension
-        for (uint64_t i = 0; i < tiled_dim_1; i++) {
-            for (uint64_t j = 0; j < tiled_dim_2; j++) {
-                for (uint64_t k = 0; k < tile_size; k++) {
-                    UnifiedCiphertext tmp_ct(target);
-                    HE->evaluator->multiply_plain(ac_rot_ct({input_rot - 1 - k % input_rot, i}), weight_pt({i, j, k}), tmp_ct);
-                    if (i) {
-                        HE->evaluator->add_inplace(int_ct({j, k}), tmp_ct);
-                    }
-                    else {
-                        int_ct({j, k}) = tmp_ct;
-                    }
-                }
-            }
-        }
-        for (uint64_t i = 0; i < tiled_dim_2; i++) {
-            // Reduce along the input rotation dimension, since it has been completed
-            for (uint64_t j = 0; j < tile_size; j++) {
-                if (j % input_rot) {
-                    HE->evaluator->add_inplace(int_ct({i, j - j % input_rot}), int_ct({i, j}));
-                }
-            }
-            out_ct(i) = int_ct({i, 0});
-            // Complete output rotation to reduce along this dimension
-            for (uint64_t j = input_rot; j < tile_size; j += input_rot) {
-                HE->evaluator->rotate_rows(out_ct(i), padded_dim_0 * input_rot / 2, *keys, out_ct(i));
-                
-                HE->evaluator->add_inplace(out_ct(i), int_ct({i, j}));
-            }
-        }
+        // a baby step moves the diagonal by one block of padded_dim_0 / 2 slots
+        return SparseBSGS(tiled_dim_1, tiled_dim_2, tile_size, zero_weight_pt)(HE, weight_pt, ac_ct, input_rot, padded_dim_0 / 2);
     }
-
-    return out_ct;
+    return Tensor<UnifiedCiphertext>({tiled_dim_2}, HE->GenerateZeroCiphertext(HOST));
 }
 
 Tensor<uint64_t> LinearBolt::DepackResult(Tensor<uint64_t> &out_msg) {
@@ -219,6 +174,28 @@ Tensor<uint64_t> LinearBolt::DepackResult(Tensor<uint64_t> &out_msg) {
     return y;
 }
 
+// The bias at every output slot DepackResult reads.
+Tensor<uint64_t> LinearBolt::PackBias() {
+    if (bias.size() == 0) {
+        return Tensor<uint64_t>();
+    }
+    Tensor<uint64_t> bias_msg({tiled_dim_2, HE->polyModulusDegree});
+    for (uint64_t i = 0; i < tiled_dim_2; i++) {
+        for (uint64_t j = 0; j < HE->polyModulusDegree; j++) {
+            uint64_t idx = i * tile_size + ((tile_size - j / (padded_dim_0 / 2) % tile_size) % tile_size);
+            if (idx < dim_2) {
+                if (j < HE->polyModulusDegree / 2) {
+                    bias_msg({i, j}) = bias_at(j % (padded_dim_0 / 2), idx) % HE->plain_mod;
+                }
+                else if (j % (padded_dim_0 / 2) + padded_dim_0 / 2 < dim_0) {
+                    bias_msg({i, j}) = bias_at(j % (padded_dim_0 / 2) + padded_dim_0 / 2, idx) % HE->plain_mod;
+                }
+            }
+        }
+    }
+    return bias_msg;
+}
+
 Tensor<uint64_t> LinearBolt::operator()(Tensor<uint64_t> &x) {
     // std::cout << "MatmulCtptBolt operator called" << std::endl;
     Tensor<uint64_t> ac_msg = PackActivation(x);
@@ -226,7 +203,7 @@ Tensor<uint64_t> LinearBolt::operator()(Tensor<uint64_t> &x) {
     Tensor<UnifiedCiphertext> ac_ct = Operator::SSToHE(ac_msg, HE);
     // std::cout << "ac_ct generated" << std::endl;
     Tensor<UnifiedCiphertext> out_ct = HECompute(weight_pt, ac_ct);
-    Tensor<uint64_t> out_msg = Operator::HEToSS(out_ct, HE);
+    Tensor<uint64_t> out_msg = Operator::HEToSS(out_ct, HE, mask_offset());
     // std::cout << "out_msg generated" << std::endl;
     Tensor<uint64_t> y = DepackResult(out_msg);
     // std::cout << "y generated" << std::endl;
@@ -240,6 +217,7 @@ LinearNest::LinearNest(uint64_t dim_0, const Tensor<uint64_t>& weight, const Ten
     compute_he_params();
     if (HE->server) {
         weight_pt = PackWeight();
+        bias_msg = PackBias();
     }
 }
 
@@ -249,6 +227,7 @@ LinearNest::LinearNest(uint64_t dim_0, uint64_t dim_1, uint64_t dim_2, HE::HEEva
     compute_he_params();
     if (HE->server) {
         weight_pt = PackWeight();
+        bias_msg = PackBias();
     }
 }
 
@@ -299,6 +278,7 @@ Tensor<UnifiedPlaintext> LinearNest::PackWeight() {
     // NTT size is padded_dim_0, similar to padded_feature_size^2 in Conv2DNest
     intel::hexl::NTT ntt(padded_dim_0, HE->plain_mod);
     Tensor<UnifiedPlaintext> weight_pt({tiled_dim_1, tiled_dim_2, tile_size}, HE->Backend());
+    zero_weight_pt.assign(tiled_dim_1 * tiled_dim_2 * tile_size, false);
 
     for (uint64_t i = 0; i < tiled_dim_1; i++) {
         for (uint64_t j = 0; j < tiled_dim_2; j++) {
@@ -337,14 +317,13 @@ Tensor<UnifiedPlaintext> LinearNest::PackWeight() {
                     }
                 }
 
-                bool zero_flag = 1;
-                for (uint64_t l = 0; l < HE->polyModulusDegree; l++) {
-                    zero_flag = zero_flag && (tmp_vec[l] == 0);
-                }
-                if (zero_flag) {
-                    tmp_vec[HE->polyModulusDegree - 1] = 1;
+                // all-zero diagonals are skipped in HECompute, their product would be a transparent ciphertext
+                bool zero_flag = std::all_of(tmp_vec.begin(), tmp_vec.end(), [](uint64_t v) { return v == 0; });
+                zero_weight_pt[(i * tiled_dim_2 + j) * tile_size + k] = zero_flag;
+                if (!zero_flag) {
+                    HE->encoder->encode(tmp_vec, weight_pt({i, j, k}));
+                    HE->PlainToNTT(weight_pt({i, j, k}));
                 }
-                HE->encoder->encode(tmp_vec, weight_pt({i, j, k}));
             }
         }
     }
@@ -404,69 +383,9 @@ Tensor<UnifiedCiphertext> LinearNest::HECompute(const Tensor<UnifiedPlaintext> &
 
     if (!HE->server) return out_ct;
     
-    UnifiedGaloisKeys* keys = HE->galoisKeys;
-    
-    if (tile_size == 1) {
-        // Simple case: no BSGS, just multiply and accumulate
-        for (uint64_t j = 0; j < tiled_dim_2; j++) {
-            bool first = true;
-            for (uint64_t i = 0; i < tiled_dim_1; i++) {
-                UnifiedCiphertext tmp_ct(target);
-                HE->evaluator->multiply_plain(ac_ct(i), weight_pt({i, j, 0}), tmp_ct);
-                if (first) {
-                    out_ct(j) = tmp_ct;
-                    first = false;
-                } else {
-                    HE->evaluator->add_inplace(out_ct(j), tmp_ct);
-                }
-            }
-        }
-    } else {
-        // Full BSGS
-        Tensor<UnifiedCiphertext> ac_rot_ct({input_rot, tiled_dim_1}, HE->GenerateZeroCiphertext(target));
-        Tensor<UnifiedCiphertext> int_ct({tiled_dim_2, tile_size}, HE->GenerateZeroCiphertext(target));
-
-        // First, complete the input rotation (rotate by padded_dim_0 for each block)
-        for (uint64_t i = 0; i < input_rot; i++) {
-            for (uint64_t j = 0; j < tiled_dim_1; j++) {
-                if (i) {
-                    HE->evaluator->rotate_rows(ac_rot_ct({i - 1, j}), padded_dim_0, *keys, ac_rot_ct({i, j}));
-                }
-                else {
-                    ac_rot_ct({i, j}) = ac_ct(j);
-                }
-            }
-        }
-        // Then, complete all the multiplication, and reduce along the input channel dimension
-        for (uint64_t i = 0; i < tiled_dim_1; i++) {
-            for (uint64_t j = 0; j < tiled_dim_2; j++) {
-                for (uint64_t k = 0; k < tile_size; k++) {
-                    UnifiedCiphertext tmp_ct(target);
-                    HE->evaluator->multiply_plain(ac_rot_ct({input_rot - 1 - k % input_rot, i}), weight_pt({i, j, k}), tmp_ct);
-                    if (i) {
-                        HE->evaluator->add_inplace(int_ct({j, k}), tmp_ct);
-                    }
-                    else {
-                        int_ct({j, k}) = tmp_ct;
-                    }
-                }
-            }
-        }
-        for (uint64_t i = 0; i < tiled_dim_2; i++) {
-            // Reduce along the input rotation dimension, since it has been completed
-            for (uint64_t j = 0; j < tile_size; j++) {
-                if (j % input_rot) {
-                    HE->evaluator->add_inplace(int_ct({i, j - j % input_rot}), int_ct({i, j}));
-                }
-            }
-            out_ct(i) = int_ct({i, 0});
-            // Complete output rotation to reduce along this dimension
-            for (uint64_t j = input_rot; j < tile_size; j += input_rot) {
-                HE->evaluator->rotate_rows(out_ct(i), padded_dim_0 * input_rot, *keys, out_ct(i));
-                HE->evaluator->add_inplace(out_ct(i), int_ct({i, j}));
-            }
-        }
-    }
+    // Rotating by blocks of padded_dim_0 slots; with tile_size == 1 there are no rotations, only the
+    // dot product of each output over the input ciphertexts.
+    out_ct = SparseBSGS(tiled_dim_1, tiled_dim_2, tile_size, zero_weight_pt)(HE, weight_pt, ac_ct, tile_size == 1 ? 1 : input_rot, padded_dim_0);
 
     return out_ct;
 }
@@ -512,12 +431,34 @@ Tensor<uint64_t> LinearNest::DepackResult(Tensor<uint64_t> &out_msg) {
     return y;
 }
 
+// The bias at every output slot DepackResult reads, then NTT per block.
+Tensor<uint64_t> LinearNest::PackBias() {
+    if (bias.size() == 0) {
+        return Tensor<uint64_t>();
+    }
+    Tensor<uint64_t> bias_msg({tiled_dim_2, HE->polyModulusDegree});
+    for (uint64_t i = 0; i < dim_2; i++) {
+        uint64_t tile_idx = i / tile_size;
+        uint64_t slot_in_tile = tile_size == 1 ? 0 : (tile_size - i % tile_size) % tile_size;
+        for (uint64_t b = 0; b < dim_0; b++) {
+            bias_msg({tile_idx, slot_in_tile * padded_dim_0 + b}) = bias_at(b, i) % HE->plain_mod;
+        }
+    }
+    intel::hexl::NTT ntt(padded_dim_0, HE->plain_mod);
+    for (uint64_t i = 0; i < tiled_dim_2; i++) {
+        for (uint64_t j = 0; j < 2 * tile_size; j++) {
+            ntt.ComputeForward(&bias_msg({i, j * padded_dim_0}), &bias_msg({i, j * padded_dim_0}), 1, 1);
+        }
+    }
+    return bias_msg;
+}
+
 Tensor<uint64_t> LinearNest::operator()(Tensor<uint64_t> &x) {
     // std::cout << "MatmulCtptNest operator called" << std::endl;
     Tensor<uint64_t> ac_msg = PackActivation(x);
     Tensor<UnifiedCiphertext> ac_ct = Operator::SSToHE(ac_msg, HE);
     Tensor<UnifiedCiphertext> out_ct = HECompute(weight_pt, ac_ct);
-    Tensor<uint64_t> out_msg = Operator::HEToSS(out_ct, HE);
+    Tensor<uint64_t> out_msg = Operator::HEToSS(out_ct, HE, mask_offset());
     Tensor<uint64_t> y = DepackResult(out_msg);
 
     return y;
@@ -0,0 +1,216 @@
+#include <Datatype/Tensor.h>
+#include <NonlinearOperator/FixPoint.h>
+#include <LinearOperator/Polynomial.h>
+#include <cmath>
+#pragma once
+using namespace Datatype;
+using namespace LinearOperator;
+using namespace NonlinearOperator;
+
+namespace NonlinearLayer{
+
+// Fixed-point arithmetic on secret shares shared by Softmax / LayerNorm / RMSNorm.
+// All inputs and outputs are shares in Z_{2^bitwidth} with `scale` fractional bits.
+// Every helper works on flat tensors so that callers can batch all rows (and all heads)
+// into a single protocol call.
+template <typename T>
+class FixArith {
+    public:
+      int bitwidth;
+      int scale;
+      int party;
+      // exp(x) = (1 + x/2^exp_iters)^(2^exp_iters), values below -exp_clip are set to 0
+      int exp_iters = 6;
+      double exp_clip = 16.0;
+      int recip_iters = 10;
+      int rsqrt_iters = 3;
+
+      FixArith(FixPoint<T> *fixPoint, HE::HEEvaluator* HE, int bitwidth, int scale){
+        this->fixPoint = fixPoint;
+        this->HE = HE;
+        this->bitwidth = bitwidth;
+        this->scale = scale;
+        this->party = fixPoint->party;
+      }
+
+      T ToFix(double v) const {
+        return static_cast<T>(llround(v * static_cast<double>(1ULL << scale)));
+      }
+
+      // x + c, only ALICE adds the constant
+      void AddConst(Tensor<T> &x, double c){
+        if (party != ALICE){
+          return;
+        }
+        T c_fix = ToFix(c);
+        for (size_t i = 0; i < x.size(); i++){
+          x(i) += c_fix;
+        }
+      }
+
+      // c - x
+      void RSubConst(Tensor<T> &x, double c){
+        for (size_t i = 0; i < x.size(); i++){
+          x(i) = -x(i);
+        }
+        AddConst(x, c);
+      }
+
+      // x * y for two shared tensors of the same size. Both operands go through a single
+      // Ring2Field call, the product is computed with ElementWiseMul and brought back to
+      // the ring with one Field2Ring + truncate_reduce.
+      Tensor<T> Mul(Tensor<T> &x, Tensor<T> &y){
+        if (x.size() != y.size()){
+          throw std::invalid_argument("x and y must have the same size in FixArith::Mul");
+        }
+        size_t n = x.size();
+        size_t N = HE->polyModulusDegree;
+        size_t padded = (n + N - 1) / N * N;
+        bool square = (&x == &y);
+        Tensor<T> xy({square ? padded : 2 * padded});
+        for (size_t i = 0; i < n; i++){
+          xy(i) = x(i);
+          if (!square){
+            xy(padded + i) = y(i);
+          }
+        }
+        fixPoint->Ring2Field(xy, HE->plain_mod, bitwidth);
+        Tensor<T> prod;
+        if (square){
+          prod = ElementWiseMul(xy, xy, HE);
+        } else {
+          Tensor<T> a({padded}), b({padded});
+          std::copy(xy.data().begin(), xy.data().begin() + padded, a.data().begin());
+          std::copy(xy.data().begin() + padded, xy.data().end(), b.data().begin());
+          prod = ElementWiseMul(a, b, HE);
+        }
+        fixPoint->Field2Ring(prod, HE->plain_mod, bitwidth + scale);
+        fixPoint->truncate_reduce(prod, scale, bitwidth + scale);
+        Tensor<T> out(x.shape());
+        std::copy(prod.data().begin(), prod.data().begin() + n, out.data().begin());
+        return out;
+      }
+
+      // c * x for a public constant c. x is extended to bitwidth+scale first so that the
+      // product of the share with c_fix does not wrap before truncation.
+      Tensor<T> MulConst(Tensor<T> &x, double c){
+        Tensor<T> y = x;
+        auto shape = y.shape();
+        y.reshape({y.size()});
+        fixPoint->extend(y, bitwidth, bitwidth + scale);
+        T c_fix = ToFix(c);
+        for (size_t i = 0; i < y.size(); i++){
+          y(i) *= c_fix;
+        }
+        fixPoint->truncate_reduce(y, scale, bitwidth + scale);
+        y.reshape(shape);
+        return y;
+      }
+
+      // mean over the last dimension of a (rows, cols) tensor, returns shape {rows}.
+      // The sum is taken locally in Z_{2^{bitwidth+scale}} so it cannot wrap, then scaled by 1/cols.
+      Tensor<T> RowMean(Tensor<T> &x, size_t rows, size_t cols){
+        Tensor<T> ext = x;
+        ext.reshape({rows * cols});
+        fixPoint->extend(ext, bitwidth, bitwidth + scale);
+        Tensor<T> mean({rows});
+        T inv_cols = ToFix(1.0 / static_cast<double>(cols));
+        for (size_t r = 0; r < rows; r++){
+          T acc = 0;
+          for (size_t j = 0; j < cols; j++){
+            acc += ext(r * cols + j);
+          }
+          mean(r) = acc * inv_cols;
+        }
+        fixPoint->truncate_reduce(mean, scale, bitwidth + scale);
+        return mean;
+      }
+
+      // local row sum, no communication
+      Tensor<T> RowSum(Tensor<T> &x, size_t rows, size_t cols){
+        Tensor<T> sum({rows});
+        for (size_t r = 0; r < rows; r++){
+          for (size_t j = 0; j < cols; j++){
+            sum(r) += x(r * cols + j);
+          }
+        }
+        return sum;
+      }
+
+      // repeat v(r) cols times, returns shape {rows * cols}
+      Tensor<T> Broadcast(Tensor<T> &v, size_t rows, size_t cols){
+        Tensor<T> out({rows * cols});
+        for (size_t r = 0; r < rows; r++){
+          for (size_t j = 0; j < cols; j++){
+            out(r * cols + j) = v(r);
+          }
+        }
+        return out;
+      }
+
+      // exp(x) for x <= 0
+      Tensor<T> Exp(Tensor<T> &x){
+        Tensor<uint8_t> keep(x.shape());
+        fixPoint->less_than_constant(x, -ToFix(exp_clip), keep, bitwidth);
+        if (party == ALICE){
+          for (size_t i = 0; i < keep.size(); i++){
+            keep(i) ^= 1;
+          }
+        }
+        Tensor<T> e = x;
+        fixPoint->truncate(e, exp_iters, bitwidth);
+        AddConst(e, 1.0);
+        for (int i = 0; i < exp_iters; i++){
+          e = Mul(e, e);
+        }
+        fixPoint->mux(keep, e, e, bitwidth, bitwidth);
+        e.reshape(x.shape());
+        return e;
+      }
+
+      // 1/d for d in [1, ~600], Newton iteration y <- y(2 - dy) from y0 = 3exp(0.5 - d) + 0.003
+      Tensor<T> Reciprocal(Tensor<T> &d){
+        Tensor<T> t = d;
+        RSubConst(t, 0.5);
+        Tensor<T> y = Exp(t);
+        for (size_t i = 0; i < y.size(); i++){
+          y(i) *= 3;
+        }
+        AddConst(y, 0.003);
+        for (int k = 0; k < recip_iters; k++){
+          Tensor<T> dy = Mul(d, y);
+          RSubConst(dy, 2.0);
+          y = Mul(y, dy);
+        }
+        return y;
+      }
+
+      // 1/sqrt(v) for v > 0, Newton iteration y <- y(3 - vy^2)/2 from
+      // y0 = 2.2exp(-(v/2 + 0.2)) + 0.2 - v/1024
+      Tensor<T> InvSqrt(Tensor<T> &v){
+        Tensor<T> half_v = v;
+        fixPoint->truncate(half_v, 1, bitwidth);
+        Tensor<T> t = half_v;
+        RSubConst(t, -0.2);
+        Tensor<T> e = Exp(t);
+        Tensor<T> y = MulConst(e, 2.2);
+        Tensor<T> v_1024 = v;
+        fixPoint->truncate(v_1024, 10, bitwidth);
+        y = y - v_1024;
+        AddConst(y, 0.2);
+        for (int k = 0; k < rsqrt_iters; k++){
+          Tensor<T> y2 = Mul(y, y);
+          Tensor<T> vy2 = Mul(v, y2);
+          RSubConst(vy2, 3.0);
+          y = Mul(y, vy2);
+          fixPoint->truncate(y, 1, bitwidth);
+        }
+        return y;
+      }
+
+    private:
+      NonlinearOperator::FixPoint<T> *fixPoint;
+      HE::HEEvaluator* HE;
+};
+
+}
@@ -0,0 +1,104 @@
+#include <Datatype/Tensor.h>
+#include "../../../Layer/Module.h"
+#include <NonlinearLayer/FixArith.h>
+#pragma once
+using namespace Datatype;
+using namespace NonlinearOperator;
+
+namespace NonlinearLayer{
+
+// gamma / beta are the server's parameters of length cols at `scale`. They are treated as shares
+// (server holds the values, client holds zeros), so both parties must pass them or both pass nullptr.
+template <typename T>
+void ApplyAffine(FixArith<T> &arith, Tensor<T> &y, size_t rows, size_t cols, Tensor<T> *gamma, Tensor<T> *beta){
+  if (gamma != nullptr){
+    Tensor<T> gamma_b = arith.Broadcast(*gamma, rows, cols);
+    y = arith.Mul(y, gamma_b);
+  }
+  if (beta != nullptr){
+    for (size_t r = 0; r < rows; r++){
+      for (size_t j = 0; j < cols; j++){
+        y(r * cols + j) += (*beta)(j);
+      }
+    }
+  }
+}
+
+// LayerNorm over the last dimension: (x - mean) / sqrt(var + eps) * gamma + beta
+// mean and var are reduced locally on the shares (RowMean), only 1/sqrt and the products are interactive.
+template <typename T, typename IO=Utils::NetIO>
+class LayerNorm : public Module{
+    public:
+      int bitwidth;
+      int scale;
+      int party;
+      double eps;
+
+      LayerNorm(FixPoint<T> *fixPoint, HE::HEEvaluator* HE, int bitwidth, int scale, double eps = 1e-5)
+        : arith(fixPoint, HE, bitwidth, scale){
+        this->bitwidth = bitwidth;
+        this->scale = scale;
+        this->party = fixPoint->party;
+        this->eps = eps;
+      }
+
+      void operator()(Tensor<T> &x, Tensor<T> *gamma = nullptr, Tensor<T> *beta = nullptr){
+        auto shape = x.shape();
+        size_t cols = shape.back();
+        size_t rows = x.size() / cols;
+        x.reshape({rows * cols});
+
+        Tensor<T> mean = arith.RowMean(x, rows, cols);
+        Tensor<T> xc = x - arith.Broadcast(mean, rows, cols);
+        Tensor<T> xc2 = arith.Mul(xc, xc);
+        Tensor<T> var = arith.RowMean(xc2, rows, cols);
+        arith.AddConst(var, eps);
+        Tensor<T> inv = arith.InvSqrt(var);
+        Tensor<T> inv_b = arith.Broadcast(inv, rows, cols);
+        x = arith.Mul(xc, inv_b);
+
+        ApplyAffine(arith, x, rows, cols, gamma, beta);
+        x.reshape(shape);
+      }
+
+      FixArith<T> arith;
+};
+
+// RMSNorm over the last dimension: x / sqrt(mean(x^2) + eps) * gamma
+template <typename T, typename IO=Utils::NetIO>
+class RMSNorm : public Module{
+    public:
+      int bitwidth;
+      int scale;
+      int party;
+      double eps;
+
+      RMSNorm(FixPoint<T> *fixPoint, HE::HEEvaluator* HE, int bitwidth, int scale, double eps = 1e-6)
+        : arith(fixPoint, HE, bitwidth, scale){
+        this->bitwidth = bitwidth;
+        this->scale = scale;
+        this->party = fixPoint->party;
+        this->eps = eps;
+      }
+
+      void operator()(Tensor<T> &x, Tensor<T> *gamma = nullptr){
+        auto shape = x.shape();
+        size_t cols = shape.back();
+        size_t rows = x.size() / cols;
+        x.reshape({rows * cols});
+
+        Tensor<T> x2 = arith.Mul(x, x);
+        Tensor<T> ms = arith.RowMean(x2, rows, cols);
+        arith.AddConst(ms, eps);
+        Tensor<T> inv = arith.InvSqrt(ms);
+        Tensor<T> inv_b = arith.Broadcast(inv, rows, cols);
+        x = arith.Mul(x, inv_b);
+
+        ApplyAffine<T>(arith, x, rows, cols, gamma, nullptr);
+        x.reshape(shape);
+      }
+
+      FixArith<T> arith;
+};
+
+}
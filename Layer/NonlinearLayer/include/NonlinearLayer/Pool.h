@@ -1,16 +1,28 @@
 #include <Datatype/Tensor.h>
+#include "../../../Layer/Module.h"
+#include <NonlinearOperator/FixPoint.h>
+#pragma once
 
 using namespace Datatype;
+using namespace NonlinearOperator;
 using namespace std;
 namespace NonlinearLayer {
 
+// Average pooling on (C, H, W) or batched (B, C, H, W) shares. Window sums are local integer additions, which are exact on
+// ring shares, so pooling itself sends nothing. The 1/k^2 is applied in one of two ways:
+//  - fixPoint == nullptr: operator() returns the window sums and the caller folds 1/divisor()
+//    into the next layer (see Conv2D::fold_scale);
+//  - otherwise the sums are divided with a single batched truncate (exact shift when k^2 is a power
+//    of two, else extend by shift bits, multiply by round(2^shift / k^2) and truncate by shift).
 template<typename T>
-class AvgPool2D{
+class AvgPool2D : public Module{
     public:
         uint64_t kernel_size;
         uint64_t stride;
         uint64_t padding;
-        AvgPool2D(uint64_t kernel_size, uint64_t stride = -1, uint64_t padding = 0){
+        int bitwidth = 0;
+        int shift = 12;
+        AvgPool2D(uint64_t kernel_size, uint64_t stride = -1, uint64_t padding = 0, FixPoint<T> *fixPoint = nullptr, int bitwidth = 0, int shift = 12){
             this->kernel_size = kernel_size;
             if (stride == -1){
                 this->stride = kernel_size;
@@ -18,42 +30,213 @@ class AvgPool2D{
                 this->stride = stride;
             }
             this->padding = padding;
+            this->fixPoint = fixPoint;
+            this->bitwidth = bitwidth;
+            this->shift = shift;
         }
-        // we do not support batch size > 1 for now
+
+        uint64_t divisor() const {
+            return kernel_size * kernel_size;
+        }
+
         Tensor<T> operator()(Tensor<T> &x){
-            uint32_t C,H,W,Hout,Wout;
             std::vector<size_t> shape = x.shape();
-            C = shape[0];
-            H = shape[1];
-            W = shape[2];
-            // cout << "C,H,W: " << C << "," << H << "," << W << endl;
-            Hout = (H - kernel_size + 2 * padding) / stride + 1;
-            Wout = (W - kernel_size + 2 * padding) / stride + 1;
-            Tensor<T> y({C,Hout,Wout});
-            // implement a avg pool below!
-            for (uint32_t c = 0; c < C; c++){
-                for (uint32_t h = 0; h < Hout; h++){
-                    for (uint32_t w = 0; w < Wout; w++){
-                            // Initialize sum for averaging
-                            float sum = 0;
-                            // Sum all values in the pooling window
-                        for (uint32_t ph = 0; ph < kernel_size; ph++) {
-                            for (uint32_t pw = 0; pw < kernel_size; pw++) {
-                                sum += x({c,h*stride + ph,w*stride + pw});
-                            }
+            uint64_t C = planes(shape);
+            uint64_t H = shape[shape.size() - 2];
+            uint64_t W = shape[shape.size() - 1];
+            uint64_t Hp = H + 2 * padding;
+            uint64_t Wp = W + 2 * padding;
+            uint64_t Hout = (Hp - kernel_size) / stride + 1;
+            uint64_t Wout = (Wp - kernel_size) / stride + 1;
+
+            // zero padding keeps count_include_pad semantics (always divide by k^2)
+            std::vector<T> padded;
+            const T *src = x.data().data();
+            if (padding > 0){
+                padded.assign(C * Hp * Wp, T(0));
+                for (uint64_t c = 0; c < C; c++){
+                    for (uint64_t h = 0; h < H; h++){
+                        std::copy(src + (c * H + h) * W, src + (c * H + h + 1) * W, padded.data() + (c * Hp + h + padding) * Wp + padding);
+                    }
+                }
+                src = padded.data();
+            }
+
+            // separable window sum: horizontal pass into hsum(c, h, ow), then vertical pass into y.
+            // Inner loops run over contiguous output columns so the compiler can vectorize them.
+            std::vector<T> hsum(C * Hp * Wout, T(0));
+            for (uint64_t ch = 0; ch < C * Hp; ch++){
+                const T *row = src + ch * Wp;
+                T *acc = hsum.data() + ch * Wout;
+                for (uint64_t pw = 0; pw < kernel_size; pw++){
+                    for (uint64_t ow = 0; ow < Wout; ow++){
+                        acc[ow] += row[ow * stride + pw];
+                    }
+                }
+            }
+            Tensor<T> y(pooled_shape(shape, Hout, Wout));
+            T *dst = y.data().data();
+            for (uint64_t c = 0; c < C; c++){
+                for (uint64_t oh = 0; oh < Hout; oh++){
+                    T *out = dst + (c * Hout + oh) * Wout;
+                    for (uint64_t ph = 0; ph < kernel_size; ph++){
+                        const T *acc = hsum.data() + (c * Hp + oh * stride + ph) * Wout;
+                        for (uint64_t ow = 0; ow < Wout; ow++){
+                            out[ow] += acc[ow];
                         }
-                        // Compute average by dividing by window size
-                        y({c,h,w}) = sum / (kernel_size * kernel_size);
                     }
                 }
             }
+
+            if (fixPoint != nullptr){
+                divide(y);
+            }
+            return y;
+        }
+
+    protected:
+        NonlinearOperator::FixPoint<T> *fixPoint = nullptr;
+
+        // all dimensions in front of (H, W), i.e. channels times images for a batch
+        static uint64_t planes(const std::vector<size_t> &shape){
+            uint64_t n = 1;
+            for (size_t i = 0; i + 2 < shape.size(); i++){
+                n *= shape[i];
+            }
+            return n;
+        }
+
+        static std::vector<size_t> pooled_shape(std::vector<size_t> shape, uint64_t Hout, uint64_t Wout){
+            shape[shape.size() - 2] = Hout;
+            shape[shape.size() - 1] = Wout;
+            return shape;
+        }
+
+        void divide(Tensor<T> &y){
+            uint64_t d = divisor();
+            if ((d & (d - 1)) == 0){
+                int log_d = 0;
+                while ((1ULL << log_d) < d){
+                    log_d++;
+                }
+                fixPoint->truncate(y, log_d, bitwidth);
+                return;
+            }
+            // like FixArith::MulConst: extend by shift bits first so the product with inv_d cannot wrap
+            T inv_d = static_cast<T>(llround(static_cast<double>(1ULL << shift) / static_cast<double>(d)));
+            auto shape = y.shape();
+            y.reshape({y.size()});
+            fixPoint->extend(y, bitwidth, bitwidth + shift);
+            for (size_t i = 0; i < y.size(); i++){
+                y(i) *= inv_d;
+            }
+            fixPoint->truncate_reduce(y, shift, bitwidth + shift);
+            y.reshape(shape);
+        }
+};
+
+// Global average pooling, (C, H, W) -> (C, 1, 1), batched (B, C, H, W) -> (B, C, 1, 1).
+// In the fused path (no FixPoint) only the per-channel sums are produced and 1/divisor() is folded
+// into the weights of the following Linear/1x1 conv, so the pooling costs no communication.
+template<typename T>
+class GlobalAvgPool : public AvgPool2D<T>{
+    public:
+        GlobalAvgPool(uint64_t feature_size, FixPoint<T> *fixPoint = nullptr, int bitwidth = 0, int shift = 12)
+            : AvgPool2D<T>(feature_size, feature_size, 0, fixPoint, bitwidth, shift){
+        }
+
+        Tensor<T> operator()(Tensor<T> &x){
+            std::vector<size_t> shape = x.shape();
+            uint64_t C = this->planes(shape);
+            uint64_t HW = shape[shape.size() - 2] * shape[shape.size() - 1];
+            const T *src = x.data().data();
+            Tensor<T> y(this->pooled_shape(shape, 1, 1));
+            for (uint64_t c = 0; c < C; c++){
+                T acc = 0;
+                const T *plane = src + c * HW;
+                for (uint64_t i = 0; i < HW; i++){
+                    acc += plane[i];
+                }
+                y(c) = acc;
+            }
+            if (this->fixPoint != nullptr){
+                this->divide(y);
+            }
             return y;
         }
 };
 
+// Secure max pooling on (C, H, W) or batched (B, C, H, W) shares.
+// Every output window is written as one column of a (k*k, C*Hout*Wout) candidate matrix, so the max
+// runs as ceil(log2(k*k)) rounds of batched less_than + mux (FixPoint::max_2d) over all windows and
+// channels at once. Padded positions hold -2^{bw-2} so they never win against a valid input.
+template<typename T>
+class MaxPool2D : public Module{
+    public:
+        uint64_t kernel_size;
+        uint64_t stride;
+        uint64_t padding;
+        int bitwidth;
+        int party;
+        MaxPool2D(FixPoint<T> *fixPoint, int bitwidth, uint64_t kernel_size, uint64_t stride = -1, uint64_t padding = 0){
+            this->fixPoint = fixPoint;
+            this->bitwidth = bitwidth;
+            this->party = fixPoint->party;
+            this->kernel_size = kernel_size;
+            if (stride == -1){
+                this->stride = kernel_size;
+            } else {
+                this->stride = stride;
+            }
+            this->padding = padding;
+        }
+
+        Tensor<T> operator()(Tensor<T> &x){
+            std::vector<size_t> shape = x.shape();
+            uint64_t C = 1;
+            for (size_t i = 0; i + 2 < shape.size(); i++){
+                C *= shape[i];
+            }
+            uint64_t H = shape[shape.size() - 2];
+            uint64_t W = shape[shape.size() - 1];
+            uint64_t Hout = (H + 2 * padding - kernel_size) / stride + 1;
+            uint64_t Wout = (W + 2 * padding - kernel_size) / stride + 1;
+            uint64_t num_out = C * Hout * Wout;
+            uint64_t window = kernel_size * kernel_size;
+            T pad_value = (party == ALICE) ? static_cast<T>(-(int64_t(1) << (bitwidth - 2))) : T(0);
 
+            // candidates(p, o) = x[c, oh*stride + ph - padding, ow*stride + pw - padding], p = ph*k + pw
+            Tensor<T> candidates({window, num_out});
+            const T *src = x.data().data();
+            T *dst = candidates.data().data();
+            for (uint64_t ph = 0; ph < kernel_size; ph++){
+                for (uint64_t pw = 0; pw < kernel_size; pw++){
+                    T *row = dst + (ph * kernel_size + pw) * num_out;
+                    for (uint64_t c = 0; c < C; c++){
+                        const T *plane = src + c * H * W;
+                        for (uint64_t oh = 0; oh < Hout; oh++){
+                            int64_t ih = int64_t(oh * stride + ph) - int64_t(padding);
+                            T *out = row + (c * Hout + oh) * Wout;
+                            for (uint64_t ow = 0; ow < Wout; ow++){
+                                int64_t iw = int64_t(ow * stride + pw) - int64_t(padding);
+                                bool inside = ih >= 0 && ih < int64_t(H) && iw >= 0 && iw < int64_t(W);
+                                out[ow] = inside ? plane[ih * W + iw] : pad_value;
+                            }
+                        }
+                    }
+                }
+            }
 
+            Tensor<T> y;
+            fixPoint->max_2d(candidates, y, 0, bitwidth);
+            shape[shape.size() - 2] = Hout;
+            shape[shape.size() - 1] = Wout;
+            y.reshape(shape);
+            return y;
+        }
 
+    private:
+        NonlinearOperator::FixPoint<T> *fixPoint;
+};
 
 }
-
@@ -2,6 +2,8 @@
 #include "../../../Layer/Module.h"
 #include <OTProtocol/aux-protocols.h>
 #include <OTProtocol/millionaire.h>
+#include <Utils/session.h>
+#include <Utils/profiler.h>
 #pragma once
 using namespace Datatype;
 using namespace Utils;
@@ -81,7 +83,17 @@ class ReLU : public Module{
         this->reluProtocol = reluprotocol;
       }
 
+      // the ReLU bound to the calling thread's client session, or this
+      ReLU *Session() {
+        return Utils::SessionBinding<ReLU>::Resolve(this);
+      }
+
       void operator()(Tensor<T> &x){
+        if (ReLU *session = Session(); session != this) {
+          (*session)(x);
+          return;
+        }
+        Utils::ProfileScope scope("ReLU", "operator");
         int dim = x.size();
         T* x_flatten = x.data().data();
         std::thread relu_threads[num_threads];
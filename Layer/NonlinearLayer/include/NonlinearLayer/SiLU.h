@@ -35,11 +35,11 @@ class SiLU : public Module{
       }
       void check_share(const Tensor<T> &x, uint64_t mod, const string &name){
         if (party == ALICE){
-          HE->IO->send_tensor(x);
+          HE->Session()->IO->send_tensor(x);
           return;
         }
         Tensor<T> peer_share(x.shape());
-        HE->IO->recv_tensor(peer_share);
+        HE->Session()->IO->recv_tensor(peer_share);
         if (mod == 0){
           cout << "check " << name << " skipped (mod is zero)" << endl;
           return;
@@ -0,0 +1,59 @@
+#include <Datatype/Tensor.h>
+#include "../../../Layer/Module.h"
+#include <NonlinearLayer/FixArith.h>
+#pragma once
+using namespace Datatype;
+using namespace NonlinearOperator;
+
+namespace NonlinearLayer{
+
+// Softmax over the last dimension, x can be (cols), (rows, cols) or (heads, rows, cols).
+// softmax(x) = exp(x - max) / sum(exp(x - max))
+// All rows of all heads are processed together: one max tree, one Exp, one Reciprocal and one Mul.
+// The row sum is kept in Z_{2^bitwidth}, so bitwidth must cover log2(cols) + scale + 1 bits.
+template <typename T, typename IO=Utils::NetIO>
+class Softmax : public Module{
+    public:
+      int bitwidth;
+      int scale;
+      int party;
+
+      Softmax(FixPoint<T> *fixPoint, HE::HEEvaluator* HE, int bitwidth, int scale)
+        : arith(fixPoint, HE, bitwidth, scale){
+        this->fixPoint = fixPoint;
+        this->bitwidth = bitwidth;
+        this->scale = scale;
+        this->HE = HE;
+        this->party = fixPoint->party;
+      }
+
+      void operator()(Tensor<T> &x){
+        auto shape = x.shape();
+        size_t cols = shape.back();
+        size_t rows = x.size() / cols;
+
+        x.reshape({rows, cols});
+        Tensor<T> row_max;
+        fixPoint->max_2d(x, row_max, 1, bitwidth, scale);
+        x.reshape({rows * cols});
+
+        // x - max <= 0, computed locally on shares
+        Tensor<T> z = x - arith.Broadcast(row_max, rows, cols);
+        Tensor<T> e = arith.Exp(z);
+
+        // every row contains exp(0) = 1, so the sum is in [1, cols]
+        Tensor<T> sum = arith.RowSum(e, rows, cols);
+        Tensor<T> inv = arith.Reciprocal(sum);
+        Tensor<T> inv_b = arith.Broadcast(inv, rows, cols);
+        x = arith.Mul(e, inv_b);
+        x.reshape(shape);
+      }
+
+      FixArith<T> arith;
+
+    private:
+      NonlinearOperator::FixPoint<T> *fixPoint;
+      HE::HEEvaluator* HE;
+};
+
+}
@@ -0,0 +1,251 @@
+#pragma once
+#include <Model/Primitive.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace Model{
+
+struct BatchStats{
+    uint64_t requests = 0;
+    uint64_t batches = 0;
+    size_t queued = 0;          // requests waiting right now
+    double mean_fill = 0;       // mean batch size / max_batch
+    double mean_queue_ms = 0;   // submit -> start of its batch
+    double max_queue_ms = 0;
+    double mean_batch_ms = 0;   // one batched forward pass
+};
+
+// One network per batch size 1..max_batch, for the prebuilt BatchScheduler constructor. The caller
+// owns the result.
+template <typename Net>
+std::map<uint64_t, Net *> BuildBatchNets(const std::function<Net *(uint64_t batch_size)> &build, size_t max_batch){
+    std::map<uint64_t, Net *> nets;
+    for (uint64_t b = 1; b <= max_batch; b++) {
+        nets[b] = build(b);
+    }
+    return nets;
+}
+
+// Dynamic batching of the inference requests of one client. Concurrent Submit() calls are queued;
+// a batch is closed when it holds max_batch requests or when its oldest request has waited
+// max_wait, then runs as a single forward pass of a network built for that batch size (see the
+// batch_size of the ResNet builders), so the whole batch shares the HE ciphertexts of every conv
+// and the OT instances of every ReLU/truncation. The results are split back per request.
+//
+// Requests from different clients never share a batch, since their shares live under different
+// keys and channels. The client (BOB) owns the queue and announces every batch size on channel 0;
+// the server (ALICE) mirrors it with Serve(). Networks are built lazily by `build` for every batch
+// size that occurs, on the thread that runs them, and kept for reuse. A multi-client server instead
+// hands every session the same networks, built once with BuildBatchNets over its shared primitive;
+// those are borrowed, the sessions only bring their keys and channels.
+template <typename T, typename Net, typename IO=Utils::NetIO>
+class BatchScheduler{
+    public:
+        using Builder = std::function<Net *(uint64_t batch_size)>;
+        using Clock = std::chrono::steady_clock;
+
+        size_t max_batch;
+        std::chrono::microseconds max_wait;
+
+        // input_shape: shape of one request, e.g. {3, 32, 32}
+        BatchScheduler(CryptoPrimitive<T, IO> *primitive, Builder build, std::vector<size_t> input_shape,
+                       size_t max_batch = 8, std::chrono::microseconds max_wait = std::chrono::milliseconds(5))
+          : max_batch(max_batch), max_wait(max_wait), primitive(primitive), build(build), input_shape(input_shape){
+            if (primitive->party == BOB) {
+                dispatcher = std::thread([this](){ Dispatch(); });
+            }
+        }
+
+        // Prebuilt networks for every batch size 1..max_batch, not owned by the scheduler.
+        BatchScheduler(CryptoPrimitive<T, IO> *primitive, const std::map<uint64_t, Net *> &prebuilt, std::vector<size_t> input_shape,
+                       size_t max_batch = 8, std::chrono::microseconds max_wait = std::chrono::milliseconds(5))
+          : BatchScheduler(primitive, Builder(), input_shape, max_batch, max_wait){
+            nets = prebuilt;
+            owns_nets = false;
+        }
+
+        // Client: runs the queued requests, then tells the server to leave Serve().
+        ~BatchScheduler(){
+            if (dispatcher.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    stopping = true;
+                }
+                cv.notify_all();
+                dispatcher.join();
+            }
+            for (auto &m : nets) {
+                if (owns_nets) {
+                    delete m.second;
+                }
+            }
+        }
+
+        // Client: queue one input share, the future yields its output share.
+        std::future<Tensor<T>> Submit(Tensor<T> input){
+            Request request{std::move(input), std::promise<Tensor<T>>(), Clock::now()};
+            std::future<Tensor<T>> result = request.result.get_future();
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                queue.push_back(std::move(request));
+            }
+            cv.notify_all();
+            return result;
+        }
+
+        // Server: run the batches the client announces until its scheduler is destroyed. The server's
+        // input shares are zero; `on_batch` receives its output shares, shaped {B, ...} when B > 1.
+        void Serve(std::function<void(Tensor<T> &, uint64_t)> on_batch = nullptr){
+            while (true) {
+                uint64_t batch_size = 0;
+                primitive->get_channel()->recv_data(&batch_size, sizeof(uint64_t));
+                if (batch_size == 0) {
+                    break;
+                }
+                Tensor<T> x(BatchShape(batch_size), 0);
+                auto start = Clock::now();
+                Tensor<T> y = (*Network(batch_size))(x);
+                Record(batch_size, {}, start);
+                if (on_batch) {
+                    on_batch(y, batch_size);
+                }
+            }
+        }
+
+        BatchStats Stats(){
+            std::lock_guard<std::mutex> lock(mtx);
+            BatchStats s = stats;
+            s.queued = queue.size();
+            if (s.batches) {
+                s.mean_fill /= s.batches;
+                s.mean_batch_ms /= s.batches;
+            }
+            if (s.requests) {
+                s.mean_queue_ms /= s.requests;
+            }
+            return s;
+        }
+
+    private:
+        struct Request{
+            Tensor<T> input;
+            std::promise<Tensor<T>> result;
+            Clock::time_point enqueued;
+        };
+
+        CryptoPrimitive<T, IO> *primitive;
+        Builder build;
+        std::vector<size_t> input_shape;
+        std::map<uint64_t, Net *> nets;
+        bool owns_nets = true;
+        std::thread dispatcher;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<Request> queue;
+        bool stopping = false;
+        // running sums, normalized in Stats()
+        BatchStats stats;
+
+        Net *Network(uint64_t batch_size){
+            auto it = nets.find(batch_size);
+            if (it == nets.end()) {
+                if (!build) {
+                    throw std::out_of_range("BatchScheduler: no network for batch size " + std::to_string(batch_size));
+                }
+                it = nets.emplace(batch_size, build(batch_size)).first;
+            }
+            return it->second;
+        }
+
+        // a single request keeps the unbatched layout, the layers only fold {B, C, H, W}
+        std::vector<size_t> BatchShape(uint64_t batch_size){
+            std::vector<size_t> shape = input_shape;
+            if (batch_size > 1) {
+                shape.insert(shape.begin(), batch_size);
+            }
+            return shape;
+        }
+
+        void Record(uint64_t batch_size, const std::vector<Clock::time_point> &enqueued, Clock::time_point start){
+            auto ms = [](Clock::duration d){ return std::chrono::duration<double, std::milli>(d).count(); };
+            double batch_ms = ms(Clock::now() - start);
+            std::lock_guard<std::mutex> lock(mtx);
+            stats.batches++;
+            stats.mean_fill += static_cast<double>(batch_size) / max_batch;
+            stats.mean_batch_ms += batch_ms;
+            stats.requests += primitive->party == BOB ? enqueued.size() : batch_size;
+            for (auto t : enqueued) {
+                stats.mean_queue_ms += ms(start - t);
+                stats.max_queue_ms = std::max(stats.max_queue_ms, ms(start - t));
+            }
+        }
+
+        void Dispatch(){
+            while (true) {
+                std::vector<Request> batch;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    cv.wait(lock, [this](){ return stopping || !queue.empty(); });
+                    if (queue.empty()) {
+                        break;
+                    }
+                    auto deadline = queue.front().enqueued + max_wait;
+                    cv.wait_until(lock, deadline, [this](){ return stopping || queue.size() >= max_batch; });
+                    size_t n = std::min(max_batch, queue.size());
+                    for (size_t i = 0; i < n; i++) {
+                        batch.push_back(std::move(queue.front()));
+                        queue.pop_front();
+                    }
+                }
+                Run(batch);
+            }
+            uint64_t stop = 0;
+            primitive->get_channel()->send_data(&stop, sizeof(uint64_t));
+            primitive->get_channel()->flush();
+        }
+
+        void Run(std::vector<Request> &batch){
+            uint64_t batch_size = batch.size();
+            std::vector<Clock::time_point> enqueued;
+            Tensor<T> x(BatchShape(batch_size));
+            size_t per_input = x.size() / batch_size;
+            for (size_t i = 0; i < batch_size; i++) {
+                std::copy(batch[i].input.data().begin(), batch[i].input.data().end(), x.data().begin() + i * per_input);
+                enqueued.push_back(batch[i].enqueued);
+            }
+            auto start = Clock::now();
+            Tensor<T> y;
+            try {
+                primitive->get_channel()->send_data(&batch_size, sizeof(uint64_t));
+                primitive->get_channel()->flush();
+                y = (*Network(batch_size))(x);
+            } catch (...) {
+                for (auto &request : batch) {
+                    request.result.set_exception(std::current_exception());
+                }
+                return;
+            }
+            Record(batch_size, enqueued, start);
+            std::vector<size_t> out_shape = y.shape();
+            if (batch_size > 1) {
+                out_shape.erase(out_shape.begin());
+            }
+            size_t per_output = y.size() / batch_size;
+            for (size_t i = 0; i < batch_size; i++) {
+                Tensor<T> out(out_shape);
+                std::copy(y.data().begin() + i * per_output, y.data().begin() + (i + 1) * per_output, out.data().begin());
+                batch[i].result.set_value(std::move(out));
+            }
+        }
+};
+
+}
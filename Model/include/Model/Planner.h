@@ -0,0 +1,433 @@
+#pragma once
+#include <HE/HE.h>
+#include <HE/unified/EvalTelemetry.h>
+#include <Utils/net_io_channel.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Model{
+
+enum class LayerProtocol { ConvNest = 0, ConvCheetah, CirConv, LinearBolt, LinearNest, CirLinearNest, PolyConvNest, PolyConvCheetah, NumProtocols };
+
+inline const char *LayerProtocolName(LayerProtocol p){
+    static const char *names[] = {"ConvNest", "ConvCheetah", "CirConv", "LinearBolt", "LinearNest", "CirLinearNest", "PolyConvNest", "PolyConvCheetah"};
+    return names[static_cast<int>(p)];
+}
+
+// bandwidth in Mbit/s, round-trip time in ms
+struct NetworkProfile{
+    double bandwidth_mbps = 1000;
+    double rtt_ms = 0.5;
+
+    static NetworkProfile LAN(){ return {3000, 0.3}; }
+    static NetworkProfile WAN(){ return {200, 40}; }
+};
+
+// One conv layer as CreateConv sees it. block_size > 1 marks a block-circulant layer.
+struct ConvShape{
+    uint64_t in_feature_size;
+    uint64_t in_channels;
+    uint64_t out_channels;
+    uint64_t kernel_size;
+    uint64_t stride = 1;
+    uint64_t padding = 0;
+    uint64_t block_size = 1;
+    uint64_t batch_size = 1;
+
+    std::string Key() const{
+        std::ostringstream os;
+        os << "conv " << in_feature_size << " " << in_channels << " " << out_channels << " " << kernel_size << " "
+           << stride << " " << padding << " " << block_size << " " << batch_size;
+        return os.str();
+    }
+};
+
+// {dim_0, dim_1} x {dim_1, dim_2}, as in LinearLayer::Linear
+struct LinearShape{
+    uint64_t dim_0;
+    uint64_t dim_1;
+    uint64_t dim_2;
+    uint64_t block_size = 1;
+
+    std::string Key() const{
+        std::ostringstream os;
+        os << "linear " << dim_0 << " " << dim_1 << " " << dim_2 << " " << block_size;
+        return os.str();
+    }
+};
+
+struct LayerCost{
+    LayerProtocol protocol;
+    HE::unified::EvalCounts ops;  // server-side evaluator operations
+    uint64_t ct_up = 0;           // ciphertexts client -> server (SSToHE)
+    uint64_t ct_down = 0;         // ciphertexts server -> client (HEToSS)
+    uint64_t bytes = 0;
+    uint64_t rounds = 0;
+    double compute_ms = 0;
+    double comm_ms = 0;
+    double total_ms() const{ return compute_ms + comm_ms; }
+};
+
+// Chooses the HE protocol of every linear layer from an estimate of its cost: the evaluator
+// operations of each candidate packing (rotations, multiply_plain, additions) priced by an
+// EvalCostModel, plus the ciphertexts it moves and its rounds priced by a NetworkProfile. The
+// operation counts mirror the packing parameters the layers compute in their constructors.
+//
+// Candidates: conv layers choose between Conv2DNest, Conv2DCheetah and CirConv2D with block size 1
+// (a dense layer), strided ones also between Conv2DNest and Conv2DCheetah run by Conv2DPolyphase;
+// block-circulant layers (block_size > 1) only run on CirConv2D. Linear layers
+// choose between LinearBolt and LinearNest, block-circulant ones use CirLinearNest.
+//
+// Plans are cached per layer shape (thread-safe, models may be built concurrently) and can be saved
+// next to the model. Both parties must build the same plan: the server Share()s its cost model and
+// its cached plans with the client before any layer is built, so only the server loads or saves a
+// plan file.
+class ProtocolPlanner{
+    public:
+        uint64_t N;
+        uint64_t L;           // ciphertext primes
+        uint64_t ct_bytes;    // serialized size of one fresh ciphertext
+        NetworkProfile net;
+        HE::unified::EvalCostModel cost;
+
+        ProtocolPlanner(uint64_t N, uint64_t L, NetworkProfile net = NetworkProfile())
+          : N(N), L(L), ct_bytes(2 * N * L * sizeof(uint64_t)), net(net), cost(HE::unified::EvalCostModel::Default(N, L)){}
+
+        explicit ProtocolPlanner(HE::HEEvaluator *HE, NetworkProfile net = NetworkProfile())
+          : ProtocolPlanner(HE->polyModulusDegree, HE->context->hcontext().first_context_data()->parms().coeff_modulus().size(), net){}
+
+        std::vector<LayerCost> Candidates(const ConvShape &s) const{
+            std::vector<LayerCost> out;
+            LayerCost c;
+            if (s.block_size == 1) {
+                if (ConvNestCost(s, c)) out.push_back(c);
+                if (ConvCheetahCost(s, c)) out.push_back(c);
+                if (s.stride > 1) {
+                    ConvShape poly = PolyphaseShape(s);
+                    if (ConvNestCost(poly, c)) {
+                        c.protocol = LayerProtocol::PolyConvNest;
+                        out.push_back(c);
+                    }
+                    if (ConvCheetahCost(poly, c)) {
+                        c.protocol = LayerProtocol::PolyConvCheetah;
+                        out.push_back(c);
+                    }
+                }
+            }
+            if (CirConvCost(s, c)) out.push_back(c);
+            return out;
+        }
+
+        std::vector<LayerCost> Candidates(const LinearShape &s) const{
+            std::vector<LayerCost> out;
+            LayerCost c;
+            if (s.block_size == 1) {
+                if (LinearBoltCost(s, c)) out.push_back(c);
+                if (LinearNestCost(s, c)) out.push_back(c);
+            } else if (CirLinearNestCost(s, c)) {
+                out.push_back(c);
+            }
+            return out;
+        }
+
+        LayerProtocol Plan(const ConvShape &s){ return PlanCached(s.Key(), Candidates(s)); }
+        LayerProtocol Plan(const LinearShape &s){ return PlanCached(s.Key(), Candidates(s)); }
+
+        std::map<std::string, LayerProtocol> Plans(){
+            std::lock_guard<std::mutex> lock(mtx);
+            return plans;
+        }
+
+        // One-time microbenchmark of the evaluator (server): replaces the analytic per-op costs of
+        // rotations, multiply_plain and additions with measured ones.
+        void Calibrate(HE::HEEvaluator *HE, int reps = 8){
+            using namespace HE::unified;
+            using Clock = std::chrono::steady_clock;
+            UnifiedCiphertext ct = HE->GenerateZeroCiphertext(HE->Backend());
+            UnifiedCiphertext tmp = HE->GenerateZeroCiphertext(HE->Backend());
+            UnifiedPlaintext pt(HOST);
+            HE->encoder->encode(std::vector<uint64_t>(N, 1), pt);
+            if (HE->Backend() == DEVICE) {
+                pt.to_device(*HE->context);
+            }
+            UnifiedGaloisKeys *keys = HE->Session()->galoisKeys;
+            EvalCounts measured;
+            auto time = [&](EvalOp op, auto &&run) {
+                run();  // warm-up
+                auto start = Clock::now();
+                for (int i = 0; i < reps; i++) {
+                    run();
+                }
+                measured.count[static_cast<int>(op)] = reps;
+                measured.ms[static_cast<int>(op)] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            };
+            if (keys != nullptr) {
+                time(EvalOp::RotateRows, [&] { HE->evaluator->rotate_rows(ct, 1, *keys, tmp); });
+            }
+            time(EvalOp::MultiplyPlain, [&] { HE->evaluator->multiply_plain(ct, pt, tmp); });
+            time(EvalOp::Add, [&] { HE->evaluator->add_inplace(tmp, ct); });
+            std::lock_guard<std::mutex> lock(mtx);
+            cost.Calibrate(measured);
+            plans.clear();
+        }
+
+        // Server sends its cost model, network profile and cached plans (e.g. Load()ed from its
+        // plan file); the client adopts them in place of its own, so that both sides plan the same
+        // protocols.
+        void Share(Utils::NetIO *io, bool server){
+            if (server) {
+                std::string text = Serialize();
+                uint64_t len = text.size();
+                io->send_data(cost.ms_per_op.data(), sizeof(double) * cost.ms_per_op.size());
+                io->send_data(&net, sizeof(NetworkProfile));
+                io->send_data(&len, sizeof(uint64_t));
+                io->send_data(text.data(), len);
+                io->flush();
+            } else {
+                uint64_t len = 0;
+                io->recv_data(cost.ms_per_op.data(), sizeof(double) * cost.ms_per_op.size());
+                io->recv_data(&net, sizeof(NetworkProfile));
+                io->recv_data(&len, sizeof(uint64_t));
+                std::string text(len, '\0');
+                io->recv_data(&text[0], len);
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    plans.clear();
+                }
+                Parse(text, "server plan");
+            }
+        }
+
+        // Plans are keyed by N and the layer shape, one "N | key | protocol" per line.
+        void Save(const std::string &path){
+            std::ofstream(path) << Serialize();
+        }
+
+        // Returns false when the file does not exist. Plans for another N are ignored.
+        bool Load(const std::string &path){
+            std::ifstream is(path);
+            if (!is) {
+                return false;
+            }
+            std::stringstream text;
+            text << is.rdbuf();
+            Parse(text.str(), path);
+            return true;
+        }
+
+    private:
+        std::mutex mtx;
+        std::map<std::string, LayerProtocol> plans;
+
+        std::string Serialize(){
+            std::lock_guard<std::mutex> lock(mtx);
+            std::ostringstream os;
+            for (auto &p : plans) {
+                os << N << " | " << p.first << " | " << static_cast<int>(p.second) << "\n";
+            }
+            return os.str();
+        }
+
+        void Parse(const std::string &text, const std::string &source){
+            std::lock_guard<std::mutex> lock(mtx);
+            std::istringstream is(text);
+            std::string line;
+            while (std::getline(is, line)) {
+                size_t a = line.find(" | "), b = line.rfind(" | ");
+                if (a == std::string::npos || a == b) {
+                    throw std::runtime_error("Malformed plan file: " + source);
+                }
+                if (std::stoull(line.substr(0, a)) != N) {
+                    continue;
+                }
+                plans[line.substr(a + 3, b - a - 3)] = static_cast<LayerProtocol>(std::stoi(line.substr(b + 3)));
+            }
+        }
+
+        static uint64_t DivUpper(uint64_t a, uint64_t b){ return (a + b - 1) / b; }
+
+        static uint64_t NextPow2(uint64_t x){
+            uint64_t p = 1;
+            while (p < x) {
+                p <<= 1;
+            }
+            return p;
+        }
+
+        static uint64_t CeilSqrt(uint64_t x){
+            uint64_t r = 1;
+            while (r * r < x) {
+                r++;
+            }
+            return r;
+        }
+
+        LayerProtocol PlanCached(const std::string &key, const std::vector<LayerCost> &candidates){
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = plans.find(key);
+            if (it != plans.end()) {
+                return it->second;
+            }
+            if (candidates.empty()) {
+                throw std::invalid_argument("No HE protocol fits layer " + key + " at N = " + std::to_string(N));
+            }
+            auto best = std::min_element(candidates.begin(), candidates.end(),
+                                         [](const LayerCost &a, const LayerCost &b) { return a.total_ms() < b.total_ms(); });
+            plans[key] = best->protocol;
+            return best->protocol;
+        }
+
+        // Every protocol is one SSToHE and one HEToSS: a single round trip.
+        void Price(LayerCost &c, uint64_t rot, uint64_t mult, uint64_t add, uint64_t up, uint64_t down) const{
+            using HE::unified::EvalOp;
+            c.ops = HE::unified::EvalCounts();
+            c.ops.count[static_cast<int>(EvalOp::RotateRows)] = rot;
+            c.ops.count[static_cast<int>(EvalOp::MultiplyPlain)] = mult;
+            c.ops.count[static_cast<int>(EvalOp::Add)] = add;
+            c.ct_up = up;
+            c.ct_down = down;
+            c.bytes = (up + down) * ct_bytes;
+            c.rounds = 1;
+            c.compute_ms = cost.Predict(c.ops);
+            c.comm_ms = c.bytes * 8.0 / (net.bandwidth_mbps * 1e3) + c.rounds * net.rtt_ms;
+        }
+
+        // Baby-step giant-step over `tile` diagonals of `ti` input and `to` output ciphertexts,
+        // with input_rot baby steps (see Conv2DNest::HECompute).
+        void PriceBSGS(LayerCost &c, uint64_t tile, uint64_t input_rot, uint64_t ti, uint64_t to) const{
+            uint64_t giant = DivUpper(tile, input_rot);
+            uint64_t rot = (input_rot - 1) * ti + to * (giant - 1);
+            uint64_t mult = ti * to * tile;
+            Price(c, rot, mult, mult + to * tile, ti, to);
+        }
+
+        // The stride-1 layer Conv2DPolyphase runs on: min(s, k)^2 phases per input channel.
+        static ConvShape PolyphaseShape(const ConvShape &s){
+            uint64_t offsets = std::min(s.stride, s.kernel_size);
+            return {DivUpper(s.in_feature_size + 2 * s.padding, s.stride), s.in_channels * offsets * offsets, s.out_channels,
+                    DivUpper(s.kernel_size, s.stride), 1, 0, 1, s.batch_size};
+        }
+
+        // Compact rows, and spatial tiles when the map does not fit (see Conv2DNest::compute_he_params).
+        bool ConvNestCost(const ConvShape &s, LayerCost &c) const{
+            auto block_len = [](uint64_t rows) { return NextPow2(rows * rows); };
+            const uint64_t half_slots = N / 2;
+            uint64_t out = (s.in_feature_size + 2 * s.padding - s.kernel_size) / s.stride + 1;
+            uint64_t len = block_len(s.in_feature_size + 2 * s.padding), images = s.batch_size;
+            if (len > half_slots) {
+                uint64_t best = std::numeric_limits<uint64_t>::max();
+                for (uint64_t t = 1; t <= out; t++) {
+                    uint64_t l = block_len((t - 1) * s.stride + s.kernel_size);
+                    if (l > half_slots) {
+                        break;
+                    }
+                    uint64_t tiles = DivUpper(out, t), n = s.batch_size * tiles * tiles, per_ct = half_slots / l;
+                    uint64_t cost = DivUpper(n * s.in_channels, per_ct) + DivUpper(n * s.out_channels / 2, per_ct);
+                    if (cost <= best) {
+                        best = cost;
+                        len = l;
+                        images = n;
+                    }
+                }
+                if (len > half_slots) {
+                    return false;
+                }
+            }
+            uint64_t tile = half_slots / len;
+            c.protocol = LayerProtocol::ConvNest;
+            uint64_t ti = DivUpper(images * s.in_channels, tile);
+            uint64_t to = DivUpper(images * s.out_channels / 2, tile);
+            uint64_t input_rot = 1;
+            while (4 * input_rot * input_rot <= tile) {
+                input_rot *= 2;
+            }
+            PriceBSGS(c, tile, input_rot, ti, to);
+            return true;
+        }
+
+        // Same window search as Conv2DCheetah::FindOptimalPartition; no rotations at all.
+        bool ConvCheetahCost(const ConvShape &s, LayerCost &c) const{
+            int64_t H = s.in_feature_size + 2 * s.padding, h = s.kernel_size;
+            int64_t C = s.batch_size * s.in_channels, M = s.batch_size * s.out_channels, n = N;
+            int64_t best = std::numeric_limits<int64_t>::max(), HW = 0, WW = 0;
+            for (int64_t hw = h; hw <= H; hw++) {
+                for (int64_t ww = h; ww <= H; ww++) {
+                    if (hw * ww > n) continue;
+                    int64_t cost = DivUpper(C, n / (hw * ww)) * DivUpper(H - h + 1, hw - h + 1) * DivUpper(H - h + 1, ww - h + 1);
+                    if (cost < best) {
+                        best = cost;
+                        HW = hw;
+                        WW = ww;
+                    }
+                }
+            }
+            if (HW == 0) {
+                return false;
+            }
+            c.protocol = LayerProtocol::ConvCheetah;
+            int64_t CW = std::min(C, n / (HW * WW));
+            int64_t MW = std::min(M, n / (CW * HW * WW));
+            uint64_t dM = DivUpper(M, MW), dC = DivUpper(C, CW);
+            uint64_t dH = DivUpper(H - h + 1, HW - h + 1), dW = DivUpper(H - h + 1, WW - h + 1);
+            uint64_t mult = dM * dC * dH * dW;
+            Price(c, 0, mult, mult, dC * dH * dW, dM * dH * dW);
+            return true;
+        }
+
+        bool CirConvCost(const ConvShape &s, LayerCost &c) const{
+            uint64_t P = NextPow2(s.in_feature_size + 2 * s.padding);
+            uint64_t ntt = s.block_size * P * P;
+            if (2 * ntt > N || s.in_channels % s.block_size || s.out_channels % s.block_size) {
+                return false;
+            }
+            c.protocol = LayerProtocol::CirConv;
+            uint64_t tile = N / (2 * ntt);
+            uint64_t ti = DivUpper(s.batch_size * s.in_channels / s.block_size, tile);
+            uint64_t to = DivUpper(s.batch_size * s.out_channels / s.block_size, tile);
+            PriceBSGS(c, tile, CeilSqrt(tile), ti, to);
+            return true;
+        }
+
+        bool LinearBoltCost(const LinearShape &s, LayerCost &c) const{
+            uint64_t tile = N / NextPow2(s.dim_0);
+            if (tile == 0) {
+                return false;
+            }
+            c.protocol = LayerProtocol::LinearBolt;
+            PriceBSGS(c, tile, std::sqrt(tile), DivUpper(s.dim_1, tile), DivUpper(s.dim_2, tile));
+            return true;
+        }
+
+        bool LinearNestCost(const LinearShape &s, LayerCost &c) const{
+            uint64_t tile = std::min(N / (2 * NextPow2(s.dim_0)), std::max(s.dim_1, s.dim_2));
+            if (tile == 0) {
+                return false;
+            }
+            c.protocol = LayerProtocol::LinearNest;
+            PriceBSGS(c, tile, CeilSqrt(tile), DivUpper(s.dim_1, tile), DivUpper(s.dim_2, tile));
+            return true;
+        }
+
+        bool CirLinearNestCost(const LinearShape &s, LayerCost &c) const{
+            uint64_t ntt = NextPow2(s.dim_0) * s.block_size;
+            if (2 * ntt > N || s.dim_1 % s.block_size || s.dim_2 % s.block_size) {
+                return false;
+            }
+            c.protocol = LayerProtocol::CirLinearNest;
+            uint64_t blocks_1 = s.dim_1 / s.block_size, blocks_2 = s.dim_2 / s.block_size;
+            uint64_t tile = std::min(N / (2 * ntt), std::max(blocks_1, blocks_2));
+            PriceBSGS(c, tile, CeilSqrt(tile), DivUpper(blocks_1, tile), DivUpper(blocks_2, tile));
+            return true;
+        }
+};
+
+}
@@ -2,6 +2,13 @@
 #include <HE/HE.h>
 #include <NonlinearLayer/ReLU.h>
 #include <NonlinearOperator/FixPoint.h>
+#include <Utils/session.h>
+#include <Utils/profiler.h>
+#include <Utils/seed.h>
+#include <Model/Planner.h>
+#include <exception>
+#include <future>
+#include <thread>
 using namespace NonlinearLayer;
 namespace Model{
 template <typename T, typename IO=Utils::NetIO>
@@ -13,6 +20,8 @@ class CryptoPrimitive{
         int32_t num_threads;
         int party;
         Datatype::CONV_TYPE conv_type = Datatype::CONV_TYPE::Nest;
+        // when set, CreateConv/CreateLinear pick each layer's protocol with it instead of conv_type
+        ProtocolPlanner *planner = nullptr;
         CryptoPrimitive(int party, HE::HEEvaluator* HE, Datatype::CONV_TYPE conv_type, NonlinearLayer::ReLU<T, IO>* relu, NonlinearOperator::FixPoint<T>* fixpoint, int32_t num_threads){
             this->HE = HE;
             this->relu = relu;
@@ -22,35 +31,125 @@ class CryptoPrimitive{
             this->conv_type = conv_type;
         }
 
-        CryptoPrimitive(int party, int32_t num_threads, int32_t bit_length, Datatype::OT_TYPE ot_type, int32_t polyModulusDegree, int32_t plainWidth, Datatype::CONV_TYPE conv_type,Datatype::LOCATION backend, string address, int port){
+        // `identity` (client only): file holding the client's HE keys across sessions, see HEEvaluator::UseIdentity.
+        CryptoPrimitive(int party, int32_t num_threads, int32_t bit_length, Datatype::OT_TYPE ot_type, int32_t polyModulusDegree, int32_t plainWidth, Datatype::CONV_TYPE conv_type,Datatype::LOCATION backend, string address, int port, const string &identity = ""){
             this->party = party;
             this->conv_type = conv_type;
             this->num_threads = num_threads;
             this->ioArr = new IO*[num_threads];
-            this->otpackArr = new OTPrimitive::OTPack<IO>*[num_threads];
-            this->reluprotocol = new NonlinearLayer::ReLUProtocol<T, IO>*[num_threads];
+            // every channel has its own port, accept/connect them all at once
+            std::vector<std::thread> connectors;
             for (int i = 0; i < num_threads; i++) {
-                // std::cout << "before, i = " << i << std::endl;
-                this->ioArr[i] = new IO(party == ALICE ? nullptr : address.c_str(), port + i + 1);
-                // std::cout << "i = " << i << std::endl;
-                // TODO: change to VOLE OT
-                if (ot_type == Datatype::VOLE) {
-                    this->otpackArr[i] = new VOLEOTPack<Utils::NetIO>(this->ioArr[i], party);
-                } else {
-                    this->otpackArr[i] = new IKNPOTPack<Utils::NetIO>(this->ioArr[i], party);
-                }
-                this->reluprotocol[i] = new NonlinearLayer::ReLURingProtocol<T, IO>(party, bit_length, MILL_PARAM, this->otpackArr[i], ot_type);
+                connectors.emplace_back([this, i, party, &address, port] {
+                    this->ioArr[i] = new IO(party == ALICE ? nullptr : address.c_str(), port + i + 1);
+                });
+            }
+            for (auto &t : connectors) {
+                t.join();
             }
-            this->relu = new NonlinearLayer::ReLU<T, IO>(reluprotocol, bit_length, num_threads);
-            cout << "begin to generate fixpoint" << endl;
-            this->fixpoint = new NonlinearOperator::FixPoint<T>(party, this->otpackArr, num_threads);
-            cout << "fixpoint generated" << endl;
             this->io = ioArr[0];
             this->HE = new HE::HEEvaluator(io, party, polyModulusDegree, plainWidth, backend);
-            this->HE->GenerateNewKey();
+            if (!identity.empty()){
+                this->HE->UseIdentity(identity);
+            }
+            SetupProtocols(bit_length, ot_type);
             // cout << "CryptoPrimitive constructor finished" << endl;
         }
 
+        // Same as above over channels that are already connected (num_threads of them).
+        CryptoPrimitive(int party, IO **ioArr, int32_t num_threads, int32_t bit_length, Datatype::OT_TYPE ot_type, int32_t polyModulusDegree, int32_t plainWidth, Datatype::CONV_TYPE conv_type, Datatype::LOCATION backend, const string &identity = ""){
+            this->party = party;
+            this->conv_type = conv_type;
+            this->num_threads = num_threads;
+            this->ioArr = ioArr;
+            this->io = ioArr[0];
+            this->HE = new HE::HEEvaluator(io, party, polyModulusDegree, plainWidth, backend);
+            if (!identity.empty()){
+                this->HE->UseIdentity(identity);
+            }
+            SetupProtocols(bit_length, ot_type);
+        }
+
+        // Server-side template for the multi-client runtime: only the HE context is built, there is no
+        // channel and no key. Models are constructed once with it (weights are packed here) and each
+        // client session below is bound over it.
+        CryptoPrimitive(int party, int32_t num_threads, int32_t bit_length, int32_t polyModulusDegree, int32_t plainWidth, Datatype::CONV_TYPE conv_type, Datatype::LOCATION backend){
+            this->party = party;
+            this->conv_type = conv_type;
+            this->num_threads = num_threads;
+            this->io = nullptr;
+            this->ioArr = nullptr;
+            this->otpackArr = nullptr;
+            this->reluprotocol = nullptr;
+            this->relu = new NonlinearLayer::ReLU<T, IO>(nullptr, bit_length, num_threads);
+            this->fixpoint = new NonlinearOperator::FixPoint<T>(nullptr, nullptr, num_threads);
+            this->fixpoint->party = party;
+            this->HE = new HE::HEEvaluator(nullptr, party, polyModulusDegree, plainWidth, backend);
+        }
+
+        // Per-client session of a shared primitive, used by the multi-client server. OT packs, ReLU,
+        // FixPoint and HE keys are fresh for the client on `ioArr`; the HE context, encoder and
+        // evaluator (and therefore every layer's packed weights) stay with `shared`.
+        // Call Bind() on the worker thread before running a model built with `shared`.
+        CryptoPrimitive(CryptoPrimitive *shared, IO **ioArr, int32_t bit_length, Datatype::OT_TYPE ot_type){
+            this->shared = shared;
+            this->party = shared->party;
+            this->conv_type = shared->conv_type;
+            this->planner = shared->planner;
+            this->num_threads = shared->num_threads;
+            this->ioArr = ioArr;
+            this->io = ioArr[0];
+            this->HE = new HE::HEEvaluator(shared->HE, io);
+            SetupProtocols(bit_length, ot_type);
+        }
+
+        ~CryptoPrimitive(){
+            if (shared == nullptr){
+                return;
+            }
+            Unbind();
+            HE->FreeKey();
+            delete HE;
+            delete relu;
+            delete fixpoint;
+            for (int i = 0; i < num_threads; i++) {
+                delete reluprotocol[i];
+                delete otpackArr[i];
+                delete ioArr[i];
+            }
+            delete[] reluprotocol;
+            delete[] otpackArr;
+            delete[] ioArr;
+        }
+
+        // Redirect the shared handles to this session on the calling thread.
+        void Bind(){
+            if (shared == nullptr){
+                return;
+            }
+            Utils::SessionBinding<HE::HEEvaluator>::Bind(shared->HE, HE);
+            Utils::SessionBinding<NonlinearLayer::ReLU<T, IO>>::Bind(shared->relu, relu);
+            Utils::SessionBinding<NonlinearOperator::FixPoint<T>>::Bind(shared->fixpoint, fixpoint);
+        }
+
+        void Unbind(){
+            if (shared == nullptr){
+                return;
+            }
+            Utils::SessionBinding<HE::HEEvaluator>::Unbind(shared->HE);
+            Utils::SessionBinding<NonlinearLayer::ReLU<T, IO>>::Unbind(shared->relu);
+            Utils::SessionBinding<NonlinearOperator::FixPoint<T>>::Unbind(shared->fixpoint);
+        }
+
+        // aggregate this primitive's channels into Utils::Profiler spans
+        void AttachProfiler(){
+            if (ioArr == nullptr){
+                return;
+            }
+            Utils::Profiler::Get().party = party;
+            Utils::Profiler::Get().AttachChannels(ioArr, num_threads);
+        }
+
         uint64_t get_total_comm(){
             uint64_t totalComm = 0;
             for (int i = 0; i < num_threads; i++) {
@@ -61,11 +160,63 @@ class CryptoPrimitive{
         uint64_t get_total_rounds(){
             return ioArr[0]->num_rounds;
         }
+        IO *get_channel(int i = 0){
+            return ioArr[i];
+        }
     private:
+        CryptoPrimitive *shared = nullptr;
         IO *io;
         IO **ioArr;
         OTPrimitive::OTPack<IO> **otpackArr;
         NonlinearLayer::ReLUProtocol<T, IO> **reluprotocol;
+
+        // Per-channel setup (base OTs and OT extension, millionaire/aux protocols) runs on all
+        // channels in parallel. The client's HE keygen overlaps with it; the keys go out on channel 0
+        // as soon as that channel's OT pack is done. HE must be constructed before. An exception of
+        // a worker or of the keygen is rethrown here once all workers have joined.
+        void SetupProtocols(int32_t bit_length, Datatype::OT_TYPE ot_type){
+            this->otpackArr = new OTPrimitive::OTPack<IO>*[num_threads];
+            this->reluprotocol = new NonlinearLayer::ReLUProtocol<T, IO>*[num_threads];
+            std::future<void> keys = std::async(std::launch::async, [this] { HE->CreateKeys(); });
+            std::vector<std::exception_ptr> errors(num_threads);
+            std::vector<std::thread> workers;
+            for (int i = 0; i < num_threads; i++) {
+                workers.emplace_back([this, i, bit_length, ot_type, &keys, &errors] {
+                    try {
+                        // distinct per-channel streams when seeds are pinned for a transcript replay
+                        Utils::SeedPin::Stream((party << 16) + i + 1);
+                        if (ot_type == Datatype::VOLE) {
+                            this->otpackArr[i] = new VOLEOTPack<Utils::NetIO>(this->ioArr[i], party);
+                        } else {
+                            this->otpackArr[i] = new IKNPOTPack<Utils::NetIO>(this->ioArr[i], party);
+                        }
+                        this->reluprotocol[i] = new NonlinearLayer::ReLURingProtocol<T, IO>(party, bit_length, MILL_PARAM, this->otpackArr[i], ot_type);
+                        if (i == 0) {
+                            keys.get();
+                            HE->ExchangeKeys();
+                        }
+                    } catch (...) {
+                        errors[i] = std::current_exception();
+                    }
+                });
+            }
+            for (auto &t : workers) {
+                t.join();
+            }
+            // channel 0 failed before it collected the keygen
+            if (keys.valid()) {
+                keys.get();
+            }
+            for (auto &e : errors) {
+                if (e) {
+                    std::rethrow_exception(e);
+                }
+            }
+            this->relu = new NonlinearLayer::ReLU<T, IO>(reluprotocol, bit_length, num_threads);
+            cout << "begin to generate fixpoint" << endl;
+            this->fixpoint = new NonlinearOperator::FixPoint<T>(party, this->otpackArr, num_threads);
+            cout << "fixpoint generated" << endl;
+        }
 };
 
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #include <LinearLayer/Conv.h>
+#include <LinearLayer/Linear.h>
 #include <NonlinearLayer/ReLU.h>
 #include <NonlinearLayer/Pool.h>
 #include "Primitive.h"
+#include <Utils/profiler.h>
 #include <NonlinearOperator/FixPoint.h>
 using namespace LinearLayer;
 using namespace NonlinearLayer;
@@ -9,23 +11,73 @@ using namespace NonlinearOperator;
 using namespace std;
 namespace Model{
 
+// Dense conv protocol: Conv2DNest or Conv2DCheetah, run on the polyphase components or not.
+// Returns false when the planner picks CirConv2D instead.
 template <typename T, typename IO=Utils::NetIO>
-Conv2D* CreateConv(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, CryptoPrimitive<T, IO> *cryptoPrimitive){
-    Conv2D* conv;
-    if (in_feature_size >=224){
-        conv = new Conv2DCheetah(in_feature_size, in_channels, out_channels, kernel_size, stride, cryptoPrimitive->HE);
-        return conv;
+bool SelectConv(const ConvShape &shape, CryptoPrimitive<T, IO> *cryptoPrimitive, Datatype::CONV_TYPE &type, bool &polyphase){
+    type = cryptoPrimitive->conv_type;
+    // without a plan, strided layers whose phases keep the kernel small run on polyphase components
+    polyphase = shape.stride > 1 && shape.kernel_size <= shape.stride + 1;
+    if (cryptoPrimitive->planner != nullptr){
+        LayerProtocol plan = cryptoPrimitive->planner->Plan(shape);
+        if (plan == LayerProtocol::CirConv){
+            return false;
+        }
+        bool cheetah = plan == LayerProtocol::ConvCheetah || plan == LayerProtocol::PolyConvCheetah;
+        type = cheetah ? Datatype::CONV_TYPE::Cheetah : Datatype::CONV_TYPE::Nest;
+        polyphase = plan == LayerProtocol::PolyConvNest || plan == LayerProtocol::PolyConvCheetah;
+    } else if (shape.in_feature_size >= 224){
+        type = Datatype::CONV_TYPE::Cheetah;
+    }
+    return true;
+}
+
+template <typename T, typename IO=Utils::NetIO>
+Conv2D* CreateConv(uint64_t in_feature_size, uint64_t in_channels, uint64_t out_channels, uint64_t kernel_size, uint64_t stride, CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size = 1){
+    ConvShape shape{in_feature_size, in_channels, out_channels, kernel_size, stride, (kernel_size - 1) / 2, 1, batch_size};
+    Datatype::CONV_TYPE type;
+    bool polyphase;
+    if (!SelectConv(shape, cryptoPrimitive, type, polyphase)){
+        return new CirConv2D(in_feature_size, in_channels, out_channels, kernel_size, stride, 1, cryptoPrimitive->HE, batch_size);
+    }
+    if (polyphase){
+        return new Conv2DPolyphase(in_feature_size, in_channels, out_channels, kernel_size, stride, cryptoPrimitive->HE, type, batch_size);
+    }
+    if (type == Datatype::CONV_TYPE::Cheetah){
+        return new Conv2DCheetah(in_feature_size, in_channels, out_channels, kernel_size, stride, cryptoPrimitive->HE, batch_size);
+    }
+    return new Conv2DNest(in_feature_size, in_channels, out_channels, kernel_size, stride, cryptoPrimitive->HE, batch_size);
+}
+
+// Convs reading the same input, e.g. conv1 and the projection shortcut of a block, as one
+// Conv2DFused: a single upload and HEToSS for all of them. Planned as the fused layer; CirConv2D
+// has no fused form, a CirConv plan falls back to Conv2DNest. The layer runs at the smallest branch
+// stride, so only fuse branches of equal stride unless the strided ones are small.
+template <typename T, typename IO=Utils::NetIO>
+Conv2DFused* CreateFusedConv(uint64_t in_feature_size, uint64_t in_channels, const std::vector<Conv2DFused::Branch> &branches, CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size = 1){
+    uint64_t out_channels = 0, kernel_size = 0, stride = branches[0].stride;
+    for (const auto &b : branches){
+        out_channels += b.out_channels;
+        kernel_size = std::max(kernel_size, b.kernel_size);
+        stride = std::min(stride, b.stride);
+    }
+    ConvShape shape{in_feature_size, in_channels, out_channels, kernel_size, stride, (kernel_size - 1) / 2, 1, batch_size};
+    Datatype::CONV_TYPE type;
+    bool polyphase;
+    if (!SelectConv(shape, cryptoPrimitive, type, polyphase)){
+        type = Datatype::CONV_TYPE::Nest;
+        polyphase = false;
     }
-    switch (cryptoPrimitive->conv_type)
-    {
-    case Datatype::CONV_TYPE::Nest:
-        conv = new Conv2DNest(in_feature_size, in_channels, out_channels, kernel_size, stride, cryptoPrimitive->HE);
-        break;
-    case Datatype::CONV_TYPE::Cheetah:
-        conv = new Conv2DCheetah(in_feature_size, in_channels, out_channels, kernel_size, stride, cryptoPrimitive->HE);
-        break;
+    return new Conv2DFused(in_feature_size, in_channels, branches, cryptoPrimitive->HE, type, polyphase, batch_size);
+}
+
+// Dense {dim_0, dim_1} x {dim_1, dim_2} layer; without a planner LinearNest.
+template <typename T, typename IO=Utils::NetIO>
+Linear* CreateLinear(uint64_t dim_0, uint64_t dim_1, uint64_t dim_2, CryptoPrimitive<T, IO> *cryptoPrimitive){
+    if (cryptoPrimitive->planner != nullptr && cryptoPrimitive->planner->Plan(LinearShape{dim_0, dim_1, dim_2}) == LayerProtocol::LinearBolt){
+        return new LinearBolt(dim_0, dim_1, dim_2, cryptoPrimitive->HE);
     }
-    return conv;
+    return new LinearNest(dim_0, dim_1, dim_2, cryptoPrimitive->HE);
 }
 
 template <typename T, typename IO=Utils::NetIO>
@@ -37,36 +89,47 @@ class BasicBlock{
         int stride = 1;
         ReLU<T, IO> *relu;
         FixPoint<T> *fixpoint;
-        Conv2D *conv1;
+        Conv2D *conv1 = nullptr;
         Conv2D *conv2;
-        Conv2D *shortcut;
+        // conv1 and the shortcut when the block has one, they share their input upload
+        Conv2DFused *conv1_shortcut = nullptr;
         bool has_shortcut = false;
-        BasicBlock(uint64_t in_feature_size, uint64_t in_planes, uint64_t planes, uint64_t stride, CryptoPrimitive<T, IO> *cryptoPrimitive){
+        BasicBlock(uint64_t in_feature_size, uint64_t in_planes, uint64_t planes, uint64_t stride, CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size = 1){
             this->in_planes = in_planes;
             this->planes = planes;
             this->stride = stride;
             this->relu = cryptoPrimitive->relu;
             this->fixpoint = cryptoPrimitive->fixpoint;
-            conv1 = CreateConv<T, IO>(in_feature_size, in_planes, planes, 3, stride, cryptoPrimitive);
-            conv2 = CreateConv<T, IO>(in_feature_size/stride, planes, planes, 3, 1, cryptoPrimitive);
+            conv2 = CreateConv<T, IO>(in_feature_size/stride, planes, planes, 3, 1, cryptoPrimitive, batch_size);
             if (stride != 1 || in_planes != planes){
                 has_shortcut = true;
-                shortcut = CreateConv<T, IO>(in_feature_size, in_planes, planes, 1, stride, cryptoPrimitive);
+                conv1_shortcut = CreateFusedConv<T, IO>(in_feature_size, in_planes, {{planes, 3, stride}, {planes, 1, stride}}, cryptoPrimitive, batch_size);
+            } else {
+                conv1 = CreateConv<T, IO>(in_feature_size, in_planes, planes, 3, stride, cryptoPrimitive, batch_size);
             }
         }
 
         Tensor<T> operator()(Tensor<T> &x){
+            Utils::ProfileScope scope("BasicBlock", "block");
             Tensor<T> x_res = x;
-            x = (*conv1)(x);
-            (*relu)(x);
-            fixpoint->truncate(x,17,43,true,true);
-            x = (*conv2)(x);
             if (has_shortcut){
-                x_res = (*shortcut)(x_res);
+                Utils::ProfileScope layer("conv1+shortcut", "layer");
+                std::vector<Tensor<T>> outs = conv1_shortcut->Forward(x);
+                x = outs[0];
+                x_res = outs[1];
+            } else {
+                Utils::ProfileScope layer("conv1", "layer");
+                x = (*conv1)(x);
+            }
+            (*relu)(x);
+            fixpoint->truncate(x,17,43,true);
+            {
+                Utils::ProfileScope layer("conv2", "layer");
+                x = (*conv2)(x);
             }
             x = x + x_res;
             (*relu)(x);
-            fixpoint->truncate(x,17,43,true,true);
+            fixpoint->truncate(x,17,43,true);
             return x;
         }
 };
@@ -82,38 +145,62 @@ class Bottleneck{
         ReLU<T, IO> *relu;
         FixPoint<T> *fixpoint;
         // TODO: can be simplified to use pointer
-        Conv2D *conv1;
+        Conv2D *conv1 = nullptr;
         Conv2D *conv2;
         Conv2D *conv3;
-        Conv2D *shortcut;
+        Conv2D *shortcut = nullptr;
+        // conv1 and a stride-1 shortcut, they share their input upload
+        Conv2DFused *conv1_shortcut = nullptr;
 
-        Bottleneck(uint64_t in_feature_size, uint64_t in_planes, uint64_t planes, uint64_t stride, CryptoPrimitive<T, IO> *cryptoPrimitive){
+        Bottleneck(uint64_t in_feature_size, uint64_t in_planes, uint64_t planes, uint64_t stride, CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size = 1){
             this->in_planes = in_planes;
             this->planes = planes;
             this->stride = stride;
             this->relu = cryptoPrimitive->relu;
             this->fixpoint = cryptoPrimitive->fixpoint;
-            this->conv1 = CreateConv<T, IO>(in_feature_size, in_planes, planes, 1, 1, cryptoPrimitive);
-            this->conv2 = CreateConv<T, IO>(in_feature_size, planes, planes, 3, stride, cryptoPrimitive);
-            this->conv3 = CreateConv<T, IO>(in_feature_size/stride, planes, planes * this->expansion, 1, 1, cryptoPrimitive);
-            if (stride != 1 || in_planes != planes * this->expansion){
-                has_shortcut = true;
-                this->shortcut = CreateConv<T, IO>(in_feature_size, in_planes, planes * this->expansion, 1, stride, cryptoPrimitive);
+            this->conv2 = CreateConv<T, IO>(in_feature_size, planes, planes, 3, stride, cryptoPrimitive, batch_size);
+            this->conv3 = CreateConv<T, IO>(in_feature_size/stride, planes, planes * this->expansion, 1, 1, cryptoPrimitive, batch_size);
+            has_shortcut = stride != 1 || in_planes != planes * this->expansion;
+            if (has_shortcut && stride == 1){
+                this->conv1_shortcut = CreateFusedConv<T, IO>(in_feature_size, in_planes, {{planes, 1, 1}, {planes * this->expansion, 1, 1}}, cryptoPrimitive, batch_size);
+            } else {
+                // a fused layer runs at the smallest stride of its branches, which would compute the
+                // strided shortcut at full resolution: more than its own upload saves
+                this->conv1 = CreateConv<T, IO>(in_feature_size, in_planes, planes, 1, 1, cryptoPrimitive, batch_size);
+                if (has_shortcut){
+                    this->shortcut = CreateConv<T, IO>(in_feature_size, in_planes, planes * this->expansion, 1, stride, cryptoPrimitive, batch_size);
+                }
             }
         }
 
         // TODO: can be simplified
         Tensor<T> operator()(Tensor<T> &x){
+            Utils::ProfileScope scope("Bottleneck", "block");
             Tensor<T> x_res = x;
-            x = (*conv1)(x);
+            if (conv1_shortcut != nullptr){
+                Utils::ProfileScope layer("conv1+shortcut", "layer");
+                std::vector<Tensor<T>> outs = conv1_shortcut->Forward(x);
+                x = outs[0];
+                x_res = outs[1];
+            } else {
+                Utils::ProfileScope layer("conv1", "layer");
+                x = (*conv1)(x);
+            }
             (*relu)(x);
-            fixpoint->truncate(x,17,43,true,true);
-            x = (*conv2)(x);
+            fixpoint->truncate(x,17,43,true);
+            {
+                Utils::ProfileScope layer("conv2", "layer");
+                x = (*conv2)(x);
+            }
             (*relu)(x);
-            fixpoint->truncate(x,17,43,true,true);
-            x = (*conv3)(x);
-            fixpoint->truncate(x,17,43,true,false);
-            if (has_shortcut){
+            fixpoint->truncate(x,17,43,true);
+            {
+                Utils::ProfileScope layer("conv3", "layer");
+                x = (*conv3)(x);
+            }
+            fixpoint->truncate(x,17,43);
+            if (shortcut != nullptr){
+                Utils::ProfileScope layer("shortcut", "layer");
                 x_res = (*shortcut)(x_res);
             }
             return x + x_res;
@@ -134,38 +221,44 @@ class ResNet_3stages {
         vector<BasicBlock<T, IO>*> layer2;
         vector<BasicBlock<T, IO>*> layer3;
         Conv2D *linear;
-        AvgPool2D<T> *avg_pool;
-        ResNet_3stages(uint64_t in_feature_size, int* num_layers,int num_classes, CryptoPrimitive<T, IO> *cryptoPrimitive){
+        GlobalAvgPool<T> *avg_pool;
+        ResNet_3stages(uint64_t in_feature_size, int* num_layers,int num_classes, CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size = 1){
             this->in_feature_size = in_feature_size;
             this->num_layers = num_layers;
             this->num_classes = num_classes;
             this->relu = cryptoPrimitive->relu;
             this->fixpoint = cryptoPrimitive->fixpoint;
-            conv1 = CreateConv<T, IO>(in_feature_size, 3, 16, 3, 1, cryptoPrimitive);
-            _make_layer(layer1, 16, num_layers[0], 1, cryptoPrimitive);
-            _make_layer(layer2, 32, num_layers[1], 2, cryptoPrimitive);
-            _make_layer(layer3, 64, num_layers[2], 2, cryptoPrimitive);
-            linear = CreateConv<T, IO>(1, 64, num_classes, 1, 1, cryptoPrimitive);
-            avg_pool = new AvgPool2D<T>(8);
+            conv1 = CreateConv<T, IO>(in_feature_size, 3, 16, 3, 1, cryptoPrimitive, batch_size);
+            _make_layer(layer1, 16, num_layers[0], 1, cryptoPrimitive, batch_size);
+            _make_layer(layer2, 32, num_layers[1], 2, cryptoPrimitive, batch_size);
+            _make_layer(layer3, 64, num_layers[2], 2, cryptoPrimitive, batch_size);
+            linear = CreateConv<T, IO>(1, 64, num_classes, 1, 1, cryptoPrimitive, batch_size);
+            // global avg pool only sums locally, 1/64 is folded into the classifier weights
+            avg_pool = new GlobalAvgPool<T>(8);
+            linear->fold_scale(1.0 / avg_pool->divisor(), avg_pool->shift);
         }
 
-        void _make_layer(vector<BasicBlock<T, IO>*> &layer, int planes, int num_blocks, int stride, CryptoPrimitive<T, IO> *cryptoPrimitive){
+        void _make_layer(vector<BasicBlock<T, IO>*> &layer, int planes, int num_blocks, int stride, CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size){
             int strides[num_blocks];
             strides[0] = stride;
             for (int i = 1; i < num_blocks; i++){
                 strides[i] = 1;
             }
             for (int i = 0; i < num_blocks; i++){
-                layer.push_back(new BasicBlock<T, IO>(this->in_feature_size, this->in_planes, planes, strides[i], cryptoPrimitive));
+                layer.push_back(new BasicBlock<T, IO>(this->in_feature_size, this->in_planes, planes, strides[i], cryptoPrimitive, batch_size));
                 this->in_planes = planes * 1;
                 this->in_feature_size = this->in_feature_size / strides[i];
             }
         }
         // TODO: implement nn.Sequential
         Tensor<T> operator()(Tensor<T> &x){
-            x = (*conv1)(x);
+            Utils::ProfileScope scope("ResNet_3stages", "model");
+            {
+                Utils::ProfileScope layer("conv1", "layer");
+                x = (*conv1)(x);
+            }
             (*relu)(x);
-            fixpoint->truncate(x,17,43,true,true);
+            fixpoint->truncate(x,17,43,true);
             for (int i = 0; i < layer1.size(); i++){
                 x = (*layer1[i])(x);
             }
@@ -176,7 +269,12 @@ class ResNet_3stages {
                 x = (*layer3[i])(x);
             }
             x = (*avg_pool)(x);
-            x = (*linear)(x);
+            {
+                Utils::ProfileScope layer("linear", "layer");
+                x = (*linear)(x);
+            }
+            // the folded 1/divisor left 2^shift on the logits, they return at the activation scale
+            fixpoint->truncate(x, avg_pool->shift, 43);
             return x;
         }
 };
@@ -196,40 +294,53 @@ class ResNet_4stages {
         vector<BasicBlock<T, IO>*> layer3;
         vector<BasicBlock<T, IO>*> layer4;
         Conv2D *linear;
-        AvgPool2D<T> *avg_pool;
-        ResNet_4stages(uint64_t in_feature_size, int* num_layers,int num_classes, CryptoPrimitive<T, IO> *cryptoPrimitive){
+        MaxPool2D<T> *max_pool;
+        GlobalAvgPool<T> *avg_pool;
+        ResNet_4stages(uint64_t in_feature_size, int* num_layers,int num_classes, CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size = 1){
             this->in_feature_size = in_feature_size;
             this->num_layers = num_layers;
             this->num_classes = num_classes;
             this->relu = cryptoPrimitive->relu;
             this->fixpoint = cryptoPrimitive->fixpoint;
-            conv1 = CreateConv<T, IO>(in_feature_size, 3, this->in_planes, 7, 4, cryptoPrimitive); // we do not support maxpool for now, so we use stride = 4
+            // stem: 7x7 conv stride 2 + 3x3 maxpool stride 2
+            conv1 = CreateConv<T, IO>(in_feature_size, 3, this->in_planes, 7, 2, cryptoPrimitive, batch_size);
+            max_pool = new MaxPool2D<T>(this->fixpoint, this->relu->bitwidth, 3, 2, 1);
             this->in_feature_size = this->in_feature_size / 4;
-            _make_layer(layer1, 64, num_layers[0], 1, cryptoPrimitive);
-            _make_layer(layer2, 128, num_layers[1], 2, cryptoPrimitive);
-            _make_layer(layer3, 256, num_layers[2], 2, cryptoPrimitive);
-            _make_layer(layer4, 512, num_layers[3], 2, cryptoPrimitive);
-            avg_pool = new AvgPool2D<T>(7);
-            linear = CreateConv<T, IO>(1, 512, num_classes, 1, 1, cryptoPrimitive);
+            _make_layer(layer1, 64, num_layers[0], 1, cryptoPrimitive, batch_size);
+            _make_layer(layer2, 128, num_layers[1], 2, cryptoPrimitive, batch_size);
+            _make_layer(layer3, 256, num_layers[2], 2, cryptoPrimitive, batch_size);
+            _make_layer(layer4, 512, num_layers[3], 2, cryptoPrimitive, batch_size);
+            // global avg pool only sums locally, 1/49 is folded into the classifier weights
+            avg_pool = new GlobalAvgPool<T>(7);
+            linear = CreateConv<T, IO>(1, 512, num_classes, 1, 1, cryptoPrimitive, batch_size);
+            linear->fold_scale(1.0 / avg_pool->divisor(), avg_pool->shift);
         }
 
-        void _make_layer(vector<BasicBlock<T, IO>*> &layer, int planes, int num_blocks, int stride, CryptoPrimitive<T, IO> *cryptoPrimitive){
+        void _make_layer(vector<BasicBlock<T, IO>*> &layer, int planes, int num_blocks, int stride, CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size){
             int strides[num_blocks];
             strides[0] = stride;
             for (int i = 1; i < num_blocks; i++){
                 strides[i] = 1;
             }
             for (int i = 0; i < num_blocks; i++){
-                layer.push_back(new BasicBlock<T, IO>(this->in_feature_size, this->in_planes, planes, strides[i], cryptoPrimitive));
+                layer.push_back(new BasicBlock<T, IO>(this->in_feature_size, this->in_planes, planes, strides[i], cryptoPrimitive, batch_size));
                 this->in_planes = planes * 1;
                 this->in_feature_size = this->in_feature_size / strides[i];
             }
         }
         // TODO: implement nn.Sequential
         Tensor<T> operator()(Tensor<T> &x){
-            x = (*conv1)(x);
+            Utils::ProfileScope scope("ResNet_4stages", "model");
+            {
+                Utils::ProfileScope layer("conv1", "layer");
+                x = (*conv1)(x);
+            }
             (*relu)(x);
-            fixpoint->truncate(x,17,43,true,true);
+            fixpoint->truncate(x,17,43,true);
+            {
+                Utils::ProfileScope layer("max_pool", "layer");
+                x = (*max_pool)(x);
+            }
             for (int i = 0; i < layer1.size(); i++){
                 x = (*layer1[i])(x);
             }
@@ -243,24 +354,29 @@ class ResNet_4stages {
                 x = (*layer4[i])(x);
             }
             x = (*avg_pool)(x);
-            x = (*linear)(x);
+            {
+                Utils::ProfileScope layer("linear", "layer");
+                x = (*linear)(x);
+            }
+            // the folded 1/divisor left 2^shift on the logits, they return at the activation scale
+            fixpoint->truncate(x, avg_pool->shift, 43);
             return x;
         }
 };
 
 template <typename T, typename IO=Utils::NetIO>
-ResNet_3stages<uint64_t> resnet_32_c10(CryptoPrimitive<T, IO> *cryptoPrimitive){
-    return ResNet_3stages<uint64_t>(32, new int[3]{5,5,5}, 10, cryptoPrimitive);
+ResNet_3stages<uint64_t> resnet_32_c10(CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size = 1){
+    return ResNet_3stages<uint64_t>(32, new int[3]{5,5,5}, 10, cryptoPrimitive, batch_size);
 }
 
 template <typename T, typename IO=Utils::NetIO>
-ResNet_4stages<uint64_t> resnet_18(CryptoPrimitive<T, IO> *cryptoPrimitive){
-    return ResNet_4stages<uint64_t>(224, new int[4]{2,2,2,2}, 1000, cryptoPrimitive);
+ResNet_4stages<uint64_t> resnet_18(CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size = 1){
+    return ResNet_4stages<uint64_t>(224, new int[4]{2,2,2,2}, 1000, cryptoPrimitive, batch_size);
 }
 
 template <typename T, typename IO=Utils::NetIO>
-ResNet_4stages<uint64_t> resnet_50(CryptoPrimitive<T, IO> *cryptoPrimitive){
-    return ResNet_4stages<uint64_t>(224, new int[4]{3,4,6,3}, 1000, cryptoPrimitive);
+ResNet_4stages<uint64_t> resnet_50(CryptoPrimitive<T, IO> *cryptoPrimitive, uint64_t batch_size = 1){
+    return ResNet_4stages<uint64_t>(224, new int[4]{3,4,6,3}, 1000, cryptoPrimitive, batch_size);
 }
 
 }
\ No newline at end of file
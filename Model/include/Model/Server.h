@@ -0,0 +1,274 @@
+#pragma once
+#include <Model/Primitive.h>
+#include <Utils/ThreadPool.h>
+#include <Utils/net_io_channel.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <poll.h>
+#include <random>
+
+namespace Model{
+
+// Every connection of a client starts with this header so that the server can group the
+// num_threads channels of one client, whatever order they are accepted in.
+struct SessionHello{
+    uint64_t token;
+    uint32_t channel;
+};
+
+// Client side: open num_threads channels to a SessionServer and announce them under one token.
+// The result is meant for CryptoPrimitive(BOB, ioArr, num_threads, ...).
+inline Utils::NetIO** ConnectSession(const string &address, int port, int32_t num_threads, uint64_t token = 0){
+    if (token == 0){
+        std::random_device rd;
+        token = (static_cast<uint64_t>(rd()) << 32) | rd();
+    }
+    Utils::NetIO **ioArr = new Utils::NetIO*[num_threads];
+    for (int i = 0; i < num_threads; i++) {
+        ioArr[i] = new Utils::NetIO(address.c_str(), port, true);
+        SessionHello hello{token, static_cast<uint32_t>(i)};
+        ioArr[i]->send_data(&hello, sizeof(SessionHello));
+        ioArr[i]->flush();
+    }
+    return ioArr;
+}
+
+// Serves many clients on one port. The model is built once with the template `shared`
+// primitive, so its packed weights and the HE context are shared by every client. Each
+// connected client gets its own session (OT packs, ReLU/FixPoint protocols, HE keys and
+// channels) which is bound to a worker of the pool for the duration of its handler.
+//
+// The accept loop never blocks on a client: hellos are read as they arrive, a connection that
+// does not complete its hello within handshake_timeout is closed, and so are the channels of a
+// client that does not open all num_threads of them in that time. At most max_pending
+// connections and channel groups wait at once, further connections are refused.
+//
+// Threads spawned inside a handler do not inherit the binding; layers that fan out their own
+// HE threads (Conv2DCheetah with MULTI_STRAEM) must run single-stream under this server.
+template <typename T, typename IO=Utils::NetIO>
+class SessionServer{
+    public:
+        using Session = CryptoPrimitive<T, IO>;
+        using Handler = std::function<void(Session *)>;
+
+        using Clock = std::chrono::steady_clock;
+
+        int32_t bit_length;
+        Datatype::OT_TYPE ot_type;
+        std::chrono::milliseconds handshake_timeout = std::chrono::seconds(10);
+        size_t max_pending = 256;
+        // evaluation keys of clients that connect with an identity, see HEEvaluator::UseIdentity
+        HE::KeyCache key_cache;
+
+        SessionServer(Session *shared, int port, size_t max_sessions, int32_t bit_length, Datatype::OT_TYPE ot_type = Datatype::IKNP,
+                      std::chrono::seconds key_ttl = std::chrono::hours(24))
+          : key_cache(key_ttl), listener(port), pool(max_sessions){
+            this->shared = shared;
+            this->bit_length = bit_length;
+            this->ot_type = ot_type;
+            shared->HE->UseKeyCache(&key_cache);
+        }
+
+        // Accept clients and run `handler` on each of them, returns after `num_sessions` clients
+        // were accepted (-1: until Stop()). Sessions still running are finished by the destructor.
+        void Serve(Handler handler, int num_sessions = -1){
+            int accepted = 0;
+            while (num_sessions < 0 || accepted < num_sessions) {
+                Expire(Clock::now());
+                std::vector<pollfd> fds(1 + handshakes.size());
+                fds[0] = {listener.mysocket, POLLIN, 0};
+                for (size_t i = 0; i < handshakes.size(); i++) {
+                    fds[i + 1] = {handshakes[i].fd, POLLIN, 0};
+                }
+                if (fds[0].fd < 0) {
+                    break;
+                }
+                if (::poll(fds.data(), fds.size(), PollTimeout()) < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                // hellos first: a completed group may start a session before the next accept
+                for (size_t i = fds.size() - 1; i > 0; i--) {
+                    if (fds[i].revents != 0 && ReadHello(handshakes[i - 1])) {
+                        Handshake done = handshakes[i - 1];
+                        handshakes.erase(handshakes.begin() + (i - 1));
+                        if (done.got == sizeof(SessionHello) && Admit(done.fd, done.hello, handler)) {
+                            accepted++;
+                        }
+                    }
+                }
+                if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                    break;
+                }
+                if (fds[0].revents & POLLIN) {
+                    int fd = listener.accept_fd();
+                    if (fd < 0) {
+                        continue;
+                    }
+                    if (handshakes.size() + pending.size() >= max_pending) {
+                        std::cerr << "SessionServer: too many pending connections, refused" << std::endl;
+                        ::close(fd);
+                        continue;
+                    }
+                    handshakes.push_back(Handshake{fd, 0, SessionHello{}, Clock::now() + handshake_timeout});
+                }
+            }
+            for (auto &h : handshakes) {
+                ::close(h.fd);
+            }
+            handshakes.clear();
+            for (auto &p : pending) {
+                DropGroup(p.second);
+            }
+            pending.clear();
+        }
+
+        void Stop(){
+            listener.close();
+        }
+
+        int active_sessions() const{
+            return active.load();
+        }
+
+    private:
+        // an accepted connection whose hello is not complete yet
+        struct Handshake{
+            int fd;
+            size_t got;
+            SessionHello hello;
+            Clock::time_point deadline;
+        };
+        // the channels of one client announced so far
+        struct PendingGroup{
+            std::vector<IO *> channels;
+            Clock::time_point deadline;
+        };
+
+        Session *shared;
+        Utils::NetListener listener;
+        ThreadPool pool;
+        std::vector<Handshake> handshakes;
+        std::map<uint64_t, PendingGroup> pending;
+        std::atomic<int> active{0};
+
+        // true once the hello is complete or the connection has failed (then got < sizeof)
+        bool ReadHello(Handshake &h){
+            ssize_t n = ::recv(h.fd, reinterpret_cast<char *>(&h.hello) + h.got, sizeof(SessionHello) - h.got, MSG_DONTWAIT);
+            if (n > 0) {
+                h.got += n;
+                return h.got == sizeof(SessionHello);
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                return false;
+            }
+            ::close(h.fd);
+            return true;
+        }
+
+        // file the channel under its client's token, start the session once all channels are in
+        bool Admit(int fd, const SessionHello &hello, const Handler &handler){
+            int32_t num_threads = shared->num_threads;
+            if (hello.channel >= static_cast<uint32_t>(num_threads)) {
+                std::cerr << "SessionServer: bad channel " << hello.channel << std::endl;
+                ::close(fd);
+                return false;
+            }
+            auto it = pending.find(hello.token);
+            if (it == pending.end()) {
+                if (pending.size() >= max_pending) {
+                    std::cerr << "SessionServer: too many pending clients, refused" << std::endl;
+                    ::close(fd);
+                    return false;
+                }
+                it = pending.emplace(hello.token, PendingGroup{std::vector<IO *>(num_threads, nullptr), Clock::now() + handshake_timeout}).first;
+            }
+            std::vector<IO *> &channels = it->second.channels;
+            if (channels[hello.channel] != nullptr) {
+                std::cerr << "SessionServer: channel " << hello.channel << " announced twice" << std::endl;
+                ::close(fd);
+                return false;
+            }
+            channels[hello.channel] = new IO(fd, true);
+            if (std::count(channels.begin(), channels.end(), nullptr) != 0) {
+                return false;
+            }
+            IO **ioArr = new IO*[num_threads];
+            std::copy(channels.begin(), channels.end(), ioArr);
+            pending.erase(it);
+            pool.enqueue([this, ioArr, handler](){ Run(ioArr, handler); });
+            return true;
+        }
+
+        // close the connections that missed their deadline
+        void Expire(Clock::time_point now){
+            for (size_t i = handshakes.size(); i > 0; i--) {
+                if (handshakes[i - 1].deadline <= now) {
+                    std::cerr << "SessionServer: no hello in time, connection closed" << std::endl;
+                    ::close(handshakes[i - 1].fd);
+                    handshakes.erase(handshakes.begin() + (i - 1));
+                }
+            }
+            for (auto it = pending.begin(); it != pending.end();) {
+                if (it->second.deadline <= now) {
+                    std::cerr << "SessionServer: client did not open all its channels in time, closed" << std::endl;
+                    DropGroup(it->second);
+                    it = pending.erase(it);
+                } else {
+                    it++;
+                }
+            }
+        }
+
+        void DropGroup(PendingGroup &group){
+            for (IO *io : group.channels) {
+                delete io;
+            }
+            group.channels.clear();
+        }
+
+        // until the next deadline, -1 (no timeout) when nothing is waiting
+        int PollTimeout() const{
+            Clock::time_point next = Clock::time_point::max();
+            for (auto &h : handshakes) {
+                next = std::min(next, h.deadline);
+            }
+            for (auto &p : pending) {
+                next = std::min(next, p.second.deadline);
+            }
+            if (next == Clock::time_point::max()) {
+                return -1;
+            }
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+            return static_cast<int>(std::max<int64_t>(0, ms) + 1);
+        }
+
+        void Run(IO **ioArr, Handler handler){
+            active++;
+            Session *session = nullptr;
+            try {
+                session = new Session(shared, ioArr, bit_length, ot_type);
+                session->Bind();
+                handler(session);
+            } catch (const std::exception &e) {
+                std::cerr << "SessionServer: session failed: " << e.what() << std::endl;
+            }
+            if (session == nullptr) {
+                for (int i = 0; i < shared->num_threads; i++) {
+                    delete ioArr[i];
+                }
+                delete[] ioArr;
+            }
+            // the destructor unbinds and releases the session's keys, protocols and channels
+            delete session;
+            active--;
+        }
+};
+
+}
@@ -11,11 +11,13 @@ namespace Operator {
 // let the last dimension of x be N, the polynomial degree
 Tensor<HE::unified::UnifiedCiphertext> SSToHE(const Tensor<uint64_t> &x, HE::HEEvaluator* HE);
 
-Tensor<uint64_t> HEToSS(Tensor<HE::unified::UnifiedCiphertext> out_ct, HE::HEEvaluator* HE);
+// offset (server, optional): {out_ct.size(), N} message added to the result for free by masking the
+// ciphertexts with offset - mask instead of -mask, e.g. a layer's bias packed like its output
+Tensor<uint64_t> HEToSS(Tensor<HE::unified::UnifiedCiphertext> out_ct, HE::HEEvaluator* HE, const Tensor<uint64_t> *offset = nullptr);
 
 Tensor<HE::unified::UnifiedCiphertext> SSToHE_coeff(const Tensor<uint64_t> &x, HE::HEEvaluator* HE);
 
-Tensor<uint64_t> HEToSS_coeff(Tensor<HE::unified::UnifiedCiphertext> &out_ct, HE::HEEvaluator* HE);
+Tensor<uint64_t> HEToSS_coeff(Tensor<HE::unified::UnifiedCiphertext> &out_ct, HE::HEEvaluator* HE, const Tensor<uint64_t> *offset = nullptr);
 
 
 
@@ -1,9 +1,20 @@
 #include <LinearOperator/Conversion.h>
+#include <Utils/mask_sampler.h>
 
 using namespace HE::unified;
 
 namespace Operator {
 
+// neg_mask[j] += offset(i, j) mod p: the client then decrypts result + offset - mask
+static void AddOffset(uint64_t *neg_mask, const Tensor<uint64_t> &offset, size_t i, HE::HEEvaluator* HE) {
+    const uint64_t n = HE->polyModulusDegree, p = HE->plain_mod;
+    const uint64_t *off = offset.data().data() + i * n;
+    for (size_t j = 0; j < n; j++) {
+        uint64_t v = neg_mask[j] + off[j] % p;
+        neg_mask[j] = v >= p ? v - p : v;
+    }
+}
+
 // input mod prime, output mod q, need a ring2field conversion before it
 Tensor<UnifiedCiphertext> SSToHE(const Tensor<uint64_t> &x, HE::HEEvaluator* HE) {
     std::vector<size_t> scalar_shape = x.shape();
@@ -34,7 +45,7 @@ Tensor<UnifiedCiphertext> SSToHE(const Tensor<uint64_t> &x, HE::HEEvaluator* HE)
     } 
     else { /* client */
         for (size_t i = 0; i < ac_pt.size(); i++) {
-            HE->encryptor->encrypt(ac_pt(i), ac_ct(i));
+            HE->Session()->encryptor->encrypt(ac_pt(i), ac_ct(i));
         }
         HE->SendEncVec(ac_ct);
         Tensor<UnifiedCiphertext> zero_ct(poly_shape,HE->GenerateZeroCiphertext(HE->Backend()));
@@ -44,25 +55,21 @@ Tensor<UnifiedCiphertext> SSToHE(const Tensor<uint64_t> &x, HE::HEEvaluator* HE)
 };
 
 // input mod q, output mod prime, need a field2ring conversion after it to support ring MPC protocols
-Tensor<uint64_t> HEToSS(Tensor<UnifiedCiphertext> out_ct, HE::HEEvaluator* HE) {
+Tensor<uint64_t> HEToSS(Tensor<UnifiedCiphertext> out_ct, HE::HEEvaluator* HE, const Tensor<uint64_t> *offset) {
     std::vector<size_t> scalar_shape = out_ct.shape();
     scalar_shape.push_back(HE->polyModulusDegree);
     Tensor<uint64_t> x(scalar_shape);
     Tensor<UnifiedPlaintext> out_share(out_ct.shape(), HOST);
-    std::random_device rd;
-    std::mt19937_64 gen(rd());
-    std::uniform_int_distribution<uint64_t> distrib(0, HE->plain_mod - 1);
     // mask generation and communication
     if (HE->server) {
+        Utils::MaskSampler sampler;
+        std::vector<uint64_t> pos_mask(HE->polyModulusDegree, 0);
+        std::vector<uint64_t> neg_mask(HE->polyModulusDegree, 0);
         for (size_t i = 0; i < out_ct.size(); i++){
-            std::vector<uint64_t> pos_mask(HE->polyModulusDegree, 0);
-            std::vector<uint64_t> neg_mask(HE->polyModulusDegree, 0);
-            for (size_t j = 0; j < pos_mask.size(); j++) {
-                pos_mask[j] = distrib(gen);
-                neg_mask[j] = HE->plain_mod - pos_mask[j];
-                if (HE->server) {
-                    x(i * HE->polyModulusDegree + j) = pos_mask[j];
-                }
+            sampler.Sample(pos_mask, neg_mask, HE->plain_mod);
+            std::copy(pos_mask.begin(), pos_mask.end(), x.data().begin() + i * HE->polyModulusDegree);
+            if (offset != nullptr) {
+                AddOffset(neg_mask.data(), *offset, i, HE);
             }
             // TODO: noise flooding (add freshly encrypted zero), refer to Cheetah
             UnifiedPlaintext tmp_pos(HOST);
@@ -96,7 +103,7 @@ Tensor<uint64_t> HEToSS(Tensor<UnifiedCiphertext> out_ct, HE::HEEvaluator* HE) {
     else {
         for (size_t i = 0; i < out_ct.size(); i++) {
             Plaintext out_pt;
-            HE->decryptor->decrypt(out_ct(i), out_pt);
+            HE->Session()->decryptor->decrypt(out_ct(i), out_pt);
             HE->encoder->decode(out_pt, tmp_vec);
             for (size_t j = 0; j < HE->polyModulusDegree; j++) {
                 x(i * HE->polyModulusDegree + j) = tmp_vec[j];
@@ -124,19 +131,15 @@ Tensor<HE::unified::UnifiedCiphertext> SSToHE_coeff(const Tensor<uint64_t> &x, H
     numPoly /= len;
     Tensor<UnifiedPlaintext> T(shapeTab,Datatype::HOST);
     for (size_t i = 0; i < numPoly; i++){
-        vector<uint64_t> Tsubv(len, 0);
-        for (size_t j = 0; j < len; j++){
-            Tsubv[j] = x(i * len + j);
-        }
         T(i).hplain().resize(polyModulusDegree);
-        seal::util::modulo_poly_coeffs(Tsubv, len, plain, T(i).hplain().data());
+        seal::util::modulo_poly_coeffs(x.data().data() + i * len, len, plain, T(i).hplain().data());
         std::fill_n(T(i).hplain().data() + len, polyModulusDegree - len, 0);
     }
     Tensor<UnifiedCiphertext> finalpack(shapeTab, HOST);
     if (!HE->server){
         //客户端
         for (size_t i = 0; i < numPoly; i++){
-            HE->encryptor->encrypt(T(i), finalpack(i));
+            HE->Session()->encryptor->encrypt(T(i), finalpack(i));
         }
         // enc.flatten();
         HE->SendEncVec(finalpack);
@@ -159,7 +162,7 @@ Tensor<HE::unified::UnifiedCiphertext> SSToHE_coeff(const Tensor<uint64_t> &x, H
 }
 
 
-Tensor<uint64_t> HEToSS_coeff(Tensor<HE::unified::UnifiedCiphertext> &out_ct, HE::HEEvaluator* HE)
+Tensor<uint64_t> HEToSS_coeff(Tensor<HE::unified::UnifiedCiphertext> &out_ct, HE::HEEvaluator* HE, const Tensor<uint64_t> *offset)
 {
     auto shapeTab = out_ct.shape();
     Tensor<UnifiedPlaintext> outShare(shapeTab,HOST);
@@ -183,21 +186,16 @@ Tensor<uint64_t> HEToSS_coeff(Tensor<HE::unified::UnifiedCiphertext> &out_ct, HE
         // for(int i=0;i<HE->polyModulusDegree;i++){
         //     cout << "out_ct(0)[i]:" << out_ct(0).hcipher().data()[i] << endl;
         // }
-        int64_t mask;
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<int64_t> dist(0, HE->plain_mod - 1);
+        Utils::MaskSampler sampler;
         // cout << "numPoly:" << numPoly << endl;
         for (size_t i = 0; i < numPoly; i++){
             outShare(i).hplain().resize(HE->polyModulusDegree);
             plainMaskInv.hplain().resize(HE->polyModulusDegree);
-            for (size_t l = 0; l < HE->polyModulusDegree; l++){
-                mask = dist(gen);
-                *(outShare(i).hplain().data() + l) = mask;
-                tensorShare((i) * HE->polyModulusDegree + l) = mask;
-                mask = HE->plain_mod - mask;
-                *(plainMaskInv.hplain().data() + l) = mask;
-                // cout << "mask:" << *(plainMaskInv.hplain().data() + l) << endl;
+            uint64_t *mask = outShare(i).hplain().data();
+            sampler.Sample(mask, plainMaskInv.hplain().data(), HE->polyModulusDegree, HE->plain_mod);
+            std::copy(mask, mask + HE->polyModulusDegree, tensorShare.data().begin() + i * HE->polyModulusDegree);
+            if (offset != nullptr) {
+                AddOffset(plainMaskInv.hplain().data(), *offset, i, HE);
             }
             
             // cout << "add_plain_inplace done1" << endl;
@@ -217,7 +215,7 @@ Tensor<uint64_t> HEToSS_coeff(Tensor<HE::unified::UnifiedCiphertext> &out_ct, HE
     }else{
         HE->ReceiveEncVec(out_ct);
         for (size_t i = 0; i < numPoly; i++){
-            HE->decryptor->decrypt(out_ct(i), outShare(i));
+            HE->Session()->decryptor->decrypt(out_ct(i), outShare(i));
             for (size_t j = 0; j < HE->polyModulusDegree; j++){
                 tensorShare(i * HE->polyModulusDegree + j) = *(outShare(i).hplain().data() + j);
             }
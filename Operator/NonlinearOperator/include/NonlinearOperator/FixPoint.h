@@ -1,5 +1,7 @@
 #include <OTProtocol/millionaire.h>
 #include <OTProtocol/truncation.h>
+#include <Utils/session.h>
+#include <Utils/profiler.h>
 #include <seal/util/common.h>
 #include <algorithm>
 #include <iostream>
@@ -32,8 +34,17 @@ class FixPoint {
             }
         }
 
+        // The instance holding OT state for the calling thread: a per-client FixPoint bound by the
+        // server runtime, or this. Every public protocol forwards to it, so layers built with the
+        // shared FixPoint run on the session's OT packs.
+        FixPoint *Session() {
+            return Utils::SessionBinding<FixPoint>::Resolve(this);
+        }
+
         // we do not implement larger than to reduce the complexity of millionaire protocol
         void less_than_zero(Tensor<T> &x, Tensor<uint8_t> &result, int32_t bw){
+            if (FixPoint *session = Session(); session != this) return session->less_than_zero(x, result, bw);
+            Utils::ProfileScope scope("FixPoint::less_than_zero", "operator");
             auto shape = x.shape();
             int dim = x.size();
             T* x_flatten = x.data().data();
@@ -42,7 +53,8 @@ class FixPoint {
             int chunk_size = dim / num_threads;
             for (int i = 0; i < num_threads; i++) {
                 int offset = i * chunk_size;
-                less_than_threads[i] = std::thread(less_than_thread, aux[i], x_flatten+offset, result_flatten+offset, chunk_size, bw);
+                int lnum_ops = (i == num_threads - 1) ? dim - offset : chunk_size;
+                less_than_threads[i] = std::thread(less_than_thread, aux[i], x_flatten+offset, result_flatten+offset, lnum_ops, bw);
             }
             for (int i = 0; i < num_threads; i++) {
                 less_than_threads[i].join();
@@ -51,6 +63,7 @@ class FixPoint {
         
         // return 1{x < constant}
         void less_than_constant(Tensor<T> &x, T constant, Tensor<uint8_t> &result, int32_t bw){
+            if (FixPoint *session = Session(); session != this) return session->less_than_constant(x, constant, result, bw);
             auto shape = x.shape();
             int dim = x.size();
             Tensor<T> y = Tensor<T>(shape, constant);
@@ -66,6 +79,7 @@ class FixPoint {
 
         // return 1{constant < x}
         void less_than_constant(T constant, Tensor<T> &x, Tensor<uint8_t> &result, int32_t bw){
+            if (FixPoint *session = Session(); session != this) return session->less_than_constant(constant, x, result, bw);
             auto shape = x.shape();
             int dim = x.size();
             Tensor<T> y = Tensor<T>(shape, constant);
@@ -89,6 +103,8 @@ class FixPoint {
 
         // for now, only support uint64_t. TODO: support other types
         void truncate(Tensor<T> &x, int32_t shift, int32_t bw, bool msb_zero=false){
+            if (FixPoint *session = Session(); session != this) return session->truncate(x, shift, bw, msb_zero);
+            Utils::ProfileScope scope("FixPoint::truncate", "operator");
             uint8_t *msb_x = nullptr;
             if (msb_zero){
                 msb_x = new uint8_t[x.size()];
@@ -103,7 +119,8 @@ class FixPoint {
             int chunk_size = dim / num_threads;
             for (int i = 0; i < num_threads; i++) {
                 int offset = i * chunk_size;
-                truncation_threads[i] = std::thread(truncation_thread, truncationProtocol[i], x_flatten+offset, x_flatten+offset, chunk_size, shift, bw, signed_arithmetic, msb_x);
+                int lnum_ops = (i == num_threads - 1) ? dim - offset : chunk_size;
+                truncation_threads[i] = std::thread(truncation_thread, truncationProtocol[i], x_flatten+offset, x_flatten+offset, lnum_ops, shift, bw, signed_arithmetic, msb_x);
             }
             for (int i = 0; i < num_threads; i++) {
                 truncation_threads[i].join();
@@ -116,6 +133,8 @@ class FixPoint {
 
         // for now, only support uint64_t
         void truncate_reduce(Tensor<T> &x, int32_t shift, int32_t bw){
+            if (FixPoint *session = Session(); session != this) return session->truncate_reduce(x, shift, bw);
+            Utils::ProfileScope scope("FixPoint::truncate_reduce", "operator");
             auto shape = x.shape();
             int dim = x.size();
             x.flatten();
@@ -124,7 +143,8 @@ class FixPoint {
             int chunk_size = dim / num_threads;
             for (int i = 0; i < num_threads; i++) {
                 int offset = i * chunk_size;
-                truncation_threads[i] = std::thread(truncate_reduce_thread, truncationProtocol[i], x_flatten+offset, x_flatten+offset, chunk_size, shift, bw);
+                int lnum_ops = (i == num_threads - 1) ? dim - offset : chunk_size;
+                truncation_threads[i] = std::thread(truncate_reduce_thread, truncationProtocol[i], x_flatten+offset, x_flatten+offset, lnum_ops, shift, bw);
             }
             for (int i = 0; i < num_threads; i++) {
                 truncation_threads[i].join();
@@ -134,6 +154,8 @@ class FixPoint {
 
         // for now, T only support uint64_t
         void extend(Tensor<T> &x, int32_t bwA, int32_t bwB, bool msb_zero=false){
+            if (FixPoint *session = Session(); session != this) return session->extend(x, bwA, bwB, msb_zero);
+            Utils::ProfileScope scope("FixPoint::extend", "operator");
             int dim = x.size();
             T* x_flatten = x.data().data();
             std::thread extend_threads[num_threads];
@@ -141,7 +163,8 @@ class FixPoint {
             const bool signed_arithmetic = std::is_signed_v<T>;
             for (int i = 0; i < num_threads; i++) {
                 int offset = i * chunk_size;
-                extend_threads[i] = std::thread(extend_thread, aux[i], x_flatten+offset, x_flatten+offset, chunk_size, bwA, bwB, signed_arithmetic, msb_zero);
+                int lnum_ops = (i == num_threads - 1) ? dim - offset : chunk_size;
+                extend_threads[i] = std::thread(extend_thread, aux[i], x_flatten+offset, x_flatten+offset, lnum_ops, bwA, bwB, signed_arithmetic, msb_zero);
             }
             for (int i = 0; i < num_threads; i++) {
                 extend_threads[i].join();
@@ -160,6 +183,7 @@ class FixPoint {
         using ModulusType = std::conditional_t<std::is_same_v<T, int128_t>, int128_t, uint64_t>;
 
         void check_share(Tensor<T> &x, ModulusType mod, const std::string &name) {
+            if (FixPoint *session = Session(); session != this) return session->check_share(x, mod, name);
             if (mod == 0) {
                 if (party == BOB) {
                     std::cout << "check " << name << ": skipped (mod=0)" << std::endl;
@@ -192,6 +216,8 @@ class FixPoint {
         }
         // Conversion from ring to field
         void Ring2Field(Tensor<T> &x, ModulusType Q, int bitwidth = 0){
+            if (FixPoint *session = Session(); session != this) return session->Ring2Field(x, Q, bitwidth);
+            Utils::ProfileScope scope("FixPoint::Ring2Field", "operator");
             if (bitwidth == 0){
                 bitwidth = x.bitwidth;
             }
@@ -230,6 +256,8 @@ class FixPoint {
 
         // Conversion from Q to bitwidth, if ceil(log2(Q)) > bitwidth, first extend to ceil(log2(Q)), then truncate to bitwidth
         void Field2Ring(Tensor<T> &x, ModulusType Q, int bitwidth = 0){
+            if (FixPoint *session = Session(); session != this) return session->Field2Ring(x, Q, bitwidth);
+            Utils::ProfileScope scope("FixPoint::Field2Ring", "operator");
             if (bitwidth == 0){
                 bitwidth = x.bitwidth; 
             }
@@ -240,7 +268,8 @@ class FixPoint {
                 int chunk_size = x.size() / num_threads;
                 for (int i = 0; i < num_threads; i++) {
                     int offset = i * chunk_size;
-                    field2ring_threads[i] = std::thread(field2ring_thread, aux[i], x.data().data()+offset, x.data().data()+offset, chunk_size, bitwidth, Q, signed_arithmetic);
+                    int lnum_ops = (i == num_threads - 1) ? static_cast<int>(x.size()) - offset : chunk_size;
+                    field2ring_threads[i] = std::thread(field2ring_thread, aux[i], x.data().data()+offset, x.data().data()+offset, lnum_ops, bitwidth, Q, signed_arithmetic);
                 }
                 for (int i = 0; i < num_threads; i++) {
                     field2ring_threads[i].join();
@@ -250,7 +279,8 @@ class FixPoint {
                 std::thread field2ring_threads[num_threads];
                 for (int i = 0; i < num_threads; i++) {
                     int offset = i * chunk_size;
-                    field2ring_threads[i] = std::thread(field2ring_thread_128, aux[i], x.data().data()+offset, x.data().data()+offset, chunk_size, bitwidth, Q, signed_arithmetic);
+                    int lnum_ops = (i == num_threads - 1) ? static_cast<int>(x.size()) - offset : static_cast<int>(chunk_size);
+                    field2ring_threads[i] = std::thread(field2ring_thread_128, aux[i], x.data().data()+offset, x.data().data()+offset, lnum_ops, bitwidth, Q, signed_arithmetic);
                 }
                 for (int i = 0; i < num_threads; i++) {
                     field2ring_threads[i].join();
@@ -260,6 +290,8 @@ class FixPoint {
         
         // return b*input
         void mux(Tensor<uint8_t> &b, Tensor<T> &input, Tensor<T> &result, int32_t bwA, int32_t bwB){
+            if (FixPoint *session = Session(); session != this) return session->mux(b, input, result, bwA, bwB);
+            Utils::ProfileScope scope("FixPoint::mux", "operator");
             int dim = input.size();
             input.flatten();
             T* input_flatten = input.data().data();
@@ -268,33 +300,83 @@ class FixPoint {
             int chunk_size = dim / num_threads;
             for (int i = 0; i < num_threads; i++) {
                 int offset = i * chunk_size;
-                mux_threads[i] = std::thread(mux_thread, aux[i], b.data().data()+offset, input_flatten+offset, result_flatten+offset, chunk_size, bwA, bwB);
+                int lnum_ops = (i == num_threads - 1) ? dim - offset : chunk_size;
+                mux_threads[i] = std::thread(mux_thread, aux[i], b.data().data()+offset, input_flatten+offset, result_flatten+offset, lnum_ops, bwA, bwB);
             }
             for (int i = 0; i < num_threads; i++) {
                 mux_threads[i].join();
             }
         }
     
+        // return the maximum of x along `dim`, result has shape {d0} (dim=1) or {d1} (dim=0)
+        // Tournament tree: every round compares the left and right halves of all rows with a single
+        // batched less_than + mux, so ceil(log2(len)) rounds are needed no matter how many rows there are.
+        // scale is kept for interface compatibility, comparison does not depend on it.
         void max_2d(Tensor<T> &x, Tensor<T> &result, int32_t dim=1, int32_t bw=0, int32_t scale=0){
             if(x.shape().size() != 2){
                 throw std::invalid_argument("max_2d only support 2D tensor");
             }
-            if((bw==0 && x.bitwidth == 0) || (scale==0 && x.scale==0)){
-                throw std::invalid_argument("bw or scale is 0, please set bw and scale for max_2d");
+            if(dim != 0 && dim != 1){
+                throw std::invalid_argument("max_2d only support dim 0 or 1");
+            }
+            if(bw==0 && x.bitwidth == 0){
+                throw std::invalid_argument("bw is 0, please set bw for max_2d");
             }
             if(bw==0){
                 bw = x.bitwidth;
             }
-            if(scale==0){
-                scale = x.scale;
-            }
             uint64_t d0 = x.shape()[0];
             uint64_t d1 = x.shape()[1];
-            result.reshape({d0, d1});
+            uint64_t rows = (dim == 1) ? d0 : d1;
+            uint64_t width = (dim == 1) ? d1 : d0;
+            // candidates of row r live in cur[r*width, (r+1)*width)
+            std::vector<T> cur(rows * width);
+            for (uint64_t r = 0; r < rows; r++){
+                for (uint64_t j = 0; j < width; j++){
+                    cur[r * width + j] = (dim == 1) ? x({r, j}) : x({j, r});
+                }
+            }
+            while (width > 1){
+                uint64_t half = width / 2;
+                uint64_t next_width = half + (width & 1);
+                Tensor<T> lhs({rows * half});
+                Tensor<T> rhs({rows * half});
+                for (uint64_t r = 0; r < rows; r++){
+                    for (uint64_t j = 0; j < half; j++){
+                        lhs(r * half + j) = cur[r * width + j];
+                        rhs(r * half + j) = cur[r * width + half + j];
+                    }
+                }
+                // max(l, r) = l + 1{l < r} * (r - l)
+                Tensor<uint8_t> b({rows * half});
+                less_than(lhs, rhs, b, bw);
+                Tensor<T> diff = rhs - lhs;
+                Tensor<T> sel({rows * half});
+                mux(b, diff, sel, bw, bw);
+                std::vector<T> next(rows * next_width);
+                for (uint64_t r = 0; r < rows; r++){
+                    for (uint64_t j = 0; j < half; j++){
+                        next[r * next_width + j] = lhs(r * half + j) + sel(r * half + j);
+                    }
+                    // odd element gets a bye to the next round
+                    if (width & 1){
+                        next[r * next_width + half] = cur[r * width + width - 1];
+                    }
+                }
+                cur.swap(next);
+                width = next_width;
+            }
+            result = Tensor<T>({rows});
+            result.bitwidth = bw;
+            result.scale = (scale == 0) ? x.scale : scale;
+            for (uint64_t r = 0; r < rows; r++){
+                result(r) = cur[r];
+            }
         }
 
         // Secure rounding protocol
         void secure_round(Tensor<T> &x, int32_t s_fix, int32_t bw_fix, int32_t bw_acc) {
+            if (FixPoint *session = Session(); session != this) return session->secure_round(x, s_fix, bw_fix, bw_acc);
             auto shape = x.shape();
             int dim = x.size();
             x.flatten();
@@ -304,9 +386,10 @@ class FixPoint {
             int chunk_size = dim / num_threads;
             for (int i = 0; i < num_threads; i++) {
                 int offset = i * chunk_size;
+                int lnum_ops = (i == num_threads - 1) ? dim - offset : chunk_size;
                 round_threads[i] = std::thread(secure_round_thread, aux[i], 
                                                 x_flatten + offset, x_flatten + offset, 
-                                                chunk_size, s_fix, bw_fix, bw_acc, party);
+                                                lnum_ops, s_fix, bw_fix, bw_acc, party);
             }
             for (int i = 0; i < num_threads; i++) {
                 round_threads[i].join();
@@ -320,6 +403,8 @@ class FixPoint {
         // Algorithm 3: from b_fix to b_acc with scale change
         void secure_requant(Tensor<T> &x, double scale_in, double scale_out, 
                            int32_t bw_in, int32_t bw_out, int32_t s_fix) {
+            if (FixPoint *session = Session(); session != this) return session->secure_requant(x, scale_in, scale_out, bw_in, bw_out, s_fix);
+            Utils::ProfileScope scope("FixPoint::secure_requant", "operator");
             auto shape = x.shape();
             int dim = x.size();
             x.flatten();
@@ -329,9 +414,10 @@ class FixPoint {
             int chunk_size = dim / num_threads;
             for (int i = 0; i < num_threads; i++) {
                 int offset = i * chunk_size;
+                int lnum_ops = (i == num_threads - 1) ? dim - offset : chunk_size;
                 requant_threads[i] = std::thread(secure_requant_thread, aux[i],
                                                   x_flatten + offset, x_flatten + offset,
-                                                  chunk_size, scale_in, scale_out,
+                                                  lnum_ops, scale_in, scale_out,
                                                   bw_in, bw_out, s_fix, party);
             }
             for (int i = 0; i < num_threads; i++) {
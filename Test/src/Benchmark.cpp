@@ -0,0 +1,423 @@
+#include <Model/ResNet.h>
+#include <LinearLayer/CirLinear.h>
+#include <LinearLayer/Linear.h>
+#include <NonlinearLayer/GeLU.h>
+#include <NonlinearLayer/SiLU.h>
+#include <Utils/loopback_io_channel.h>
+#include <Utils/ArgMapping/ArgMapping.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+using namespace std;
+using namespace Model;
+using namespace LinearLayer;
+using namespace NonlinearLayer;
+
+int32_t bitlength = 16;
+int32_t kScale = 12;
+
+// Two-party benchmark of every layer and protocol. Both parties run as threads of this process
+// over loopback channels, so one invocation measures a case end to end:
+//   ./benchmark -suite all -o bench.jsonl                  sweep and write one JSON object per case
+//   ./benchmark -suite conv -baseline bench.jsonl          rerun and flag regressions
+// wall_ms excludes setup (OT packs, HE keys, weight packing); comm_bytes counts both directions.
+string suite = "all";
+string filter = "";
+string output = "bench_results.jsonl";
+string baseline = "";
+double wall_tolerance = 0.10;
+double comm_tolerance = 0.01;
+int reps = 1;
+bool quick = false;
+
+struct Config {
+  size_t N = 8192;
+  int threads = 4;
+  Datatype::OT_TYPE ot = Datatype::IKNP;
+  Datatype::CONV_TYPE conv = Datatype::CONV_TYPE::Nest;
+};
+
+struct Result {
+  string bench;
+  string params;
+  double wall_ms = 0;
+  uint64_t comm_bytes = 0;
+  uint64_t rounds = 0;
+
+  string key() const { return bench + " " + params; }
+
+  string ToJson() const {
+    ostringstream os;
+    os << std::fixed << std::setprecision(3);
+    os << "{\"bench\":\"" << bench << "\",\"params\":\"" << params << "\",\"wall_ms\":" << wall_ms
+       << ",\"comm_bytes\":" << comm_bytes << ",\"rounds\":" << rounds << "}";
+    return os.str();
+  }
+};
+
+// Times one party's share of a case; the channels are synchronized first so that both parties
+// start the measured region together.
+class Measure {
+public:
+  double wall_ms = 1e30;
+  uint64_t comm_bytes = 0;
+  uint64_t rounds = 0;
+
+  Measure(Utils::NetIO **ioArr, int num_channels) : ioArr(ioArr), num_channels(num_channels) {}
+
+  void operator()(const function<void()> &body) {
+    ioArr[0]->sync();
+    uint64_t comm0 = Comm(), rounds0 = ioArr[0]->num_rounds;
+    auto start = chrono::high_resolution_clock::now();
+    body();
+    double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+    wall_ms = std::min(wall_ms, ms);
+    comm_bytes = Comm() - comm0;
+    rounds = ioArr[0]->num_rounds - rounds0;
+  }
+
+private:
+  Utils::NetIO **ioArr;
+  int num_channels;
+
+  uint64_t Comm() {
+    uint64_t comm = 0;
+    for (int i = 0; i < num_channels; i++) {
+      comm += ioArr[i]->counter;
+    }
+    return comm;
+  }
+};
+
+struct Case {
+  string bench;
+  string params;
+  Config config;
+  function<void(int party, Utils::NetIO **ioArr, Config &config, Measure &measure)> run;
+};
+
+string Params(const Config &c, const string &shape) {
+  ostringstream os;
+  os << shape << " N=" << c.N << " threads=" << c.threads
+     << " ot=" << (c.ot == Datatype::VOLE ? "VOLE" : "IKNP")
+     << " conv=" << (c.conv == Datatype::CONV_TYPE::Nest ? "Nest" : "Cheetah");
+  return os.str();
+}
+
+// ---------------------------------------------------------------------------------------------
+// Cases. Layers built from dimensions get random weights on ALICE and a random input share on
+// both sides; the benchmark measures cost, correctness stays with the Test* programs.
+
+CryptoPrimitive<uint64_t> *Primitive(int party, Utils::NetIO **ioArr, Config &c) {
+  return new CryptoPrimitive<uint64_t>(party, ioArr, c.threads, bitlength, c.ot, c.N, 60, c.conv, Datatype::HOST);
+}
+
+template <typename Layer, typename Make>
+void RunLinear(int party, Utils::NetIO **ioArr, Config &c, Measure &measure, vector<size_t> in_shape, Make make) {
+  CryptoPrimitive<uint64_t> *cp = Primitive(party, ioArr, c);
+  Layer *layer = make(cp->HE);
+  Tensor<uint64_t> x(in_shape);
+  x.randomize(1ULL << 16);
+  for (int r = 0; r < reps; r++) {
+    measure([&] { (*layer)(x); });
+  }
+  delete layer;
+  delete cp;
+}
+
+void AddConvCases(vector<Case> &cases, const vector<Config> &configs) {
+  struct Shape { uint64_t H, Ci, Co, k, s; };
+  vector<Shape> shapes = {{32, 16, 16, 3, 1}, {32, 16, 32, 3, 2}, {16, 64, 64, 3, 1}, {8, 128, 128, 1, 1}};
+  if (quick) {
+    shapes.resize(1);
+  }
+  for (const Config &config : configs) {
+    for (const Shape &s : shapes) {
+      ostringstream shape;
+      shape << "H=" << s.H << " Ci=" << s.Ci << " Co=" << s.Co << " k=" << s.k << " s=" << s.s;
+      vector<size_t> in_shape = {s.Ci, s.H, s.H};
+      cases.push_back({"Conv2DNest", Params(config, shape.str()), config, [=](int party, Utils::NetIO **ioArr, Config &c, Measure &m) {
+        RunLinear<Conv2D>(party, ioArr, c, m, in_shape, [&](HE::HEEvaluator *he) { return new Conv2DNest(s.H, s.Ci, s.Co, s.k, s.s, he); });
+      }});
+      cases.push_back({"Conv2DCheetah", Params(config, shape.str()), config, [=](int party, Utils::NetIO **ioArr, Config &c, Measure &m) {
+        RunLinear<Conv2D>(party, ioArr, c, m, in_shape, [&](HE::HEEvaluator *he) { return new Conv2DCheetah(s.H, s.Ci, s.Co, s.k, s.s, he); });
+      }});
+      cases.push_back({"CirConv2D", Params(config, shape.str() + " b=8"), config, [=](int party, Utils::NetIO **ioArr, Config &c, Measure &m) {
+        RunLinear<Conv2D>(party, ioArr, c, m, in_shape, [&](HE::HEEvaluator *he) { return new CirConv2D(s.H, s.Ci, s.Co, s.k, s.s, 8, he); });
+      }});
+    }
+  }
+}
+
+void AddLinearCases(vector<Case> &cases, const vector<Config> &configs) {
+  struct Shape { uint64_t d0, d1, d2; };
+  vector<Shape> shapes = {{1, 768, 768}, {16, 768, 3072}, {128, 768, 768}};
+  if (quick) {
+    shapes.resize(1);
+  }
+  for (const Config &config : configs) {
+    for (const Shape &s : shapes) {
+      ostringstream shape;
+      shape << "d0=" << s.d0 << " d1=" << s.d1 << " d2=" << s.d2;
+      vector<size_t> in_shape = {s.d0, s.d1};
+      cases.push_back({"LinearBolt", Params(config, shape.str()), config, [=](int party, Utils::NetIO **ioArr, Config &c, Measure &m) {
+        RunLinear<Linear>(party, ioArr, c, m, in_shape, [&](HE::HEEvaluator *he) { return new LinearBolt(s.d0, s.d1, s.d2, he); });
+      }});
+      cases.push_back({"LinearNest", Params(config, shape.str()), config, [=](int party, Utils::NetIO **ioArr, Config &c, Measure &m) {
+        RunLinear<Linear>(party, ioArr, c, m, in_shape, [&](HE::HEEvaluator *he) { return new LinearNest(s.d0, s.d1, s.d2, he); });
+      }});
+      cases.push_back({"CirLinearNest", Params(config, shape.str() + " b=16"), config, [=](int party, Utils::NetIO **ioArr, Config &c, Measure &m) {
+        RunLinear<CirLinearNest>(party, ioArr, c, m, in_shape, [&](HE::HEEvaluator *he) { return new CirLinearNest(s.d0, s.d1, s.d2, 16, he); });
+      }});
+    }
+  }
+}
+
+// Element-wise protocols on FixPoint / ReLU, dim elements each.
+void AddNonlinearCases(vector<Case> &cases, const vector<Config> &configs) {
+  vector<size_t> dims = {1 << 12, 1 << 16};
+  if (quick) {
+    dims.resize(1);
+  }
+  typedef function<void(CryptoPrimitive<uint64_t> *, Tensor<uint64_t> &)> Op;
+  vector<pair<string, Op>> ops = {
+      {"ReLU", [](CryptoPrimitive<uint64_t> *cp, Tensor<uint64_t> &x) { (*cp->relu)(x); }},
+      {"truncate", [](CryptoPrimitive<uint64_t> *cp, Tensor<uint64_t> &x) { cp->fixpoint->truncate(x, kScale, 32); }},
+      {"extend", [](CryptoPrimitive<uint64_t> *cp, Tensor<uint64_t> &x) { cp->fixpoint->extend(x, 16, 32); }},
+      {"Ring2Field", [](CryptoPrimitive<uint64_t> *cp, Tensor<uint64_t> &x) { cp->fixpoint->Ring2Field(x, cp->HE->plain_mod, 16); }},
+      {"Field2Ring", [](CryptoPrimitive<uint64_t> *cp, Tensor<uint64_t> &x) { cp->fixpoint->Field2Ring(x, cp->HE->plain_mod, 16); }},
+  };
+  for (const Config &config : configs) {
+    for (size_t dim : dims) {
+      string params = Params(config, "dim=" + to_string(dim));
+      for (auto &op : ops) {
+        Op fn = op.second;
+        cases.push_back({op.first, params, config, [=](int party, Utils::NetIO **ioArr, Config &c, Measure &m) {
+          CryptoPrimitive<uint64_t> *cp = Primitive(party, ioArr, c);
+          Tensor<uint64_t> x({dim});
+          for (int r = 0; r < reps; r++) {
+            x.randomize(1ULL << 16);
+            x.bitwidth = 16;
+            m([&] { fn(cp, x); });
+          }
+          delete cp;
+        }});
+      }
+      // GeLU / SiLU evaluate their polynomial under HE with a 32-bit plaintext and short chain
+      for (string act : {"GeLU", "SiLU"}) {
+        cases.push_back({act, params, config, [=](int party, Utils::NetIO **ioArr, Config &c, Measure &m) {
+          CryptoPrimitive<uint64_t> *cp = Primitive(party, ioArr, c);
+          HE::HEEvaluator he(ioArr[0], party, c.N, bitlength * 2, Datatype::HOST, {60, 33, 33});
+          he.GenerateNewKey();
+          Tensor<uint64_t> x({dim});
+          for (int r = 0; r < reps; r++) {
+            x.randomize(1ULL << bitlength);
+            if (act == "GeLU") {
+              GeLU<uint64_t> layer(cp->fixpoint, &he, bitlength, kScale);
+              m([&] { layer(x); });
+            } else {
+              SiLU<uint64_t> layer(cp->fixpoint, &he, bitlength, kScale);
+              m([&] { layer(x); });
+            }
+          }
+          delete cp;
+        }});
+      }
+    }
+  }
+}
+
+void AddBlockCases(vector<Case> &cases, const vector<Config> &configs) {
+  struct Shape { uint64_t H, in_planes, planes, stride; bool bottleneck; };
+  vector<Shape> shapes = {{32, 16, 16, 1, false}, {32, 16, 32, 2, false}, {16, 64, 16, 1, true}};
+  if (quick) {
+    shapes.resize(1);
+  }
+  for (const Config &config : configs) {
+    for (const Shape &s : shapes) {
+      ostringstream shape;
+      shape << "H=" << s.H << " in=" << s.in_planes << " planes=" << s.planes << " s=" << s.stride;
+      string bench = s.bottleneck ? "Bottleneck" : "BasicBlock";
+      cases.push_back({bench, Params(config, shape.str()), config, [=](int party, Utils::NetIO **ioArr, Config &c, Measure &m) {
+        CryptoPrimitive<uint64_t> *cp = Primitive(party, ioArr, c);
+        Tensor<uint64_t> x({s.in_planes, s.H, s.H});
+        x.randomize(1ULL << 16);
+        if (s.bottleneck) {
+          Bottleneck<uint64_t> block(s.H, s.in_planes, s.planes, s.stride, cp);
+          for (int r = 0; r < reps; r++) {
+            m([&] { block(x); });
+          }
+        } else {
+          BasicBlock<uint64_t> block(s.H, s.in_planes, s.planes, s.stride, cp);
+          for (int r = 0; r < reps; r++) {
+            m([&] { block(x); });
+          }
+        }
+        delete cp;
+      }});
+    }
+  }
+}
+
+// Sweep axes: HE layers over N and threads, OT protocols over threads and OT type, blocks over
+// the conv packing.
+vector<Case> BuildCases() {
+  vector<Config> he_configs, ot_configs, block_configs;
+  for (size_t N : {8192, 16384}) {
+    for (int threads : {1, 4}) {
+      Config c;
+      c.N = N;
+      c.threads = threads;
+      he_configs.push_back(c);
+    }
+  }
+  for (Datatype::OT_TYPE ot : {Datatype::IKNP, Datatype::VOLE}) {
+    for (int threads : {1, 4}) {
+      Config c;
+      c.ot = ot;
+      c.threads = threads;
+      ot_configs.push_back(c);
+    }
+  }
+  for (Datatype::CONV_TYPE conv : {Datatype::CONV_TYPE::Nest, Datatype::CONV_TYPE::Cheetah}) {
+    Config c;
+    c.conv = conv;
+    block_configs.push_back(c);
+  }
+  if (quick) {
+    he_configs.resize(1);
+    ot_configs.resize(1);
+    block_configs.resize(1);
+  }
+  vector<Case> cases;
+  if (suite == "all" || suite == "conv") AddConvCases(cases, he_configs);
+  if (suite == "all" || suite == "linear") AddLinearCases(cases, he_configs);
+  if (suite == "all" || suite == "nonlinear") AddNonlinearCases(cases, ot_configs);
+  if (suite == "all" || suite == "block") AddBlockCases(cases, block_configs);
+  return cases;
+}
+
+Result RunCase(Case &c) {
+  Measure alice(nullptr, 0), bob(nullptr, 0);
+  Utils::RunTwoParty(
+      [&](Utils::NetIO **ioArr) {
+        alice = Measure(ioArr, c.config.threads);
+        c.run(ALICE, ioArr, c.config, alice);
+      },
+      [&](Utils::NetIO **ioArr) {
+        bob = Measure(ioArr, c.config.threads);
+        c.run(BOB, ioArr, c.config, bob);
+      },
+      c.config.threads);
+  Result r;
+  r.bench = c.bench;
+  r.params = c.params;
+  r.wall_ms = std::max(alice.wall_ms, bob.wall_ms);
+  r.comm_bytes = alice.comm_bytes + bob.comm_bytes;
+  r.rounds = std::max(alice.rounds, bob.rounds);
+  return r;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Baseline comparison
+
+string JsonField(const string &line, const string &key) {
+  size_t pos = line.find("\"" + key + "\":");
+  if (pos == string::npos) {
+    return "";
+  }
+  pos += key.size() + 3;
+  if (line[pos] == '"') {
+    return line.substr(pos + 1, line.find('"', pos + 1) - pos - 1);
+  }
+  return line.substr(pos, line.find_first_of(",}", pos) - pos);
+}
+
+map<string, Result> LoadBaseline(const string &path) {
+  map<string, Result> results;
+  ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("cannot open baseline " + path);
+  }
+  string line;
+  while (getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    Result r;
+    r.bench = JsonField(line, "bench");
+    r.params = JsonField(line, "params");
+    r.wall_ms = stod(JsonField(line, "wall_ms"));
+    r.comm_bytes = stoull(JsonField(line, "comm_bytes"));
+    r.rounds = stoull(JsonField(line, "rounds"));
+    results[r.key()] = r;
+  }
+  return results;
+}
+
+// Wall time may drift by wall_tolerance; traffic and rounds are deterministic up to the
+// protocol's randomness and get the much tighter comm_tolerance.
+bool Compare(const Result &now, const Result &base) {
+  bool regressed = false;
+  auto check = [&](const char *metric, double value, double reference, double tolerance) {
+    if (value > reference * (1 + tolerance)) {
+      cout << "REGRESSION " << now.key() << ": " << metric << " " << reference << " -> " << value
+           << " (+" << (value / reference - 1) * 100 << "%)" << endl;
+      regressed = true;
+    } else if (value < reference * (1 - tolerance)) {
+      cout << "improved   " << now.key() << ": " << metric << " " << reference << " -> " << value << endl;
+    }
+  };
+  check("wall_ms", now.wall_ms, base.wall_ms, wall_tolerance);
+  check("comm_bytes", now.comm_bytes, base.comm_bytes, comm_tolerance);
+  check("rounds", now.rounds, base.rounds, comm_tolerance);
+  return regressed;
+}
+
+int main(int argc, char **argv) {
+  ArgMapping amap;
+  amap.arg("suite", suite, "all | conv | linear | nonlinear | block");
+  amap.arg("filter", filter, "only run benches whose name contains this string");
+  amap.arg("o", output, "results file, one JSON object per line");
+  amap.arg("baseline", baseline, "results file to compare against");
+  amap.arg("tol", wall_tolerance, "allowed relative wall-time increase");
+  amap.arg("comm_tol", comm_tolerance, "allowed relative communication/rounds increase");
+  amap.arg("reps", reps, "repetitions per case, the fastest is reported");
+  amap.arg("quick", quick, "first shape and configuration of every sweep only");
+  amap.parse(argc, argv);
+
+  map<string, Result> base;
+  if (!baseline.empty()) {
+    base = LoadBaseline(baseline);
+  }
+
+  vector<Case> cases = BuildCases();
+  ofstream out(output);
+  int regressions = 0, compared = 0;
+  for (Case &c : cases) {
+    if (!filter.empty() && c.bench.find(filter) == string::npos) {
+      continue;
+    }
+    cout << "[bench] " << c.bench << " " << c.params << endl;
+    Result r = RunCase(c);
+    cout << "[bench] " << r.ToJson() << endl;
+    out << r.ToJson() << endl;
+    auto it = base.find(r.key());
+    if (it != base.end()) {
+      compared++;
+      regressions += Compare(r, it->second);
+    }
+  }
+
+  if (!baseline.empty()) {
+    cout << "[bench] compared " << compared << " cases against " << baseline << ", " << regressions
+         << " regressed" << endl;
+  }
+  return regressions == 0 ? 0 : 1;
+}
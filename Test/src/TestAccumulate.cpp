@@ -0,0 +1,78 @@
+#include <HE/unified/UnifiedContext.h>
+#include <HE/unified/UnifiedEncoder.h>
+#include <HE/unified/UnifiedEvaluator.h>
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+using namespace std;
+using namespace HE::unified;
+
+// multiply_plain_ntt_accumulate against a multiply_plain + add per product, over more products
+// than either path reduces after: 2^12 - 1 on the IFMA path (primes up to 50 bits) and
+// 2^(128 - 2 * 60) for the 60-bit primes. Half of the products have every coefficient of both
+// operands at q - 1, the largest the accumulators can see.
+int main(int argc, char **argv) {
+  const size_t N = 8192;
+  const size_t num_products = 4100;
+  UnifiedContext context(N, 20, {50, 60, 60});
+  seal::KeyGenerator keygen(context);
+  seal::PublicKey pk;
+  keygen.create_public_key(pk);
+  seal::Encryptor encryptor(context, pk);
+  UnifiedBatchEncoder encoder(context);
+  UnifiedEvaluator evaluator(context);
+  const seal::parms_id_type parms_id = context.hcontext().first_parms_id();
+  const vector<seal::Modulus> &coeff_modulus = context.hcontext().first_context_data()->parms().coeff_modulus();
+
+  // operand 0 is all q - 1, the others are encryptions of random values
+  const size_t num_operands = 4;
+  mt19937_64 rng(7);
+  vector<UnifiedCiphertext> cts;
+  vector<UnifiedPlaintext> pts;
+  for (size_t i = 0; i < num_operands; i++) {
+    cts.emplace_back(HOST);
+    pts.emplace_back(HOST);
+    vector<uint64_t> values(N);
+    for (auto &v : values) {
+      v = rng() % (1 << 19);
+    }
+    encoder.encode(values, pts[i]);
+    encryptor.encrypt(pts[i], cts[i]);
+    evaluator.transform_to_ntt_inplace(cts[i]);
+    evaluator.transform_to_ntt_inplace(pts[i], parms_id);
+  }
+  for (size_t j = 0; j < coeff_modulus.size(); j++) {
+    const uint64_t max = coeff_modulus[j].value() - 1;
+    for (size_t p = 0; p < cts[0].hcipher().size(); p++) {
+      fill_n(cts[0].hcipher().data(p) + j * N, N, max);
+    }
+    fill_n(pts[0].hplain().data() + j * N, N, max);
+  }
+
+  vector<const UnifiedCiphertext *> a;
+  vector<const UnifiedPlaintext *> b;
+  for (size_t t = 0; t < num_products; t++) {
+    bool largest = t % 2 == 0;
+    a.push_back(&cts[largest ? 0 : 1 + t % 3]);
+    b.push_back(&pts[largest ? 0 : 1 + (t / 2) % 3]);
+  }
+
+  UnifiedCiphertext result(HOST), expected(HOST), product(HOST);
+  evaluator.multiply_plain_ntt_accumulate(a, b, result);
+  evaluator.multiply_plain(*a[0], *b[0], expected);
+  for (size_t t = 1; t < num_products; t++) {
+    evaluator.multiply_plain(*a[t], *b[t], product);
+    evaluator.add_inplace(expected, product);
+  }
+
+  const seal::Ciphertext &x = result.hcipher(), &y = expected.hcipher();
+  bool ok = x.is_ntt_form() && x.size() == y.size() && x.dyn_array().size() == y.dyn_array().size() &&
+            equal(x.data(), x.data() + x.dyn_array().size(), y.data());
+  cout << num_products << " products, primes of";
+  for (auto &q : coeff_modulus) {
+    cout << " " << q.bit_count();
+  }
+  cout << " bits: " << (ok ? "ok" : "FAILED") << endl;
+  return ok ? 0 : 1;
+}
@@ -56,6 +56,7 @@ Tensor<uint64_t> create_block_circulant_conv_weight(
 
 /**
  * Compute expected convolution output via brute force.
+ * A batch is stacked along the channels: {B * Ci, H, H} -> {B * Co, H', H'}.
  */
 Tensor<uint64_t> compute_expected_conv(
     const Tensor<uint64_t>& input,
@@ -63,27 +64,29 @@ Tensor<uint64_t> compute_expected_conv(
     uint64_t Ci, uint64_t Co,
     uint64_t H, uint64_t kernel_size,
     uint64_t stride, uint64_t pad,
-    uint64_t plain_mod)
+    uint64_t plain_mod,
+    uint64_t batch = 1)
 {
     uint64_t H_out = (H + 2 * pad - kernel_size) / stride + 1;
     uint64_t W_out = H_out;
-    Tensor<uint64_t> expected({Co, H_out, W_out});
+    Tensor<uint64_t> expected({batch * Co, H_out, W_out});
 
-    Tensor<uint64_t> padded_input({Ci, H + 2 * pad, H + 2 * pad});
-    for (uint64_t c = 0; c < Ci; c++)
+    Tensor<uint64_t> padded_input({batch * Ci, H + 2 * pad, H + 2 * pad});
+    for (uint64_t c = 0; c < batch * Ci; c++)
         for (uint64_t i = 0; i < H; i++)
             for (uint64_t j = 0; j < H; j++)
                 padded_input({c, i + pad, j + pad}) = input({c, i, j});
 
-    for (uint64_t co = 0; co < Co; co++) {
+    for (uint64_t co = 0; co < batch * Co; co++) {
+        uint64_t b = co / Co;
         for (uint64_t i = 0; i < H_out; i++) {
             for (uint64_t j = 0; j < W_out; j++) {
                 __uint128_t acc = 0;
                 for (uint64_t ci = 0; ci < Ci; ci++) {
                     for (uint64_t m = 0; m < kernel_size; m++) {
                         for (uint64_t n = 0; n < kernel_size; n++) {
-                            acc += (__uint128_t)padded_input({ci, i * stride + m, j * stride + n})
-                                   * weight({co, ci, m, n});
+                            acc += (__uint128_t)padded_input({b * Ci + ci, i * stride + m, j * stride + n})
+                                   * weight({co % Co, ci, m, n});
                         }
                     }
                 }
@@ -121,18 +124,21 @@ int main(int argc, char **argv) {
 
     struct Case {
         uint64_t Ci, Co, H, kernel, stride, padding;
+        uint64_t batch = 1;
     };
 
     std::vector<Case> cases = {
         {4, 4, 4, 3, 1, 1},
         {8, 8, 4, 3, 1, 1},
+        {4, 4, 4, 3, 1, 1, 2},
+        {8, 8, 4, 3, 1, 1, 4},
     };
 
     if (party == ALICE) {
         cout << "\n========== CirConv2D Test ==========\n";
         cout << "-----------------------------------------------------------\n";
         cout << setw(4) << "Ci" << setw(4) << "Co" << setw(4) << "H"
-             << setw(4) << "K" << setw(6) << "blk" << setw(8) << "ntt"
+             << setw(4) << "K" << setw(4) << "B" << setw(6) << "blk" << setw(8) << "ntt"
              << setw(6) << "tile" << setw(8) << "status" << "\n";
         cout << "-----------------------------------------------------------\n";
     }
@@ -140,16 +146,17 @@ int main(int argc, char **argv) {
     for (const auto& tc : cases) {
         uint64_t Ci = tc.Ci, Co = tc.Co, H = tc.H;
         uint64_t kernelSize = tc.kernel, s = tc.stride, pad = tc.padding;
+        uint64_t B = tc.batch;
 
         for (uint64_t block_size = 1; block_size <= Ci; block_size *= 2) {
             if (Ci % block_size != 0 || Co % block_size != 0) continue;
 
-            Tensor<uint64_t> input({Ci, H, H});
+            Tensor<uint64_t> input({B * Ci, H, H});  // images stacked along the channels
             Tensor<uint64_t> weight = create_block_circulant_conv_weight(Co, Ci, kernelSize, block_size);
             Tensor<uint64_t> bias({Co});
 
             if (party == ALICE) {
-                for (uint64_t c = 0; c < Ci; c++)
+                for (uint64_t c = 0; c < B * Ci; c++)
                     for (uint64_t i = 0; i < H; i++)
                         for (uint64_t j = 0; j < H; j++)
                             input({c, i, j}) = (c + i + j + 1) % 5;
@@ -161,10 +168,14 @@ int main(int argc, char **argv) {
             }
 
             Tensor<uint64_t> expected = compute_expected_conv(
-                input, weight, Ci, Co, H, kernelSize, s, pad, HE.plain_mod);
+                input, weight, Ci, Co, H, kernelSize, s, pad, HE.plain_mod, B);
 
-            CirConv2D layer(H, s, pad, block_size, weight, bias, &HE);
+            CirConv2D layer(H, s, pad, block_size, weight, bias, &HE, B);
+            if (B > 1) {
+                input.reshape({B, Ci, H, H});
+            }
             Tensor<uint64_t> output = layer(input);
+            output.reshape(expected.shape());
 
             if (party == ALICE) {
                 Tensor<uint64_t> output_peer(output.shape());
@@ -172,7 +183,7 @@ int main(int argc, char **argv) {
                 bool pass = verify_result(output, output_peer, expected, HE.plain_mod);
 
                 cout << setw(4) << Ci << setw(4) << Co << setw(4) << H
-                     << setw(4) << kernelSize << setw(6) << block_size
+                     << setw(4) << kernelSize << setw(4) << B << setw(6) << block_size
                      << setw(8) << layer.ntt_size << setw(6) << layer.tile_size
                      << setw(8) << (pass ? "PASS" : "FAIL") << "\n";
 
@@ -1,8 +1,10 @@
+#include <LinearLayer/BatchNorm.h>
 #include <LinearLayer/Conv.h>
 // #include <Model/ResNet.h>
 #include <Utils/ArgMapping/ArgMapping.h>
 #include <iostream>
 #include <vector>
+#include <cmath>
 
 int party, port = 32000;
 int num_threads = 2;
@@ -29,7 +31,16 @@ int main(int argc, char **argv){
         uint64_t kernel;
         uint64_t stride;
         uint64_t padding;
+        uint64_t batch = 1;
+        bool compact = true;  // Conv2DNest row layout, false pads rows to a power of two
+        bool polyphase = false;  // Conv2DPolyphase over a Conv2DNest
+        bool fused = false;      // Conv2DFused with a 1x1 shortcut branch, checks the conv branch
+        bool pruned = false;     // only the kernels with (o + c) % 4 == 0 are nonzero
+        CONV_TYPE type = CONV_TYPE::Nest;  // Cheetah runs a plain Conv2DCheetah
+        bool folded = false;     // fold_scale(1/9, fold_shift) into the layer, as after a 3x3 average pool
+        bool bn = false;         // fold a BatchNorm2D into the layer with fold_shift fractional bits
     };
+    const int fold_shift = 12;
 
     std::vector<Case> cases = {
         {3, 4, 4, 3, 1, 1},
@@ -38,7 +49,31 @@ int main(int argc, char **argv){
         {32, 64, 16, 3, 1, 1},
         {64, 64, 16, 1, 1, 0},
         {64, 128, 16, 3, 2, 1},
-        {128, 128, 8, 3, 1, 1}
+        {128, 128, 8, 3, 1, 1},
+        {3, 4, 4, 3, 1, 1, 4},
+        {16, 16, 8, 3, 1, 1, 2},
+        {16, 32, 8, 3, 2, 1, 4},
+        {16, 16, 32, 3, 1, 1, 1, false},
+        {4, 8, 64, 3, 1, 1},          // spatially tiled
+        {3, 8, 70, 7, 2, 3},          // spatially tiled, strided
+        {4, 8, 64, 3, 1, 1, 2},       // spatially tiled batch
+        {16, 32, 32, 3, 2, 1, 1, true, true},
+        {16, 32, 32, 1, 2, 0, 1, true, true},
+        {16, 32, 8, 3, 2, 1, 4, true, true},
+        {16, 32, 32, 3, 2, 1, 1, true, false, true},
+        {16, 32, 32, 3, 2, 1, 1, true, true, true},
+        {64, 64, 16, 3, 1, 1, 1, true, false, false, true},
+        {16, 16, 8, 1, 1, 0, 4, true, false, false, true},
+        {3, 4, 4, 3, 1, 1, 1, true, false, false, false, CONV_TYPE::Cheetah},
+        {3, 4, 4, 3, 1, 1, 4, true, false, false, false, CONV_TYPE::Cheetah},
+        {16, 16, 8, 3, 1, 1, 2, true, false, false, false, CONV_TYPE::Cheetah},
+        {16, 32, 8, 3, 2, 1, 4, true, false, false, false, CONV_TYPE::Cheetah},
+        {16, 10, 8, 3, 1, 1, 1, true, false, false, false, CONV_TYPE::Nest, true},
+        {64, 10, 1, 1, 1, 0, 2, true, false, false, false, CONV_TYPE::Nest, true},
+        {16, 16, 8, 3, 1, 1, 2, true, false, false, false, CONV_TYPE::Cheetah, true},
+        {16, 10, 8, 3, 1, 1, 1, true, false, false, false, CONV_TYPE::Nest, false, true},
+        {16, 16, 8, 3, 2, 1, 2, true, false, false, false, CONV_TYPE::Nest, false, true},
+        {16, 16, 8, 3, 1, 1, 2, true, false, false, false, CONV_TYPE::Cheetah, false, true}
     };
 
     std::vector<double> case_ratios(cases.size(), -1.0);
@@ -52,15 +87,24 @@ int main(int argc, char **argv){
         uint64_t kernelSize = tc.kernel;
         uint64_t s = tc.stride;
         uint64_t padding = tc.padding;
+        uint64_t B = tc.batch;
 
         std::cout << "[Case " << case_idx << "] start Ci=" << Ci
               << " Co=" << Co
               << " H=" << H
               << " K=" << kernelSize
               << " S=" << s
-              << " P=" << padding << std::endl;
+              << " P=" << padding
+              << " B=" << B
+              << " compact=" << tc.compact
+              << " polyphase=" << tc.polyphase
+              << " fused=" << tc.fused
+              << " pruned=" << tc.pruned
+              << " cheetah=" << (tc.type == CONV_TYPE::Cheetah)
+              << " folded=" << tc.folded
+              << " bn=" << tc.bn << std::endl;
 
-        Tensor<uint64_t> input({Ci, H, W});
+        Tensor<uint64_t> input({B * Ci, H, W});  // images stacked along the channels
         Tensor<uint64_t> weight({Co, Ci, kernelSize, kernelSize});
         Tensor<uint64_t> bias({Co});
 
@@ -69,18 +113,21 @@ int main(int argc, char **argv){
                 for (uint32_t j = 0; j < Ci; j++) {
                     for (uint32_t p = 0; p < kernelSize; p++) {
                         for (uint32_t q = 0; q < kernelSize; q++) {
-                            weight({i, j, p, q}) = (i + j + p + q) % 7;
+                            weight({i, j, p, q}) = tc.pruned && (i + j) % 4 ? 0 : (i + j + p + q) % 7;
                         }
                     }
                 }
             }
-            for (uint32_t i = 0; i < Ci; i++) {
+            for (uint32_t i = 0; i < B * Ci; i++) {
                 for (uint32_t j = 0; j < H; j++) {
                     for (uint32_t p = 0; p < W; p++) {
                         input({i, j, p}) = (i + j + p + 1) % 5;
                     }
                 }
             }
+            for (uint32_t i = 0; i < Co; i++) {
+                bias(i) = i % 3;  // added by the server while masking the HEToSS
+            }
         } else {
             for (uint32_t i = 0; i < Co; i++) {
                 for (uint32_t j = 0; j < Ci; j++) {
@@ -91,7 +138,7 @@ int main(int argc, char **argv){
                     }
                 }
             }
-            for (uint32_t i = 0; i < Ci; i++) {
+            for (uint32_t i = 0; i < B * Ci; i++) {
                 for (uint32_t j = 0; j < H; j++) {
                     for (uint32_t p = 0; p < W; p++) {
                         input({i, j, p}) = 0;
@@ -100,17 +147,62 @@ int main(int argc, char **argv){
             }
         }
 
-        Conv2D* conv1 = new Conv2DNest(H, s, padding, weight, bias, &HE);
+        Conv2D* conv1;
+        if (tc.fused) {
+            Tensor<uint64_t> shortcut_weight({Co, Ci, 1, 1});
+            if (party == ALICE) {
+                shortcut_weight.randomize(16);
+            }
+            conv1 = new Conv2DFused(H, {{Co, kernelSize, s, padding}, {Co, 1, s, 0}}, {weight, shortcut_weight}, {bias, bias}, &HE, CONV_TYPE::Nest, tc.polyphase, B);
+        } else if (tc.type == CONV_TYPE::Cheetah) {
+            conv1 = new Conv2DCheetah(H, s, padding, weight, bias, &HE, B);
+        } else if (tc.polyphase) {
+            conv1 = new Conv2DPolyphase(H, s, padding, weight, bias, &HE, CONV_TYPE::Nest, B);
+        } else {
+            conv1 = new Conv2DNest(H, s, padding, weight, bias, &HE, B, tc.compact);
+        }
+        // weights take round(2^shift / 9), the bias only the 2^shift of the output
+        const int64_t fold_factor = tc.folded ? llround(static_cast<double>(1 << fold_shift) / 9.0) : 1;
+        const int64_t fold_bias = tc.folded ? int64_t(1) << fold_shift : 1;
+        if (tc.folded) {
+            conv1->fold_scale(1.0 / 9.0, fold_shift);
+        }
+        // negative shifts and a non-trivial scale in every channel; the client only marks the fold
+        BatchNorm2D bn(Co);
+        std::vector<int64_t> bn_scale(Co), bn_shift(Co);
+        if (tc.bn) {
+            for (uint64_t c = 0; c < Co; c++) {
+                if (party == ALICE) {
+                    bn.gamma[c] = 0.5 + 0.25 * (c % 4);
+                    bn.beta[c] = 0.5 * (c % 3) - 1.0;
+                    bn.running_mean[c] = c % 5;
+                    bn.running_var[c] = 1.0 + c % 3;
+                }
+                double a = bn.gamma[c] / std::sqrt(bn.running_var[c] + bn.eps);
+                bn_scale[c] = llround(std::ldexp(a, fold_shift));
+                bn_shift[c] = llround(std::ldexp(bn.beta[c] - a * bn.running_mean[c], fold_shift));
+            }
+            bn.FoldInto(conv1, 0, fold_shift);
+        }
         size_t H_out = (H - kernelSize + 2 * padding) / s + 1;
         size_t W_out = (W - kernelSize + 2 * padding) / s + 1;
-        Tensor<uint64_t> output({Co, H_out, W_out});
-        output = conv1->operator()(input);
+        Tensor<uint64_t> output({B * Co, H_out, W_out});
+        if (B > 1) {
+            input.reshape({B, Ci, H, W});
+        }
+        if (tc.fused) {
+            output = static_cast<Conv2DFused*>(conv1)->Forward(input)[0];
+        } else {
+            output = conv1->operator()(input);
+        }
+        input.reshape({B * Ci, H, W});
+        output.reshape({B * Co, H_out, W_out});
         if (party == ALICE) {
             Tensor<uint64_t> output_peer(output.shape());
             netio->recv_data(output_peer.data().data(), output_peer.size() * sizeof(uint64_t));
 
-            Tensor<uint64_t> padded_input({Ci, H + 2 * padding, W + 2 * padding});
-            for (uint64_t c = 0; c < Ci; c++) {
+            Tensor<uint64_t> padded_input({B * Ci, H + 2 * padding, W + 2 * padding});
+            for (uint64_t c = 0; c < B * Ci; c++) {
                 for (uint64_t i = 0; i < H; i++) {
                     for (uint64_t j = 0; j < W; j++) {
                         padded_input({c, i + padding, j + padding}) = input({c, i, j});
@@ -118,21 +210,28 @@ int main(int argc, char **argv){
                 }
             }
 
-            Tensor<int64_t> expected({Co, H_out, W_out});
-            for (size_t m = 0; m < Co; m++) {
+            Tensor<int64_t> expected({B * Co, H_out, W_out});
+            Tensor<double> expected_bn({B * Co, H_out, W_out});  // the BatchNorm in floating point
+            for (size_t m = 0; m < B * Co; m++) {
                 for (size_t i = 0; i < H_out; i++) {
                     for (size_t j = 0; j < W_out; j++) {
-                        int64_t sum = 0;
+                        int64_t sum = bias(m % Co) * fold_bias;
                         uint64_t in_i = i * s;
                         uint64_t in_j = j * s;
 
                         for (size_t c = 0; c < Ci; c++) {
                             for (size_t p = 0; p < kernelSize; p++) {
                                 for (size_t q = 0; q < kernelSize; q++) {
-                                    sum += padded_input({c, in_i + p, in_j + q}) * weight({m, c, p, q});
+                                    sum += padded_input({m / Co * Ci + c, in_i + p, in_j + q}) * weight({m % Co, c, p, q}) * fold_factor;
                                 }
                             }
                         }
+                        if (tc.bn) {
+                            const uint64_t o = m % Co;
+                            double a = bn.gamma[o] / std::sqrt(bn.running_var[o] + bn.eps);
+                            expected_bn({m, i, j}) = a * (sum - bn.running_mean[o]) + bn.beta[o];
+                            sum = sum * bn_scale[o] + bn_shift[o];
+                        }
                         expected({m, i, j}) = sum;
                     }
                 }
@@ -141,14 +240,23 @@ int main(int argc, char **argv){
             expected.print();
             Tensor<uint64_t> reconstructed(output.shape());
             uint64_t mismatches = 0;
+            double max_bn_error = 0;
+            const int64_t t = static_cast<int64_t>(HE.plain_mod);
             for (uint64_t i = 0; i < output.size(); i++) {
                 uint64_t recon = (output(i) + output_peer(i)) % HE.plain_mod;
                 reconstructed(i) = recon;
-                uint64_t exp = static_cast<uint64_t>(expected(i) % static_cast<int64_t>(HE.plain_mod));
+                uint64_t exp = static_cast<uint64_t>((expected(i) % t + t) % t);
                 mismatches += (recon != exp);
+                if (tc.bn) {
+                    int64_t centered = recon > HE.plain_mod / 2 ? static_cast<int64_t>(recon) - t : static_cast<int64_t>(recon);
+                    max_bn_error = std::max(max_bn_error, std::fabs(std::ldexp(static_cast<double>(centered), -fold_shift) - expected_bn(i)));
+                }
             }
             cout << "reconstructed:" << endl;
             reconstructed.print();
+            if (tc.bn) {
+                std::cout << "[Case " << case_idx << "] max |fixed point - float BatchNorm| = " << max_bn_error << std::endl;
+            }
 
             double ratio = output.size() ? static_cast<double>(mismatches) / static_cast<double>(output.size()) : 0.0;
             std::cout << "[Case " << case_idx << "] Ci=" << Ci
@@ -157,6 +265,7 @@ int main(int argc, char **argv){
                       << " K=" << kernelSize
                       << " S=" << s
                       << " P=" << padding
+                      << " B=" << B
                       << " mismatch_ratio=" << ratio << std::endl;
             std::cout << "[Case " << case_idx << "] done" << std::endl;
 
@@ -180,6 +289,7 @@ int main(int argc, char **argv){
                       << ", K=" << tc.kernel
                       << ", S=" << tc.stride
                       << ", P=" << tc.padding
+                      << ", B=" << tc.batch
                       << ") mismatch_ratio=" << case_ratios[i] << std::endl;
         }
     }
@@ -0,0 +1,94 @@
+#include <Utils/emulated_io_channel.h>
+#include <Utils/loopback_io_channel.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+using namespace std;
+using Utils::EmulatedIO;
+using Utils::LoopbackIO;
+
+typedef chrono::steady_clock Clock;
+
+static double since(Clock::time_point start) {
+  return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Both parties in one process over an emulated link on top of LoopbackIO: checks that rounds pay
+// the latency, that bulk sends are paced to the bandwidth, that bytes arrive intact through
+// open_netio, and that emulate = false only accounts.
+int main(int argc, char **argv) {
+  const Utils::NetProfile profile = {"test", 80, 20, 0};  // 10 MB/s, 20 ms one way
+  const int rounds = 5;
+  const size_t bulk = 2 << 20;
+  int failures = 0;
+  auto check = [&](bool ok, const string &what) {
+    cout << (ok ? "ok: " : "FAILED: ") << what << endl;
+    failures += !ok;
+  };
+
+  for (bool emulate : {true, false}) {
+    auto pair = LoopbackIO::Pair();
+    EmulatedIO<LoopbackIO> alice(pair.first, profile, emulate), bob(pair.second, profile, emulate);
+    double ping_s = 0, bulk_s = 0;
+    vector<char> sent(bulk), back(bulk);
+    for (size_t k = 0; k < bulk; k++) {
+      sent[k] = static_cast<char>(k % 251);
+    }
+
+    std::thread bob_thread([&] {
+      uint64_t v;
+      for (int r = 0; r < rounds; r++) {
+        bob.recv_data(&v, sizeof(v));
+        v++;
+        bob.send_data(&v, sizeof(v));
+      }
+      Utils::NetIO *io = bob.open_netio();
+      vector<char> buf(bulk);
+      io->recv_data(buf.data(), bulk);
+      io->send_data(buf.data(), bulk);
+      io->flush();
+      delete io;
+    });
+
+    // ping-pong: every round of ALICE waits one latency (BOB's wait overlaps it, like Estimate)
+    auto start = Clock::now();
+    uint64_t v = 0;
+    for (int r = 0; r < rounds; r++) {
+      alice.send_data(&v, sizeof(v));
+      alice.recv_data(&v, sizeof(v));
+    }
+    ping_s = since(start);
+
+    // bulk transfer: ALICE's sends go through the token bucket
+    Utils::NetIO *io = alice.open_netio();
+    start = Clock::now();
+    io->send_data(sent.data(), bulk);
+    io->flush();
+    bulk_s = since(start);
+    io->recv_data(back.data(), bulk);
+    delete io;
+    bob_thread.join();
+
+    string mode = emulate ? "emulated" : "accounting only";
+    cout << mode << ": ping-pong " << ping_s << " s, bulk send " << bulk_s << " s" << endl;
+    check(v == static_cast<uint64_t>(rounds), mode + " ping-pong values");
+    check(back == sent, mode + " bulk round trip through open_netio");
+    check(alice.recv_rounds >= static_cast<uint64_t>(rounds), mode + " recv rounds counted");
+    check(alice.bytes_sent >= bulk && bob.bytes_recv >= bulk, mode + " bytes counted");
+    if (emulate) {
+      // one latency per receive round, and the bucket only lets a 64 KB burst through early
+      double min_ping = rounds * profile.latency_ms * 1e-3;
+      double min_bulk = (bulk - 65536) * 8 / (profile.bandwidth_mbps * 1e6);
+      check(ping_s >= 0.9 * min_ping, "latency: ping-pong >= " + to_string(min_ping) + " s");
+      check(bulk_s >= 0.9 * min_bulk, "bandwidth: bulk send >= " + to_string(min_bulk) + " s");
+      check(alice.Estimate(profile, ping_s) >= min_ping, "Estimate covers the rounds");
+      check(alice.delay_s > 0 && alice.ComputeTime(ping_s + bulk_s) < ping_s + bulk_s, "sleeps accounted in delay_s");
+    } else {
+      check(alice.delay_s == 0 && bob.delay_s == 0, "no sleeps without emulation");
+    }
+    delete pair.first;
+    delete pair.second;
+  }
+  return failures == 0 ? 0 : 1;
+}
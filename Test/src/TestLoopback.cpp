@@ -0,0 +1,52 @@
+#include <NonlinearOperator/FixPoint.h>
+#include <Utils/loopback_io_channel.h>
+#include <chrono>
+#include <iostream>
+using namespace std;
+using namespace NonlinearOperator;
+typedef int64_t T;
+
+int bitlength = 16;
+int32_t kScale = 12;
+int num_threads = 4;
+
+// Both parties in one process: compute-only timing of FixPoint::truncate without TCP.
+int main(int argc, char **argv) {
+  const size_t dim = 1 << 16;
+  const int bw = 32, shift = 12;
+  Tensor<T> x_alice({dim}), x_bob({dim});
+  x_alice.randomize(1ULL << 20);
+  Tensor<T> plain = x_alice;
+
+  auto run = [&](int party, Tensor<T> &x, Utils::NetIO **ioArr) {
+    OTPrimitive::OTPack<Utils::NetIO> **otpackArr = new OTPrimitive::OTPack<Utils::NetIO>*[num_threads];
+    for (int i = 0; i < num_threads; i++) {
+      otpackArr[i] = new IKNPOTPack<Utils::NetIO>(ioArr[i], party);
+    }
+    FixPoint<T> fixpoint(party, otpackArr, num_threads);
+    auto start = chrono::high_resolution_clock::now();
+    fixpoint.truncate(x, shift, bw, true);
+    double secs = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    uint64_t comm = 0;
+    for (int i = 0; i < num_threads; i++) {
+      comm += ioArr[i]->counter;
+    }
+    cout << (party == ALICE ? "ALICE" : "BOB") << " truncate: " << secs << " s, " << comm << " bytes" << endl;
+  };
+  Utils::RunTwoParty([&](Utils::NetIO **ioArr) { run(ALICE, x_alice, ioArr); },
+                     [&](Utils::NetIO **ioArr) { run(BOB, x_bob, ioArr); },
+                     num_threads);
+
+  // shares of a positive value truncate to plain >> shift, up to one bit of error
+  const uint64_t mask = (1ULL << bw) - 1;
+  size_t wrong = 0;
+  for (size_t i = 0; i < dim; i++) {
+    int64_t got = static_cast<int64_t>((static_cast<uint64_t>(x_alice(i)) + static_cast<uint64_t>(x_bob(i))) & mask);
+    int64_t want = plain(i) >> shift;
+    if (std::abs(got - want) > 1) {
+      wrong++;
+    }
+  }
+  cout << "truncate mismatches: " << wrong << " / " << dim << endl;
+  return wrong == 0 ? 0 : 1;
+}
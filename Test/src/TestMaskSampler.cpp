@@ -0,0 +1,73 @@
+/**
+ * TestMaskSampler: bounds, negation and reproducibility of Utils::MaskSampler
+ */
+#include <Utils/mask_sampler.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const size_t kPool = 1024;  // words the sampler draws from the PRG at a time
+const size_t n = 5003;      // several pools, not a multiple of the four AVX2 lanes
+
+// The scalar rule on the same PRG stream: each pool is cut to the bit length of p and scanned in
+// order. Whichever path the sampler was built with, it has to give exactly these masks.
+std::vector<uint64_t> reference(const Utils::block128 &seed, int id, uint64_t p) {
+    Utils::PRG128 prg(&seed, id);
+    const int bits = 64 - __builtin_clzll(p - 1);
+    const uint64_t lane_mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+    std::vector<uint64_t> mask;
+    std::vector<uint64_t> pool(kPool);
+    while (mask.size() < n) {
+        prg.random_data(pool.data(), kPool * sizeof(uint64_t));
+        for (size_t i = 0; i < kPool && mask.size() < n; i++) {
+            uint64_t v = pool[i] & lane_mask;
+            if (v < p) {
+                mask.push_back(v);
+            }
+        }
+    }
+    return mask;
+}
+
+bool check(uint64_t p) {
+    Utils::block128 seed = Utils::makeBlock128(0x5eed, p);
+    const int id = 3;
+    Utils::MaskSampler sampler(&seed, id);
+    std::vector<uint64_t> mask(n), neg;
+    sampler.Sample(mask, neg, p);
+    uint64_t out_of_range = 0, bad_neg = 0;
+    for (size_t i = 0; i < n; i++) {
+        out_of_range += mask[i] >= p;
+        bad_neg += neg[i] != (p - mask[i]) % p;
+    }
+    bool same = mask == reference(seed, id, p);
+    if (out_of_range || bad_neg || !same) {
+        std::cout << "  p=" << p << ": " << out_of_range << " masks >= p, " << bad_neg << " wrong negations, "
+                  << (same ? "" : "differs from the scalar stream") << std::endl;
+    }
+    return !out_of_range && !bad_neg && same;
+}
+
+int main() {
+#ifdef __AVX2__
+    std::cout << "Testing MaskSampler (AVX2 path)..." << std::endl;
+#else
+    std::cout << "Testing MaskSampler (scalar path)..." << std::endl;
+#endif
+    std::vector<uint64_t> moduli = {2, 3, 5};
+    for (int k : {4, 17, 32, 45, 59, 62}) {
+        // a power of two takes every draw, one above it barely half of them
+        moduli.push_back((1ULL << k) - 1);
+        moduli.push_back(1ULL << k);
+        moduli.push_back((1ULL << k) + 1);
+    }
+    moduli.push_back((1ULL << 62) - 57);
+    moduli.push_back((1ULL << 62) + 135);
+    moduli.push_back(1152921504606830593ULL);  // plain_mod from HE
+    bool ok = true;
+    for (uint64_t p : moduli) {
+        ok &= check(p);
+    }
+    std::cout << (ok ? "All tests passed!" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
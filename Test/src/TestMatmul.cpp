@@ -21,92 +21,98 @@ int main(int argc, char **argv){
     HE.GenerateNewKey();
     
     // Use matrix dimensions where tile_size is a perfect square
-    // With padded_dim_0=128, tile_size = 8192/128 = 64, input_rot = 8, and 8*8=64
-    uint64_t d0 = 128; uint64_t d1 = 64; uint64_t d2 = 64;
-    Tensor<uint64_t> input({d0, d1}); 
-    Tensor<uint64_t> weight({d1, d2});
-    Tensor<uint64_t> bias({d0, d2});
-    if(party == ALICE){
-        cout << "-----I'm ALICE------" << endl;
-        for(uint32_t i = 0; i < d0; i++){
-            for(uint32_t j = 0; j < d1; j++){
-                input({i, j}) = 1;
+    // With padded_dim_0=128, tile_size = 8192/128 = 64, input_rot = 8, and 8*8=64; dim_0 = 100 leaves
+    // padded rows. Each runs a per-element {d0, d2} bias (distinct in every row, so both halves of
+    // LinearBolt's slots are checked), then a {d2} bias shared by all rows
+    uint64_t d1 = 64; uint64_t d2 = 64;
+    for (uint64_t d0 : {128, 100})
+    for (bool row_bias : {true, false}) {
+        Tensor<uint64_t> input({d0, d1});
+        Tensor<uint64_t> weight({d1, d2});
+        Tensor<uint64_t> bias = row_bias ? Tensor<uint64_t>({d0, d2}) : Tensor<uint64_t>({d2});
+        if(party == ALICE){
+            cout << "-----I'm ALICE------ d0=" << d0 << ", " << (row_bias ? "{d0, d2}" : "{d2}") << " bias" << endl;
+            for(uint32_t i = 0; i < d0; i++){
+                for(uint32_t j = 0; j < d1; j++){
+                    input({i, j}) = (i + j) % 5;
+                }
             }
-        }
-    } else {
-        // cout << "-----I'm BOB------" << endl;
-        for (uint32_t i = 0; i < d0; i++) {
-            for (uint32_t j = 0; j < d1; j++) {
-                input({i, j}) = 0;
+            for(uint32_t i = 0; i < bias.size(); i++){
+                bias(i) = (i * 7 + 3) % 11;  // added by the server while masking the HEToSS
+            }
+        } else {
+            // cout << "-----I'm BOB------" << endl;
+            for (uint32_t i = 0; i < d0; i++) {
+                for (uint32_t j = 0; j < d1; j++) {
+                    input({i, j}) = 0;
+                }
             }
         }
-    }
-    for(uint32_t i = 0; i < d1; i++){
-        for(uint32_t j = 0; j < d2; j++){
-            weight({i, j}) = 1;
+        for(uint32_t i = 0; i < d1; i++){
+            for(uint32_t j = 0; j < d2; j++){
+                weight({i, j}) = 1;
+            }
         }
-    }
-    if(party == ALICE){
-        input.print();
-        weight.print();
-    }
 
-    // cout << "input generated" << endl;
-    LinearBolt* matmul1 = new LinearBolt(d0, weight, weight, &HE);
-    Tensor<uint64_t> output1 = matmul1->operator()(input);
-    cout << "--------output LinearBolt--------" << endl;
-    output1.print(10);
-    LinearNest* matmul_nest = new LinearNest(d0, weight, weight, &HE);
-    Tensor<uint64_t> output_nest = matmul_nest->operator()(input);
-    cout << "--------output LinearNest--------" << endl;
-    output_nest.print(10);
-    // MatmulCtctBumble* matmul2 = new MatmulCtctBumble(&HE);
-    // Tensor<uint64_t> output2 = matmul2->operator()(input, weight);
-    // output2.print();
+        // cout << "input generated" << endl;
+        LinearBolt* matmul1 = new LinearBolt(d0, weight, bias, &HE);
+        Tensor<uint64_t> output1 = matmul1->operator()(input);
+        cout << "--------output LinearBolt--------" << endl;
+        output1.print(10);
+        LinearNest* matmul_nest = new LinearNest(d0, weight, bias, &HE);
+        Tensor<uint64_t> output_nest = matmul_nest->operator()(input);
+        cout << "--------output LinearNest--------" << endl;
+        output_nest.print(10);
+        // MatmulCtctBumble* matmul2 = new MatmulCtctBumble(&HE);
+        // Tensor<uint64_t> output2 = matmul2->operator()(input, weight);
+        // output2.print();
 
-    if (party == ALICE) {
-        Tensor<uint64_t> output_bolt_peer(output1.shape());
-        netio->recv_data(output_bolt_peer.data().data(), output_bolt_peer.size() * sizeof(uint64_t));
-        
-        Tensor<uint64_t> output_nest_peer(output_nest.shape());
-        netio->recv_data(output_nest_peer.data().data(), output_nest_peer.size() * sizeof(uint64_t));
+        if (party == ALICE) {
+            Tensor<uint64_t> output_bolt_peer(output1.shape());
+            netio->recv_data(output_bolt_peer.data().data(), output_bolt_peer.size() * sizeof(uint64_t));
 
-        Tensor<uint64_t> expected({d0, d2});
-        for (uint64_t i = 0; i < d0; i++) {
-            for (uint64_t j = 0; j < d2; j++) {
-                uint64_t acc = 0;
-                for (uint64_t k = 0; k < d1; k++) {
-                    acc = (acc + (input({i, k}) * weight({k, j})) % HE.plain_mod) % HE.plain_mod;
+            Tensor<uint64_t> output_nest_peer(output_nest.shape());
+            netio->recv_data(output_nest_peer.data().data(), output_nest_peer.size() * sizeof(uint64_t));
+
+            Tensor<uint64_t> expected({d0, d2});
+            for (uint64_t i = 0; i < d0; i++) {
+                for (uint64_t j = 0; j < d2; j++) {
+                    uint64_t acc = row_bias ? bias({i, j}) : bias(j);
+                    for (uint64_t k = 0; k < d1; k++) {
+                        acc = (acc + (input({i, k}) * weight({k, j})) % HE.plain_mod) % HE.plain_mod;
+                    }
+                    expected({i, j}) = acc;
                 }
-                expected({i, j}) = acc;
             }
-        }
 
-        auto verify = [&](const char* name, Tensor<uint64_t>& local_share, Tensor<uint64_t>& peer_share) {
-            uint64_t mismatches = 0;
-            for (uint64_t i = 0; i < local_share.size(); i++) {
-                uint64_t recon = (local_share(i) + peer_share(i)) % HE.plain_mod;
-                uint64_t exp = expected(i);
-                if (recon != exp) {
-                    if (mismatches < 8) {
-                        std::cout << "[" << name << "] mismatch idx=" << i
-                                  << " recon=" << recon
-                                  << " expected=" << exp << std::endl;
+            auto verify = [&](const char* name, Tensor<uint64_t>& local_share, Tensor<uint64_t>& peer_share) {
+                uint64_t mismatches = 0;
+                for (uint64_t i = 0; i < local_share.size(); i++) {
+                    uint64_t recon = (local_share(i) + peer_share(i)) % HE.plain_mod;
+                    uint64_t exp = expected(i);
+                    if (recon != exp) {
+                        if (mismatches < 8) {
+                            std::cout << "[" << name << "] mismatch idx=" << i
+                                      << " recon=" << recon
+                                      << " expected=" << exp << std::endl;
+                        }
+                        mismatches++;
                     }
-                    mismatches++;
                 }
-            }
-            if (mismatches == 0) {
-                std::cout << "[" << name << "] PASS: all outputs match" << std::endl;
-            } else {
-                std::cout << "[" << name << "] FAIL: mismatches=" << mismatches << " total:" << local_share.size() << std::endl;
-            }
-        };
-        verify("LinearBolt", output1, output_bolt_peer);
-        verify("LinearNest", output_nest, output_nest_peer);
-    } else {
-        netio->send_data(output1.data().data(), output1.size() * sizeof(uint64_t));
-        netio->send_data(output_nest.data().data(), output_nest.size() * sizeof(uint64_t));
+                if (mismatches == 0) {
+                    std::cout << "[" << name << "] PASS: all outputs match" << std::endl;
+                } else {
+                    std::cout << "[" << name << "] FAIL: mismatches=" << mismatches << " total:" << local_share.size() << std::endl;
+                }
+            };
+            verify("LinearBolt", output1, output_bolt_peer);
+            verify("LinearNest", output_nest, output_nest_peer);
+        } else {
+            netio->send_data(output1.data().data(), output1.size() * sizeof(uint64_t));
+            netio->send_data(output_nest.data().data(), output_nest.size() * sizeof(uint64_t));
+        }
+        delete matmul1;
+        delete matmul_nest;
     }
 
     return 0;
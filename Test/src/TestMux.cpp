@@ -0,0 +1,87 @@
+#include <Utils/mux_io_channel.h>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+using namespace std;
+
+int num_channels = 4;
+
+// Both parties in one process over a Unix-domain MuxConnection. Every channel sends its own
+// pattern from ALICE to BOB and back; the inboxes are kept small so that the demux thread has to
+// wait for slow readers. Then BOB goes away and ALICE's next frames have to throw.
+int main(int argc, char **argv) {
+  const string path = "/tmp/sec_ppdl_test_mux.sock";
+  Utils::MuxConnection *conn[2] = {nullptr, nullptr};
+  std::thread accept_thread([&] { conn[0] = new Utils::MuxConnection(Utils::AcceptUnix(path.c_str()), true); });
+  conn[1] = new Utils::MuxConnection(Utils::ConnectUnix(path.c_str()), false);
+  accept_thread.join();
+  conn[0]->max_inbox_bytes = conn[1]->max_inbox_bytes = 1 << 16;
+
+  auto pattern = [](int ch, size_t len) {
+    vector<char> buf(len);
+    for (size_t k = 0; k < len; k++) {
+      buf[k] = static_cast<char>((ch * 131 + k) % 251);
+    }
+    return buf;
+  };
+
+  Utils::NetIO **alice_io = conn[0]->open_netio(num_channels);
+  Utils::NetIO **bob_io = conn[1]->open_netio(num_channels);
+  vector<int> ok(num_channels, 0);
+  vector<std::thread> threads;
+  for (int i = 0; i < num_channels; i++) {
+    const size_t len = (i + 1) * 300000;
+    threads.emplace_back([&, i, len] {
+      vector<char> sent = pattern(i, len), back(len);
+      alice_io[i]->send_data(sent.data(), len);
+      alice_io[i]->flush();
+      alice_io[i]->recv_data(back.data(), len);
+      ok[i] = (back == sent);
+    });
+    threads.emplace_back([&, i, len] {
+      vector<char> buf(len);
+      if (i == num_channels - 1) {
+        // a slow reader: its inbox fills up and the demux thread waits for it
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      bob_io[i]->recv_data(buf.data(), len);
+      bob_io[i]->send_data(buf.data(), len);
+      bob_io[i]->flush();
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  int failures = 0;
+  for (int i = 0; i < num_channels; i++) {
+    cout << "channel " << i << ": " << (ok[i] ? "ok" : "MISMATCH") << endl;
+    failures += !ok[i];
+  }
+  cout << "frames: " << conn[0]->num_frames << " sent by ALICE, " << conn[1]->num_frames << " by BOB" << endl;
+
+  for (int i = 0; i < num_channels; i++) {
+    delete bob_io[i];
+  }
+  delete[] bob_io;
+  delete conn[1];
+
+  bool threw = false;
+  vector<char> frame(4096);
+  try {
+    for (int k = 0; k < 1000; k++) {
+      conn[0]->write_frame(0, frame.data(), frame.size());
+    }
+  } catch (const std::runtime_error &e) {
+    cout << "write after close: " << e.what() << endl;
+    threw = true;
+  }
+  if (!threw) {
+    cout << "write after close did not throw" << endl;
+    failures++;
+  }
+
+  delete[] alice_io;  // their streams write to a dead connection, only the array is released
+  delete conn[0];
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#include <Model/Planner.h>
+#include <Utils/loopback_io_channel.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+using namespace std;
+using namespace Model;
+
+int failures = 0;
+
+void check(bool ok, const string &what) {
+  cout << (ok ? "ok: " : "FAILED: ") << what << endl;
+  failures += !ok;
+}
+
+bool has(const vector<LayerCost> &candidates, LayerProtocol p) {
+  for (auto &c : candidates) {
+    if (c.protocol == p) {
+      return true;
+    }
+  }
+  return false;
+}
+
+LayerProtocol cheapest(const vector<LayerCost> &candidates) {
+  return min_element(candidates.begin(), candidates.end(),
+                     [](const LayerCost &a, const LayerCost &b) { return a.total_ms() < b.total_ms(); })->protocol;
+}
+
+const uint64_t N = 8192, L = 3;
+const ConvShape conv_s1{32, 16, 16, 3, 1, 1};
+const ConvShape conv_s2{32, 16, 32, 3, 2, 1};
+const ConvShape conv_cir{16, 64, 64, 3, 1, 1, 4};
+const LinearShape linear{1, 512, 10};
+const LinearShape linear_cir{1, 512, 256, 8};
+
+// Which packings a layer may run on, and that Plan takes the cheapest of them.
+void TestCandidates() {
+  ProtocolPlanner planner(N, L, NetworkProfile::LAN());
+  auto s1 = planner.Candidates(conv_s1), s2 = planner.Candidates(conv_s2);
+  check(has(s1, LayerProtocol::ConvNest) && has(s1, LayerProtocol::ConvCheetah) &&
+            !has(s1, LayerProtocol::PolyConvNest) && !has(s1, LayerProtocol::PolyConvCheetah),
+        "stride 1 conv: Nest and Cheetah, no polyphase");
+  check(has(s2, LayerProtocol::PolyConvNest) && has(s2, LayerProtocol::PolyConvCheetah),
+        "strided conv: polyphase candidates");
+  auto cir = planner.Candidates(conv_cir);
+  check(cir.size() == 1 && cir[0].protocol == LayerProtocol::CirConv, "block-circulant conv: CirConv only");
+  auto dense = planner.Candidates(linear), blocks = planner.Candidates(linear_cir);
+  check(has(dense, LayerProtocol::LinearBolt) && has(dense, LayerProtocol::LinearNest) && !has(dense, LayerProtocol::CirLinearNest),
+        "dense linear: Bolt and Nest");
+  check(blocks.size() == 1 && blocks[0].protocol == LayerProtocol::CirLinearNest, "block-circulant linear: CirLinearNest only");
+
+  check(planner.Plan(conv_s1) == cheapest(s1) && planner.Plan(conv_s2) == cheapest(s2) && planner.Plan(linear) == cheapest(dense),
+        "Plan picks the cheapest candidate");
+  check(planner.Plans().size() == 3, "one cached plan per shape");
+
+  ProtocolPlanner wan(N, L, NetworkProfile::WAN());
+  auto slow = wan.Candidates(conv_s2);
+  bool pricier = slow.size() == s2.size();
+  for (size_t i = 0; pricier && i < slow.size(); i++) {
+    pricier = slow[i].protocol == s2[i].protocol && slow[i].comm_ms > s2[i].comm_ms && slow[i].compute_ms == s2[i].compute_ms;
+  }
+  check(pricier, "WAN: same ops, more time on the wire");
+
+  bool threw = false;
+  try {
+    planner.Plan(ConvShape{16, 6, 6, 3, 1, 1, 4});  // 6 channels do not split into blocks of 4
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  check(threw, "no fitting protocol throws");
+}
+
+// Plans survive Save/Load for the same N, are ignored for another N, and a loaded plan wins over
+// the planner's own choice.
+void TestPlanFile() {
+  const string path = "test_planner_plan.txt";
+  ProtocolPlanner planner(N, L);
+  planner.Plan(conv_s1);
+  planner.Plan(conv_s2);
+  planner.Plan(linear);
+  planner.Save(path);
+
+  ProtocolPlanner same(N, L);
+  check(same.Load(path) && same.Plans() == planner.Plans(), "Load gives back the saved plans");
+  ProtocolPlanner other(2 * N, L);
+  check(other.Load(path) && other.Plans().empty(), "plans for another N are ignored");
+  check(!same.Load("test_planner_missing.txt"), "a missing plan file is reported");
+
+  LayerProtocol forced = planner.Plan(conv_s1) == LayerProtocol::ConvNest ? LayerProtocol::ConvCheetah : LayerProtocol::ConvNest;
+  std::ofstream(path) << N << " | " << conv_s1.Key() << " | " << static_cast<int>(forced) << "\n";
+  ProtocolPlanner loaded(N, L);
+  loaded.Load(path);
+  check(loaded.Plan(conv_s1) == forced, "a loaded plan is used as is");
+
+  std::ofstream(path) << "not a plan\n";
+  bool threw = false;
+  try {
+    loaded.Load(path);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  check(threw, "a malformed plan file throws");
+  std::remove(path.c_str());
+}
+
+// Share: the client drops its own cost model, network and plans for the server's, so both build
+// the same protocols, also for layers planned after the exchange.
+void TestShare() {
+  ProtocolPlanner server(N, L, NetworkProfile::WAN()), client(N, L, NetworkProfile::LAN());
+  server.cost.ms_per_op[static_cast<int>(HE::unified::EvalOp::RotateRows)] *= 50;  // e.g. after Calibrate
+  server.Plan(conv_s1);
+  server.Plan(linear);
+  client.Plan(conv_s2);  // the client's own plans are dropped
+  Utils::RunTwoParty([&](Utils::NetIO **io) { server.Share(io[0], true); },
+                     [&](Utils::NetIO **io) { client.Share(io[0], false); });
+  check(client.cost.ms_per_op == server.cost.ms_per_op, "client takes the server's cost model");
+  check(client.net.bandwidth_mbps == server.net.bandwidth_mbps && client.net.rtt_ms == server.net.rtt_ms,
+        "client takes the server's network profile");
+  check(client.Plans() == server.Plans(), "client takes the server's plans");
+  check(client.Plan(conv_s2) == server.Plan(conv_s2) && client.Plan(linear_cir) == server.Plan(linear_cir),
+        "both sides plan new layers alike");
+}
+
+int main(int argc, char **argv) {
+  TestCandidates();
+  TestPlanFile();
+  TestShare();
+  return failures == 0 ? 0 : 1;
+}
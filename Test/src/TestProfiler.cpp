@@ -0,0 +1,127 @@
+#include <Utils/loopback_io_channel.h>
+#include <Utils/profiler.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+using namespace std;
+
+int failures = 0;
+
+void check(bool ok, const string &what) {
+  cout << (ok ? "ok: " : "FAILED: ") << what << endl;
+  failures += !ok;
+}
+
+bool contains(const string &s, const string &part) { return s.find(part) != string::npos; }
+
+string read_file(const string &path) {
+  std::ifstream is(path);
+  std::stringstream text;
+  text << is.rdbuf();
+  return text.str();
+}
+
+// Nested spans get their depth and parent, and the counters of every thread that counted while
+// they were open, inner spans included.
+void TestSpans() {
+  Utils::Profiler profiler;
+  int dropped = profiler.Begin("disabled", "op");
+  profiler.End(dropped);
+  profiler.Clear();
+  profiler.enabled = true;
+  int model = profiler.Begin("model", "model");
+  profiler.Count("he.rotate", 2);
+  int layer = profiler.Begin("layer1", "layer");
+  profiler.Count("he.rotate", 3);
+  std::thread worker([&profiler] { profiler.Count("he.mult", 5); });
+  worker.join();
+  profiler.End(layer);
+  profiler.End(model);
+  profiler.Count("he.rotate", 7);  // after both spans closed
+
+  const vector<Utils::Profiler::Span> &spans = profiler.Spans();
+  check(spans.size() == 2 && spans[0].name == "model" && spans[1].name == "layer1", "spans in opening order");
+  check(spans[0].depth == 0 && spans[0].parent == -1 && spans[1].depth == 1 && spans[1].parent == 0, "depth and parent");
+  check(spans[1].counters.at("he.rotate") == 3 && spans[1].counters.at("he.mult") == 5, "inner span: its own and a worker thread's counts");
+  check(spans[0].counters.at("he.rotate") == 5 && spans[0].counters.at("he.mult") == 5, "outer span: includes the inner span");
+  check(spans[0].dur_us >= spans[1].dur_us, "outer span lasts at least as long");
+
+  // ProfileScope records on the global profiler only while it is enabled
+  Utils::Profiler &global = Utils::Profiler::Get();
+  global.Clear();
+  { Utils::ProfileScope scope("off"); }
+  global.enabled = true;
+  { Utils::ProfileScope scope("on", "layer"); }
+  global.enabled = false;
+  check(global.Spans().size() == 1 && global.Spans()[0].name == "on" && global.Spans()[0].cat == "layer",
+        "ProfileScope only records when enabled");
+  global.Clear();
+}
+
+// Both parties in this process, each with its own profiler over loopback channels: traffic and
+// rounds of the attached channels per span, the clock offset (one clock here, so about zero),
+// and BOB's spans in ALICE's exports.
+void TestTwoParty() {
+  Utils::Profiler alice, bob;
+  const int num_channels = 2;
+  Utils::RunTwoParty(
+      [&](Utils::NetIO **io) {
+        alice.enabled = true;
+        alice.AttachChannels(io, num_channels);
+        int id = alice.Begin("send", "layer");
+        vector<char> data(1000);
+        io[0]->send_data(data.data(), 600);
+        io[1]->send_data(data.data(), 400);
+        io[0]->flush();
+        io[1]->flush();
+        char ack;
+        io[0]->recv_data(&ack, 1);
+        alice.End(id);
+        alice.AlignClock(io[0], 1);
+        alice.GatherTo(io[0], 1);
+      },
+      [&](Utils::NetIO **io) {
+        bob.enabled = true;
+        bob.AttachChannels(io, num_channels);
+        int id = bob.Begin("bob \"recv\"", "layer");
+        vector<char> data(1000);
+        io[0]->recv_data(data.data(), 600);
+        io[1]->recv_data(data.data(), 400);
+        char ack = 1;
+        io[0]->send_data(&ack, 1);
+        io[0]->flush();
+        bob.End(id);
+        bob.AlignClock(io[0], 2);
+        bob.GatherTo(io[0], 2);
+      },
+      num_channels);
+
+  const Utils::Profiler::Span &sent = alice.Spans()[0], &got = bob.Spans()[0];
+  check(sent.bytes_sent == 1000 && sent.bytes_recv == 1 && got.bytes_recv == 1000 && got.bytes_sent == 1,
+        "span traffic summed over the channels");
+  check(sent.rounds == 2 && got.rounds == 2, "span rounds: a send and a receive");
+  check(alice.clock_offset_us == 0 && std::fabs(bob.clock_offset_us) < 1e4, "clock offset, ALICE is the reference");
+
+  const string json_path = "test_profiler.json", trace_path = "test_profiler_trace.json";
+  alice.ExportJson(json_path);
+  alice.ExportChromeTrace(trace_path);
+  string json = read_file(json_path), trace = read_file(trace_path);
+  check(contains(json, "\"party\":1") && contains(json, "\"name\":\"send\"") && contains(json, "\"bytes_sent\":1000") &&
+            !contains(json, "bob"),
+        "ExportJson: ALICE's spans only");
+  check(trace.rfind("{\"traceEvents\":[", 0) == 0 && contains(trace, "\"pid\":1") && contains(trace, "\"pid\":2") &&
+            contains(trace, "\"name\":\"ALICE\"") && contains(trace, "\"name\":\"BOB\"") &&
+            contains(trace, "\"name\":\"bob \\\"recv\\\"\""),
+        "ExportChromeTrace: both parties, names escaped");
+  std::remove(json_path.c_str());
+  std::remove(trace_path.c_str());
+}
+
+int main(int argc, char **argv) {
+  TestSpans();
+  TestTwoParty();
+  return failures == 0 ? 0 : 1;
+}
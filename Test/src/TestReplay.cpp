@@ -0,0 +1,74 @@
+#include <NonlinearOperator/FixPoint.h>
+#include <Utils/loopback_io_channel.h>
+#include <Utils/record_io_channel.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+using namespace std;
+using namespace NonlinearOperator;
+typedef int64_t T;
+
+int bitlength = 16;
+int32_t kScale = 12;
+int num_threads = 2;
+
+// Record ALICE's side of a two-party FixPoint::truncate, then replay ALICE alone against the
+// transcript. The replay has to consume the whole transcript and send exactly as much as the
+// recorded run did.
+uint64_t run(int party, Tensor<T> x, Utils::NetIO **ioArr, double &secs) {
+  OTPrimitive::OTPack<Utils::NetIO> **otpackArr = new OTPrimitive::OTPack<Utils::NetIO>*[num_threads];
+  for (int i = 0; i < num_threads; i++) {
+    otpackArr[i] = new IKNPOTPack<Utils::NetIO>(ioArr[i], party);
+  }
+  FixPoint<T> fixpoint(party, otpackArr, num_threads);
+  auto start = chrono::high_resolution_clock::now();
+  fixpoint.truncate(x, 12, 32, true);
+  secs = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+  uint64_t comm = 0;
+  for (int i = 0; i < num_threads; i++) {
+    ioArr[i]->flush();
+    comm += ioArr[i]->counter;
+    delete otpackArr[i];
+  }
+  delete[] otpackArr;
+  return comm;
+}
+
+int main(int argc, char **argv) {
+  const string prefix = "replay_alice";
+  Tensor<T> x_alice({1 << 14}), x_bob({1 << 14});
+  x_alice.randomize(1ULL << 20);
+
+  uint64_t recorded = 0;
+  double live_secs = 0, bob_secs = 0;
+  Utils::RunTwoParty(
+      [&](Utils::NetIO **ioArr) {
+        Utils::TranscriptRecorder recorder(prefix, ioArr, num_threads, ALICE);
+        recorded = run(ALICE, x_alice, ioArr, live_secs);
+      },
+      [&](Utils::NetIO **ioArr) { run(BOB, x_bob, ioArr, bob_secs); },
+      num_threads);
+  bool unpinned = !Utils::SeedPin::Pinned();
+
+  double replay_secs = 0;
+  uint64_t replayed = 0;
+  {
+    Utils::TranscriptReplay replay(prefix);
+    replayed = run(replay.party, x_alice, replay.ioArr, replay_secs);
+  }
+  unpinned = unpinned && !Utils::SeedPin::Pinned();
+
+  // threads that never select a stream must not repeat each other's draws
+  Utils::SeedPin::Pin(1);
+  uint64_t draws[2];
+  std::thread t0([&] { draws[0] = Utils::SeedPin::Next(); });
+  std::thread t1([&] { draws[1] = Utils::SeedPin::Next(); });
+  t0.join();
+  t1.join();
+  Utils::SeedPin::Unpin();
+
+  cout << "live: " << live_secs << " s, " << recorded << " bytes; replay: " << replay_secs << " s, "
+       << replayed << " bytes" << endl;
+  cout << "unpinned after record/replay: " << unpinned << ", distinct thread streams: " << (draws[0] != draws[1]) << endl;
+  return replayed == recorded && unpinned && draws[0] != draws[1] ? 0 : 1;
+}
@@ -11,6 +11,8 @@ int bitlength = 32;
 int party, port = 32000;
 int num_threads = 32;
 string address = "127.0.0.1";
+// "": global Nest, "lan"/"wan": per-layer protocols picked by the planner for that network
+string plan = "";
 
 uint64_t comm_threads[MAX_THREADS];
 void test_tensor(Tensor<uint64_t> &x) {
@@ -23,12 +25,27 @@ int main(int argc, char **argv) {
   amap.arg("r", party, "Role of party: ALICE = 1; BOB = 2"); // 1 is server, 2 is client
   amap.arg("p", port, "Port Number");
   amap.arg("ip", address, "IP Address of server (ALICE)");
+  amap.arg("plan", plan, "Pick conv protocols per layer: lan | wan");
   amap.parse(argc, argv);
   assert(num_threads <= MAX_THREADS);
 
   // you can switch IKNP/VOLE; Cheetah/Nested; HOST/DEVICE
   CryptoPrimitive<uint64_t, Utils::NetIO> *cryptoPrimitive = new CryptoPrimitive<uint64_t, Utils::NetIO>(party, num_threads, bitlength, Datatype::VOLE, 8192, 60, Nest, Datatype::DEVICE, address, port);
 
+  Utils::Profiler::Get().enabled = true;
+  cryptoPrimitive->AttachProfiler();
+
+  ProtocolPlanner *planner = nullptr;
+  if (!plan.empty()) {
+    planner = new ProtocolPlanner(cryptoPrimitive->HE, plan == "wan" ? NetworkProfile::WAN() : NetworkProfile::LAN());
+    // only the server owns the plan file; the client always takes the server's cost model and plans
+    if (party == ALICE && !planner->Load("resnet_plan.txt")) {
+      planner->Calibrate(cryptoPrimitive->HE);
+    }
+    planner->Share(cryptoPrimitive->HE->IO, party == ALICE);
+    cryptoPrimitive->planner = planner;
+  }
+
   // ResNet_3stages<uint64_t> model = resnet_32_c10(cryptoPrimitive);
   ResNet_4stages<uint64_t> model = resnet_50(cryptoPrimitive);
   Tensor<uint64_t> input({3, 224, 224});
@@ -36,6 +53,14 @@ int main(int argc, char **argv) {
   auto start = high_resolution_clock::now();
   Tensor<uint64_t> output = model(input);
   cout << "resnet done" << endl;
+  if (planner != nullptr) {
+    for (auto &p : planner->Plans()) {
+      cout << p.first << ": " << LayerProtocolName(p.second) << endl;
+    }
+    if (party == ALICE) {
+      planner->Save("resnet_plan.txt");
+    }
+  }
   output.print_shape();
 
   cout << "time:" << ((high_resolution_clock::now() - start)).count()/1e+9 << " s" << endl;
@@ -44,5 +69,15 @@ int main(int argc, char **argv) {
   uint64_t totalRounds = cryptoPrimitive->get_total_rounds();
   cout << "totalRounds: " << totalRounds << endl;
 
+  // spans of both parties on ALICE's clock, open in chrome://tracing or Perfetto
+  Utils::Profiler &profiler = Utils::Profiler::Get();
+  Utils::NetIO *io0 = cryptoPrimitive->HE->IO;
+  profiler.AlignClock(io0, party);
+  profiler.GatherTo(io0, party);
+  if (party == ALICE) {
+    profiler.ExportJson("resnet_profile.json");
+    profiler.ExportChromeTrace("resnet_trace.json");
+  }
+
   // output.print();
 }
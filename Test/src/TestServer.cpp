@@ -0,0 +1,209 @@
+#include <Model/ResNet.h>
+#include <Model/Server.h>
+#include <Model/Batcher.h>
+#include <iostream>
+#include <thread>
+using namespace std;
+using namespace NonlinearLayer;
+using namespace Model;
+using namespace Datatype;
+
+int bitlength = 32;
+int party, port = 33000;
+int num_threads = 4;
+int num_clients = 2;
+int max_sessions = 2;
+string address = "127.0.0.1";
+string identity = "test_server.key";
+int max_batch = 0;
+int num_requests = 8;
+
+// the checked session: a conv with the server's weights on the client's input, then a ReLU
+const uint64_t Ci = 4, Co = 8, H = 8, K = 3;
+
+// known to both sides so that the client can check what it reconstructs
+int64_t weight_at(uint64_t o, uint64_t c, uint64_t p, uint64_t q) { return (o + c + p + q) % 7; }
+int64_t input_at(int client, uint64_t c, uint64_t i, uint64_t j) { return (c + 3 * i + j + client) % 5; }
+int64_t relu_input_at(int client, uint64_t i) { return static_cast<int64_t>((i * 2654435761ULL + client) % 4096) - 2048; }
+
+// Client `client`: runs the session against the server, which then sends its output shares on
+// channel 0, and checks the reconstructed conv and ReLU outputs against plaintext.
+bool check_session(int client, CryptoPrimitive<uint64_t, Utils::NetIO> *cryptoPrimitive) {
+  Tensor<uint64_t> zero_weight({Co, Ci, K, K});
+  Tensor<uint64_t> zero_bias({Co});
+  Conv2DNest conv(H, 1, 1, zero_weight, zero_bias, cryptoPrimitive->HE);
+  Tensor<uint64_t> x({Ci, H, H});
+  for (uint64_t c = 0; c < Ci; c++) {
+    for (uint64_t i = 0; i < H; i++) {
+      for (uint64_t j = 0; j < H; j++) {
+        x({c, i, j}) = input_at(client, c, i, j);
+      }
+    }
+  }
+  Tensor<uint64_t> y = conv(x);
+  const uint64_t ring_mask = (1ULL << bitlength) - 1;
+  Tensor<uint64_t> z({Co * H * H});
+  for (size_t i = 0; i < z.size(); i++) {
+    z(i) = static_cast<uint64_t>(relu_input_at(client, i)) & ring_mask;
+  }
+  (*cryptoPrimitive->relu)(z);
+
+  Tensor<uint64_t> y_server(y.shape()), z_server(z.shape());
+  Utils::NetIO *io = cryptoPrimitive->get_channel(0);
+  io->recv_data(y_server.data().data(), y_server.size() * sizeof(uint64_t));
+  io->recv_data(z_server.data().data(), z_server.size() * sizeof(uint64_t));
+
+  const uint64_t t = cryptoPrimitive->HE->plain_mod;
+  uint64_t wrong = 0;
+  for (uint64_t o = 0; o < Co; o++) {
+    for (uint64_t i = 0; i < H; i++) {
+      for (uint64_t j = 0; j < H; j++) {
+        int64_t sum = 0;
+        for (uint64_t c = 0; c < Ci; c++) {
+          for (uint64_t p = 0; p < K; p++) {
+            for (uint64_t q = 0; q < K; q++) {
+              int64_t ih = int64_t(i + p) - 1, iw = int64_t(j + q) - 1;
+              if (ih >= 0 && ih < int64_t(H) && iw >= 0 && iw < int64_t(H)) {
+                sum += input_at(client, c, ih, iw) * weight_at(o, c, p, q);
+              }
+            }
+          }
+        }
+        wrong += (y({o, i, j}) + y_server({o, i, j})) % t != static_cast<uint64_t>(sum) % t;
+      }
+    }
+  }
+  for (size_t i = 0; i < z.size(); i++) {
+    wrong += ((z(i) + z_server(i)) & ring_mask) != static_cast<uint64_t>(std::max<int64_t>(relu_input_at(client, i), 0));
+  }
+  if (wrong) {
+    cout << "client " << client << ": " << wrong << " wrong outputs" << endl;
+  }
+  return wrong == 0;
+}
+
+// One client: connects, sets up its session with the key file of `client` and runs it.
+bool run_client(int client, bool expect_cached) {
+  Utils::NetIO **ioArr = ConnectSession(address, port, num_threads);
+  auto setup = high_resolution_clock::now();
+  string key_file = identity + "." + to_string(client);
+  auto *cryptoPrimitive = new CryptoPrimitive<uint64_t, Utils::NetIO>(party, ioArr, num_threads, bitlength, Datatype::IKNP, 8192, 60, Nest, Datatype::HOST, key_file);
+  cout << "client " << client << " setup: " << ((high_resolution_clock::now() - setup)).count()/1e+9 << " s, keys "
+       << (cryptoPrimitive->HE->keys_from_cache ? "cached by the server" : "uploaded") << endl;
+  if (expect_cached && !cryptoPrimitive->HE->keys_from_cache) {
+    cout << "client " << client << ": reconnected without a key cache hit" << endl;
+    return false;
+  }
+  if (max_batch == 0) {
+    bool passed = check_session(client, cryptoPrimitive);
+    cout << "client " << client << ": " << (passed ? "ok" : "FAILED") << endl;
+    return passed;
+  }
+  auto start = high_resolution_clock::now();
+  BatchStats stats;
+  {
+    BatchScheduler<uint64_t, ResNet_3stages<uint64_t>> batcher(cryptoPrimitive, [cryptoPrimitive](uint64_t b) {
+      return new ResNet_3stages<uint64_t>(resnet_32_c10(cryptoPrimitive, b));
+    }, {3, 32, 32}, max_batch);
+    vector<future<Tensor<uint64_t>>> outputs;
+    for (int i = 0; i < num_requests; i++) {
+      Tensor<uint64_t> input({3, 32, 32});
+      input.randomize(16);
+      outputs.push_back(batcher.Submit(input));
+    }
+    for (auto &output : outputs) {
+      output.get();
+    }
+    stats = batcher.Stats();
+  }
+  cout << "client " << client << ", " << num_requests << " requests: " << ((high_resolution_clock::now() - start)).count()/1e+9 << " s, "
+       << stats.batches << " batches, fill " << stats.mean_fill << ", queue " << stats.mean_queue_ms
+       << " ms (max " << stats.max_queue_ms << " ms)" << endl;
+  return true;
+}
+
+// ALICE: one model, many clients. BOB: num_clients clients at once, each checks its outputs, then
+// client 0 reconnects and must find its keys in the server's cache.
+int main(int argc, char **argv) {
+  ArgMapping amap;
+  amap.arg("r", party, "Role of party: ALICE = 1; BOB = 2");
+  amap.arg("p", port, "Port Number");
+  amap.arg("ip", address, "IP Address of server (ALICE)");
+  amap.arg("n", num_clients, "Number of clients served before the server exits");
+  amap.arg("s", max_sessions, "Number of sessions run concurrently");
+  amap.arg("id", identity, "Client key file prefix; client 0 reconnects with its file and must skip the key upload");
+  amap.arg("b", max_batch, "Max batch size of the request batcher, 0: one checked conv and ReLU per session");
+  amap.arg("q", num_requests, "Requests per client when batching");
+  amap.parse(argc, argv);
+
+  if (party == ALICE) {
+    auto *shared = new CryptoPrimitive<uint64_t, Utils::NetIO>(party, num_threads, bitlength, 8192, 60, Nest, Datatype::HOST);
+    Tensor<uint64_t> weight({Co, Ci, K, K});
+    Tensor<uint64_t> bias({Co});
+    for (uint64_t o = 0; o < Co; o++) {
+      for (uint64_t c = 0; c < Ci; c++) {
+        for (uint64_t p = 0; p < K; p++) {
+          for (uint64_t q = 0; q < K; q++) {
+            weight({o, c, p, q}) = weight_at(o, c, p, q);
+          }
+        }
+      }
+    }
+    // packed once, every session runs it under its own keys
+    Conv2DNest conv(H, 1, 1, weight, bias, shared->HE);
+    // batched models: built once here, every session runs them under its own keys
+    std::map<uint64_t, ResNet_3stages<uint64_t> *> batch_nets;
+    if (max_batch > 0) {
+      batch_nets = BuildBatchNets<ResNet_3stages<uint64_t>>([shared](uint64_t b) {
+        return new ResNet_3stages<uint64_t>(resnet_32_c10(shared, b));
+      }, max_batch);
+    }
+    // the clients, then client 0 once more over its cached keys
+    std::atomic<int> reused{0};
+    {
+      SessionServer<uint64_t> server(shared, port, max_sessions, bitlength, Datatype::IKNP);
+      server.Serve([&conv, &batch_nets, &reused, &server, shared](CryptoPrimitive<uint64_t, Utils::NetIO> *session) {
+        if (session->HE->keys_from_cache) {
+          reused++;
+          cout << "session over cached keys, " << server.key_cache.hit_count() << " cache hits" << endl;
+        }
+        if (max_batch > 0) {
+          BatchScheduler<uint64_t, ResNet_3stages<uint64_t>> batcher(session, batch_nets, {3, 32, 32}, max_batch);
+          batcher.Serve();
+          BatchStats stats = batcher.Stats();
+          cout << "session done, " << stats.requests << " requests in " << stats.batches << " batches, comm: "
+               << session->get_total_comm() << " bytes" << endl;
+          return;
+        }
+        auto start = high_resolution_clock::now();
+        Tensor<uint64_t> x({Ci, H, H});
+        Tensor<uint64_t> y = conv(x);
+        Tensor<uint64_t> z({Co * H * H});
+        (*shared->relu)(z);
+        // test only: hand the server's shares to the client for the check
+        Utils::NetIO *io = session->get_channel(0);
+        io->send_data(y.data().data(), y.size() * sizeof(uint64_t));
+        io->send_data(z.data().data(), z.size() * sizeof(uint64_t));
+        io->flush();
+        cout << "session done, time: " << ((high_resolution_clock::now() - start)).count()/1e+9
+             << " s, comm: " << session->get_total_comm() << " bytes" << endl;
+      }, num_clients + 1);
+    }
+    for (auto &m : batch_nets) {
+      delete m.second;
+    }
+    cout << "served " << num_clients + 1 << " sessions, " << reused << " over cached keys" << endl;
+    return reused == 1 ? 0 : 1;
+  }
+
+  vector<int> passed(num_clients, 0);
+  vector<thread> clients;
+  for (int client = 0; client < num_clients; client++) {
+    clients.emplace_back([client, &passed] { passed[client] = run_client(client, false); });
+  }
+  for (auto &c : clients) {
+    c.join();
+  }
+  bool reconnected = run_client(0, true);
+  return std::count(passed.begin(), passed.end(), 0) == 0 && reconnected ? 0 : 1;
+}
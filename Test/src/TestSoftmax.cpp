@@ -0,0 +1,138 @@
+#include <NonlinearLayer/Softmax.h>
+#include <NonlinearLayer/LayerNorm.h>
+#include <HE/HE.h>
+#include <iostream>
+#include <cmath>
+#include <random>
+#include <limits>
+using namespace std;
+using namespace NonlinearLayer;
+using namespace HE;
+#define MAX_THREADS 4
+typedef int64_t T;
+int party, port = 8000;
+int num_threads = 4;
+string address = "127.0.0.1";
+
+int bitlength = 20;
+int32_t kScale = 12;
+Utils::NetIO *ioArr[MAX_THREADS];
+OTPrimitive::OTPack<Utils::NetIO> *otpackArr[MAX_THREADS];
+
+FixPoint<T> *fixpoint;
+HEEvaluator *he;
+
+const int bitwidth = 20;
+const int scale = 12;
+
+// ALICE receives BOB's share and returns the reconstructed real values
+Tensor<double> reconstruct(Tensor<T> &share){
+  Tensor<double> recon(share.shape());
+  if (party == ALICE){
+    Tensor<T> other(share.shape());
+    ioArr[0]->recv_tensor(other);
+    const uint64_t ring_mask = (1ULL << bitwidth) - 1;
+    const uint64_t sign_bit = 1ULL << (bitwidth - 1);
+    for (size_t i = 0; i < share.size(); i++){
+      uint64_t u = (static_cast<uint64_t>(share(i)) + static_cast<uint64_t>(other(i))) & ring_mask;
+      int64_t s = (u >= sign_bit) ? static_cast<int64_t>(u) - static_cast<int64_t>(1ULL << bitwidth) : static_cast<int64_t>(u);
+      recon(i) = static_cast<double>(s) / static_cast<double>(1ULL << scale);
+    }
+  } else {
+    ioArr[0]->send_tensor(share);
+  }
+  return recon;
+}
+
+void report(const string &name, Tensor<double> &recon, Tensor<double> &gt){
+  if (party != ALICE){
+    return;
+  }
+  double mae = 0.0, max_err = 0.0;
+  for (size_t i = 0; i < gt.size(); i++){
+    double err = std::abs(recon(i) - gt(i));
+    mae += err;
+    max_err = std::max(max_err, err);
+  }
+  mae /= static_cast<double>(gt.size());
+  cout << "[" << name << "] mae=" << mae << ", max_err=" << max_err << endl;
+}
+
+void test_softmax(){
+  const size_t heads = 2, rows = 8, cols = 32;
+  Tensor<T> input({heads, rows, cols});
+  Tensor<double> input_real({heads, rows, cols});
+  Tensor<double> gt({heads, rows, cols});
+  if (party == ALICE){
+    std::mt19937_64 gen(1);
+    std::uniform_real_distribution<double> dist(-4.0, 4.0);
+    for (size_t i = 0; i < input.size(); i++){
+      input_real(i) = dist(gen);
+      input(i) = static_cast<T>(llround(input_real(i) * (1ULL << scale)));
+    }
+    for (size_t r = 0; r < heads * rows; r++){
+      double mx = -std::numeric_limits<double>::infinity(), sum = 0.0;
+      for (size_t j = 0; j < cols; j++) mx = std::max(mx, input_real(r * cols + j));
+      for (size_t j = 0; j < cols; j++) sum += std::exp(input_real(r * cols + j) - mx);
+      for (size_t j = 0; j < cols; j++) gt(r * cols + j) = std::exp(input_real(r * cols + j) - mx) / sum;
+    }
+  }
+  Softmax<T> softmax(fixpoint, he, bitwidth, scale);
+  softmax(input);
+  Tensor<double> recon = reconstruct(input);
+  report("Softmax", recon, gt);
+}
+
+void test_layernorm(){
+  const size_t rows = 16, cols = 64;
+  Tensor<T> input({rows, cols});
+  Tensor<double> input_real({rows, cols});
+  Tensor<double> gt({rows, cols});
+  if (party == ALICE){
+    std::mt19937_64 gen(2);
+    std::uniform_real_distribution<double> dist(-2.0, 2.0);
+    for (size_t i = 0; i < input.size(); i++){
+      input_real(i) = dist(gen);
+      input(i) = static_cast<T>(llround(input_real(i) * (1ULL << scale)));
+    }
+    for (size_t r = 0; r < rows; r++){
+      double mean = 0.0, var = 0.0;
+      for (size_t j = 0; j < cols; j++) mean += input_real(r * cols + j);
+      mean /= cols;
+      for (size_t j = 0; j < cols; j++) var += (input_real(r * cols + j) - mean) * (input_real(r * cols + j) - mean);
+      var /= cols;
+      for (size_t j = 0; j < cols; j++) gt(r * cols + j) = (input_real(r * cols + j) - mean) / std::sqrt(var + 1e-5);
+    }
+  }
+  LayerNorm<T> layernorm(fixpoint, he, bitwidth, scale);
+  layernorm(input);
+  Tensor<double> recon = reconstruct(input);
+  report("LayerNorm", recon, gt);
+}
+
+int main(int argc, char **argv) {
+  /************* Argument Parsing  ************/
+  /********************************************/
+  ArgMapping amap;
+  amap.arg("r", party, "Role of party: ALICE = 1; BOB = 2");
+  amap.arg("p", port, "Port Number");
+  amap.arg("ip", address, "IP Address of server (ALICE)");
+
+  amap.parse(argc, argv);
+
+  assert(num_threads <= MAX_THREADS);
+
+  /********** Setup IO and Base OTs ***********/
+  /********************************************/
+  for (int i = 0; i < num_threads; i++) {
+    ioArr[i] =
+        new Utils::NetIO(party == ALICE ? nullptr : address.c_str(), port + i);
+    otpackArr[i] = new IKNPOTPack<Utils::NetIO>(ioArr[i], party);
+  }
+  fixpoint = new FixPoint<T>(party, otpackArr, num_threads);
+  he = new HE::HEEvaluator(ioArr[0], party, 8192, bitwidth*2, Datatype::HOST, {60,60,60});
+  he->GenerateNewKey();
+
+  test_softmax();
+  test_layernorm();
+}
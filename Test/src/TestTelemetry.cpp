@@ -0,0 +1,138 @@
+#include <HE/unified/EvalTelemetry.h>
+#include <HE/unified/UnifiedContext.h>
+#include <HE/unified/UnifiedEncoder.h>
+#include <HE/unified/UnifiedEvaluator.h>
+#include <Utils/profiler.h>
+#include <cmath>
+#include <iostream>
+#include <vector>
+using namespace std;
+using namespace HE::unified;
+
+int failures = 0;
+
+void check(bool ok, const string &what) {
+  cout << (ok ? "ok: " : "FAILED: ") << what << endl;
+  failures += !ok;
+}
+
+bool close_to(double a, double b) { return std::fabs(a - b) <= 1e-9 * std::max(1.0, std::fabs(b)); }
+
+// Calibrate takes the per-op average of the measured ops and keeps the model's constants for the
+// ops that were not measured; Predict is the count-weighted sum.
+void TestCostModel() {
+  EvalCostModel model = EvalCostModel::Default(8192, 3);
+  const EvalCostModel analytic = model;
+  check(model.ms_per_op[int(EvalOp::RotateRows)] > model.ms_per_op[int(EvalOp::MultiplyPlain)] &&
+            model.ms_per_op[int(EvalOp::MultiplyPlain)] > model.ms_per_op[int(EvalOp::Add)],
+        "analytic model: rotate > multiply_plain > add");
+
+  EvalCounts measured;
+  measured.count[int(EvalOp::RotateRows)] = 4;
+  measured.ms[int(EvalOp::RotateRows)] = 8.0;
+  measured.count[int(EvalOp::MultiplyPlain)] = 10;
+  measured.ms[int(EvalOp::MultiplyPlain)] = 5.0;
+  model.Calibrate(measured);
+  check(close_to(model.ms_per_op[int(EvalOp::RotateRows)], 2.0) &&
+            close_to(model.ms_per_op[int(EvalOp::MultiplyPlain)], 0.5),
+        "Calibrate: per-op averages of the measured ops");
+  check(model.ms_per_op[int(EvalOp::Add)] == analytic.ms_per_op[int(EvalOp::Add)],
+        "Calibrate: unmeasured ops keep the analytic cost");
+
+  EvalCounts layer;
+  layer.count[int(EvalOp::RotateRows)] = 3;
+  layer.count[int(EvalOp::MultiplyPlain)] = 2;
+  layer.count[int(EvalOp::Add)] = 7;
+  check(close_to(model.Predict(layer), 3 * 2.0 + 2 * 0.5 + 7 * analytic.ms_per_op[int(EvalOp::Add)]),
+        "Predict: count-weighted sum");
+  check(close_to(model.Predict(measured), 8.0 + 5.0), "Predict reproduces the calibration run");
+}
+
+// A known sequence of evaluator ops, counted by HE_COUNT_OP / the counted seal members and
+// attributed to the profiler span that was open.
+void TestOpCounts() {
+  UnifiedContext context(8192, 20);
+  seal::KeyGenerator keygen(context);
+  seal::PublicKey pk;
+  seal::RelinKeys rk;
+  UnifiedGaloisKeys gk(HOST);
+  keygen.create_public_key(pk);
+  keygen.create_relin_keys(rk);
+  keygen.create_galois_keys(gk);
+  seal::Encryptor encryptor(context, pk);
+  UnifiedBatchEncoder encoder(context);
+  UnifiedEvaluator evaluator(context);
+
+  std::vector<uint64_t> values(8192, 1);
+  UnifiedPlaintext pt(HOST), pt_ntt(HOST);
+  encoder.encode(values, pt);
+  encoder.encode(values, pt_ntt);
+  UnifiedCiphertext a(HOST), b(HOST), c(HOST);
+  encryptor.encrypt(pt, a);
+  encryptor.encrypt(pt, b);
+
+  Utils::Profiler &profiler = Utils::Profiler::Get();
+  profiler.enabled = true;
+  EvalTelemetry::Get().Reset();
+  {
+    Utils::ProfileScope scope("sequence", "layer");
+    for (int i = 0; i < 3; i++) {
+      evaluator.rotate_rows_inplace(a, 1 << i, gk);
+    }
+    evaluator.multiply_plain(a, pt, c);
+    evaluator.multiply_plain_inplace(b, pt);
+    evaluator.add_inplace(c, b);
+    evaluator.add_inplace(c, a);
+    evaluator.add_plain_inplace(c, pt);
+    evaluator.multiply_inplace(c, b);
+    evaluator.relinearize_inplace(c, rk);
+    evaluator.transform_to_ntt_inplace(pt_ntt, context.hcontext().first_parms_id());
+    evaluator.transform_to_ntt_inplace(a);
+    evaluator.transform_to_ntt_inplace(b);
+    evaluator.multiply_plain_ntt_accumulate({&a, &b}, {&pt_ntt, &pt_ntt}, c);
+    evaluator.transform_from_ntt_inplace(c);
+  }
+  profiler.enabled = false;
+
+  EvalCounts counts = EvalTelemetry::Get().Snapshot();
+#ifdef HE_TELEMETRY
+  std::array<uint64_t, kNumEvalOps> expected{};
+  expected[int(EvalOp::RotateRows)] = 3;
+  expected[int(EvalOp::MultiplyPlain)] = 2;
+  expected[int(EvalOp::Add)] = 2;
+  expected[int(EvalOp::AddPlain)] = 1;
+  expected[int(EvalOp::Multiply)] = 1;
+  expected[int(EvalOp::Relinearize)] = 1;
+  expected[int(EvalOp::ToNTT)] = 3;
+  expected[int(EvalOp::MultiplyPlainAccumulate)] = 1;
+  expected[int(EvalOp::FromNTT)] = 1;
+  const Utils::Profiler::Span &span = profiler.Spans().back();
+  for (int i = 0; i < kNumEvalOps; i++) {
+    const char *name = EvalOpName(static_cast<EvalOp>(i));
+    auto it = span.counters.find(name);
+    uint64_t in_span = it == span.counters.end() ? 0 : it->second;
+    check(counts.count[i] == expected[i] && in_span == expected[i],
+          string(name) + ": " + to_string(counts.count[i]) + " counted, " + to_string(in_span) +
+              " in the span, " + to_string(expected[i]) + " expected");
+  }
+  EvalCostModel model = EvalCostModel::Default(8192, 3);
+  model.Calibrate(counts);
+  double total_ms = 0;
+  for (int i = 0; i < kNumEvalOps; i++) {
+    total_ms += counts.ms[i];
+  }
+  check(close_to(model.Predict(counts), total_ms), "calibrated on a run, Predict gives back its time");
+#else
+  uint64_t total = 0;
+  for (int i = 0; i < kNumEvalOps; i++) {
+    total += counts.count[i];
+  }
+  check(total == 0, "HE_TELEMETRY off: nothing is counted");
+#endif
+}
+
+int main(int argc, char **argv) {
+  TestCostModel();
+  TestOpCounts();
+  return failures == 0 ? 0 : 1;
+}
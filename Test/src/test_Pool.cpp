@@ -1,16 +1,186 @@
 //#include "NetIO.h"
 #include <NonlinearLayer/Pool.h>
+#include <Utils/loopback_io_channel.h>
+#include <algorithm>
+#include <climits>
+#include <functional>
 using namespace std;
 using namespace NonlinearLayer;
 
-// avg_pool is correct!
-int main(int argc, char* argv[]) {
-    Tensor<uint64_t> x({1,1,4,4});
-    x.randomize(4);
-    x.print();
-    std::cout << "gen";
-    AvgPool2D<uint64_t> avg_pool(2);
+int num_threads = 2;
+const int bw = 32;
+const uint64_t ring_mask = (1ULL << bw) - 1;
+
+// window sums of AvgPool2D (deferred scaling) against a naive loop
+bool check_avg_pool(uint64_t C, uint64_t H, uint64_t k, uint64_t s, uint64_t p) {
+    Tensor<uint64_t> x({C, H, H});
+    x.randomize(1ULL << 16);
+    AvgPool2D<uint64_t> avg_pool(k, s, p);
     Tensor<uint64_t> y = avg_pool(x);
-    y.print();
-    return 0;
-}
\ No newline at end of file
+    uint64_t Hout = (H + 2 * p - k) / s + 1;
+    for (uint64_t c = 0; c < C; c++) {
+        for (uint64_t oh = 0; oh < Hout; oh++) {
+            for (uint64_t ow = 0; ow < Hout; ow++) {
+                uint64_t sum = 0;
+                for (uint64_t ph = 0; ph < k; ph++) {
+                    for (uint64_t pw = 0; pw < k; pw++) {
+                        int64_t ih = int64_t(oh * s + ph) - int64_t(p);
+                        int64_t iw = int64_t(ow * s + pw) - int64_t(p);
+                        if (ih >= 0 && ih < int64_t(H) && iw >= 0 && iw < int64_t(H)) {
+                            sum += x({c, uint64_t(ih), uint64_t(iw)});
+                        }
+                    }
+                }
+                if (y({c, oh, ow}) != sum) {
+                    cout << "mismatch at " << c << "," << oh << "," << ow << endl;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Both parties in this process: `layer` runs on ALICE's and BOB's bw-bit shares of `plain` and the
+// reconstructed output is returned, as signed values.
+Tensor<int64_t> run_shared(const Tensor<int64_t> &plain, const function<Tensor<uint64_t>(FixPoint<uint64_t> *, Tensor<uint64_t> &)> &layer) {
+    Tensor<uint64_t> x_alice(plain.shape()), x_bob(plain.shape());
+    Tensor<uint64_t> r(plain.shape());
+    r.randomize(1ULL << 62);
+    for (size_t i = 0; i < plain.size(); i++) {
+        x_alice(i) = (static_cast<uint64_t>(plain(i)) + r(i)) & ring_mask;
+        x_bob(i) = (0 - r(i)) & ring_mask;
+    }
+    Tensor<uint64_t> y_alice, y_bob;
+    auto run = [&](int party, Tensor<uint64_t> &x, Tensor<uint64_t> &y, Utils::NetIO **ioArr) {
+        OTPrimitive::OTPack<Utils::NetIO> **otpackArr = new OTPrimitive::OTPack<Utils::NetIO>*[num_threads];
+        for (int i = 0; i < num_threads; i++) {
+            otpackArr[i] = new IKNPOTPack<Utils::NetIO>(ioArr[i], party);
+        }
+        FixPoint<uint64_t> fixpoint(party, otpackArr, num_threads);
+        y = layer(&fixpoint, x);
+    };
+    Utils::RunTwoParty([&](Utils::NetIO **ioArr) { run(ALICE, x_alice, y_alice, ioArr); },
+                       [&](Utils::NetIO **ioArr) { run(BOB, x_bob, y_bob, ioArr); },
+                       num_threads);
+    Tensor<int64_t> y(y_alice.shape());
+    for (size_t i = 0; i < y.size(); i++) {
+        uint64_t v = (y_alice(i) + y_bob(i)) & ring_mask;
+        y(i) = v >> (bw - 1) ? static_cast<int64_t>(v) - (int64_t(1) << bw) : static_cast<int64_t>(v);
+    }
+    return y;
+}
+
+// AvgPool2D with a FixPoint divides the window sums of the shares: an exact shift for a power-of-two
+// window, else extend, multiply by round(2^shift / k^2) and truncate, each within one unit
+bool check_avg_pool_divide(uint64_t C, uint64_t H, uint64_t k, uint64_t s, uint64_t p) {
+    Tensor<int64_t> x({C, H, H});
+    for (size_t i = 0; i < x.size(); i++) {
+        x(i) = (i * 7919) % (1 << 16);
+    }
+    const int shift = 12;
+    Tensor<int64_t> y = run_shared(x, [&](FixPoint<uint64_t> *fixpoint, Tensor<uint64_t> &share) {
+        AvgPool2D<uint64_t> avg_pool(k, s, p, fixpoint, bw, shift);
+        return avg_pool(share);
+    });
+    uint64_t d = k * k;
+    int64_t inv_d = llround(static_cast<double>(1 << shift) / static_cast<double>(d));
+    uint64_t Hout = (H + 2 * p - k) / s + 1;
+    uint64_t wrong = 0;
+    for (uint64_t c = 0; c < C; c++) {
+        for (uint64_t oh = 0; oh < Hout; oh++) {
+            for (uint64_t ow = 0; ow < Hout; ow++) {
+                int64_t sum = 0;
+                for (uint64_t ph = 0; ph < k; ph++) {
+                    for (uint64_t pw = 0; pw < k; pw++) {
+                        int64_t ih = int64_t(oh * s + ph) - int64_t(p);
+                        int64_t iw = int64_t(ow * s + pw) - int64_t(p);
+                        if (ih >= 0 && ih < int64_t(H) && iw >= 0 && iw < int64_t(H)) {
+                            sum += x({c, uint64_t(ih), uint64_t(iw)});
+                        }
+                    }
+                }
+                int64_t want = (d & (d - 1)) == 0 ? sum / int64_t(d) : (sum * inv_d) >> shift;
+                wrong += std::abs(y({c, oh, ow}) - want) > 1;
+            }
+        }
+    }
+    if (wrong) {
+        cout << "avg_pool divide k=" << k << ": " << wrong << " outputs off by more than one" << endl;
+    }
+    return wrong == 0;
+}
+
+// MaxPool2D on signed shares against a plaintext max over the valid positions of every window; padded
+// positions must never win and odd windows hand a bye to the next tournament round
+bool check_max_pool(std::vector<size_t> shape, uint64_t k, uint64_t s, uint64_t p) {
+    Tensor<int64_t> x(shape);
+    for (size_t i = 0; i < x.size(); i++) {
+        x(i) = static_cast<int64_t>((i * 2654435761ULL) % 8192) - 4096;
+    }
+    Tensor<int64_t> y = run_shared(x, [&](FixPoint<uint64_t> *fixpoint, Tensor<uint64_t> &share) {
+        MaxPool2D<uint64_t> max_pool(fixpoint, bw, k, s, p);
+        return max_pool(share);
+    });
+    uint64_t H = shape[shape.size() - 2], W = shape[shape.size() - 1];
+    uint64_t C = x.size() / (H * W);
+    uint64_t Hout = (H + 2 * p - k) / s + 1, Wout = (W + 2 * p - k) / s + 1;
+    if (y.size() != C * Hout * Wout || y.shape().size() != shape.size()) {
+        cout << "max_pool k=" << k << ": wrong output shape" << endl;
+        return false;
+    }
+    uint64_t wrong = 0;
+    for (uint64_t c = 0; c < C; c++) {
+        for (uint64_t oh = 0; oh < Hout; oh++) {
+            for (uint64_t ow = 0; ow < Wout; ow++) {
+                int64_t want = INT64_MIN;
+                for (uint64_t ph = 0; ph < k; ph++) {
+                    for (uint64_t pw = 0; pw < k; pw++) {
+                        int64_t ih = int64_t(oh * s + ph) - int64_t(p);
+                        int64_t iw = int64_t(ow * s + pw) - int64_t(p);
+                        if (ih >= 0 && ih < int64_t(H) && iw >= 0 && iw < int64_t(W)) {
+                            want = std::max(want, x(c * H * W + ih * W + iw));
+                        }
+                    }
+                }
+                wrong += y(c * Hout * Wout + oh * Wout + ow) != want;
+            }
+        }
+    }
+    if (wrong) {
+        cout << "max_pool k=" << k << " s=" << s << " p=" << p << ": " << wrong << " mismatches" << endl;
+    }
+    return wrong == 0;
+}
+
+int main(int argc, char* argv[]) {
+    bool ok = true;
+    auto report = [&ok](const string &name, bool passed) {
+        cout << name << ": " << (passed ? "ok" : "FAILED") << endl;
+        ok &= passed;
+    };
+    report("avg_pool k=2 s=2 p=0", check_avg_pool(3, 8, 2, 2, 0));
+    report("avg_pool k=3 s=2 p=1", check_avg_pool(3, 9, 3, 2, 1));
+    report("avg_pool k=3 s=1 p=1", check_avg_pool(2, 7, 3, 1, 1));
+
+    Tensor<uint64_t> x({4, 7, 7});
+    x.randomize(1ULL << 16);
+    GlobalAvgPool<uint64_t> global_pool(7);
+    AvgPool2D<uint64_t> avg_pool(7);
+    Tensor<uint64_t> g = global_pool(x);
+    Tensor<uint64_t> a = avg_pool(x);
+    bool same = true;
+    for (size_t c = 0; c < 4; c++) {
+        same &= (g(c) == a(c));
+    }
+    report("global_avg_pool, divisor " + to_string(global_pool.divisor()), same);
+
+    report("avg_pool divide k=2 s=2 p=0", check_avg_pool_divide(3, 8, 2, 2, 0));
+    report("avg_pool divide k=3 s=2 p=1", check_avg_pool_divide(3, 9, 3, 2, 1));
+
+    report("max_pool k=2 s=2 p=0", check_max_pool({3, 8, 8}, 2, 2, 0));
+    report("max_pool k=3 s=2 p=1", check_max_pool({3, 9, 9}, 3, 2, 1));
+    report("max_pool k=3 s=1 p=0, odd width", check_max_pool({2, 7, 5}, 3, 1, 0));
+    report("max_pool k=3 s=2 p=1, batch", check_max_pool({2, 4, 8, 8}, 3, 2, 1));
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "Utils/net_io_channel.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace Utils {
+/** @addtogroup IO
+  @{
+ */
+
+// A network link: bandwidth, one-way latency and latency jitter.
+struct NetProfile {
+  string name;
+  double bandwidth_mbps;
+  double latency_ms;
+  double jitter_ms = 0;
+};
+
+// The settings of the former throttle.sh (tc tbf rate + netem delay on lo) plus a mobile uplink.
+inline const std::vector<NetProfile> &NetProfiles() {
+  static const std::vector<NetProfile> profiles = {
+      {"lan", 3000, 0.25, 0},  {"wan1", 400, 2, 0},   {"wan2", 800, 40, 0},
+      {"wan3", 1600, 20, 0},   {"wan4", 1600, 40, 0}, {"mobile", 20, 50, 5},
+  };
+  return profiles;
+}
+
+inline NetProfile GetNetProfile(const string &name) {
+  for (const NetProfile &p : NetProfiles()) {
+    if (p.name == name)
+      return p;
+  }
+  throw std::invalid_argument("unknown network profile: " + name);
+}
+
+// Token bucket pacing the bytes leaving one party. Channels that share a physical link share
+// one bucket, so num_threads OT channels together get the profile's bandwidth.
+class TokenBucket {
+public:
+  explicit TokenBucket(double bandwidth_mbps)
+      : rate(bandwidth_mbps * 1e6 / 8), burst(std::max(65536.0, rate * 1e-3)),
+        tokens(burst), last(std::chrono::steady_clock::now()) {}
+
+  // Returns the seconds the caller has to wait before `len` bytes are on the wire.
+  double take(size_t len) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto now = std::chrono::steady_clock::now();
+    tokens = std::min(burst, tokens + std::chrono::duration<double>(now - last).count() * rate);
+    last = now;
+    tokens -= static_cast<double>(len);
+    return tokens < 0 ? -tokens / rate : 0.0;
+  }
+
+private:
+  double rate, burst, tokens;
+  std::chrono::steady_clock::time_point last;
+  std::mutex mtx;
+};
+
+// Decorator that puts a NetProfile in front of another channel. Sends are paced by the token
+// bucket; the first receive of every round is delivered one latency (+ jitter) late. With
+// emulate = false nothing sleeps and the channel only accounts bytes and rounds, which is enough
+// for Estimate() to predict the wall time of any profile from a single LAN or loopback run.
+template <typename IO> class EmulatedIO : public IOChannel<EmulatedIO<IO>> {
+public:
+  IO *io;
+  NetProfile profile;
+  bool emulate;
+  bool is_server;
+  uint64_t num_rounds = 0;
+  uint64_t recv_rounds = 0;
+  uint64_t bytes_sent = 0, bytes_recv = 0;
+  double delay_s = 0; // time spent sleeping for the emulation
+  LastCall last_call = LastCall::None;
+
+  EmulatedIO(IO *io, const NetProfile &profile, bool emulate = true,
+             std::shared_ptr<TokenBucket> link = nullptr, uint64_t seed = 0)
+      : io(io), profile(profile), emulate(emulate), is_server(io->is_server),
+        link(link ? link : std::make_shared<TokenBucket>(profile.bandwidth_mbps)),
+        gen(seed) {}
+
+  void sync() { io->sync(); }
+
+  void flush() { io->flush(); }
+
+  void send_data_internal(const void *data, int len) {
+    if (last_call != LastCall::Send) {
+      num_rounds++;
+      last_call = LastCall::Send;
+    }
+    bytes_sent += len;
+    if (emulate)
+      sleep(link->take(len));
+    io->send_data(data, len);
+  }
+
+  void recv_data_internal(void *data, int len) {
+    if (last_call != LastCall::Recv) {
+      num_rounds++;
+      recv_rounds++;
+      last_call = LastCall::Recv;
+      if (emulate) {
+        io->flush();
+        double jitter = profile.jitter_ms > 0
+                            ? std::uniform_real_distribution<double>(-profile.jitter_ms, profile.jitter_ms)(gen)
+                            : 0.0;
+        sleep(std::max(0.0, profile.latency_ms + jitter) * 1e-3);
+      }
+    }
+    bytes_recv += len;
+    io->recv_data(data, len);
+  }
+
+  // Wall time of the same run over `p`: the time not spent on communication, one latency per
+  // round and the traffic of both directions through the link.
+  double Estimate(const NetProfile &p, double wall_s) const {
+    return ComputeTime(wall_s) + recv_rounds * p.latency_ms * 1e-3 +
+           (bytes_sent + bytes_recv) * 8 / (p.bandwidth_mbps * 1e6);
+  }
+
+  double ComputeTime(double wall_s) const {
+    return std::max(0.0, wall_s - (emulate ? delay_s : 0.0));
+  }
+
+  // NetIO over this channel for the NetIO-only protocols (FixPoint, AuxProtocols, HEEvaluator).
+  // Both parties must use it: every stream write is framed with its length so that the reader
+  // can return short reads at frame boundaries instead of waiting for a full stdio buffer.
+  NetIO *open_netio() { return new NetIO(open_stream(), is_server); }
+
+  FILE *open_stream() {
+    cookie_io_functions_t funcs;
+    funcs.read = [](void *c, char *buf, size_t size) -> ssize_t {
+      EmulatedIO *self = static_cast<EmulatedIO *>(c);
+      while (self->frame_left == 0) {
+        self->recv_data(&self->frame_left, sizeof(uint32_t));
+      }
+      size_t take = std::min<size_t>(size, self->frame_left);
+      self->recv_data(buf, take);
+      self->frame_left -= take;
+      return take;
+    };
+    funcs.write = [](void *c, const char *buf, size_t size) -> ssize_t {
+      EmulatedIO *self = static_cast<EmulatedIO *>(c);
+      uint32_t len = size;
+      self->send_data(&len, sizeof(uint32_t));
+      self->send_data(buf, size);
+      self->flush();
+      return size;
+    };
+    funcs.seek = nullptr;
+    funcs.close = nullptr;
+    return fopencookie(this, "wb+", funcs);
+  }
+
+private:
+  std::shared_ptr<TokenBucket> link;
+  std::mt19937_64 gen;
+  uint32_t frame_left = 0;
+
+  void sleep(double secs) {
+    if (secs <= 0)
+      return;
+    delay_s += secs;
+    std::this_thread::sleep_for(std::chrono::duration<double>(secs));
+  }
+};
+
+// Estimated wall time of one run for every NetProfile. Channels run concurrently, so rounds are
+// taken from the busiest channel while the bytes of all channels share the link.
+template <typename IO>
+void ReportNetProfiles(EmulatedIO<IO> **channels, int num_channels, double wall_s,
+                       std::ostream &os = std::cout) {
+  uint64_t rounds = 0, bytes = 0;
+  double delay = 0;
+  for (int i = 0; i < num_channels; i++) {
+    rounds = std::max(rounds, channels[i]->recv_rounds);
+    bytes += channels[i]->bytes_sent + channels[i]->bytes_recv;
+    delay = std::max(delay, channels[i]->emulate ? channels[i]->delay_s : 0.0);
+  }
+  double compute = std::max(0.0, wall_s - delay);
+  os << "measured: " << wall_s << " s, compute: " << compute << " s, rounds: " << rounds
+     << ", comm: " << bytes / 1048576.0 << " MB" << std::endl;
+  for (const NetProfile &p : NetProfiles()) {
+    double est = compute + rounds * p.latency_ms * 1e-3 + bytes * 8 / (p.bandwidth_mbps * 1e6);
+    os << "  " << p.name << " (" << p.bandwidth_mbps << " Mbps, " << p.latency_ms
+       << " ms): " << est << " s" << std::endl;
+  }
+}
+/**@}*/
+
+} // namespace Utils
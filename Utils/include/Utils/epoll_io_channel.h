@@ -0,0 +1,354 @@
+#pragma once
+
+#include "Utils/net_io_channel.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <utility>
+#include <vector>
+
+namespace Utils {
+/** @addtogroup IO
+  @{
+ */
+
+// User-space buffer of each EpollIO direction. OT extension sends a few MB per batch, so a
+// large buffer turns one fflush per send_data into one writev per batch.
+const static size_t EPOLL_BUFFER_SIZE = 1 << 22;
+
+// Readiness loop shared by any number of EpollIO channels. A channel that would block runs the
+// reactor until its own socket is ready; meanwhile the other channels on the same reactor drain
+// their pending sends and pull incoming bytes into their buffers, so many channels can be kept
+// in flight by one thread. Not thread-safe: one reactor per thread.
+class EpollReactor {
+public:
+  class Handler {
+  public:
+    virtual void on_event(uint32_t events) = 0;
+    // Called before every wait. Edge-triggered EPOLLOUT does not fire again for a socket that
+    // stayed writable, so bytes buffered since the last edge are pushed from here.
+    virtual void on_poll() {}
+    virtual ~Handler() = default;
+  };
+
+  EpollReactor() {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+      perror("error: epoll_create1");
+      exit(1);
+    }
+  }
+
+  ~EpollReactor() { ::close(epfd); }
+
+  void add(int fd, Handler *handler) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = handler;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      perror("error: epoll_ctl");
+      exit(1);
+    }
+    handlers.emplace_back(fd, handler);
+  }
+
+  void remove(int fd) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    handlers.erase(std::remove_if(handlers.begin(), handlers.end(),
+                                  [fd](const std::pair<int, Handler *> &h) { return h.first == fd; }),
+                   handlers.end());
+  }
+
+  // Let every channel make progress, then dispatch the events that are ready, waiting at most
+  // timeout_ms (-1: forever).
+  int run_once(int timeout_ms = -1) {
+    for (auto &h : handlers) {
+      h.second->on_poll();
+    }
+    struct epoll_event evs[64];
+    int n = epoll_wait(epfd, evs, 64, timeout_ms);
+    if (n < 0) {
+      if (errno == EINTR)
+        return 0;
+      perror("error: epoll_wait");
+      exit(1);
+    }
+    num_waits++;
+    for (int i = 0; i < n; i++) {
+      static_cast<Handler *>(evs[i].data.ptr)->on_event(evs[i].events);
+    }
+    return n;
+  }
+
+  uint64_t num_waits = 0;
+
+private:
+  int epfd = -1;
+  std::vector<std::pair<int, Handler *>> handlers;
+};
+
+// Non-blocking socket channel with the NetIO interface. Sends are buffered in user space and
+// written with writev (buffered bytes and a large payload in one call); receives are served from
+// a user-space buffer refilled with readv, which also reads straight into the destination when
+// it is empty. Pass a shared EpollReactor to drive several channels from one thread.
+class EpollIO : public IOChannel<EpollIO>, public EpollReactor::Handler {
+public:
+  bool is_server;
+  int consocket = -1;
+  string addr;
+  int port;
+  uint64_t num_rounds = 0;
+  uint64_t num_syscalls = 0;
+  LastCall last_call = LastCall::None;
+
+  EpollIO(const char *address, int port, bool quiet = false,
+          EpollReactor *reactor = nullptr,
+          size_t buffer_size = EPOLL_BUFFER_SIZE) {
+    this->port = port;
+    is_server = (address == nullptr);
+    if (address == nullptr) {
+      consocket = AcceptOne(port);
+    } else {
+      addr = string(address);
+      consocket = ConnectTo(address, port);
+    }
+    setup(reactor, buffer_size);
+    if (!quiet)
+      std::cout << "connected\n";
+  }
+
+  EpollIO(int fd, bool is_server, EpollReactor *reactor = nullptr,
+          size_t buffer_size = EPOLL_BUFFER_SIZE) {
+    this->is_server = is_server;
+    this->port = -1;
+    consocket = fd;
+    setup(reactor, buffer_size);
+  }
+
+  // Buffered bytes are flushed best effort; call flush() before destruction to see send errors.
+  ~EpollIO() {
+    if (!closed) {
+      try {
+        flush();
+      } catch (const std::exception &) {
+      }
+    }
+    reactor->remove(consocket);
+    ::close(consocket);
+  }
+
+  void sync() {
+    int tmp = 0;
+    if (is_server) {
+      send_data_internal(&tmp, 1);
+      recv_data_internal(&tmp, 1);
+    } else {
+      recv_data_internal(&tmp, 1);
+      send_data_internal(&tmp, 1);
+      flush();
+    }
+  }
+
+  void set_nodelay() {
+    const int one = 1;
+    setsockopt(consocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  void set_delay() {
+    const int zero = 0;
+    setsockopt(consocket, IPPROTO_TCP, TCP_NODELAY, &zero, sizeof(zero));
+  }
+
+  void flush() { write_vectored(nullptr, 0); }
+
+  void send_data_internal(const void *data, int len) {
+    if (last_call != LastCall::Send) {
+      num_rounds++;
+      last_call = LastCall::Send;
+    }
+    if (send_end + len > send_buf.size() && send_begin > 0) {
+      compact(send_buf, send_begin, send_end);
+    }
+    if (send_end + len > send_buf.size()) {
+      write_vectored(static_cast<const char *>(data), len);
+      return;
+    }
+    memcpy(send_buf.data() + send_end, data, len);
+    send_end += len;
+  }
+
+  void recv_data_internal(void *data, int len) {
+    if (last_call != LastCall::Recv) {
+      num_rounds++;
+      last_call = LastCall::Recv;
+    }
+    // the peer cannot answer what we have not sent yet
+    flush();
+    char *out = static_cast<char *>(data);
+    size_t need = len;
+    while (need > 0) {
+      size_t avail = recv_end - recv_begin;
+      if (avail > 0) {
+        size_t take = std::min(avail, need);
+        memcpy(out, recv_buf.data() + recv_begin, take);
+        recv_begin += take;
+        out += take;
+        need -= take;
+        if (recv_begin == recv_end)
+          recv_begin = recv_end = 0;
+        continue;
+      }
+      struct iovec iov[2];
+      iov[0].iov_base = out;
+      iov[0].iov_len = need;
+      iov[1].iov_base = recv_buf.data();
+      iov[1].iov_len = recv_buf.size();
+      ssize_t n = ::readv(consocket, iov, 2);
+      num_syscalls++;
+      if (n > 0) {
+        if (static_cast<size_t>(n) <= need) {
+          out += n;
+          need -= n;
+        } else {
+          recv_begin = 0;
+          recv_end = n - need;
+          need = 0;
+        }
+      } else if (n == 0) {
+        closed = true;
+        throw std::runtime_error("EpollIO: connection closed by peer");
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        wait(readable);
+      } else if (errno != EINTR) {
+        throw std::runtime_error(string("EpollIO: readv failed: ") + strerror(errno));
+      }
+    }
+  }
+
+  void on_event(uint32_t events) override {
+    if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+      readable = writable = true;
+    }
+    if (events & EPOLLOUT) {
+      writable = true;
+      try_send();
+    }
+    if (events & EPOLLIN) {
+      readable = true;
+      try_fill();
+    }
+  }
+
+  void on_poll() override {
+    if (writable && send_begin < send_end)
+      try_send();
+  }
+
+private:
+  std::unique_ptr<EpollReactor> own_reactor;
+  EpollReactor *reactor = nullptr;
+  std::vector<char> send_buf, recv_buf;
+  size_t send_begin = 0, send_end = 0;
+  size_t recv_begin = 0, recv_end = 0;
+  bool readable = false, writable = false, closed = false;
+
+  void setup(EpollReactor *reactor, size_t buffer_size) {
+    set_nodelay();
+    int flags = fcntl(consocket, F_GETFL, 0);
+    fcntl(consocket, F_SETFL, flags | O_NONBLOCK);
+    send_buf.resize(buffer_size);
+    recv_buf.resize(buffer_size);
+    if (reactor == nullptr) {
+      own_reactor.reset(new EpollReactor());
+      reactor = own_reactor.get();
+    }
+    this->reactor = reactor;
+    reactor->add(consocket, this);
+  }
+
+  static void compact(std::vector<char> &buf, size_t &begin, size_t &end) {
+    memmove(buf.data(), buf.data() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+  }
+
+  // Block on the reactor until `flag` is raised by an event of this socket. Edge-triggered, so
+  // the flag is only cleared after a syscall has returned EAGAIN.
+  void wait(bool &flag) {
+    flag = false;
+    while (!flag) {
+      reactor->run_once();
+    }
+  }
+
+  // Write the buffered bytes followed by data[0, len), blocking until all are on the socket.
+  void write_vectored(const char *data, size_t len) {
+    while (send_begin < send_end || len > 0) {
+      struct iovec iov[2];
+      int cnt = 0;
+      size_t buffered = send_end - send_begin;
+      if (buffered > 0) {
+        iov[cnt].iov_base = send_buf.data() + send_begin;
+        iov[cnt++].iov_len = buffered;
+      }
+      if (len > 0) {
+        iov[cnt].iov_base = const_cast<char *>(data);
+        iov[cnt++].iov_len = len;
+      }
+      ssize_t n = ::writev(consocket, iov, cnt);
+      num_syscalls++;
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          wait(writable);
+          continue;
+        }
+        if (errno == EINTR)
+          continue;
+        closed = true;
+        throw std::runtime_error(string("EpollIO: writev failed: ") + strerror(errno));
+      }
+      size_t from_buf = std::min(static_cast<size_t>(n), buffered);
+      send_begin += from_buf;
+      data += n - from_buf;
+      len -= n - from_buf;
+      if (send_begin == send_end)
+        send_begin = send_end = 0;
+    }
+  }
+
+  // Opportunistic progress from the reactor, never blocks.
+  void try_send() {
+    while (send_begin < send_end) {
+      ssize_t n = ::write(consocket, send_buf.data() + send_begin,
+                          send_end - send_begin);
+      num_syscalls++;
+      if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          writable = false;  // the next EPOLLOUT edge resumes
+        return;
+      }
+      send_begin += n;
+    }
+    send_begin = send_end = 0;
+  }
+
+  void try_fill() {
+    if (recv_begin > 0)
+      compact(recv_buf, recv_begin, recv_end);
+    while (recv_end < recv_buf.size()) {
+      ssize_t n = ::read(consocket, recv_buf.data() + recv_end,
+                         recv_buf.size() - recv_end);
+      num_syscalls++;
+      if (n <= 0)
+        return;
+      recv_end += n;
+    }
+  }
+};
+/**@}*/
+
+} // namespace Utils
@@ -13,11 +13,15 @@ namespace Utils {
 template <typename T> class IOChannel {
 public:
     uint64_t counter = 0;
+    uint64_t recv_counter = 0;
   void send_data(const void *data, int nbyte) {
       counter += nbyte;
     derived().send_data_internal(data, nbyte);
   }
-  void recv_data(void *data, int nbyte) { derived().recv_data_internal(data, nbyte); }
+  void recv_data(void *data, int nbyte) {
+      recv_counter += nbyte;
+    derived().recv_data_internal(data, nbyte);
+  }
 
   // implement a function to send a tensor
   template <typename U>
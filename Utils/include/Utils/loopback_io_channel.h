@@ -0,0 +1,191 @@
+#pragma once
+
+#include "Utils/net_io_channel.h"
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace Utils {
+/** @addtogroup IO
+  @{
+ */
+
+// Lock-free single-producer single-consumer byte ring. The producer only moves `tail`, the
+// consumer only moves `head`; both spin briefly and then yield when the ring is full/empty.
+class SPSCRing {
+public:
+  explicit SPSCRing(size_t capacity = 1 << 22) {
+    size_t cap = 1;
+    while (cap < capacity)
+      cap <<= 1;
+    buf.resize(cap);
+    mask = cap - 1;
+  }
+
+  void write(const char *data, size_t len) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    while (len > 0) {
+      size_t free_bytes;
+      int spins = 0;
+      while ((free_bytes = buf.size() - (t - head.load(std::memory_order_acquire))) == 0) {
+        backoff(spins);
+      }
+      size_t chunk = std::min({len, free_bytes, buf.size() - (t & mask)});
+      memcpy(buf.data() + (t & mask), data, chunk);
+      t += chunk;
+      data += chunk;
+      len -= chunk;
+      tail.store(t, std::memory_order_release);
+    }
+  }
+
+  // Returns between 1 and len bytes, or 0 if the ring is empty and closed.
+  size_t read(char *data, size_t len) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t avail;
+    int spins = 0;
+    while ((avail = tail.load(std::memory_order_acquire) - h) == 0) {
+      if (closed.load(std::memory_order_acquire)) {
+        if (tail.load(std::memory_order_acquire) == h)
+          return 0;
+        continue;
+      }
+      backoff(spins);
+    }
+    size_t copied = 0;
+    while (copied < len && avail > 0) {
+      size_t chunk = std::min({len - copied, avail, buf.size() - (h & mask)});
+      memcpy(data + copied, buf.data() + (h & mask), chunk);
+      h += chunk;
+      copied += chunk;
+      avail -= chunk;
+    }
+    head.store(h, std::memory_order_release);
+    return copied;
+  }
+
+  void close() { closed.store(true, std::memory_order_release); }
+
+private:
+  std::vector<char> buf;
+  size_t mask;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  std::atomic<bool> closed{false};
+
+  static void backoff(int &spins) {
+    if (++spins < 1024)
+      return;
+    std::this_thread::yield();
+  }
+};
+
+// In-process channel between two threads: one ring per direction, no syscalls on the data path.
+class LoopbackIO : public IOChannel<LoopbackIO> {
+public:
+  bool is_server;
+  uint64_t num_rounds = 0;
+  LastCall last_call = LastCall::None;
+
+  LoopbackIO(SPSCRing *out, SPSCRing *in, bool is_server)
+      : is_server(is_server), out(out), in(in) {}
+
+  // Both ends of one channel, first is ALICE's.
+  static std::pair<LoopbackIO *, LoopbackIO *> Pair(size_t capacity = 1 << 22) {
+    auto rings = std::make_shared<std::pair<SPSCRing, SPSCRing>>(capacity, capacity);
+    LoopbackIO *alice = new LoopbackIO(&rings->first, &rings->second, true);
+    LoopbackIO *bob = new LoopbackIO(&rings->second, &rings->first, false);
+    alice->rings = bob->rings = rings;
+    return {alice, bob};
+  }
+
+  ~LoopbackIO() { out->close(); }
+
+  void sync() {
+    int tmp = 0;
+    if (is_server) {
+      send_data_internal(&tmp, 1);
+      recv_data_internal(&tmp, 1);
+    } else {
+      recv_data_internal(&tmp, 1);
+      send_data_internal(&tmp, 1);
+    }
+  }
+
+  void flush() {}
+
+  void send_data_internal(const void *data, int len) {
+    if (last_call != LastCall::Send) {
+      num_rounds++;
+      last_call = LastCall::Send;
+    }
+    out->write(static_cast<const char *>(data), len);
+  }
+
+  void recv_data_internal(void *data, int len) {
+    if (last_call != LastCall::Recv) {
+      num_rounds++;
+      last_call = LastCall::Recv;
+    }
+    char *dst = static_cast<char *>(data);
+    int got = 0;
+    while (got < len) {
+      size_t n = in->read(dst + got, len - got);
+      if (n == 0) {
+        fprintf(stderr, "error: loopback peer closed\n");
+        return;
+      }
+      got += n;
+    }
+  }
+
+  // A FILE* over this channel, for NetIO(FILE *, is_server) and the NetIO-only protocols.
+  FILE *open_stream() {
+    cookie_io_functions_t funcs;
+    funcs.read = [](void *c, char *buf, size_t size) -> ssize_t {
+      return static_cast<LoopbackIO *>(c)->in->read(buf, size);
+    };
+    funcs.write = [](void *c, const char *buf, size_t size) -> ssize_t {
+      static_cast<LoopbackIO *>(c)->out->write(buf, size);
+      return size;
+    };
+    funcs.seek = nullptr;
+    funcs.close = nullptr;
+    return fopencookie(this, "wb+", funcs);
+  }
+
+private:
+  SPSCRing *out, *in;
+  std::shared_ptr<std::pair<SPSCRing, SPSCRing>> rings;
+};
+
+// Run both parties as threads of this process over num_channels loopback channels. Each lambda
+// receives its party's NetIO array (ALICE first), ready for OTPack / FixPoint / CryptoPrimitive.
+inline void RunTwoParty(const std::function<void(NetIO **)> &alice,
+                        const std::function<void(NetIO **)> &bob,
+                        int num_channels = 1) {
+  std::vector<std::pair<LoopbackIO *, LoopbackIO *>> pairs;
+  NetIO **alice_io = new NetIO *[num_channels];
+  NetIO **bob_io = new NetIO *[num_channels];
+  for (int i = 0; i < num_channels; i++) {
+    pairs.push_back(LoopbackIO::Pair());
+    alice_io[i] = new NetIO(pairs[i].first->open_stream(), true);
+    bob_io[i] = new NetIO(pairs[i].second->open_stream(), false);
+  }
+  std::thread alice_thread([&] { alice(alice_io); });
+  std::thread bob_thread([&] { bob(bob_io); });
+  alice_thread.join();
+  bob_thread.join();
+  for (int i = 0; i < num_channels; i++) {
+    delete alice_io[i];
+    delete bob_io[i];
+    delete pairs[i].first;
+    delete pairs[i].second;
+  }
+  delete[] alice_io;
+  delete[] bob_io;
+}
+/**@}*/
+
+} // namespace Utils
@@ -0,0 +1,116 @@
+#pragma once
+#include "Utils/prg.h"
+#include <cassert>
+#include <vector>
+/** @addtogroup BP
+  @{
+ */
+namespace Utils
+{
+
+  // Bulk sampler for the additive masks of the HE -> secret share conversions: fills mask[i]
+  // uniform in [0, p) and neg[i] = -mask[i] mod p in one pass. 64-bit words are drawn from an
+  // AES-NI PRG128 in batches, cut down to the bit length of p and rejected when >= p (acceptance
+  // rate > 1/2), four lanes at a time with AVX2. Seeded like PRG128: a fixed (seed, id) pair, e.g.
+  // id = channel index, reproduces the masks, so they can also be drawn offline ahead of the
+  // conversion; without a seed it draws from RDSEED, or from SeedPin when pinned.
+  class MaskSampler
+  {
+  public:
+    explicit MaskSampler(const void *seed = nullptr, int id = 0) : prg(seed, id) {}
+
+    void Sample(uint64_t *mask, uint64_t *neg, size_t n, uint64_t p)
+    {
+      assert(p >= 2);
+      const int bits = 64 - __builtin_clzll(p - 1);
+      const uint64_t lane_mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+      size_t k = 0;
+      while (k < n)
+      {
+        prg.random_data(pool, sizeof(pool));
+        size_t i = 0;
+#ifdef __AVX2__
+        // the signed 64-bit compare is exact while p < 2^63
+        if (bits < 64)
+        {
+          const __m256i vmask = _mm256_set1_epi64x(lane_mask);
+          const __m256i vp = _mm256_set1_epi64x(p);
+          const __m256i zero = _mm256_setzero_si256();
+          const CompressTable &compress = Compress();
+          for (; i + 4 <= kPool && k + 4 <= n; i += 4)
+          {
+            __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(pool + i)), vmask);
+            int keep = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vp, v)));
+            // move the accepted lanes to the front
+            __m256i perm = _mm256_loadu_si256((const __m256i *)compress.idx[keep]);
+            v = _mm256_permutevar8x32_epi32(v, perm);
+            __m256i nv = _mm256_sub_epi64(vp, v);
+            nv = _mm256_andnot_si256(_mm256_cmpeq_epi64(v, zero), nv);
+            _mm256_storeu_si256((__m256i *)(mask + k), v);
+            _mm256_storeu_si256((__m256i *)(neg + k), nv);
+            k += __builtin_popcount(keep);
+          }
+        }
+#endif
+        for (; i < kPool && k < n; i++)
+        {
+          uint64_t v = pool[i] & lane_mask;
+          if (v < p)
+          {
+            mask[k] = v;
+            neg[k] = v == 0 ? 0 : p - v;
+            k++;
+          }
+        }
+      }
+    }
+
+    void Sample(std::vector<uint64_t> &mask, std::vector<uint64_t> &neg, uint64_t p)
+    {
+      neg.resize(mask.size());
+      Sample(mask.data(), neg.data(), mask.size(), p);
+    }
+
+  private:
+    static const size_t kPool = 1024;
+    PRG128 prg;
+    uint64_t pool[kPool];
+
+#ifdef __AVX2__
+    // kCompress[m]: 32-bit permutation moving the 64-bit lanes set in m to the front
+    struct CompressTable
+    {
+      int32_t idx[16][8];
+      CompressTable()
+      {
+        for (int m = 0; m < 16; m++)
+        {
+          int out = 0;
+          for (int lane = 0; lane < 4; lane++)
+          {
+            if (m & (1 << lane))
+            {
+              idx[m][2 * out] = 2 * lane;
+              idx[m][2 * out + 1] = 2 * lane + 1;
+              out++;
+            }
+          }
+          for (; out < 4; out++)
+          {
+            idx[m][2 * out] = 0;
+            idx[m][2 * out + 1] = 1;
+          }
+        }
+      }
+    };
+
+    static const CompressTable &Compress()
+    {
+      static const CompressTable table;
+      return table;
+    }
+#endif
+  };
+
+} // namespace Utils
+/**@}*/
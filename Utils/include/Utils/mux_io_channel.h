@@ -0,0 +1,284 @@
+#pragma once
+
+#include "Utils/net_io_channel.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <thread>
+#include <vector>
+
+namespace Utils {
+/** @addtogroup IO
+  @{
+ */
+
+// Listen on a Unix-domain socket path and accept a single connection.
+inline int AcceptUnix(const char *path) {
+  struct sockaddr_un serv;
+  memset(&serv, 0, sizeof(serv));
+  serv.sun_family = AF_UNIX;
+  strncpy(serv.sun_path, path, sizeof(serv.sun_path) - 1);
+  unlink(path);
+  int mysocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (::bind(mysocket, (struct sockaddr *)&serv, sizeof(serv)) < 0) {
+    perror("error: bind");
+    exit(1);
+  }
+  if (listen(mysocket, 1) < 0) {
+    perror("error: listen");
+    exit(1);
+  }
+  int consocket = accept(mysocket, nullptr, nullptr);
+  close(mysocket);
+  unlink(path);
+  return consocket;
+}
+
+inline int ConnectUnix(const char *path) {
+  struct sockaddr_un dest;
+  memset(&dest, 0, sizeof(dest));
+  dest.sun_family = AF_UNIX;
+  strncpy(dest.sun_path, path, sizeof(dest.sun_path) - 1);
+  while (1) {
+    int consocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(consocket, (struct sockaddr *)&dest, sizeof(dest)) == 0) {
+      return consocket;
+    }
+    close(consocket);
+    usleep(1000);
+  }
+}
+
+class MuxConnection;
+
+// One logical byte stream of a MuxConnection. Writes become frames on the shared socket,
+// reads block until the demux thread has routed enough bytes to this channel. At most
+// MuxConnection::max_inbox_bytes wait unread in the inbox; beyond that the demux thread stalls
+// until this channel is read, which pushes back on the sender through the socket.
+class MuxChannel {
+public:
+  uint32_t id;
+
+  MuxChannel(MuxConnection *conn, uint32_t id) : id(id), conn(conn) {}
+
+  void write(const char *data, size_t len);
+
+  // Returns between 1 and len bytes, or 0 once the connection is closed and drained.
+  size_t read(char *data, size_t len) {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return !inbox.empty() || closed; });
+    size_t copied = 0;
+    while (copied < len && !inbox.empty()) {
+      std::vector<char> &front = inbox.front();
+      size_t take = std::min(len - copied, front.size() - front_offset);
+      memcpy(data + copied, front.data() + front_offset, take);
+      copied += take;
+      front_offset += take;
+      if (front_offset == front.size()) {
+        inbox.pop_front();
+        front_offset = 0;
+      }
+    }
+    inbox_bytes -= copied;
+    lock.unlock();
+    space_cv.notify_one();
+    return copied;
+  }
+
+  // A FILE* over this channel so that NetIO (and everything hardwired to it) can run on top.
+  // A failed write throws out of the stdio call, see MuxConnection::write_frame.
+  FILE *open_stream() {
+    cookie_io_functions_t funcs;
+    funcs.read = [](void *c, char *buf, size_t size) -> ssize_t {
+      return static_cast<MuxChannel *>(c)->read(buf, size);
+    };
+    funcs.write = [](void *c, const char *buf, size_t size) -> ssize_t {
+      static_cast<MuxChannel *>(c)->write(buf, size);
+      return size;
+    };
+    funcs.seek = nullptr;
+    funcs.close = [](void *) -> int { return 0; };
+    return fopencookie(this, "wb+", funcs);
+  }
+
+private:
+  friend class MuxConnection;
+  MuxConnection *conn;
+  std::mutex mtx;
+  std::condition_variable cv, space_cv;
+  std::deque<std::vector<char>> inbox;
+  size_t inbox_bytes = 0;
+  size_t front_offset = 0;
+  bool closed = false;
+
+  // Called by the demux thread; blocks while the inbox is over `limit`. A frame larger than the
+  // limit is still taken once the inbox is empty.
+  void deliver(std::vector<char> &&frame, size_t limit) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      space_cv.wait(lock, [&] { return inbox.empty() || inbox_bytes + frame.size() <= limit || closed; });
+      inbox_bytes += frame.size();
+      inbox.push_back(std::move(frame));
+    }
+    cv.notify_one();
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      closed = true;
+    }
+    cv.notify_all();
+    space_cv.notify_all();
+  }
+};
+
+// Many logical channels over one TCP or Unix-domain connection. Each write is sent as a frame
+// {channel, length, payload}; a demux thread reads frames and queues them on their channel.
+// Replaces the num_threads sockets on consecutive ports that CryptoPrimitive otherwise opens.
+class MuxConnection {
+public:
+  bool is_server;
+  uint64_t num_frames = 0;
+  // unread bytes a channel may hold before the demux thread waits for its reader
+  size_t max_inbox_bytes = 1 << 26;
+
+  // TCP, address == nullptr for the server side
+  MuxConnection(const char *address, int port) {
+    is_server = (address == nullptr);
+    start(is_server ? AcceptOne(port) : ConnectTo(address, port));
+  }
+
+  // A connected socket, e.g. MuxConnection(AcceptUnix(path), true) / (ConnectUnix(path), false)
+  MuxConnection(int fd, bool is_server) {
+    this->is_server = is_server;
+    start(fd);
+  }
+
+  ~MuxConnection() {
+    ::shutdown(consocket, SHUT_RDWR);
+    {
+      // wakes a demux thread that waits for inbox space
+      std::lock_guard<std::mutex> lock(channels_mtx);
+      for (auto &c : channels) {
+        c.second->close();
+      }
+    }
+    demux_thread.join();
+    ::close(consocket);
+  }
+
+  MuxChannel *channel(uint32_t id) {
+    std::lock_guard<std::mutex> lock(channels_mtx);
+    std::unique_ptr<MuxChannel> &c = channels[id];
+    if (!c) {
+      c.reset(new MuxChannel(this, id));
+      if (eof)
+        c->close();
+    }
+    return c.get();
+  }
+
+  // NetIO endpoints for channels [0, n), e.g. for CryptoPrimitive(party, ioArr, n, ...).
+  // The connection must outlive them.
+  NetIO **open_netio(int n) {
+    NetIO **ioArr = new NetIO *[n];
+    for (int i = 0; i < n; i++) {
+      ioArr[i] = new NetIO(channel(i)->open_stream(), is_server);
+    }
+    return ioArr;
+  }
+
+  // Throws std::runtime_error when the socket fails, e.g. after the peer has gone away.
+  void write_frame(uint32_t id, const char *data, size_t len) {
+    uint32_t header[2] = {id, static_cast<uint32_t>(len)};
+    std::lock_guard<std::mutex> lock(write_mtx);
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<char *>(data);
+    iov[1].iov_len = len;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    while (msg.msg_iovlen > 0) {
+      // sendmsg instead of writev: MSG_NOSIGNAL turns a closed peer into EPIPE, not SIGPIPE
+      ssize_t n = ::sendmsg(consocket, &msg, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::runtime_error(string("MuxConnection: send failed: ") + strerror(errno));
+      }
+      struct iovec *cur = msg.msg_iov;
+      size_t cnt = msg.msg_iovlen;
+      while (cnt > 0 && static_cast<size_t>(n) >= cur->iov_len) {
+        n -= cur->iov_len;
+        cur++;
+        cnt--;
+      }
+      if (cnt > 0) {
+        cur->iov_base = static_cast<char *>(cur->iov_base) + n;
+        cur->iov_len -= n;
+      }
+      msg.msg_iov = cur;
+      msg.msg_iovlen = cnt;
+    }
+    num_frames++;
+  }
+
+private:
+  int consocket = -1;
+  std::thread demux_thread;
+  std::mutex write_mtx, channels_mtx;
+  std::map<uint32_t, std::unique_ptr<MuxChannel>> channels;
+  bool eof = false;
+
+  void start(int fd) {
+    consocket = fd;
+    const int one = 1;
+    setsockopt(consocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    demux_thread = std::thread([this] { demux(); });
+  }
+
+  bool read_full(void *data, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+      ssize_t n = ::read(consocket, static_cast<char *>(data) + got, len - got);
+      if (n > 0) {
+        got += n;
+      } else if (n == 0 || errno != EINTR) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void demux() {
+    uint32_t header[2];
+    while (read_full(header, sizeof(header))) {
+      std::vector<char> frame(header[1]);
+      if (!read_full(frame.data(), frame.size()))
+        break;
+      channel(header[0])->deliver(std::move(frame), max_inbox_bytes);
+    }
+    std::lock_guard<std::mutex> lock(channels_mtx);
+    eof = true;
+    for (auto &c : channels) {
+      c.second->close();
+    }
+  }
+};
+
+inline void MuxChannel::write(const char *data, size_t len) {
+  conn->write_frame(id, data, len);
+}
+/**@}*/
+
+} // namespace Utils
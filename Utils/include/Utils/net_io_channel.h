@@ -12,6 +12,7 @@ using std::string;
 using namespace std;
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
@@ -25,6 +26,53 @@ namespace Utils {
   @{
  */
 
+// Listen on `port`, accept a single connection and close the listener.
+inline int AcceptOne(int port) {
+  struct sockaddr_in dest;
+  struct sockaddr_in serv;
+  socklen_t socksize = sizeof(struct sockaddr_in);
+  memset(&serv, 0, sizeof(serv));
+  serv.sin_family = AF_INET;
+  serv.sin_addr.s_addr = htonl(INADDR_ANY); /* set our address to any interface */
+  serv.sin_port = htons(port);              /* set the server port number */
+  int mysocket = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(mysocket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse,
+             sizeof(reuse));
+  if (::bind(mysocket, (struct sockaddr *)&serv, sizeof(struct sockaddr)) < 0) {
+    perror("error: bind");
+    exit(1);
+  }
+  if (listen(mysocket, 1) < 0) {
+    perror("error: listen");
+    exit(1);
+  }
+  int consocket = accept(mysocket, (struct sockaddr *)&dest, &socksize);
+  close(mysocket);
+  return consocket;
+}
+
+// Connect to address:port, retrying every millisecond until the server is up.
+inline int ConnectTo(const char *address, int port) {
+  struct sockaddr_in dest;
+  memset(&dest, 0, sizeof(dest));
+  dest.sin_family = AF_INET;
+  dest.sin_addr.s_addr = inet_addr(address);
+  dest.sin_port = htons(port);
+
+  while (1) {
+    int consocket = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (connect(consocket, (struct sockaddr *)&dest,
+                sizeof(struct sockaddr)) == 0) {
+      return consocket;
+    }
+
+    close(consocket);
+    usleep(1000);
+  }
+}
+
 class NetIO : public IOChannel<NetIO> {
 public:
   bool is_server;
@@ -37,62 +85,34 @@ public:
   int port;
   uint64_t num_rounds = 0;
   LastCall last_call = LastCall::None;
+  // every received message is also appended here as {uint32 length, bytes}, see record_io_channel.h
+  FILE *record = nullptr;
   NetIO(const char *address, int port, bool quiet = false) {
     this->port = port;
     is_server = (address == nullptr);
     if (address == nullptr) {
-      struct sockaddr_in dest;
-      struct sockaddr_in serv;
-      socklen_t socksize = sizeof(struct sockaddr_in);
-      memset(&serv, 0, sizeof(serv));
-      serv.sin_family = AF_INET;
-      serv.sin_addr.s_addr =
-          htonl(INADDR_ANY);       /* set our address to any interface */
-      serv.sin_port = htons(port); /* set the server port number */
-      mysocket = socket(AF_INET, SOCK_STREAM, 0);
-      int reuse = 1;
-      setsockopt(mysocket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse,
-                 sizeof(reuse));
-      if (::bind(mysocket, (struct sockaddr *)&serv, sizeof(struct sockaddr)) <
-          0) {
-        perror("error: bind");
-        exit(1);
-      }
-      if (listen(mysocket, 1) < 0) {
-        perror("error: listen");
-        exit(1);
-      }
-      consocket = accept(mysocket, (struct sockaddr *)&dest, &socksize);
-      close(mysocket);
+      consocket = AcceptOne(port);
     } else {
       addr = string(address);
+      consocket = ConnectTo(address, port);
+    }
+    setup_stream(quiet);
+  }
 
-      struct sockaddr_in dest;
-      memset(&dest, 0, sizeof(dest));
-      dest.sin_family = AF_INET;
-      dest.sin_addr.s_addr = inet_addr(address);
-      dest.sin_port = htons(port);
-
-      while (1) {
-        consocket = socket(AF_INET, SOCK_STREAM, 0);
-
-        if (connect(consocket, (struct sockaddr *)&dest,
-                    sizeof(struct sockaddr)) == 0) {
-          break;
-        }
+  // Wrap a socket that is already connected, e.g. one returned by NetListener::accept_fd.
+  NetIO(int fd, bool is_server, bool quiet = true) {
+    this->is_server = is_server;
+    this->port = -1;
+    consocket = fd;
+    setup_stream(quiet);
+  }
 
-        close(consocket);
-        usleep(1000);
-      }
-    }
-    set_nodelay();
-    stream = fdopen(consocket, "wb+");
-    buffer = new char[NETWORK_BUFFER_SIZE];
-    memset(buffer, 0, NETWORK_BUFFER_SIZE);
-	// NOTE(Zhicong): we need _IONBF for the best network performance
-    setvbuf(stream, buffer, _IOFBF, NETWORK_BUFFER_SIZE);
-    if (!quiet)
-      std::cout << "connected\n";
+  // Run over a stream that is not a socket, e.g. a logical channel of a MuxConnection.
+  NetIO(FILE *stream, bool is_server) {
+    this->is_server = is_server;
+    this->port = -1;
+    this->stream = stream;
+    setup_stream(true);
   }
 
   void sync() {
@@ -110,7 +130,8 @@ public:
   ~NetIO() {
     fflush(stream);
     fclose(stream);
-    close(consocket);
+    if (consocket >= 0)
+      close(consocket);
     delete[] buffer;
   }
 
@@ -126,6 +147,19 @@ public:
 
   void flush() { fflush(stream); }
 
+  void setup_stream(bool quiet) {
+    if (stream == nullptr) {
+      set_nodelay();
+      stream = fdopen(consocket, "wb+");
+    }
+    buffer = new char[NETWORK_BUFFER_SIZE];
+    memset(buffer, 0, NETWORK_BUFFER_SIZE);
+	// NOTE(Zhicong): we need _IONBF for the best network performance
+    setvbuf(stream, buffer, _IOFBF, NETWORK_BUFFER_SIZE);
+    if (!quiet)
+      std::cout << "connected\n";
+  }
+
   void send_data_internal(const void *data, int len) {
     if (last_call != LastCall::Send) {
       num_rounds++;
@@ -160,6 +194,67 @@ public:
       else
         fprintf(stderr, "error: net_send_data %d\n", res);
     }
+    if (record != nullptr) {
+      uint32_t frame = len;
+      fwrite(&frame, sizeof(uint32_t), 1, record);
+      fwrite(data, 1, len, record);
+    }
+  }
+};
+
+// A listening socket that stays open across clients. NetIO(nullptr, port) closes its listener
+// after the first accept, so a server that takes many connections on one port uses this instead.
+class NetListener {
+public:
+  int mysocket = -1;
+  int port;
+
+  NetListener(int port, int backlog = 64) {
+    this->port = port;
+    struct sockaddr_in serv;
+    memset(&serv, 0, sizeof(serv));
+    serv.sin_family = AF_INET;
+    serv.sin_addr.s_addr = htonl(INADDR_ANY);
+    serv.sin_port = htons(port);
+    mysocket = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(mysocket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse,
+               sizeof(reuse));
+    if (::bind(mysocket, (struct sockaddr *)&serv, sizeof(struct sockaddr)) <
+        0) {
+      perror("error: bind");
+      exit(1);
+    }
+    if (listen(mysocket, backlog) < 0) {
+      perror("error: listen");
+      exit(1);
+    }
+  }
+
+  ~NetListener() { close(); }
+
+  // Blocks until a client connects, returns -1 once the listener is closed.
+  int accept_fd() {
+    struct sockaddr_in dest;
+    socklen_t socksize = sizeof(struct sockaddr_in);
+    while (true) {
+      int fd = ::accept(mysocket, (struct sockaddr *)&dest, &socksize);
+      if (fd >= 0 || errno != EINTR)
+        return fd;
+    }
+  }
+
+  NetIO *accept_io() {
+    int fd = accept_fd();
+    return fd < 0 ? nullptr : new NetIO(fd, true);
+  }
+
+  void close() {
+    if (mysocket >= 0) {
+      ::shutdown(mysocket, SHUT_RDWR);
+      ::close(mysocket);
+      mysocket = -1;
+    }
   }
 };
 /**@}*/
@@ -1,6 +1,7 @@
 #include "aes-ni.h"
 #include <emp-tool/utils/aes.h>
 #include "block.h"
+#include "seed.h"
 #include <emp-tool/utils/constants.h>
 #include <random>
 
@@ -27,6 +28,11 @@ namespace Utils
       {
         reseed(seed, id);
       }
+      else if (SeedPin::Pinned())
+      {
+        block128 v = makeBlock128(SeedPin::Next(), SeedPin::Next());
+        reseed(&v);
+      }
       else
       {
         block128 v;
@@ -169,6 +175,11 @@ namespace Utils
       {
         reseed(seed, id);
       }
+      else if (SeedPin::Pinned())
+      {
+        alignas(32) block256 v = makeBlock256(SeedPin::Next(), SeedPin::Next(), SeedPin::Next(), SeedPin::Next());
+        reseed(&v);
+      }
       else
       {
         alignas(32) block256 v;
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Utils {
+/** @addtogroup Profiling
+  @{
+ */
+
+// Structured replacement for time_log: nested spans (model > block > layer > operator) that
+// record wall time, process CPU time, traffic and rounds over all attached channels, and the
+// named event counters (HE ops, ...) accumulated while the span was open. Disabled by default;
+// when disabled a ProfileScope costs one branch. Counters are kept per thread, so Count() on the
+// HE hot path only takes its own thread's lock; spans sum them over all threads.
+class Profiler {
+public:
+  struct ChannelStat {
+    uint64_t sent = 0;
+    uint64_t recv = 0;
+    uint64_t rounds = 0;
+  };
+
+  struct Span {
+    std::string name;
+    std::string cat;
+    int depth = 0;
+    int parent = -1;
+    uint64_t tid = 0;
+    double start_us = 0;  // local clock, exports add clock_offset_us
+    double dur_us = 0;
+    double cpu_us = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_recv = 0;
+    uint64_t rounds = 0;
+    std::map<std::string, uint64_t> counters;
+  };
+
+  bool enabled = false;
+  int party = 0;
+  // added to local timestamps at export to express them on ALICE's clock, set by AlignClock,
+  // which may run after the spans were recorded
+  double clock_offset_us = 0;
+
+  static Profiler &Get() {
+    static Profiler profiler;
+    return profiler;
+  }
+
+  // Channels whose counters are aggregated into every span: bytes are summed over the
+  // channels, rounds are the maximum over channels since they progress in parallel.
+  template <typename IO> void AttachChannels(IO **ioArr, int num_channels) {
+    std::lock_guard<std::mutex> lock(mtx);
+    sources.push_back([ioArr, num_channels](std::vector<ChannelStat> &out) {
+      for (int i = 0; i < num_channels; i++) {
+        out.push_back({ioArr[i]->counter, ioArr[i]->recv_counter, ioArr[i]->num_rounds});
+      }
+    });
+  }
+
+  void DetachChannels() {
+    std::lock_guard<std::mutex> lock(mtx);
+    sources.clear();
+  }
+
+  // Add n to the named counter, e.g. Count("he.rotate").
+  void Count(const char *name, uint64_t n = 1) {
+    if (!enabled)
+      return;
+    ThreadCounters &local = Local();
+    std::lock_guard<std::mutex> lock(local.mtx);
+    local.counts[name] += n;
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mtx);
+    spans.clear();
+    remote_events.clear();
+  }
+
+  const std::vector<Span> &Spans() const { return spans; }
+
+  // Start a span, returns its id for End().
+  int Begin(const std::string &name, const std::string &cat) {
+    Open open;
+    open.wall = Now();
+    open.cpu = CpuNow();
+    std::lock_guard<std::mutex> lock(mtx);
+    open.channels = CollectLocked();
+    open.counters = SumCounters();
+    Span span;
+    span.name = name;
+    span.cat = cat;
+    span.tid = ThreadId();
+    span.start_us = open.wall;
+    std::vector<int> &stack = Stack();
+    span.depth = stack.size();
+    span.parent = stack.empty() ? -1 : stack.back();
+    int id = spans.size();
+    spans.push_back(span);
+    opens[id] = std::move(open);
+    stack.push_back(id);
+    return id;
+  }
+
+  void End(int id) {
+    double wall = Now();
+    double cpu = CpuNow();
+    std::lock_guard<std::mutex> lock(mtx);
+    std::vector<int> &stack = Stack();
+    if (!stack.empty() && stack.back() == id)
+      stack.pop_back();
+    Open &open = opens[id];
+    Span &span = spans[id];
+    span.dur_us = wall - open.wall;
+    span.cpu_us = cpu - open.cpu;
+    std::vector<ChannelStat> now = CollectLocked();
+    for (size_t i = 0; i < now.size() && i < open.channels.size(); i++) {
+      span.bytes_sent += now[i].sent - open.channels[i].sent;
+      span.bytes_recv += now[i].recv - open.channels[i].recv;
+      span.rounds = std::max(span.rounds, now[i].rounds - open.channels[i].rounds);
+    }
+    for (auto &c : SumCounters()) {
+      uint64_t before = open.counters.count(c.first) ? open.counters[c.first] : 0;
+      if (c.second != before)
+        span.counters[c.first] = c.second - before;
+    }
+    opens.erase(id);
+  }
+
+  // NTP-style offset of BOB's clock to ALICE's from the fastest of `rounds` ping-pongs.
+  template <typename IO> void AlignClock(IO *io, int party, int rounds = 8) {
+    this->party = party;
+    double best_rtt = 1e30;
+    for (int r = 0; r < rounds; r++) {
+      if (party == 1) {
+        double t;
+        io->recv_data(&t, sizeof(double));
+        t = Now();
+        io->send_data(&t, sizeof(double));
+        io->flush();
+      } else {
+        double t0 = Now();
+        io->send_data(&t0, sizeof(double));
+        io->flush();
+        double ts;
+        io->recv_data(&ts, sizeof(double));
+        double t1 = Now();
+        if (t1 - t0 < best_rtt) {
+          best_rtt = t1 - t0;
+          clock_offset_us = ts - (t0 + t1) / 2;
+        }
+      }
+    }
+  }
+
+  // BOB ships its trace events to ALICE, whose exports then contain both parties.
+  template <typename IO> void GatherTo(IO *io, int party) {
+    if (party == 1) {
+      uint64_t len;
+      io->recv_data(&len, sizeof(uint64_t));
+      std::string events(len, '\0');
+      io->recv_data(&events[0], len);
+      remote_events = events;
+    } else {
+      std::string events = ChromeEvents();
+      uint64_t len = events.size();
+      io->send_data(&len, sizeof(uint64_t));
+      io->send_data(events.data(), len);
+      io->flush();
+    }
+  }
+
+  std::string ToJson() {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(3);
+    os << "{\"party\":" << party << ",\"clock_offset_us\":" << clock_offset_us
+       << ",\"spans\":[";
+    for (size_t i = 0; i < spans.size(); i++) {
+      const Span &s = spans[i];
+      os << (i ? "," : "") << "{\"id\":" << i << ",\"name\":\"" << Escape(s.name)
+         << "\",\"cat\":\"" << Escape(s.cat) << "\",\"parent\":" << s.parent
+         << ",\"depth\":" << s.depth << ",\"tid\":" << s.tid << ",\"start_us\":" << s.start_us + clock_offset_us
+         << ",\"dur_us\":" << s.dur_us << ",\"cpu_us\":" << s.cpu_us
+         << ",\"bytes_sent\":" << s.bytes_sent << ",\"bytes_recv\":" << s.bytes_recv
+         << ",\"rounds\":" << s.rounds << ",\"counters\":" << CountersJson(s) << "}";
+    }
+    os << "]}";
+    return os.str();
+  }
+
+  // Chrome trace-event format (chrome://tracing, Perfetto), one process per party.
+  std::string ToChromeTrace() {
+    std::string events = ChromeEvents();
+    if (!remote_events.empty())
+      events += (events.empty() ? "" : ",") + remote_events;
+    return "{\"traceEvents\":[" + events + "],\"displayTimeUnit\":\"ms\"}";
+  }
+
+  void ExportJson(const std::string &path) { std::ofstream(path) << ToJson(); }
+
+  void ExportChromeTrace(const std::string &path) { std::ofstream(path) << ToChromeTrace(); }
+
+private:
+  struct Open {
+    double wall = 0;
+    double cpu = 0;
+    std::vector<ChannelStat> channels;
+    std::map<std::string, uint64_t> counters;
+  };
+
+  // Counters of one thread. Its lock is only contended while a span opens or closes.
+  struct ThreadCounters {
+    std::mutex mtx;
+    std::map<std::string, uint64_t> counts;
+  };
+
+  std::mutex mtx;
+  std::vector<Span> spans;
+  std::map<int, Open> opens;
+  std::vector<std::function<void(std::vector<ChannelStat> &)>> sources;
+  std::string remote_events;
+  // every thread that ever counted; kept after the thread exits so that its counts still add up
+  std::mutex threads_mtx;
+  std::vector<std::unique_ptr<ThreadCounters>> thread_counters;
+
+  ThreadCounters &Local() {
+    thread_local Profiler *owner = nullptr;
+    thread_local ThreadCounters *local = nullptr;
+    if (owner != this) {
+      std::lock_guard<std::mutex> lock(threads_mtx);
+      thread_counters.emplace_back(new ThreadCounters());
+      local = thread_counters.back().get();
+      owner = this;
+    }
+    return *local;
+  }
+
+  std::map<std::string, uint64_t> SumCounters() {
+    std::map<std::string, uint64_t> sum;
+    std::lock_guard<std::mutex> lock(threads_mtx);
+    for (auto &t : thread_counters) {
+      std::lock_guard<std::mutex> thread_lock(t->mtx);
+      for (auto &c : t->counts)
+        sum[c.first] += c.second;
+    }
+    return sum;
+  }
+
+  static std::vector<int> &Stack() {
+    thread_local std::vector<int> stack;
+    return stack;
+  }
+
+  static double Now() {
+    return std::chrono::duration<double, std::micro>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // process CPU time, so that the protocol threads a layer spawns are included
+  static double CpuNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+  }
+
+  static uint64_t ThreadId() { return std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000; }
+
+  std::vector<ChannelStat> CollectLocked() {
+    std::vector<ChannelStat> out;
+    for (auto &source : sources)
+      source(out);
+    return out;
+  }
+
+  static std::string Escape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+      if (c == '"' || c == '\\')
+        out += '\\';
+      out += c;
+    }
+    return out;
+  }
+
+  static std::string CountersJson(const Span &s) {
+    std::ostringstream os;
+    os << "{";
+    bool first = true;
+    for (auto &c : s.counters) {
+      os << (first ? "" : ",") << "\"" << Escape(c.first) << "\":" << c.second;
+      first = false;
+    }
+    os << "}";
+    return os.str();
+  }
+
+  std::string ChromeEvents() {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(3);
+    os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << party
+       << ",\"args\":{\"name\":\"" << (party == 1 ? "ALICE" : "BOB") << "\"}}";
+    for (const Span &s : spans) {
+      os << ",{\"name\":\"" << Escape(s.name) << "\",\"cat\":\"" << Escape(s.cat)
+         << "\",\"ph\":\"X\",\"pid\":" << party << ",\"tid\":" << s.tid
+         << ",\"ts\":" << s.start_us + clock_offset_us << ",\"dur\":" << s.dur_us
+         << ",\"args\":{\"cpu_us\":" << s.cpu_us << ",\"bytes_sent\":" << s.bytes_sent
+         << ",\"bytes_recv\":" << s.bytes_recv << ",\"rounds\":" << s.rounds;
+      for (auto &c : s.counters)
+        os << ",\"" << Escape(c.first) << "\":" << c.second;
+      os << "}}";
+    }
+    return os.str();
+  }
+};
+
+// RAII span: ProfileScope scope("layer1.0.conv1", "layer");
+class ProfileScope {
+public:
+  ProfileScope(const char *name, const char *cat = "op") {
+    Profiler &p = Profiler::Get();
+    if (p.enabled)
+      id = p.Begin(name, cat);
+  }
+
+  ~ProfileScope() {
+    if (id >= 0)
+      Profiler::Get().End(id);
+  }
+
+private:
+  int id = -1;
+};
+/**@}*/
+} // namespace Utils
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Utils/file_io_channel.h"
+#include "Utils/net_io_channel.h"
+#include "Utils/seed.h"
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace Utils {
+/** @addtogroup IO
+  @{
+ */
+
+// Transcript of one party: `<prefix>.meta` holds "party seed num_channels", `<prefix>.<i>` every
+// message the party received on channel i. A party replayed against its transcript runs alone and
+// takes the same code path as in the recorded run, e.g. to profile HECompute or OT extension
+// under perf without the peer process or network noise.
+inline string TranscriptPath(const string &prefix, int channel) {
+  return prefix + "." + std::to_string(channel);
+}
+
+// Records the channels of a live run. Construct it right after the channels are connected and
+// before any OT pack or HE key is created: it pins the PRG seeds, so that a replay draws the same
+// randomness. Recording and the pin stop when it is destroyed.
+class TranscriptRecorder {
+public:
+  TranscriptRecorder(const string &prefix, NetIO **ioArr, int num_channels, int party,
+                     uint64_t seed = 0x5eed)
+      : ioArr(ioArr) {
+    SeedPin::Pin(seed);
+    SeedPin::Stream(party);
+    std::ofstream(prefix + ".meta") << party << " " << seed << " " << num_channels << std::endl;
+    for (int i = 0; i < num_channels; i++) {
+      files.push_back(new FileIO(TranscriptPath(prefix, i).c_str(), false));
+      ioArr[i]->record = files[i]->stream;
+    }
+  }
+
+  ~TranscriptRecorder() {
+    for (size_t i = 0; i < files.size(); i++) {
+      ioArr[i]->record = nullptr;
+      delete files[i];
+    }
+    SeedPin::Unpin();
+  }
+
+private:
+  NetIO **ioArr;
+  std::vector<FileIO *> files;
+};
+
+// Replays a recorded party. ioArr are NetIOs whose receives are served from the transcript and
+// whose sends are counted and dropped; they stand in for the live channels everywhere. The seeds
+// stay pinned while it exists.
+class TranscriptReplay {
+public:
+  int party;
+  uint64_t seed;
+  int num_channels;
+  NetIO **ioArr;
+
+  explicit TranscriptReplay(const string &prefix) {
+    std::ifstream meta(prefix + ".meta");
+    if (!(meta >> party >> seed >> num_channels))
+      throw std::runtime_error("cannot read transcript " + prefix + ".meta");
+    SeedPin::Pin(seed);
+    SeedPin::Stream(party);
+    ioArr = new NetIO *[num_channels];
+    for (int i = 0; i < num_channels; i++) {
+      sources.push_back(new Source{new FileIO(TranscriptPath(prefix, i).c_str(), true)});
+      ioArr[i] = new NetIO(open_stream(sources[i]), party == ALICE);
+    }
+  }
+
+  ~TranscriptReplay() {
+    for (int i = 0; i < num_channels; i++) {
+      delete ioArr[i];
+      delete sources[i]->file;
+      delete sources[i];
+    }
+    delete[] ioArr;
+    SeedPin::Unpin();
+  }
+
+private:
+  struct Source {
+    FileIO *file;
+    uint32_t frame_left = 0;
+  };
+  std::vector<Source *> sources;
+
+  // Reads stop at message boundaries: stdio must never buffer bytes of the next message, since
+  // it cannot seek back on this stream when the party switches to sending.
+  static FILE *open_stream(Source *source) {
+    cookie_io_functions_t funcs;
+    funcs.read = [](void *c, char *buf, size_t size) -> ssize_t {
+      Source *src = static_cast<Source *>(c);
+      while (src->frame_left == 0) {
+        if (fread(&src->frame_left, sizeof(uint32_t), 1, src->file->stream) != 1) {
+          // the replayed party diverged from the recording (or read past its end)
+          fprintf(stderr, "error: transcript exhausted\n");
+          exit(1);
+        }
+      }
+      size_t n = fread(buf, 1, std::min<size_t>(size, src->frame_left), src->file->stream);
+      src->frame_left -= n;
+      return n;
+    };
+    funcs.write = [](void *, const char *, size_t size) -> ssize_t { return size; };
+    funcs.seek = nullptr;
+    funcs.close = nullptr;
+    return fopencookie(source, "wb+", funcs);
+  }
+};
+/**@}*/
+
+} // namespace Utils
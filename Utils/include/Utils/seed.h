@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <random>
+
+namespace Utils {
+/** @addtogroup BP
+  @{
+ */
+
+// Pinned seeding for transcript replay (record_io_channel.h). After Pin(seed), PRGs constructed
+// without a key, HE masks and SEAL's key/encryption randomness are derived from `seed` instead of
+// RDSEED / std::random_device. Base-OT exponents come from emp's Group (OpenSSL RNG) and stay
+// unpinned. Every thread draws from its own stream (stream id, counter), so a party repeats its
+// randomness as long as each thread makes its draws in the same order. A thread that never called
+// Stream() gets the next automatic stream at its first draw; that only repeats if such threads
+// start drawing in a fixed order, so protocol threads should call Stream() themselves.
+// Debugging and profiling only: a pinned party has no secret randomness.
+class SeedPin {
+public:
+  static void Pin(uint64_t seed) {
+    global_seed() = seed;
+    pinned() = true;
+  }
+
+  static void Unpin() { pinned() = false; }
+
+  static bool Pinned() { return pinned(); }
+
+  // Select the calling thread's stream, e.g. the party id when both parties share a process.
+  static void Stream(uint64_t id) {
+    stream() = id;
+    counter() = 0;
+  }
+
+  static uint64_t Next() {
+    if (stream() == kNoStream) {
+      // above the (party << 16) + i streams that callers select
+      stream() = (1ULL << 23) + auto_streams().fetch_add(1);
+      counter() = 0;
+    }
+    uint64_t z = global_seed() + (stream() << 40) + (++counter()) * 0x9e3779b97f4a7c15ULL;
+    // splitmix64 finalizer
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+private:
+  static constexpr uint64_t kNoStream = ~0ULL;
+
+  static std::atomic<bool> &pinned() {
+    static std::atomic<bool> value{false};
+    return value;
+  }
+
+  static uint64_t &global_seed() {
+    static uint64_t value = 0;
+    return value;
+  }
+
+  static uint64_t &stream() {
+    thread_local uint64_t value = kNoStream;
+    return value;
+  }
+
+  static std::atomic<uint64_t> &auto_streams() {
+    static std::atomic<uint64_t> value{0};
+    return value;
+  }
+
+  static uint64_t &counter() {
+    thread_local uint64_t value = 0;
+    return value;
+  }
+};
+
+// Seed for the std:: engines used for masks, pinned when SeedPin is.
+inline uint64_t RandomSeed() {
+  if (SeedPin::Pinned())
+    return SeedPin::Next();
+  std::random_device rd;
+  return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+/**@}*/
+} // namespace Utils
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace Utils {
+/** @addtogroup IO
+  @{
+ */
+
+// Thread-local redirection from a shared protocol handle (HEEvaluator, FixPoint, ReLU) to the
+// per-client instance serving the current thread. Layers keep pointing at the shared handle that
+// was used to build them; a worker running a client session binds that session's handles, so the
+// packed weights are reused while keys, OT packs and channels come from the session.
+template <typename Handle> class SessionBinding {
+public:
+  static Handle *Resolve(Handle *shared) {
+    for (auto &b : bindings()) {
+      if (b.first == shared)
+        return b.second;
+    }
+    return shared;
+  }
+
+  static void Bind(Handle *shared, Handle *session) {
+    Unbind(shared);
+    bindings().emplace_back(shared, session);
+  }
+
+  static void Unbind(Handle *shared) {
+    auto &b = bindings();
+    for (size_t i = 0; i < b.size(); i++) {
+      if (b[i].first == shared) {
+        b.erase(b.begin() + i);
+        return;
+      }
+    }
+  }
+
+private:
+  static std::vector<std::pair<Handle *, Handle *>> &bindings() {
+    thread_local std::vector<std::pair<Handle *, Handle *>> b;
+    return b;
+  }
+};
+/**@}*/
+} // namespace Utils